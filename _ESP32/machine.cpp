@@ -19,6 +19,9 @@
 #include "FastAccelStepper.h" //Jochen's library
 #include <Preferences.h>
 #include <HTTPClient.h>
+#include <esp_rom_crc.h>
+#include <mbedtls/sha256.h>
+#include <esp_timer.h>
 
 //Firmware version to be updated on major milestones - Version tracking
 #define FIRMWARE_VERSION "1.0.12"
@@ -61,19 +64,599 @@ FastAccelStepper *zStepper = NULL;
 FastAccelStepper *rightStepper = NULL;
 FastAccelStepper *leftStepper = NULL;
 
-//Webserver Object
-WebServer server(80);
+//Webserver Object. Handlers read JSON with readJsonBody() and reply with sendJson(): the body is parsed in
+//place inside the server's own copy of the request (ArduinoJson's zero-copy mode points into it rather than duplicating
+//strings) and replies are serialized into responseBuffer, so a request costs no heap beyond what WebServer itself uses.
+//Only the network task runs handlers, so one response buffer is enough.
+#define responseBufferSize 3072
+class RequestServer : public WebServer {
+public:
+  RequestServer(int port) : WebServer(port) {}
+
+  //Raw body of a JSON POST, or NULL. It belongs to the current request, so it may be parsed destructively.
+  char* body() {
+    for (int i = _currentArgCount - 1; i >= 0; i--) {
+      if (_currentArgs[i].key == "plain") return (char*)_currentArgs[i].value.c_str();
+    }
+    return NULL;
+  }
+};
+RequestServer server(80);
+char responseBuffer[responseBufferSize];
+
+//Raw G-code stream - one persistent TCP client, GRBL style "ok"/"error:n" replies per line.
+#define gcodePort 23
+WiFiServer gcodeServer(gcodePort);
+WiFiClient gcodeClient;
+
+//Binary telemetry - fixed layout frames pushed to one TCP client every telemetryIntervalMs. The client can change the rate by
+//sending a little-endian uint16 interval in milliseconds. Frames that would block are dropped rather than queued.
+#define telemetryPort 81
+#define telemetryDefaultIntervalMs 100
+#define telemetryMinIntervalMs 10
+#define telemetryMaxIntervalMs 5000
+WiFiServer telemetryServer(telemetryPort);
+WiFiClient telemetryClient;
+
+//Binary control - jog and move commands as small frames on one persistent TCP client, so a jog costs a few bytes
+//instead of an HTTP request. Frame, little-endian:
+//  0 magic 0x5A, 1 opcode, 2 sequence (u16), 4 payload length, 5 payload, then CRC-32 (u32) of everything before it.
+//Every frame is answered with an ack in the same format: the opcode with controlAckFlag set, the same sequence and a
+//two byte payload - status, free queue slots. Sequence numbers go up by one per frame. A repeat of the last one is
+//acked again with its original status but not run (the client lost the ack), an older one is dropped as out of
+//order, and a jump forward still runs but is acked as CONTROL_GAP so the client knows frames went missing.
+#define controlPort 82
+#define controlMagic 0x5A
+#define controlHeaderSize 5
+#define controlMaxPayload 16
+#define controlFrameMax (controlHeaderSize + controlMaxPayload + 4)
+#define controlAckFlag 0x80
+enum ControlOpcode {
+  CONTROL_PING = 0x00,    //No payload - round trip check
+  CONTROL_JOG = 0x01,     //direction u8, speed f32 mm/min, step f32 mm - the directions of /api/control
+  CONTROL_MOVE = 0x02,    //distance f32 mm, turn f32 degrees, speed f32 mm/min
+  CONTROL_Z = 0x03,       //speed f32 mm/min, step f32 mm
+  CONTROL_STOP = 0x04,    //No payload - e-stop
+  CONTROL_SPINDLE = 0x05, //enable u8, speed u8 percent (255 leaves the speed alone)
+  CONTROL_LASER = 0x06,   //enable u8
+  CONTROL_JOG_VELOCITY = 0x07, //direction u8, speed f32 mm/min (0 stops) - continuous jog, resend every jogKeepaliveMs
+  CONTROL_HOLD = 0x08,    //No payload - feed hold
+  CONTROL_RESUME = 0x09,  //No payload - cycle start
+  CONTROL_OVERRIDE = 0x0A //feed u8 percent, spindle u8 percent - 0 leaves that one alone
+};
+enum ControlStatus {
+  CONTROL_OK,
+  CONTROL_GAP,         //Ran, but sequence numbers were skipped since the last frame
+  CONTROL_STALE,       //Older than the last frame - dropped
+  CONTROL_BAD_CRC,
+  CONTROL_BAD_OPCODE,
+  CONTROL_BAD_PAYLOAD,
+  CONTROL_QUEUE_FULL,
+  CONTROL_REJECTED     //The planner or a limit check refused the move
+};
+WiFiServer controlServer(controlPort);
+WiFiClient controlClient;
+uint8_t controlFrame[controlFrameMax];
+uint8_t controlLength = 0;
+uint16_t controlLastSequence = 0;
+uint8_t controlLastStatus = CONTROL_OK;
+bool controlSynced = false; //False until the first good frame on a connection
+
+//Console log pipeline - sendConsoleMessage() only copies into this ring, a task on core 0 drains it to the server in
+//batches over one keep-alive connection. Producers claim slots with an atomic counter, so any task may log. When the
+//ring is full the oldest entries are overwritten and counted, and the drop count is reported with the next batch.
+#define consoleQueueSize 32 //Power of two
+#define consoleTypeSize 8
+#define consoleMessageSize 120
+#define consoleBatchSize 8
+#define consoleIdleMs 100 //How long the task sleeps when there is nothing to send
+#define consoleRetryMs 1000 //Back-off after a failed POST
+#define consoleBodySize 1536
+struct ConsoleEntry {
+  uint32_t sequence; //Claim index + 1 once the entry is complete, 0 while it is being written
+  char type[consoleTypeSize];
+  char message[consoleMessageSize];
+};
+ConsoleEntry consoleQueue[consoleQueueSize];
+uint32_t consoleHead = 0; //Next index to claim - shared by all producers
+uint32_t consoleTail = 0; //Next index to send - console task only
+uint32_t consoleDropped = 0;
+TaskHandle_t consoleTaskHandle = NULL;
+char consoleServerUrl[80] = "";
+portMUX_TYPE consoleUrlMux = portMUX_INITIALIZER_UNLOCKED;
+
+//Chunked OTA - the image arrives in pieces that each carry their offset and a CRC-32, so a dropped connection only costs
+//the chunk in flight: calling /api/update/begin again with the same size and SHA-256 picks up at the last good offset.
+//The network task only buffers a chunk. otaTask writes it to flash a slice at a time, and only while the motion queue
+//is empty, because a flash write stalls the caches on both cores. Nothing is applied until /api/update/commit has
+//checked the SHA-256 of everything written.
+#define otaChunkSize 4096 //Largest chunk accepted per request
+#define otaSliceSize 1024 //Bytes per flash write
+#define otaSliceGapMs 5   //Pause between slices so WiFi and the console keep the core
+#define otaIdleMs 100
+enum OtaState {
+  OTA_IDLE,
+  OTA_RECEIVING,
+  OTA_FAILED
+};
+OtaState otaState = OTA_IDLE;
+uint32_t otaSize = 0;
+uint32_t otaReceived = 0; //Bytes accepted, including a chunk still waiting for flash
+uint32_t otaWritten = 0;  //Bytes in flash - otaTask only
+uint8_t otaExpected[32];  //SHA-256 given to /api/update/begin
+mbedtls_sha256_context otaSha;
+uint8_t otaChunk[otaChunkSize];
+uint32_t otaChunkLength = 0;
+bool otaChunkOverflow = false;
+//Length of the chunk handed to otaTask, 0 once it is in flash. The network task only touches Update, otaSha and
+//otaChunk while this is 0 and otaTask only while it is not, so the handoff needs no lock.
+uint32_t otaPending = 0;
+TaskHandle_t otaTaskHandle = NULL;
 
 //Preferences Object.
 Preferences myPrgVar;
 
+//GRBL settings - loaded from the "GBRL" namespace once at boot and kept in RAM. Updates are written through to NVS,
+//so nothing on the request path has to open Preferences. Axis order is left/X, right/Y, z.
+enum SettingType {
+  SETTING_INT,
+  SETTING_SHORT,
+  SETTING_BOOL,
+  SETTING_FLOAT
+};
+
+struct GrblSettings {
+  int32_t stepPulseUs;      //$0
+  int32_t stepIdleDelayMs;  //$1
+  int16_t stepInvertMask;   //$2
+  int16_t dirInvertMask;    //$3
+  bool invertEnable;        //$4
+  bool invertLimits;        //$5
+  bool invertProbe;         //$6
+  int16_t statusReportMask; //$10
+  float junctionDeviation;  //$11, mm
+  float arcTolerance;       //$12, mm
+  bool reportInches;        //$13
+  bool softLimits;          //$20
+  bool hardLimits;          //$21
+  bool homingEnable;        //$22
+  int16_t homingDirMask;    //$23
+  float homingFeed;         //$24, mm/min
+  float homingSeek;         //$25, mm/min
+  int32_t homingDebounceMs; //$26
+  float homingPullOff;      //$27, mm
+  int32_t spindleMaxRpm;    //$30
+  int32_t spindleMinRpm;    //$31
+  bool laserMode;           //$32
+  float stepsPerMM[3];      //$100-$102
+  float maxRate[3];         //$110-$112, mm/min
+  float acceleration[3];    //$120-$122, mm/sec^2
+  float maxTravel[3];       //$130-$132, mm
+  float trackWidth;         //$140, mm - distance between the track centre lines
+  //Derived values - worked out by applySettings(), never stored.
+  float hzPerMMPerMin[3];   //Step rate in Hz for each mm/min of feed
+  float accelSteps[3];      //Acceleration in steps/sec^2
+};
+
+GrblSettings settings;
+
+struct SettingDescriptor {
+  const char* key;
+  SettingType type;
+  void* value;
+  float defaultValue;
+};
+
+//Every stored setting with its NVS type (matches the server's type map) and factory default.
+const SettingDescriptor settingTable[] = {
+  {"$0", SETTING_INT, &settings.stepPulseUs, 10},
+  {"$1", SETTING_INT, &settings.stepIdleDelayMs, 25},
+  {"$2", SETTING_SHORT, &settings.stepInvertMask, 0},
+  {"$3", SETTING_SHORT, &settings.dirInvertMask, 0},
+  {"$4", SETTING_BOOL, &settings.invertEnable, 0},
+  {"$5", SETTING_BOOL, &settings.invertLimits, 0},
+  {"$6", SETTING_BOOL, &settings.invertProbe, 0},
+  {"$10", SETTING_SHORT, &settings.statusReportMask, 1},
+  {"$11", SETTING_FLOAT, &settings.junctionDeviation, 0.010},
+  {"$12", SETTING_FLOAT, &settings.arcTolerance, 0.002},
+  {"$13", SETTING_BOOL, &settings.reportInches, 0},
+  {"$20", SETTING_BOOL, &settings.softLimits, 0},
+  {"$21", SETTING_BOOL, &settings.hardLimits, 0},
+  {"$22", SETTING_BOOL, &settings.homingEnable, 0},
+  {"$23", SETTING_SHORT, &settings.homingDirMask, 0},
+  {"$24", SETTING_FLOAT, &settings.homingFeed, 25.000},
+  {"$25", SETTING_FLOAT, &settings.homingSeek, 500.000},
+  {"$26", SETTING_INT, &settings.homingDebounceMs, 250},
+  {"$27", SETTING_FLOAT, &settings.homingPullOff, 1.000},
+  {"$30", SETTING_INT, &settings.spindleMaxRpm, 10000},
+  {"$31", SETTING_INT, &settings.spindleMinRpm, 1000},
+  {"$32", SETTING_BOOL, &settings.laserMode, 0},
+  {"$100", SETTING_FLOAT, &settings.stepsPerMM[0], 250.000},
+  {"$101", SETTING_FLOAT, &settings.stepsPerMM[1], 250.000},
+  {"$102", SETTING_FLOAT, &settings.stepsPerMM[2], 250.000},
+  {"$110", SETTING_FLOAT, &settings.maxRate[0], 500.000},
+  {"$111", SETTING_FLOAT, &settings.maxRate[1], 500.000},
+  {"$112", SETTING_FLOAT, &settings.maxRate[2], 500.000},
+  {"$120", SETTING_FLOAT, &settings.acceleration[0], 10.000},
+  {"$121", SETTING_FLOAT, &settings.acceleration[1], 10.000},
+  {"$122", SETTING_FLOAT, &settings.acceleration[2], 10.000},
+  {"$130", SETTING_FLOAT, &settings.maxTravel[0], 200.000},
+  {"$131", SETTING_FLOAT, &settings.maxTravel[1], 200.000},
+  {"$132", SETTING_FLOAT, &settings.maxTravel[2], 200.000},
+  {"$140", SETTING_FLOAT, &settings.trackWidth, 250.000}
+};
+#define settingCount (sizeof(settingTable) / sizeof(settingTable[0]))
+//JSON capacity for a bulk update carrying every setting (keys stay in the request body, see readJsonBody()).
+#define settingsJsonCapacity (JSON_OBJECT_SIZE(1) + JSON_OBJECT_SIZE(settingCount) + settingCount * 8 + 64)
+
+//Motion queue - fixed size ring buffer of segments waiting to be handed to the steppers. Size must be a power of two.
+#define motionQueueSize 64
+//JSON capacity for a full batch request (array of motionQueueSize objects with up to four members each).
+#define batchJsonCapacity (JSON_ARRAY_SIZE(motionQueueSize) + motionQueueSize * JSON_OBJECT_SIZE(4) + 256)
+
+//One queued move. Steps are signed relative moves, rates are in steps per second (Hz).
+struct MotionSegment {
+  int32_t leftSteps;
+  int32_t rightSteps;
+  int32_t zSteps;
+  uint32_t leftHz;
+  uint32_t rightHz;
+  uint32_t zHz;
+  //Look-ahead planner data - filled in by plannerPrepare(). Speeds are along the move in joint space (left, right, z).
+  float lengthMM;         //Length of the move, millimeters
+  float nominalSpeed;     //Programmed speed, mm/sec
+  float acceleration;     //Acceleration limit along the move, mm/sec^2
+  float maxEntrySpeedSqr; //Junction limit from $11 and the nominal speeds either side
+  float entrySpeedSqr;    //Planned speed entering this segment
+  uint8_t leadAxis;       //Axis with the most steps - 0 left, 1 right, 2 z
+  //Laser mode ($32) - the power this segment cuts at, set from M3/M4/S when it is queued. See laserService().
+  uint8_t laserPower;     //PWM duty before the spindle override, 0 for off
+  bool laserDynamic;      //M4 - power follows the speed through the ramps
+};
+
+//The network task is the only producer and the motion task the only consumer. The producer just copies a segment in
+//and publishes head; planning and execution both happen on the motion task.
+MotionSegment motionQueue[motionQueueSize];
+uint16_t motionQueueHead = 0;    //Next free slot - written by the network task
+uint16_t motionQueueTail = 0;    //Next segment to execute - written by the motion task
+uint16_t motionQueuePlanned = 0; //End of the segments plannerPrepare() has seen - motion task only
+
+//Soft limits ($20). The network task keeps the machine position the queued segments end at - x and y in mm and the
+//heading in radians from the track steps, with the same geometry as kinematicsPlan(), and Z in steps - and checks
+//moves against $130-$132 before they are queued. X and Y run from 0 to $130 and $131 from where the tank started
+//(facing Y+, like the odometry); Z runs from 0 to $132 above the homed zero and is only checked once Z is homed.
+//Whenever the machine is idle the position is read back from the odometry and the Z stepper, so jogs, probing, homing
+//and e-stops are picked up.
+#define envelopeToleranceMM 0.05 //Rounding to steps - a job that comes back to X0 or Y0 is still inside
+float envelopePose[3] = {0, 0, PI / 2};
+int32_t envelopeZ = 0;
+
+//Task split. The motion task owns the steppers, the planner and the executor and runs at high priority on core 1.
+//The network task owns the web server, the G-code stream and telemetry on core 0 next to the WiFi stack. Anything
+//the network side needs done to the steppers goes through the motion queue or the command ring below.
+#define motionTaskPriority 5
+#define motionTaskStack 4096
+#define networkTaskPriority 2
+#define networkTaskStack 8192
+TaskHandle_t motionTaskHandle = NULL;
+TaskHandle_t networkTaskHandle = NULL;
+
+//Requests from the network task that have to run on the motion task. Single producer, single consumer.
+enum MotionCommand {
+  MOTION_CMD_HOME,    //Start the Z homing cycle
+  MOTION_CMD_SETTINGS, //Push new accelerations to the steppers
+  MOTION_CMD_HOLD,     //Feed hold - decelerate to a stop part way through the segment, keep the queue
+  MOTION_CMD_RESUME,   //Cycle start - finish the held segment and carry on with the queue
+  MOTION_CMD_PROBE     //Start the Z probing cycle described by probeSetup
+};
+#define motionCommandSize 8 //Power of two
+MotionCommand motionCommands[motionCommandSize];
+uint8_t motionCommandHead = 0;
+uint8_t motionCommandTail = 0;
+bool motionStopRequest = false; //E-stop skips the command ring so nothing queued ahead of it can delay it
+
+//Continuous jog - the tracks run at a velocity for as long as the client keeps asking. The network task publishes the
+//command and the time of the last request; the motion task ramps the tracks to match and ramps them down on its own
+//if no request arrives for jogTimeoutMs. Clients resend the jog every jogKeepaliveMs while the button is held.
+#define jogKeepaliveMs 100
+#define jogTimeoutMs 300
+uint32_t jogCommand = 0;       //0 for none, else direction + 1 in the low byte and mm/min above it - one store, no tearing
+uint32_t jogLastRequest = 0;   //millis() of the last jog request - written by the network task
+uint32_t jogActive = 0;        //Command the tracks were last set up for - motion task only
+
+//Real-time overrides in percent, GRBL's 10-200% range. The network task writes feedOverride; the motion task rescales
+//the running segment within a pass once it sees the change, and every later segment starts at the new rate.
+//spindleOverride scales the commanded spindle PWM (spindleDuty) - see spindleWrite().
+#define overrideMin 10
+#define overrideMax 200
+uint8_t feedOverride = 100;
+uint8_t feedOverrideApplied = 100; //What the running segment was last set up for - motion task only
+uint8_t spindleOverride = 100;
+uint8_t spindleDuty = 0;           //PWM duty asked for by M3/S, /api/spindle/speed or the control port, before the override
+
+//Laser power stage ($32). M3/M4/M5/S no longer wait for the queue to drain: each segment carries the power it cuts at
+//and a periodic timer sets the PWM from the segment the steppers are running. M3 holds the programmed power while the
+//axes move; M4 scales it with the lead axis speed against its programmed rate, so the burn per millimeter stays even
+//through the ramps. Rapids, spins in place (the tank turns about the tool), holds and idle are dark. The power goes out
+//on spindlePWM with the laser pin as its enable.
+#define laserUpdateUs 1000
+esp_timer_handle_t laserTimer = NULL;
+//Published by the motion task for the running segment, read by the timer: power in bits 0-7, bit 8 M4, bits 9-10 lead
+//axis, bits 12-31 lead axis programmed rate in Hz. 0 while nothing is cutting. One word, so the timer never sees half.
+uint32_t laserActive = 0;
+int16_t laserDutyWritten = -1; //Last duty the timer wrote, -1 when laser mode is off - timer only
+//A segment handed over while the previous one is still finishing takes over the power once its lead axis reaches the
+//end of that segment, not when it is queued on the steppers. Motion task only.
+uint32_t laserPending = 0;
+int32_t laserSwitchAt = 0;
+int8_t laserSwitchDir = 0;   //Direction the lead axis is travelling towards laserSwitchAt, 0 when nothing is pending
+uint8_t laserSwitchAxis = 0;
+
+//Dead reckoning. The motion task turns the track step counts into a pose every odometryIntervalUs, all in fixed point:
+//x and y in mm as Q32.32 and the heading as a binary angle - 2^32 to the turn, counter-clockwise from X+, so it wraps
+//by itself. The heading is worked out from the track steps since odometryHeadingOrigin rather than summed a tick at a
+//time, so it can never drift from what the steps say; x and y add up the centre line distance along the heading half
+//way through each tick. Same geometry as kinematicsPlan(). Z is just the Z stepper position and is not tracked here.
+#define odometryIntervalUs 1000
+#define odometrySineBits 10        //Sine table entries per turn, as a power of two
+#define odometryRebaseSteps 0x1000000 //Fold the step counts into odometryHeadingOrigin past this, well short of overflow
+int32_t odometrySine[(1 << odometrySineBits) + 1]; //Q24, one turn plus the first entry again for interpolation
+int64_t odometryMMPerStep[2] = {0, 0};   //Q32 - left, right
+int64_t odometryTurnPerStep[2] = {0, 0}; //Q48 binary angle the tank turns per step of each track
+int32_t odometryLastSteps[2] = {0, 0};
+int64_t odometryTurnSteps[2] = {0, 0};   //Track steps since odometryHeadingOrigin
+uint32_t odometryHeadingOrigin = 0x40000000; //Facing Y+, like tankHeading
+uint32_t odometryHeading = 0x40000000;
+int64_t odometryX = 0;
+int64_t odometryY = 0;
+uint32_t odometryLastUs = 0;
+//The pose the network task sees, in µm and binary angle, and a pose it wants the motion task to take on. Both are
+//copied under odometryMux so neither side ever sees half of one.
+portMUX_TYPE odometryMux = portMUX_INITIALIZER_UNLOCKED;
+int32_t odometryPublished[3] = {0, 0, 0x40000000};
+int32_t odometrySetPose[3];
+bool odometrySetPending = false;
+
+//Motion executor - a state machine advanced by the motion task so the web server never affects step timing.
+enum MotionState {
+  MOTION_IDLE,    //Nothing handed to the steppers
+  MOTION_RUNNING, //A queued segment is executing
+  MOTION_HOMING,  //Z homing cycle in progress - see homingService()
+  MOTION_JOGGING, //Tracks running at a jog velocity - see jogService()
+  MOTION_HOLD,    //Feed hold - slowing or stopped part way through activeSegment, see holdService()
+  MOTION_PROBING  //Z probing cycle in progress - see probeService()
+};
+
+enum HomingPhase {
+  HOMING_IDLE,
+  HOMING_SEEK,     //Running towards the switch at $25, waiting on the ISR
+  HOMING_DEBOUNCE, //Switch hit, waiting $26 and for the axis to stop before moving again
+  HOMING_BACKOFF,  //Backing off $27 from the first contact
+  HOMING_LOCATE,   //Coming back at $24 for the contact that sets zero
+  HOMING_PULLOFF   //Backing off $27 from that contact before zeroing
+};
+
+enum ProbePhase {
+  PROBE_IDLE,
+  PROBE_SEEK,    //Running towards the surface at the seek feed, waiting on the ISR
+  PROBE_STOP,    //First contact - waiting for the forced stop to finish before reversing
+  PROBE_BACKOFF, //Backing off $27 from that contact
+  PROBE_RETOUCH  //Coming back at $24 for the contact that gets reported
+};
+
+//Outcome of the last probing cycle, shared between the tasks.
+enum ProbeState {
+  PROBE_NONE,
+  PROBE_RUNNING,
+  PROBE_DONE,
+  PROBE_FAILED
+};
+
+//Filled in by the network task before MOTION_CMD_PROBE - the motion task reads it when the command comes up.
+struct ProbeSetup {
+  int32_t distanceSteps; //Furthest the seek goes, signed like Z moves
+  uint32_t seekHz;
+  uint32_t locateHz;
+  int32_t pullOffSteps;
+};
+
+//Executor transitions reported through motionEvent().
+enum MotionEvent {
+  EVENT_SEGMENT_DONE,
+  EVENT_HOMING_DONE,
+  EVENT_HOMING_FAILED,
+  EVENT_PROBE_DONE,
+  EVENT_PROBE_FAILED,
+  EVENT_STOPPED
+};
+
+MotionState motionState = MOTION_IDLE;
+HomingPhase homingPhase = HOMING_IDLE;
+uint32_t segmentsCompleted = 0;
+bool zHomed = false;
+uint32_t homingTimer = 0;
+int homingDebounceMs = 0;
+int32_t homingPullOffSteps = 0;
+uint32_t homingLocateHz = 0;
+bool homingLocating = false;     //Second, slow approach - the contact it latches becomes zero
+volatile int32_t homeLatched = 0; //Z position at the switch's closing edge, from homingStop()
+
+//Z probing (G38.2/G38.3, /api/control/probe). The probe pulls zProbe low on contact and probeTouch() latches the Z
+//position on that edge, so the result does not depend on when the motion task next looks. Seek at the requested feed,
+//back off $27, then touch again at $24 and report the second contact - the same two speeds homing uses.
+#define probeMinPullOffMM 0.5
+ProbeSetup probeSetup;
+ProbePhase probePhase = PROBE_IDLE;
+int8_t probeDirection = 0;
+volatile bool probeTouched = false;
+volatile int32_t probeLatched = 0;
+uint8_t probeState = PROBE_NONE; //Published by the motion task once probePosition is set
+int32_t probePosition = 0;       //Z steps at the reported contact
+
+//Look-ahead planner. Limits come from settings; axis order is left ($100/$120), right ($101/$121), z ($102/$122).
+#define minimumJunctionSpeed 0.0 //mm/sec
+float plannerPrevUnit[3] = {0, 0, 0};
+float plannerPrevNominal = 0;
+MotionSegment activeSegment; //Segment currently handed to the steppers
+//A segment handed over early (plannerReadyForNext()) starts where the one before it ends, while that one is still
+//running. A feed hold that stops short of the boundary has to finish the previous segment before the active one.
+MotionSegment previousSegment; //Segment activeSegment took over from
+bool activeHandedOver = false; //activeSegment was handed over while previousSegment was still running
+int32_t activeStart[3];        //Where activeSegment starts on each axis - the end of previousSegment
+int32_t holdTargets[3];      //Where each axis was headed when the feed hold started
+bool holdResume = false;     //Cycle start arrived - resume once the hold has finished decelerating
+bool holdMidSegment = false; //The hold caught a segment on the steppers - otherwise there is nothing to resume
+
+//Telemetry frame layout, little-endian:
+//  0 magic 0xA5, 1 version, 2 frame length, 3 flags, 4 sequence (u16), 6 millis (u32),
+//  10 motion state, 11 pin bits, 12 spindle PWM duty,
+//  then the blocks named in flags, in bit order:
+//  telemetryFlagPositions - left, right, z stepper positions in steps (3 x i32)
+//  telemetryFlagBuffer    - queued segments (u16), free slots (u16), segments completed (u32)
+//  telemetryFlagPose      - dead-reckoned x, y in µm (2 x i32), heading as a binary angle, 2^32 to the turn (u32)
+//The optional blocks follow the $10 status report mask: bit 0 (machine position) brings the stepper positions and the
+//pose, bit 1 the buffer data.
+#define telemetryMagic 0xA5
+#define telemetryVersion 2
+#define telemetryFlagPositions 0x01
+#define telemetryFlagBuffer 0x02
+#define telemetryFlagPose 0x04
+#define telemetryFrameSize 45
+//Pin bits report raw levels - the switches pull low when triggered.
+#define telemetryPinEndStop 0x01
+#define telemetryPinProbe 0x02
+#define telemetryPinSpindle 0x04
+#define telemetryPinHomed 0x08
+uint16_t telemetryIntervalMs = telemetryDefaultIntervalMs;
+uint32_t telemetryLastMs = 0;
+uint16_t telemetrySequence = 0;
+
+//G-code interpreter. The line buffer is filled in place - comments, spaces and case are stripped as bytes arrive.
+#define gcodeLineSize 96
+//Status codes follow GRBL's numbering so stock senders can report them.
+#define gcodeOk 0
+#define gcodeErrorExpectedLetter 1
+#define gcodeErrorBadNumber 2
+#define gcodeErrorLineOverflow 11
+#define gcodeErrorUnsupported 20
+#define gcodeErrorUndefinedFeed 22
+#define gcodeErrorNoAxisWordsInPlane 32
+#define gcodeErrorInvalidTarget 33
+#define gcodeErrorArcRadius 34
+#define gcodeErrorNoOffsetsInPlane 35
+//GRBL raises ALARM:4/5 when a G38.2 probe does not touch. There is no alarm lock here, so the line fails instead.
+#define gcodeErrorProbeFail 80
+//GRBL raises ALARM:2 when a move would pass the soft limits ($20). The line fails with the code GRBL gives a jog that would.
+#define gcodeErrorSoftLimit 15
+#define gcodeWait 255 //Line is valid but has to wait for room in the queue or for motion to finish
+char gcodeLine[gcodeLineSize];
+uint8_t gcodeLineLength = 0;
+bool gcodeLineReady = false;
+bool gcodeLineOverflow = false;
+bool gcodeInComment = false;
+bool gcodeSkipRest = false;
+//Modal state - persists between lines and connections like any G-code interpreter.
+uint8_t gcodeMotionMode = 0; //0-3 for G0-G3
+bool gcodeAbsolute = true;   //G90/G91
+bool gcodeInches = false;    //G20/G21
+float gcodeFeed = 0;         //mm/min, 0 until the first F word
+float gcodeSpindleSpeed = 0; //S word, RPM between $31 and $30
+bool gcodeSpindleOn = false;
+bool gcodeProbing = false;        //A G38 line is waiting on its probing cycle
+int32_t gcodeProbeStart = 0;      //Z steps when it started
+bool gcodeSpindleDynamic = false; //M4 - laser power follows the speed in laser mode ($32)
+float gcodePosition[3] = {0, 0, 0}; //Programmed position, mm
+float tankHeading = 90.0;           //Degrees - 0 is X+, 90 is Y+ (start facing Y+ like the server planner)
+float gcodeCarry[3] = {0, 0, 0};    //Left, right and Z travel in mm the queued steps are short of the program by
+
+//G2/G3 arcs are cut into chords no further than $12 from the true arc. Chords are queued from gcodeService() as space frees up,
+//stepping the radius vector with a small-angle rotation matrix and snapping it back to exact trig every arcCorrection chords.
+#define arcCorrection 12
+#define arcAngularTravelEpsilon 5E-7
+struct ArcState {
+  bool active;
+  uint16_t segments;   //Chords in the whole arc
+  uint16_t index;      //Next chord to queue, 1-based - the last one goes to the exact target
+  uint8_t sinceCorrection;
+  float center[2];
+  float offset[2];     //Center minus start point, for the exact correction
+  float radius[2];     //Center to the current chord end
+  float thetaPerSegment;
+  float cosT;
+  float sinT;
+  float zPerSegment;
+  float target[3];
+  float feed;
+};
+ArcState gcodeArc = {false};
+
+//Height map for surfaces that are not flat: probe contacts on a grid in G-code coordinates, held relative to the first
+//point probed. With compensation on, G-code moves are cut where they cross a grid line and each piece ends at its
+//programmed Z plus the map's offset there. Within a cell the offset is bilinear, z = a + b*u + c*v + d*u*v with u, v in
+//mm from the cell's first corner, and the four coefficients of every cell are worked out once whenever the map changes.
+#define heightMapMaxPoints 16
+//GET /api/status/leveling - the state, the grid and a full map of offsets.
+#define levelingJsonCapacity (JSON_OBJECT_SIZE(10) + JSON_ARRAY_SIZE(heightMapMaxPoints * heightMapMaxPoints))
+struct HeightMap {
+  float x0;   //First grid point
+  float y0;
+  float dx;   //Spacing between points
+  float dy;
+  uint8_t nx; //Points along X and Y, 2 to heightMapMaxPoints
+  uint8_t ny;
+  float z[heightMapMaxPoints * heightMapMaxPoints]; //Row by row from y0, nx to a row
+};
+struct HeightCell {
+  float a;
+  float b;
+  float c;
+  float d;
+};
+HeightMap heightMap = {0};
+HeightCell heightCells[(heightMapMaxPoints - 1) * (heightMapMaxPoints - 1)]; //Row by row, nx - 1 to a row
+bool heightMapValid = false;
+bool heightMapEnabled = false;
+float gcodeZOffset = 0; //Compensation in the Z already queued, mm - the machine is at gcodePosition Z plus this
+
+//Grid probing. Runs from the network task a step at a time: a rapid to each point at the starting Z, visiting the rows
+//in a serpentine, a probing cycle, and a retract to the starting Z. Ends back at the starting XY.
+enum LevelingPhase {
+  LEVEL_IDLE,
+  LEVEL_TRAVEL,
+  LEVEL_PROBE,
+  LEVEL_CONTACT,
+  LEVEL_RETURN,
+  LEVEL_FINISH
+};
+enum LevelingState {
+  LEVELING_NONE,
+  LEVELING_RUNNING,
+  LEVELING_DONE,
+  LEVELING_FAILED
+};
+LevelingPhase levelingPhase = LEVEL_IDLE;
+LevelingState levelingState = LEVELING_NONE;
+HeightMap levelingMap;         //Filled in as the points are probed, copied to heightMap at the end
+uint16_t levelingPoint = 0;    //Next point in probing order
+float levelingStart[3];        //G-code position when the cycle started
+float levelingDistance = 0;    //Probe travel from the starting Z, signed like Z moves
+float levelingFeed = 0;        //Seek feed, mm/min
+int32_t levelingProbeStart = 0; //Z steps when the current point's probing cycle started
+
 //ISRs for hardware interrupt(Z probing and Z homing)
 void IRAM_ATTR homingStop(){
+  homeLatched = zStepper->getCurrentPosition();
   homeStop = true;
   //Allow the processor to think without ISR being hammered.
   detachInterrupt(zEndStop);
 }
 
+void IRAM_ATTR probeTouch(){
+  probeLatched = zStepper->getCurrentPosition();
+  probeTouched = true;
+  detachInterrupt(zProbe);
+}
+
 //Replace with credential bound keys.
 String ssid;
 String password;
@@ -81,23 +664,34 @@ String password;
 // Change this to your desired hostname - for MDNS
 const char* host = "cnc-tank";
 
-// HTML for the update page - this will be for direct updates, not through the tunnel service
-const char* serverIndex = R"(
-<!DOCTYPE html>
-<html>
-<body>
-    <h2>CNC Tank Firmware Update</h2>
-    <form method='POST' action='/update' enctype='multipart/form-data'>
-        <input type='file' name='update'>
-        <input type='submit' value='Update Firmware'>
-    </form>
-</body>
-</html>
-)";
-
 // Endpoint handlers
 String serverAddress = ""; // Global variable to store the server address
 
+//Parse the JSON body of the current request into doc. On failure the 400 reply has been sent and false is returned.
+bool readJsonBody(JsonDocument& doc) {
+    char* body = server.body();
+    if (body == NULL) {
+        server.send(400, "application/json", "{\"error\": \"No data received\"}");
+        return false;
+    }
+    if (deserializeJson(doc, body)) {
+        server.send(400, "application/json", "{\"error\": \"Invalid JSON\"}");
+        return false;
+    }
+    return true;
+}
+
+//Serialize doc into the shared response buffer and send it.
+void sendJson(int code, const JsonDocument& doc) {
+    if (measureJson(doc) >= sizeof(responseBuffer)) {
+        server.send(500, "application/json", "{\"error\": \"Response too large\"}");
+        return;
+    }
+    size_t length = serializeJson(doc, responseBuffer, sizeof(responseBuffer));
+    //send_P writes straight from the buffer - the String overloads would copy it.
+    server.send_P(code, "application/json", responseBuffer, length);
+}
+
 //Consider this function if space becomes a problem - otherwise, leave it as is.
 void handleTestData() {
     StaticJsonDocument<200> doc;
@@ -110,9 +704,7 @@ void handleTestData() {
     // Get the firmware version
     doc["firmware_version"] = FIRMWARE_VERSION;
     
-    String response;
-    serializeJson(doc, response);
-    server.send(200, "application/json", response);
+    sendJson(200, doc);
 }
 
 //Let the server no we are here!
@@ -121,6 +713,11 @@ void handleStatus() {
         serverAddress = server.arg("serverAddress");
         Serial.println("Server address set to: " + serverAddress);
 
+        String url = "http://" + serverAddress + "/api/status/console";
+        portENTER_CRITICAL(&consoleUrlMux);
+        strlcpy(consoleServerUrl, url.c_str(), sizeof(consoleServerUrl));
+        portEXIT_CRITICAL(&consoleUrlMux);
+
         // Send initial console message
         sendConsoleMessage("info", "Hello, I'm ready to go!");
     }
@@ -128,62 +725,115 @@ void handleStatus() {
     StaticJsonDocument<200> response;
     response["status"] = "connected";
     
-    String responseStr;
-    serializeJson(response, responseStr);
-    server.send(200, "application/json", responseStr);
+    sendJson(200, response);
 }
 
 // Send a console message to the server - for debugging through the client-visible console.
-void sendConsoleMessage(const String& type, const String& message) {
-    if (serverAddress == "") {
-        Serial.println("Server address not set. Cannot send console message.");
-        return;
+// Never blocks: the message is copied into the console ring and sent later by consoleTask.
+void sendConsoleMessage(const char* type, const char* message) {
+    uint32_t index = __atomic_fetch_add(&consoleHead, 1, __ATOMIC_RELAXED);
+    ConsoleEntry& entry = consoleQueue[index & (consoleQueueSize - 1)];
+
+    __atomic_store_n(&entry.sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    strlcpy(entry.type, type, sizeof(entry.type));
+    strlcpy(entry.message, message, sizeof(entry.message));
+    __atomic_store_n(&entry.sequence, index + 1, __ATOMIC_RELEASE);
+
+    if (consoleTaskHandle) xTaskNotifyGive(consoleTaskHandle);
+}
+
+// Move published entries from the ring into the batch. Entries that were overwritten before they could be read are
+// counted as dropped. Stops at the first slot a producer is still writing.
+int consoleCollect(ConsoleEntry *batch, int count) {
+    uint32_t head = __atomic_load_n(&consoleHead, __ATOMIC_ACQUIRE);
+    if (head - consoleTail > consoleQueueSize) {
+        consoleDropped += head - consoleTail - consoleQueueSize;
+        consoleTail = head - consoleQueueSize;
     }
 
+    while (count < consoleBatchSize && consoleTail != head) {
+        ConsoleEntry& entry = consoleQueue[consoleTail & (consoleQueueSize - 1)];
+        uint32_t sequence = __atomic_load_n(&entry.sequence, __ATOMIC_ACQUIRE);
+        if (sequence == 0 || sequence - 1 < consoleTail) break; //Not published yet
+
+        if (sequence - 1 == consoleTail) {
+            memcpy(&batch[count], &entry, sizeof(ConsoleEntry));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            //A producer lapping the ring while we copied leaves a torn entry - drop it.
+            if (__atomic_load_n(&entry.sequence, __ATOMIC_RELAXED) == sequence) count++;
+            else consoleDropped++;
+        } else {
+            consoleDropped++; //Slot was already reused by a newer message
+        }
+        consoleTail++;
+    }
+    return count;
+}
+
+// Console task - drains the ring to the server, up to consoleBatchSize messages per POST over a reused connection.
+// A failed POST keeps its batch and is retried, so messages are only lost when the ring overflows.
+void consoleTask(void *parameter) {
+    static ConsoleEntry batch[consoleBatchSize];
+    static char body[consoleBodySize];
+    int pending = 0;
     HTTPClient http;
-    String serverName = "http://" + serverAddress + "/api/status/console";
+    http.setReuse(true);
+    http.setTimeout(1000);
 
-    // Prepare JSON payload
-    StaticJsonDocument<200> doc;
-    doc["type"] = type;
-    doc["message"] = message;
+    for (;;) {
+        if (pending == 0 && consoleTail == __atomic_load_n(&consoleHead, __ATOMIC_ACQUIRE)) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(consoleIdleMs));
+        }
 
-    String requestBody;
-    serializeJson(doc, requestBody);
+        char url[sizeof(consoleServerUrl)];
+        portENTER_CRITICAL(&consoleUrlMux);
+        memcpy(url, consoleServerUrl, sizeof(url));
+        portEXIT_CRITICAL(&consoleUrlMux);
+        if (url[0] == 0) {
+            //Nowhere to send yet - let the ring hold the newest messages until the server checks in.
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(consoleIdleMs));
+            continue;
+        }
 
-    // Configure HTTPClient
-    http.begin(serverName);
-    http.addHeader("Content-Type", "application/json");
+        pending = consoleCollect(batch, pending);
+        if (pending == 0 && consoleDropped == 0) continue;
 
-    // Send HTTP POST request
-    int httpResponseCode = http.POST(requestBody);
+        StaticJsonDocument<consoleBodySize> doc;
+        JsonArray messages = doc.createNestedArray("messages");
+        if (consoleDropped) {
+            char note[48];
+            snprintf(note, sizeof(note), "%lu console messages dropped", (unsigned long)consoleDropped);
+            JsonObject dropped = messages.createNestedObject();
+            dropped["type"] = "warning";
+            dropped["message"] = note;
+        }
+        for (int i = 0; i < pending; i++) {
+            JsonObject item = messages.createNestedObject();
+            item["type"] = (const char*)batch[i].type;
+            item["message"] = (const char*)batch[i].message;
+        }
+        size_t length = serializeJson(doc, body, sizeof(body));
 
-    // Check the response
-    if (httpResponseCode > 0) {
-        String response = http.getString();
-        Serial.println("Server response: " + response);
-    } else {
-        Serial.println("Error sending console message: " + String(httpResponseCode));
-        Serial.println("HTTPClient error: " + http.errorToString(httpResponseCode));
-    }
+        http.begin(url);
+        http.addHeader("Content-Type", "application/json");
+        int httpResponseCode = http.POST((uint8_t*)body, length);
+        if (httpResponseCode > 0) http.getString(); //Read the reply so the connection can be reused
+        http.end(); //Keeps the socket open when the server allows keep-alive
 
-    // End the HTTP connection
-    http.end();
+        if (httpResponseCode > 0) {
+            pending = 0;
+            consoleDropped = 0;
+        } else {
+            vTaskDelay(pdMS_TO_TICKS(consoleRetryMs));
+        }
+    }
 }
 
 //TO-DO Add a switch on/off for the Laser. Laser SHOULD not be left running for long periods of time. Consider adding a non-blocking timer.
 void handleLaser() {
-    if (server.hasArg("plain") == false) {
-        server.send(400, "application/json", "{\"error\": \"No data received\"}");
-        return;
-    }
-
-    String body = server.arg("plain");
     StaticJsonDocument<200> doc;
-    DeserializationError error = deserializeJson(doc, body);
-
-    if (error) {
-        server.send(400, "application/json", "{\"error\": \"Invalid JSON\"}");
+    if (!readJsonBody(doc)) {
         return;
     }
 
@@ -192,6 +842,12 @@ void handleLaser() {
         return;
     }
 
+    //In laser mode the laser timer is the only writer of the laser pin - see laserService().
+    if (settings.laserMode) {
+        server.send(409, "application/json", "{\"error\": \"Laser is driven by the motion in laser mode\"}");
+        return;
+    }
+
     bool enable = doc["enable"];
     digitalWrite(laser, enable ? HIGH : LOW);
 
@@ -199,637 +855,3285 @@ void handleLaser() {
     response["status"] = "success";
     response["laser"] = enable ? "enabled" : "disabled";
 
-    String responseStr;
-    serializeJson(response, responseStr);
-    server.send(200, "application/json", responseStr);
+    sendJson(200, response);
 }
 
 //TO-DO Probably remove this function. As the spindle should be controlled by the handleSpindleSpeed function. Might use this as a "playground" for testing purposes.
 void handleSpindle() {
-    if (server.hasArg("plain") == false) {
-        server.send(400, "application/json", "{\"error\": \"No data received\"}");
+    StaticJsonDocument<200> doc;
+    if (!readJsonBody(doc)) {
+        return;
+    }
+
+    if (!doc.containsKey("enable")) {
+        server.send(400, "application/json", "{\"error\": \"Missing required parameter: enable\"}");
+        return;
+    }
+
+    bool enable = doc["enable"];
+    digitalWrite(spindleEnb, enable ? HIGH : LOW);
+
+    StaticJsonDocument<200> response;
+    response["status"] = "success";
+    response["spindle"] = enable ? "enabled" : "disabled";
+
+    sendJson(200, response);
+}
+
+//TO-DO Receive spindle state as "M" codes. M03 for enable, M05 for disable followed by integer value of 0-255 for PWM.
+void handleSpindleSpeed() {
+    StaticJsonDocument<200> doc;
+    if (!readJsonBody(doc)) {
+        return;
+    }
+
+    if (!doc.containsKey("speed")) {
+        server.send(400, "application/json", "{\"error\": \"Missing required parameter: speed\"}");
+        return;
+    }
+
+    int speed = doc["speed"];
+    if (speed < 0 || speed > 100) {
+        server.send(400, "application/json", "{\"error\": \"Invalid spindle speed value\"}");
+        return;
+    }
+    if (settings.laserMode) {
+        server.send(409, "application/json", "{\"error\": \"Laser is driven by the motion in laser mode\"}");
+        return;
+    }
+
+    spindleWrite(map(speed, 0, 100, 0, 255));
+
+    StaticJsonDocument<200> response;
+    response["status"] = "success";
+    response["spindle_speed"] = speed;
+
+    sendJson(200, response);
+}
+
+//Set the spindle PWM. duty is what was asked for; the pin gets it scaled by the spindle override. Network task.
+//In laser mode the laser timer owns the PWM and applies the override itself, so only the duty is kept.
+void spindleWrite(uint8_t duty){
+    spindleDuty = duty;
+    if (!settings.laserMode) {
+        ledcWrite(spindlePWM, min(255, duty * spindleOverride / 100));
+    }
+}
+
+//Real-time commands. They skip the motion queue - hold and resume go through the command ring and the overrides are
+//picked up by the motion task on its next pass - so they act mid-segment. Network task only.
+bool feedHold(){
+    return motionRequest(MOTION_CMD_HOLD);
+}
+
+bool cycleStart(){
+    return motionRequest(MOTION_CMD_RESUME);
+}
+
+void setFeedOverride(int percent){
+    __atomic_store_n(&feedOverride, (uint8_t)constrain(percent, overrideMin, overrideMax), __ATOMIC_RELEASE);
+    if (motionTaskHandle) xTaskNotifyGive(motionTaskHandle);
+}
+
+void setSpindleOverride(int percent){
+    spindleOverride = constrain(percent, overrideMin, overrideMax);
+    spindleWrite(spindleDuty);
+}
+
+void sendOverrideStatus(){
+    StaticJsonDocument<200> response;
+    response["status"] = "success";
+    response["state"] = motionStateName();
+    response["feed"] = __atomic_load_n(&feedOverride, __ATOMIC_ACQUIRE);
+    response["spindle"] = spindleOverride;
+    sendJson(200, response);
+}
+
+//Feed hold - the machine slows to a stop on the path and keeps its queue. POST /api/control/resume carries on.
+void handleFeedHold() {
+    if (!feedHold()) {
+        server.send(503, "application/json", "{\"error\": \"Motion task is not accepting commands\"}");
+        return;
+    }
+    sendOverrideStatus();
+}
+
+void handleCycleStart() {
+    if (!cycleStart()) {
+        server.send(503, "application/json", "{\"error\": \"Motion task is not accepting commands\"}");
+        return;
+    }
+    sendOverrideStatus();
+}
+
+//Overrides in percent, clamped to 10-200: {"feed":120,"spindle":80}. Either may be left out.
+void handleOverride() {
+    StaticJsonDocument<200> doc;
+    if (!readJsonBody(doc)) {
+        return;
+    }
+    if (!doc.containsKey("feed") && !doc.containsKey("spindle")) {
+        server.send(400, "application/json", "{\"error\": \"Missing required parameter: feed or spindle\"}");
+        return;
+    }
+    if (doc.containsKey("feed")) {
+        setFeedOverride(doc["feed"]);
+    }
+    if (doc.containsKey("spindle")) {
+        setSpindleOverride(doc["spindle"]);
+    }
+    sendOverrideStatus();
+}
+
+// OTA update handlers
+//Version and flash space. Images go through the chunked endpoints below - nothing writes flash from a request handler.
+void handleApiUpdateGet() {
+    StaticJsonDocument<200> response;
+    response["version"] = FIRMWARE_VERSION;
+    response["used_space"] = ESP.getSketchSize();
+    response["free_space"] = ESP.getFreeSketchSpace();
+    
+    sendJson(200, response);
+}
+
+const char* otaStateName(){
+    if (otaState == OTA_RECEIVING) return "receiving";
+    if (otaState == OTA_FAILED) return "failed";
+    return "idle";
+}
+
+void sendOtaStatus(int code, const char* error) {
+    StaticJsonDocument<256> response;
+    if (error) response["error"] = error;
+    response["state"] = otaStateName();
+    response["size"] = otaSize;
+    response["offset"] = otaReceived;
+    response["written"] = otaWritten;
+    response["chunk"] = otaChunkSize;
+
+    sendJson(code, response);
+}
+
+//64 hex digits to 32 bytes, either case.
+bool otaParseDigest(const char* hex, uint8_t* digest) {
+    if (!hex || strlen(hex) != 64) return false;
+    for (uint8_t i = 0; i < 32; i++) {
+        char pair[3] = {hex[i * 2], hex[i * 2 + 1], 0};
+        char* end;
+        digest[i] = strtoul(pair, &end, 16);
+        if (*end != 0) return false;
+    }
+    return true;
+}
+
+bool otaChunkInFlight() {
+    return __atomic_load_n(&otaPending, __ATOMIC_ACQUIRE) != 0;
+}
+
+void otaAbandon() {
+    if (Update.isRunning()) Update.abort();
+    mbedtls_sha256_free(&otaSha);
+    otaState = OTA_IDLE;
+    otaSize = 0;
+    otaReceived = 0;
+    otaWritten = 0;
+}
+
+//Start a session, or resume the current one when size and SHA-256 match it. Replies with the offset to send from.
+void handleOtaBegin() {
+    StaticJsonDocument<256> doc;
+    if (!readJsonBody(doc)) {
+        return;
+    }
+    uint32_t size = doc["size"] | 0;
+    uint8_t digest[32];
+    if (size == 0 || !otaParseDigest(doc["sha256"], digest)) {
+        server.send(400, "application/json", "{\"error\": \"size and sha256 required\"}");
+        return;
+    }
+    if (size > ESP.getFreeSketchSpace()) {
+        server.send(400, "application/json", "{\"error\": \"Firmware file too large\"}");
+        return;
+    }
+    if (otaChunkInFlight()) {
+        sendOtaStatus(503, "Flash write in progress");
+        return;
+    }
+    if (otaState == OTA_RECEIVING && size == otaSize && memcmp(digest, otaExpected, 32) == 0) {
+        sendOtaStatus(200, NULL);
+        return;
+    }
+
+    otaAbandon();
+    if (!Update.begin(size)) {
+        Update.printError(Serial);
+        otaState = OTA_FAILED;
+        sendOtaStatus(500, "Update could not start");
+        return;
+    }
+    memcpy(otaExpected, digest, 32);
+    mbedtls_sha256_init(&otaSha);
+    mbedtls_sha256_starts(&otaSha, 0);
+    otaSize = size;
+    otaState = OTA_RECEIVING;
+    sendConsoleMessage("info", "Firmware update started");
+    sendOtaStatus(200, NULL);
+}
+
+//Multipart body of /api/update/chunk - buffered whole so the CRC can be checked before anything reaches flash.
+void handleOtaChunkUpload() {
+    HTTPUpload& upload = server.upload();
+    if (upload.status == UPLOAD_FILE_START) {
+        otaChunkLength = 0;
+        otaChunkOverflow = false;
+    } else if (upload.status == UPLOAD_FILE_WRITE && !otaChunkInFlight()) {
+        if (otaChunkLength + upload.currentSize > otaChunkSize) {
+            otaChunkOverflow = true;
+            return;
+        }
+        memcpy(otaChunk + otaChunkLength, upload.buf, upload.currentSize);
+        otaChunkLength += upload.currentSize;
+    }
+}
+
+//?offset=&crc= (hex CRC-32 of the chunk). A chunk that was already accepted is acknowledged again, so a client that
+//lost the reply can simply resend it.
+void handleOtaChunk() {
+    if (otaChunkInFlight()) {
+        sendOtaStatus(503, "Flash write in progress");
+        return;
+    }
+    if (otaState != OTA_RECEIVING) {
+        sendOtaStatus(409, "No update in progress");
+        return;
+    }
+    if (otaChunkOverflow) {
+        sendOtaStatus(413, "Chunk too large");
+        return;
+    }
+    uint32_t offset = strtoul(server.arg("offset").c_str(), NULL, 10);
+    uint32_t crc = strtoul(server.arg("crc").c_str(), NULL, 16);
+    if (!server.hasArg("offset") || !server.hasArg("crc") || otaChunkLength == 0) {
+        sendOtaStatus(400, "offset, crc and data required");
+        return;
+    }
+    if (offset + otaChunkLength <= otaReceived) {
+        sendOtaStatus(200, NULL);
+        return;
+    }
+    if (offset != otaReceived || offset + otaChunkLength > otaSize) {
+        sendOtaStatus(409, "Offset mismatch");
+        return;
+    }
+    if (esp_rom_crc32_le(0, otaChunk, otaChunkLength) != crc) {
+        sendOtaStatus(400, "CRC mismatch");
+        return;
+    }
+
+    otaReceived += otaChunkLength;
+    __atomic_store_n(&otaPending, otaChunkLength, __ATOMIC_RELEASE);
+    xTaskNotifyGive(otaTaskHandle);
+    sendOtaStatus(200, NULL);
+}
+
+//Apply a complete, verified image and reboot into it.
+void handleOtaCommit() {
+    if (otaChunkInFlight() || otaState != OTA_RECEIVING || otaWritten != otaSize) {
+        sendOtaStatus(409, "Update incomplete");
+        return;
+    }
+    if (motionBusy()) {
+        sendOtaStatus(409, "Machine is busy");
+        return;
+    }
+
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&otaSha, digest);
+    if (memcmp(digest, otaExpected, 32) != 0) {
+        otaAbandon();
+        otaState = OTA_FAILED;
+        sendOtaStatus(400, "SHA-256 mismatch");
+        return;
+    }
+    if (!Update.end(true)) {
+        Update.printError(Serial);
+        otaAbandon();
+        otaState = OTA_FAILED;
+        sendOtaStatus(500, "Update failed");
+        return;
+    }
+
+    sendConsoleMessage("info", "Firmware update verified, restarting");
+    server.sendHeader("Connection", "close");
+    server.send(200, "application/json", "{\"success\": true, \"message\": \"Update successful\"}");
+    delay(1000);  // Give time for response to be sent
+    ESP.restart();
+}
+
+void handleOtaAbort() {
+    if (otaChunkInFlight()) {
+        sendOtaStatus(503, "Flash write in progress");
         return;
     }
+    otaAbandon();
+    sendOtaStatus(200, NULL);
+}
+
+void handleOtaStatus() {
+    sendOtaStatus(200, NULL);
+}
+
+//OTA task - moves buffered chunks into flash at low priority, and only while the machine is idle. A failed write is
+//reported through otaState, which the network task only reads after seeing otaPending go back to 0.
+void otaTask(void *parameter) {
+    for (;;) {
+        uint32_t length = __atomic_load_n(&otaPending, __ATOMIC_ACQUIRE);
+        if (length == 0 || motionBusy()) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(otaIdleMs));
+            continue;
+        }
+
+        bool ok = true;
+        for (uint32_t done = 0; ok && done < length; done += otaSliceSize) {
+            uint32_t slice = min((uint32_t)otaSliceSize, length - done);
+            ok = Update.write(otaChunk + done, slice) == slice;
+            mbedtls_sha256_update(&otaSha, otaChunk + done, slice);
+            vTaskDelay(pdMS_TO_TICKS(otaSliceGapMs));
+        }
+        if (ok) {
+            otaWritten += length;
+        } else {
+            Update.printError(Serial);
+            otaState = OTA_FAILED;
+            sendConsoleMessage("error", "Firmware update write failed");
+        }
+        __atomic_store_n(&otaPending, 0, __ATOMIC_RELEASE);
+    }
+}
+
+//Load every GRBL setting into RAM. Keys missing from NVS (first boot, or a setting added in a later firmware) are written
+//with their defaults first.
+void handleGrblSetup(){
+  myPrgVar.begin("GBRL", false);
+  for (uint8_t i = 0; i < settingCount; i++) {
+    const SettingDescriptor &setting = settingTable[i];
+    if (!myPrgVar.isKey(setting.key)) {
+      storeSetting(setting, setting.defaultValue);
+    }
+    switch (setting.type) {
+      case SETTING_INT: *(int32_t*)setting.value = myPrgVar.getInt(setting.key); break;
+      case SETTING_SHORT: *(int16_t*)setting.value = myPrgVar.getShort(setting.key); break;
+      case SETTING_BOOL: *(bool*)setting.value = myPrgVar.getBool(setting.key); break;
+      case SETTING_FLOAT: *(float*)setting.value = myPrgVar.getFloat(setting.key); break;
+    }
+  }
+  myPrgVar.end();
+}
+
+//Write one setting to NVS with its own type. The namespace must already be open for writing.
+bool storeSetting(const SettingDescriptor &setting, double value){
+  switch (setting.type) {
+    case SETTING_INT: return myPrgVar.putInt(setting.key, (int32_t)value) > 0;
+    case SETTING_SHORT: return myPrgVar.putShort(setting.key, (int16_t)value) > 0;
+    case SETTING_BOOL: return myPrgVar.putBool(setting.key, value != 0) > 0;
+    case SETTING_FLOAT: return myPrgVar.putFloat(setting.key, (float)value) > 0;
+  }
+  return false;
+}
+
+//Copy a value into the in-RAM settings with the setting's own type.
+void assignSetting(const SettingDescriptor &setting, double value){
+  switch (setting.type) {
+    case SETTING_INT: *(int32_t*)setting.value = (int32_t)value; break;
+    case SETTING_SHORT: *(int16_t*)setting.value = (int16_t)value; break;
+    case SETTING_BOOL: *(bool*)setting.value = value != 0; break;
+    case SETTING_FLOAT: *(float*)setting.value = (float)value; break;
+  }
+}
+
+//True when the in-RAM setting already holds value, once converted to the setting's type.
+bool settingMatches(const SettingDescriptor &setting, double value){
+  switch (setting.type) {
+    case SETTING_INT: return *(int32_t*)setting.value == (int32_t)value;
+    case SETTING_SHORT: return *(int16_t*)setting.value == (int16_t)value;
+    case SETTING_BOOL: return *(bool*)setting.value == (value != 0);
+    case SETTING_FLOAT: return *(float*)setting.value == (float)value;
+  }
+  return false;
+}
+
+//Put a setting's current value into a JSON object under its key.
+void reportSetting(const SettingDescriptor &setting, JsonObject target){
+  switch (setting.type) {
+    case SETTING_INT: target[setting.key] = *(int32_t*)setting.value; break;
+    case SETTING_SHORT: target[setting.key] = *(int16_t*)setting.value; break;
+    case SETTING_BOOL: target[setting.key] = *(bool*)setting.value; break;
+    case SETTING_FLOAT: target[setting.key] = *(float*)setting.value; break;
+  }
+}
+
+const SettingDescriptor* findSetting(const char* key){
+  for (uint8_t i = 0; i < settingCount; i++) {
+    if (strcmp(settingTable[i].key, key) == 0) {
+      return &settingTable[i];
+    }
+  }
+  return NULL;
+}
+
+//On connection to the server, the server will send the current GRBL settings to the client.
+void handleGrblStatus() {
+    StaticJsonDocument<1024> response;
+    JsonObject values = response.to<JsonObject>();
+    
+    for (uint8_t i = 0; i < settingCount; i++) {
+        reportSetting(settingTable[i], values);
+    }
+    
+    sendJson(200, response);
+}
+
+//When the client sends a GRBL update, the server will update the GRBL settings with the new values.
+void handleGrblUpdate() {
+    StaticJsonDocument<200> doc;
+    if (!readJsonBody(doc)) {
+        return;
+    }
+
+    //"type" is still accepted from older clients, but the settings table decides how a key is stored.
+    if (!doc.containsKey("key") || !doc.containsKey("value")) {
+        server.send(400, "application/json", "{\"error\": \"Missing required parameters\"}");
+        return;
+    }
+
+    const SettingDescriptor* setting = findSetting(doc["key"] | "");
+    if (setting == NULL) {
+        server.send(400, "application/json", "{\"error\": \"Unknown setting\"}");
+        return;
+    }
+    double value = doc["value"].as<double>();
+    //The motion task and the laser timer read the settings without a lock - they only change while nothing moves.
+    if (motionBusy()) {
+        server.send(409, "application/json", "{\"error\": \"Machine is busy\"}");
+        return;
+    }
+
+    //Write through to NVS first so RAM never holds a value that would be lost on reboot.
+    myPrgVar.begin("GBRL", false);
+    bool success = storeSetting(*setting, value);
+    myPrgVar.end();
+
+    if (!success) {
+        server.send(500, "application/json", "{\"error\": \"Failed to update setting\"}");
+        return;
+    }
+
+    assignSetting(*setting, value);
+    //Derived values and stepper accelerations follow the new setting.
+    applySettings();
+
+    StaticJsonDocument<200> response;
+    response["status"] = "success";
+    reportSetting(*setting, response.as<JsonObject>());
+    
+    sendJson(200, response);
+}
+
+//Several settings in one request - {"settings":{"$110":1000,"$111":1000}}. Every key is checked before anything is written,
+//changed values go to NVS inside a single open of the namespace and the motion parameters are reapplied once. Refused
+//while the machine is busy.
+void handleGrblBulkUpdate() {
+    StaticJsonDocument<settingsJsonCapacity> doc;
+    if (!readJsonBody(doc)) {
+        return;
+    }
+
+    JsonObject changes = doc["settings"];
+    if (changes.isNull() || changes.size() == 0) {
+        server.send(400, "application/json", "{\"error\": \"Missing required parameter: settings\"}");
+        return;
+    }
+
+    const SettingDescriptor* found[settingCount];
+    double values[settingCount];
+    uint8_t count = 0;
+    for (JsonPair change : changes) {
+        const SettingDescriptor* setting = findSetting(change.key().c_str());
+        if (setting == NULL || count == settingCount) {
+            StaticJsonDocument<200> response;
+            response["error"] = setting == NULL ? "Unknown setting" : "Too many settings";
+            response["key"] = change.key().c_str();
+
+            sendJson(400, response);
+            return;
+        }
+        found[count] = setting;
+        values[count] = change.value().as<double>();
+        count++;
+    }
+    //Same as handleGrblUpdate() - nothing is written under a running job.
+    if (motionBusy()) {
+        server.send(409, "application/json", "{\"error\": \"Machine is busy\"}");
+        return;
+    }
+
+    //Only values that actually change are written - saving an untouched form costs no flash wear.
+    uint8_t written = 0;
+    bool success = true;
+    myPrgVar.begin("GBRL", false);
+    for (uint8_t i = 0; i < count; i++) {
+        if (settingMatches(*found[i], values[i])) {
+            continue;
+        }
+        if (!storeSetting(*found[i], values[i])) {
+            success = false;
+            break;
+        }
+        assignSetting(*found[i], values[i]);
+        written++;
+    }
+    myPrgVar.end();
+
+    if (written > 0) {
+        applySettings();
+    }
+
+    StaticJsonDocument<1024> response;
+    response["status"] = success ? "success" : "error";
+    if (!success) {
+        response["error"] = "Failed to update setting";
+    }
+    response["written"] = written;
+    JsonObject current = response.createNestedObject("settings");
+    for (uint8_t i = 0; i < count; i++) {
+        reportSetting(*found[i], current);
+    }
+
+    sendJson(success ? 200 : 500, response);
+}
+
+//Work out the derived values and have the motion task push the accelerations to the steppers. Called at boot and
+//after any settings change.
+void applySettings(){
+    for (uint8_t i = 0; i < 3; i++) {
+        settings.hzPerMMPerMin[i] = settings.stepsPerMM[i] / 60.0;
+        //GRBL stores mm/sec^2, FastAccelStepper wants steps/sec^2.
+        settings.accelSteps[i] = settings.acceleration[i] * settings.stepsPerMM[i];
+    }
+    motionRequest(MOTION_CMD_SETTINGS);
+}
+
+//Differential-drive kinematics. Every track move is a distance along the centre line plus a change of heading: the
+//tracks travel distance +/- turn * $140 / 2, so the tank follows a circular arc - a straight line when turn is 0 and a
+//spin in place when distance is 0. Step signs match the jog directions: forward is negative steps on both tracks and a
+//counter-clockwise turn (direction 4) runs the left track forward and the right track back.
+
+//Plan distance mm along the centre line while the heading changes by turn radians (counter-clockwise positive), with
+//Z moving dz mm alongside. feed is the centre line speed in mm/min - the track speed for a spin - and 0 means as fast as
+//the axes allow. Every axis gets a rate in proportion to its steps so they all start and finish together.
+//carry, when not NULL, is the travel in mm (left, right, z) earlier segments were rounded short by. It goes into this
+//segment's steps and is left holding what this one is short by, so a run of segments adds up to its exact length.
+//Returns false when the move is too small to take a step - its travel then stays in carry.
+bool kinematicsPlan(float distance, float turn, float dz, float feed, MotionSegment &segment, float *carry){
+    float halfTurn = turn * settings.trackWidth / 2;
+    float leftMM = distance + halfTurn;
+    float rightMM = distance - halfTurn;
+    float exact[3] = {leftMM, rightMM, dz};
+    for (uint8_t i = 0; carry && i < 3; i++) {
+        exact[i] += carry[i];
+    }
+    segment.leftSteps = -lround(exact[0] * settings.stepsPerMM[0]);
+    segment.rightSteps = -lround(exact[1] * settings.stepsPerMM[1]);
+    segment.zSteps = lround(exact[2] * settings.stepsPerMM[2]);
+    if (carry) {
+        carry[0] = exact[0] + segment.leftSteps / settings.stepsPerMM[0];
+        carry[1] = exact[1] + segment.rightSteps / settings.stepsPerMM[1];
+        carry[2] = exact[2] - segment.zSteps / settings.stepsPerMM[2];
+    }
+    if (segment.leftSteps == 0 && segment.rightSteps == 0 && segment.zSteps == 0) {
+        segment.leftHz = segment.rightHz = segment.zHz = 0;
+        return false;
+    }
+
+    //Time in minutes - the programmed feed unless an axis would pass its own maximum rate.
+    float pathMM = distance != 0 ? fabsf(distance) : max(fabsf(exact[0]), fabsf(exact[1]));
+    float minutes = max(fabsf(exact[0]) / settings.maxRate[0], fabsf(exact[1]) / settings.maxRate[1]);
+    minutes = max(minutes, fabsf(exact[2]) / settings.maxRate[2]);
+    if (feed > 0) {
+        minutes = max(minutes, sqrtf(pathMM * pathMM + dz * dz) / feed);
+    }
+    float seconds = minutes * 60;
+    segment.leftHz = segment.leftSteps ? max(1L, lround(abs(segment.leftSteps) / seconds)) : 0;
+    segment.rightHz = segment.rightSteps ? max(1L, lround(abs(segment.rightSteps) / seconds)) : 0;
+    segment.zHz = segment.zSteps ? max(1L, lround(abs(segment.zSteps) / seconds)) : 0;
+    segment.laserPower = 0;
+    segment.laserDynamic = false;
+    return true;
+}
+
+//Body velocities held for a time: v in mm/min along the centre line, omega in degrees/sec counter-clockwise.
+bool kinematicsVelocity(float v, float omega, float seconds, MotionSegment &segment){
+    float turn = omega * DEG_TO_RAD * seconds;
+    float feed = v != 0 ? fabsf(v) : fabsf(omega * DEG_TO_RAD) * settings.trackWidth / 2 * 60;
+    return kinematicsPlan(v / 60 * seconds, turn, 0, feed, segment, NULL);
+}
+
+//Convert a jog pad move (direction code, mm/min, mm) into a motion segment. step and speed apply to the outer track;
+//the curves run the inner track at half of it. Returns false for an unknown direction, a speed that is not positive or
+//a move too small to take a step.
+bool planTrackSegment(int direction, float speed, float step, MotionSegment &segment){
+    if (speed <= 0) {
+        return false;
+    }
+    float distance;
+    float turn;
+    switch (direction) {
+        case 0: distance = step; turn = 0; break;                                    // forward
+        case 1: distance = -step; turn = 0; break;                                   // backward
+        case 2: distance = 0.75 * step; turn = step / (2 * settings.trackWidth); break;   // forwardLeft
+        case 3: distance = 0.75 * step; turn = -step / (2 * settings.trackWidth); break;  // forwardRight
+        case 4: distance = 0; turn = 2 * step / settings.trackWidth; break;          // turnLeft - spin in place
+        case 5: distance = 0; turn = -2 * step / settings.trackWidth; break;         // turnRight - spin in place
+        case 6: distance = -0.75 * step; turn = -step / (2 * settings.trackWidth); break; // backwardLeft - retraces forwardLeft
+        case 7: distance = -0.75 * step; turn = step / (2 * settings.trackWidth); break;  // backwardRight - retraces forwardRight
+        default:
+            return false;
+    }
+    //Centre line speed that puts the outer track at the requested speed.
+    float feed = distance != 0 ? speed * fabsf(distance) / fabsf(step) : speed;
+    return kinematicsPlan(distance, turn, 0, feed, segment, NULL);
+}
+
+//Turn one control request into a track segment. Three forms, speeds in mm/min:
+//  {"direction":0-7,"speed":500,"step":10}         - jog pad moves, see planTrackSegment()
+//  {"distance":10,"turn":90,"speed":500}           - arc of distance mm along the centre line turning turn degrees
+//  {"v":500,"omega":15,"duration":2}               - body velocities (mm/min, degrees/sec) held for duration seconds
+//Returns an error message, or NULL once the segment is planned.
+const char* planControlSegment(JsonObject request, MotionSegment &segment){
+    if (request.containsKey("v") || request.containsKey("omega")) {
+        float duration = request["duration"] | 0.0;
+        if (duration <= 0) {
+            return "Missing required parameter: duration";
+        }
+        if (!kinematicsVelocity(request["v"] | 0.0, request["omega"] | 0.0, duration, segment)) {
+            return "Move is shorter than one step";
+        }
+        return NULL;
+    }
+    if (request.containsKey("distance") || request.containsKey("turn")) {
+        float speed = request["speed"] | 0.0;
+        if (speed <= 0) {
+            return "Missing required parameter: speed";
+        }
+        if (!kinematicsPlan(request["distance"] | 0.0, (request["turn"] | 0.0) * DEG_TO_RAD, 0, speed, segment, NULL)) {
+            return "Move is shorter than one step";
+        }
+        return NULL;
+    }
+    float speed = request["speed"] | 0.0;
+    float step = request["step"] | 0.0;
+    if (speed <= 0 || step == 0) {
+        return "Missing required parameters ESP32";
+    }
+    int direction = request["direction"] | -1;
+    if (direction < 0 || direction > 7) {
+        return "Invalid direction";
+    }
+    if (!planTrackSegment(direction, speed, step, segment)) {
+        return "Move is shorter than one step";
+    }
+    return NULL;
+}
+
+//Convert a Z move (mm/min, mm) into a motion segment. Returns false for a speed that is not positive or a move too
+//small to take a step.
+bool planZSegment(float speed, float step, MotionSegment &segment){
+    if (speed <= 0) {
+        return false;
+    }
+    //Enforce maximum speed.
+    if(speed > settings.maxRate[2]){
+      speed = settings.maxRate[2];
+    }
+    segment.leftSteps = segment.rightSteps = 0;
+    segment.leftHz = segment.rightHz = 0;
+    //Determine the step rate and the actual number of steps required.
+    segment.zHz = round(speed * settings.hzPerMMPerMin[2]);
+    segment.zSteps = round(step * settings.stepsPerMM[2]);
+    segment.laserPower = 0;
+    segment.laserDynamic = false;
+    return segment.zSteps != 0;
+}
+
+//TODO Function Needs to receive commands from the console and execute them. Expected to turn the robot in the direction specified by the command.
+//Moves are queued and executed by the motion task, so this returns as soon as the segment is accepted.
+void handleControl() {
+    StaticJsonDocument<200> doc;
+    if (!readJsonBody(doc)) {
+        return;
+    }
+
+    MotionSegment segment;
+    const char* planError = planControlSegment(doc.as<JsonObject>(), segment);
+    if (planError) {
+        StaticJsonDocument<200> response;
+        response["error"] = planError;
+        sendJson(400, response);
+        return;
+    }
+
+    if (envelopeCheck(&segment, 1) != -1) {
+        server.send(400, "application/json", "{\"error\": \"Move exceeds soft limits\"}");
+        return;
+    }
+
+    // Queue movement
+    if (motionQueuePush(segment)) {
+        StaticJsonDocument<200> response;
+        response["status"] = "success";
+        if (doc.containsKey("direction")) {
+            response["direction"] = doc["direction"];
+        }
+        response["speed"] = max(segment.leftHz, segment.rightHz);
+        response["step"] = abs(segment.leftSteps) > abs(segment.rightSteps) ? abs(segment.leftSteps) : abs(segment.rightSteps);
+        response["queued"] = motionQueueCount();
+        
+        sendJson(200, response);
+    } else {
+        server.send(503, "application/json", "{\"error\": \"Motion queue full\"}");
+    }
+}
+
+void handleSpindleZDepth() {
+    StaticJsonDocument<200> doc;
+    if (!readJsonBody(doc)) {
+        return;
+    }
+    
+    float speed = doc["speed"];
+    float step = doc["step"];
+    
+    if (speed == 0 || step == 0) {
+        server.send(400, "application/json", "{\"error\": \"Missing keys\"}");
+        return;
+    }
+    
+    MotionSegment segment;
+    if (!planZSegment(speed, step, segment)) {
+        server.send(400, "application/json", "{\"error\": \"Invalid speed or step\"}");
+        return;
+    }
+
+    //Enforce soft limits if enabled - against where Z will be once everything queued has run.
+    if (envelopeCheck(&segment, 1) != -1) {
+        server.send(400, "application/json", "{\"error\": \"Z depth exceeds maximum travel\"}");
+        return;
+    }
+
+    //Queue the move - the motion task runs it once everything ahead of it has finished.
+    if (!motionQueuePush(segment)) {
+        server.send(503, "application/json", "{\"error\": \"Motion queue full\"}");
+        return;
+    }
+
+    StaticJsonDocument<200> response;
+    response["status"] = "success";
+    response["queued"] = motionQueueCount();
+    
+    sendJson(200, response);
+}
+
+//Accepts many segments in one request so a job does not stall on a round-trip per move.
+//Body: {"segments":[{"direction":0,"speed":500,"step":10},{"axis":"z","speed":200,"step":-1}, ...]}
+//Track entries take any of the forms planControlSegment() understands.
+//The whole batch is validated first and queued all-or-nothing.
+void handleControlBatch() {
+    //Static so a full batch document stays off the heap and off the network task's stack.
+    static StaticJsonDocument<batchJsonCapacity> doc;
+    if (!readJsonBody(doc)) {
+        return;
+    }
+
+    JsonArray segments = doc["segments"];
+    if (segments.isNull() || segments.size() == 0) {
+        server.send(400, "application/json", "{\"error\": \"Missing required parameter: segments\"}");
+        return;
+    }
+
+    if (segments.size() > motionQueueFree()) {
+        StaticJsonDocument<200> response;
+        response["error"] = "Motion queue full";
+        response["free"] = motionQueueFree();
+
+        sendJson(503, response);
+        return;
+    }
+
+    //Plan every segment before touching the queue so a bad entry rejects the whole batch.
+    MotionSegment planned[motionQueueSize];
+    uint16_t count = 0;
+    for (JsonObject item : segments) {
+        const char* axis = item["axis"] | "xy";
+        if (strcmp(axis, "z") == 0) {
+            float speed = item["speed"];
+            float step = item["step"];
+            if (speed == 0 || step == 0) {
+                server.send(400, "application/json", "{\"error\": \"Segment missing speed or step\"}");
+                return;
+            }
+            if (!planZSegment(speed, step, planned[count])) {
+                StaticJsonDocument<200> response;
+                response["error"] = "Invalid speed or step";
+                response["index"] = count;
+                sendJson(400, response);
+                return;
+            }
+        } else {
+            const char* planError = planControlSegment(item, planned[count]);
+            if (planError) {
+                StaticJsonDocument<200> response;
+                response["error"] = planError;
+                response["index"] = count;
+                sendJson(400, response);
+                return;
+            }
+        }
+        count++;
+    }
+
+    int16_t outside = envelopeCheck(planned, count);
+    if (outside != -1) {
+        StaticJsonDocument<200> response;
+        response["error"] = "Segment exceeds soft limits";
+        response["index"] = outside;
+        sendJson(400, response);
+        return;
+    }
+
+    for (uint16_t i = 0; i < count; i++) {
+        motionQueuePush(planned[i]);
+    }
+
+    StaticJsonDocument<200> response;
+    response["status"] = "success";
+    response["accepted"] = count;
+    response["queued"] = motionQueueCount();
+    response["free"] = motionQueueFree();
+
+    sendJson(200, response);
+}
+
+//Lets the server know whether the machine is still working through queued moves or homing.
+void handleBusy() {
+    StaticJsonDocument<200> response;
+    response["busy"] = motionBusy();
+    response["state"] = motionStateName();
+    response["queued"] = motionQueueCount();
+    response["free"] = motionQueueFree();
+    response["completed"] = segmentsCompleted;
+    response["homed"] = zHomed;
+    response["feed_override"] = __atomic_load_n(&feedOverride, __ATOMIC_ACQUIRE);
+    response["spindle_override"] = spindleOverride;
+
+    sendJson(200, response);
+}
+
+void handleHoming() {
+    StaticJsonDocument<200> response;
+
+    //Homing owns the Z axis - refuse while anything else is moving.
+    if (motionState != MOTION_IDLE || motionQueueCount() > 0) {
+        server.send(409, "application/json", "{\"error\": \"Machine is busy\"}");
+        return;
+    }
+
+    // Send initial status
+    sendConsoleMessage("info", "Starting Z-axis homing sequence...");
+
+    // Hand zHoming to the motion task. Failures and completion are reported through /api/status/busy and the console.
+    if (!motionRequest(MOTION_CMD_HOME)) {
+        response["error"] = "Motion task is not accepting commands";
+        sendJson(503, response);
+        return;
+    }
+
+    // Started response
+    response["status"] = "started";
+    response["message"] = "Z-axis homing started";
+    
+    sendJson(200, response);
+}
+
+//Continuous jog, speeds in mm/min:
+//  {"direction":0-7,"speed":500} - start the jog or change it; repeat every jogKeepaliveMs to keep it going
+//  {"stop":true} or speed 0      - ramp the tracks down
+//The tracks ramp down by themselves when no request arrives for jogTimeoutMs.
+void handleJog() {
+    StaticJsonDocument<200> doc;
+    if (!readJsonBody(doc)) {
+        return;
+    }
+
+    float speed = (doc["stop"] | false) ? 0 : (doc["speed"] | 0.0);
+    int direction = doc["direction"] | -1;
+    if (speed < 0 || (speed > 0 && (direction < 0 || direction > 7))) {
+        server.send(400, "application/json", "{\"error\": \"Invalid direction or speed\"}");
+        return;
+    }
+    if (!jogRequest(direction, speed)) {
+        server.send(409, "application/json", "{\"error\": \"Machine is busy\"}");
+        return;
+    }
+
+    StaticJsonDocument<200> response;
+    response["status"] = speed > 0 ? "jogging" : "stopping";
+    response["keepalive"] = jogKeepaliveMs;
+    response["timeout"] = jogTimeoutMs;
+
+    sendJson(200, response);
+}
+
+//Dead-reckoned pose from the track steps: x and y in mm, heading in degrees counter-clockwise from X+.
+void sendPose(const int32_t *pose) {
+    StaticJsonDocument<200> response;
+    response["x"] = pose[0] / 1000.0;
+    response["y"] = pose[1] / 1000.0;
+    response["heading"] = (uint32_t)pose[2] * (360.0 / 4294967296.0);
+
+    sendJson(200, response);
+}
+
+void handlePose() {
+    int32_t pose[3];
+    odometryRead(pose);
+    sendPose(pose);
+}
+
+//Set the pose, e.g. after the tank has been placed on the stock. Anything left out keeps its value.
+void handlePoseUpdate() {
+    StaticJsonDocument<200> doc;
+    if (!readJsonBody(doc)) {
+        return;
+    }
+    if (!doc.containsKey("x") && !doc.containsKey("y") && !doc.containsKey("heading")) {
+        server.send(400, "application/json", "{\"error\": \"Missing required parameter: x, y or heading\"}");
+        return;
+    }
+
+    int32_t pose[3];
+    odometryRead(pose);
+    if (doc.containsKey("x")) {
+        pose[0] = lround(constrain(doc["x"].as<double>(), -2000000.0, 2000000.0) * 1000);
+    }
+    if (doc.containsKey("y")) {
+        pose[1] = lround(constrain(doc["y"].as<double>(), -2000000.0, 2000000.0) * 1000);
+    }
+    if (doc.containsKey("heading")) {
+        double turns = doc["heading"].as<double>() / 360.0;
+        pose[2] = (int32_t)(uint32_t)llround((turns - floor(turns)) * 4294967296.0);
+    }
+    odometrySet(pose);
+    sendPose(pose);
+}
+
+//Z probing cycle: {"distance": mm, signed like Z moves, "feed": seek mm/min - $25 if left out}. The contact is found
+//again at $24 after backing off $27. Poll GET /api/status/probe for the result.
+void handleProbe() {
+    StaticJsonDocument<200> doc;
+    if (!readJsonBody(doc)) {
+        return;
+    }
+
+    float distance = doc["distance"] | 0.0;
+    float feed = doc["feed"] | settings.homingSeek;
+    if (distance == 0 || feed <= 0) {
+        server.send(400, "application/json", "{\"error\": \"Invalid distance or feed\"}");
+        return;
+    }
+    if (!envelopeZWithin(distance)) {
+        server.send(400, "application/json", "{\"error\": \"Probe travel exceeds soft limits\"}");
+        return;
+    }
+    if (!probeCycleStart(distance, feed)) {
+        server.send(409, "application/json", "{\"error\": \"Machine is busy\"}");
+        return;
+    }
+
+    StaticJsonDocument<200> response;
+    response["status"] = "started";
+
+    sendJson(200, response);
+}
+
+//Result of the last probing cycle - z is the contact in mm from Z zero.
+void handleProbeStatus() {
+    StaticJsonDocument<200> response;
+    uint8_t state = __atomic_load_n(&probeState, __ATOMIC_ACQUIRE);
+    switch (state) {
+        case PROBE_RUNNING: response["state"] = "probing"; break;
+        case PROBE_DONE: response["state"] = "done"; break;
+        case PROBE_FAILED: response["state"] = "failed"; break;
+        default: response["state"] = "idle"; break;
+    }
+    if (state == PROBE_DONE) {
+        response["z"] = probePosition / settings.stepsPerMM[2];
+        response["steps"] = probePosition;
+    }
+
+    sendJson(200, response);
+}
+
+//Grid probing for the height map: {"x", "y": first point, "width", "height": grid size in mm, "columns", "rows": points
+//along X and Y, 2-16, "distance": probe travel from the current Z in mm, signed like Z moves, "feed": seek mm/min - $25
+//if left out}. All in G-code coordinates. Poll GET /api/status/leveling for progress.
+void handleLevelingProbe() {
+    StaticJsonDocument<256> doc;
+    if (!readJsonBody(doc)) {
+        return;
+    }
+
+    HeightMap grid;
+    grid.x0 = doc["x"] | 0.0;
+    grid.y0 = doc["y"] | 0.0;
+    grid.nx = constrain(doc["columns"] | 0, 0, 255);
+    grid.ny = constrain(doc["rows"] | 0, 0, 255);
+    grid.dx = grid.nx > 1 ? (doc["width"] | 0.0) / (grid.nx - 1) : 0;
+    grid.dy = grid.ny > 1 ? (doc["height"] | 0.0) / (grid.ny - 1) : 0;
+    float distance = doc["distance"] | 0.0;
+    float feed = doc["feed"] | settings.homingSeek;
+    if (!heightMapCheck(grid)) {
+        server.send(400, "application/json", "{\"error\": \"Invalid grid\"}");
+        return;
+    }
+    if (distance == 0 || feed <= 0) {
+        server.send(400, "application/json", "{\"error\": \"Invalid distance or feed\"}");
+        return;
+    }
+    //Every corner of the grid at the bottom of the probe travel.
+    for (uint8_t corner = 0; corner < 4; corner++) {
+        float point[3] = {grid.x0 + (corner & 1) * grid.dx * (grid.nx - 1), grid.y0 + (corner >> 1) * grid.dy * (grid.ny - 1),
+                          gcodePosition[2] + distance};
+        if (!gcodeWithinTravel(point, NULL, 0)) {
+            server.send(400, "application/json", "{\"error\": \"Grid exceeds soft limits\"}");
+            return;
+        }
+    }
+    if (!levelingBegin(grid, distance, feed)) {
+        server.send(409, "application/json", "{\"error\": \"Machine is busy\"}");
+        return;
+    }
+
+    StaticJsonDocument<200> response;
+    response["status"] = "started";
+
+    sendJson(200, response);
+}
+
+//Grid probing progress and the height map - z holds the offsets in mm, row by row from y, relative to the first point.
+void handleLeveling() {
+    static StaticJsonDocument<levelingJsonCapacity> response;
+    response.clear();
+    switch (levelingState) {
+        case LEVELING_RUNNING: response["state"] = "probing"; break;
+        case LEVELING_DONE: response["state"] = "done"; break;
+        case LEVELING_FAILED: response["state"] = "failed"; break;
+        default: response["state"] = "idle"; break;
+    }
+    response["enabled"] = heightMapEnabled;
+    if (levelingState == LEVELING_RUNNING) {
+        response["point"] = levelingPoint;
+        response["points"] = levelingMap.nx * levelingMap.ny;
+    }
+    if (heightMapValid) {
+        response["x"] = heightMap.x0;
+        response["y"] = heightMap.y0;
+        response["width"] = heightMap.dx * (heightMap.nx - 1);
+        response["height"] = heightMap.dy * (heightMap.ny - 1);
+        response["columns"] = heightMap.nx;
+        response["rows"] = heightMap.ny;
+        JsonArray z = response.createNestedArray("z");
+        for (uint16_t i = 0; i < heightMap.nx * heightMap.ny; i++) {
+            z.add(roundf(heightMap.z[i] * 1000) / 1000);
+        }
+    }
+
+    sendJson(200, response);
+}
+
+//Switch compensation on or off: {"enabled": true|false}. Takes effect from the next G-code move.
+void handleLevelingUpdate() {
+    StaticJsonDocument<200> doc;
+    if (!readJsonBody(doc)) {
+        return;
+    }
+
+    if (!doc.containsKey("enabled")) {
+        server.send(400, "application/json", "{\"error\": \"Missing required parameter: enabled\"}");
+        return;
+    }
+    bool enabled = doc["enabled"];
+    if (enabled && !heightMapValid) {
+        server.send(409, "application/json", "{\"error\": \"No height map - probe one first\"}");
+        return;
+    }
+    heightMapEnabled = enabled;
+    myPrgVar.begin("leveling", false);
+    myPrgVar.putBool("enabled", heightMapEnabled);
+    myPrgVar.end();
+
+    StaticJsonDocument<200> response;
+    response["enabled"] = heightMapEnabled;
+
+    sendJson(200, response);
+}
+
+//Emergency stop - halts every axis immediately and throws away anything still queued.
+void handleEstop() {
+    gcodeArc.active = false;
+    levelingStop();
+    motionRequestStop();
+
+    StaticJsonDocument<200> response;
+    response["status"] = "stopped";
+
+    sendJson(200, response);
+
+    sendConsoleMessage("warning", "Emergency stop - motion halted and queue cleared");
+}
+
+//Motion queue helpers. Push runs on the network task; plan and pop run on the motion task. Count and free are safe
+//from either side.
+uint16_t motionQueueCount(){
+    uint16_t head = __atomic_load_n(&motionQueueHead, __ATOMIC_ACQUIRE);
+    uint16_t tail = __atomic_load_n(&motionQueueTail, __ATOMIC_ACQUIRE);
+    return (uint16_t)(head - tail) & (motionQueueSize - 1);
+}
+
+//One slot is kept empty to tell a full queue from an empty one.
+uint16_t motionQueueFree(){
+    return (motionQueueSize - 1) - motionQueueCount();
+}
+
+bool motionQueuePush(const MotionSegment &segment){
+    if (motionQueueFree() == 0) {
+        return false;
+    }
+    envelopeSync();
+    envelopeStep(envelopePose, segment, NULL);
+    envelopeZ += segment.zSteps;
+    uint16_t head = motionQueueHead;
+    motionQueue[head] = segment;
+    __atomic_store_n(&motionQueueHead, (uint16_t)((head + 1) & (motionQueueSize - 1)), __ATOMIC_RELEASE);
+    if (motionTaskHandle) xTaskNotifyGive(motionTaskHandle);
+    return true;
+}
+
+//Take the position back from the machine while nothing is queued or moving. Network task only.
+void envelopeSync(){
+    if (motionBusy()) {
+        return;
+    }
+    int32_t pose[3];
+    odometryRead(pose);
+    envelopePose[0] = pose[0] / 1000.0;
+    envelopePose[1] = pose[1] / 1000.0;
+    envelopePose[2] = (uint32_t)pose[2] * (2 * PI / 4294967296.0);
+    envelopeZ = zStepper->getCurrentPosition();
+}
+
+//Move pose (x, y mm, heading radians) to the end of segment. With box (min x, min y, max x, max y) it is widened to
+//take in the whole path - the end point and, for an arc, wherever it passes the far side of its circle.
+void envelopeStep(float *pose, const MotionSegment &segment, float *box){
+    float leftMM = -segment.leftSteps / settings.stepsPerMM[0];
+    float rightMM = -segment.rightSteps / settings.stepsPerMM[1];
+    float distance = (leftMM + rightMM) / 2;
+    float turn = (leftMM - rightMM) / settings.trackWidth;
+    if (distance == 0) {
+        pose[2] += turn;
+    } else if (fabsf(turn) < 1e-6) {
+        pose[0] += distance * cosf(pose[2]);
+        pose[1] += distance * sinf(pose[2]);
+    } else {
+        float radius = distance / turn;
+        float center[2] = {pose[0] - radius * sinf(pose[2]), pose[1] + radius * cosf(pose[2])};
+        if (box) {
+            envelopeArcBox(center, pose, turn, box);
+        }
+        pose[2] += turn;
+        pose[0] = center[0] + radius * sinf(pose[2]);
+        pose[1] = center[1] - radius * cosf(pose[2]);
+    }
+    if (box) {
+        envelopeBoxAdd(box, pose[0], pose[1]);
+    }
+}
+
+void envelopeBoxAdd(float *box, float x, float y){
+    box[0] = min(box[0], x);
+    box[1] = min(box[1], y);
+    box[2] = max(box[2], x);
+    box[3] = max(box[3], y);
+}
+
+//Widen box to take in the arc from start around center through sweep radians (counter-clockwise positive). Its
+//extremes are where it crosses the axes through the center.
+void envelopeArcBox(const float *center, const float *start, float sweep, float *box){
+    float dx = start[0] - center[0];
+    float dy = start[1] - center[1];
+    float radius = sqrtf(dx * dx + dy * dy);
+    float from = atan2f(dy, dx) + min(sweep, 0.0f);
+    float to = from + fabsf(sweep);
+    //A full turn or more passes all four.
+    float quarter = ceilf(from / (PI / 2)) * (PI / 2);
+    for (uint8_t i = 0; i < 4 && quarter < to; i++, quarter += PI / 2) {
+        envelopeBoxAdd(box, center[0] + radius * cosf(quarter), center[1] + radius * sinf(quarter));
+    }
+}
+
+//Whether a path within box ending at Z z (steps) stays inside $130-$132. Only where a move goes is checked, never where
+//it starts, so a machine left outside can be driven straight back in.
+bool envelopeInside(const float *box, int32_t z){
+    bool inside = box[0] >= -envelopeToleranceMM && box[1] >= -envelopeToleranceMM &&
+                  box[2] <= settings.maxTravel[0] + envelopeToleranceMM && box[3] <= settings.maxTravel[1] + envelopeToleranceMM;
+    if (zHomed) {
+        inside = inside && z >= 0 && z <= lround(settings.maxTravel[2] * settings.stepsPerMM[2]);
+    }
+    return inside;
+}
+
+//Check a run of segments as if queued after everything already queued. Returns the index of the first one that would
+//leave the travel envelope, or -1 when they all stay inside or soft limits are off. The whole run is walked first and
+//then checked in one pass, so a job with a bad move anywhere is refused before any of it is queued. Network task only.
+int16_t envelopeCheck(const MotionSegment *segments, uint16_t count){
+    if (!settings.softLimits) {
+        return -1;
+    }
+    envelopeSync();
+    //Static - a full batch of boxes stays off the network task's stack.
+    static float boxes[motionQueueSize][4];
+    static int32_t zEnd[motionQueueSize];
+    count = min(count, (uint16_t)motionQueueSize);
+    float pose[3] = {envelopePose[0], envelopePose[1], envelopePose[2]};
+    int32_t z = envelopeZ;
+    for (uint16_t i = 0; i < count; i++) {
+        boxes[i][0] = boxes[i][1] = INFINITY;
+        boxes[i][2] = boxes[i][3] = -INFINITY;
+        envelopeStep(pose, segments[i], boxes[i]);
+        z += segments[i].zSteps;
+        zEnd[i] = z;
+    }
+    for (uint16_t i = 0; i < count; i++) {
+        if (!envelopeInside(boxes[i], zEnd[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//Whether Z can move dz mm from where the queued moves end without leaving $132. Network task only.
+bool envelopeZWithin(float dz){
+    if (!settings.softLimits) {
+        return true;
+    }
+    envelopeSync();
+    float box[4] = {INFINITY, INFINITY, -INFINITY, -INFINITY};
+    return envelopeInside(box, envelopeZ + lround(dz * settings.stepsPerMM[2]));
+}
+
+//Only segments the planner has already seen are handed out.
+bool motionQueuePop(MotionSegment &segment){
+    if (motionQueueTail == motionQueuePlanned) {
+        return false;
+    }
+    segment = motionQueue[motionQueueTail];
+    __atomic_store_n(&motionQueueTail, (uint16_t)((motionQueueTail + 1) & (motionQueueSize - 1)), __ATOMIC_RELEASE);
+    return true;
+}
+
+//Segments planned and waiting to run. Motion task only.
+uint16_t motionQueuePlannedCount(){
+    return (uint16_t)(motionQueuePlanned - motionQueueTail) & (motionQueueSize - 1);
+}
+
+//Queue a request for the motion task and wake it. Network task only.
+bool motionRequest(MotionCommand command){
+    uint8_t head = motionCommandHead;
+    uint8_t next = (head + 1) & (motionCommandSize - 1);
+    if (next == __atomic_load_n(&motionCommandTail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    motionCommands[head] = command;
+    __atomic_store_n(&motionCommandHead, next, __ATOMIC_RELEASE);
+    if (motionTaskHandle) xTaskNotifyGive(motionTaskHandle);
+    return true;
+}
+
+//E-stop from any task. The motion task picks it up before anything else on its next pass.
+void motionRequestStop(){
+    __atomic_store_n(&motionStopRequest, true, __ATOMIC_RELEASE);
+    if (motionTaskHandle) xTaskNotifyGive(motionTaskHandle);
+}
+
+//Run whatever the network task has asked for. Motion task only.
+void motionCommandService(){
+    if (__atomic_exchange_n(&motionStopRequest, false, __ATOMIC_ACQ_REL)) {
+        motionStop();
+    }
+    uint8_t head = __atomic_load_n(&motionCommandHead, __ATOMIC_ACQUIRE);
+    while (motionCommandTail != head) {
+        switch (motionCommands[motionCommandTail]) {
+            case MOTION_CMD_HOME:
+                //Homing owns the Z axis - anything queued since the request was accepted wins.
+                if (motionState != MOTION_IDLE || motionQueueCount() > 0 || !zHoming()) {
+                    motionEvent(EVENT_HOMING_FAILED);
+                }
+                break;
+            case MOTION_CMD_SETTINGS:
+                odometryScale();
+                leftStepper->setAcceleration(settings.accelSteps[0]);
+                rightStepper->setAcceleration(settings.accelSteps[1]);
+                zStepper->setAcceleration(settings.accelSteps[2]);
+                break;
+            case MOTION_CMD_HOLD:
+                motionHold();
+                break;
+            case MOTION_CMD_RESUME:
+                holdResume = motionState == MOTION_HOLD;
+                break;
+            case MOTION_CMD_PROBE:
+                probeBegin();
+                break;
+        }
+        __atomic_store_n(&motionCommandTail, (uint8_t)((motionCommandTail + 1) & (motionCommandSize - 1)), __ATOMIC_RELEASE);
+    }
+    uint8_t feed = __atomic_load_n(&feedOverride, __ATOMIC_ACQUIRE);
+    if (feed != feedOverrideApplied) {
+        feedOverrideApplied = feed;
+        if (motionState == MOTION_RUNNING) {
+            stepperApplyFeed(activeSegment);
+        }
+    }
+}
+
+//Plan every segment the network task has published since the last pass, then rerun look-ahead. Motion task only.
+void plannerService(){
+    uint16_t head = __atomic_load_n(&motionQueueHead, __ATOMIC_ACQUIRE);
+    if (motionQueuePlanned == head) {
+        return;
+    }
+    while (motionQueuePlanned != head) {
+        plannerPrepare(motionQueue[motionQueuePlanned]);
+        motionQueuePlanned = (motionQueuePlanned + 1) & (motionQueueSize - 1);
+    }
+    plannerRecalculate();
+}
+
+//Fill in a segment's planner data and its junction limit against the segment queued before it (GRBL junction deviation).
+void plannerPrepare(MotionSegment &segment){
+    int32_t steps[3] = {segment.leftSteps, segment.rightSteps, segment.zSteps};
+    uint32_t rates[3] = {segment.leftHz, segment.rightHz, segment.zHz};
+    float delta[3];
+    float lengthSqr = 0;
+    float duration = 0;
+    segment.leadAxis = 0;
+    for (uint8_t i = 0; i < 3; i++) {
+        delta[i] = steps[i] / settings.stepsPerMM[i];
+        lengthSqr += delta[i] * delta[i];
+        if (abs(steps[i]) > abs(steps[segment.leadAxis])) {
+            segment.leadAxis = i;
+        }
+        //The move lasts as long as its slowest axis.
+        if (steps[i] != 0 && rates[i] > 0) {
+            duration = max(duration, (float)abs(steps[i]) / rates[i]);
+        }
+    }
+    segment.lengthMM = sqrt(lengthSqr);
+    segment.nominalSpeed = duration > 0 ? segment.lengthMM / duration : 0;
+    segment.entrySpeedSqr = 0;
+    segment.maxEntrySpeedSqr = 0;
+    segment.acceleration = 0;
+    if (segment.lengthMM == 0) {
+        return;
+    }
+
+    //Acceleration along the move is capped by whichever axis reaches its own limit first.
+    float unit[3];
+    float accel = 1e9;
+    for (uint8_t i = 0; i < 3; i++) {
+        unit[i] = delta[i] / segment.lengthMM;
+        if (unit[i] != 0) {
+            accel = min(accel, settings.acceleration[i] / fabsf(unit[i]));
+        }
+    }
+    segment.acceleration = accel;
+
+    //Starting from rest there is no junction to carry speed through.
+    if ((motionState == MOTION_IDLE || motionState == MOTION_JOGGING) && motionQueuePlannedCount() == 0) {
+        plannerPrevNominal = 0;
+    }
+
+    //Junction speed from the angle between this move and the previous one.
+    float cosTheta = -(plannerPrevUnit[0] * unit[0] + plannerPrevUnit[1] * unit[1] + plannerPrevUnit[2] * unit[2]);
+    float junctionSpeedSqr;
+    if (plannerPrevNominal == 0 || cosTheta > 0.999999) {
+        //Full reversal or first move - come to a stop.
+        junctionSpeedSqr = minimumJunctionSpeed * minimumJunctionSpeed;
+    } else if (cosTheta < -0.999999) {
+        //Straight through - only the nominal speeds limit it.
+        junctionSpeedSqr = 1e9;
+    } else {
+        float sinThetaD2 = sqrt(0.5 * (1.0 - cosTheta));
+        junctionSpeedSqr = max(minimumJunctionSpeed * minimumJunctionSpeed,
+                               (accel * settings.junctionDeviation * sinThetaD2) / (1.0 - sinThetaD2));
+    }
+    float nominalLimit = min(segment.nominalSpeed, plannerPrevNominal);
+    segment.maxEntrySpeedSqr = min(junctionSpeedSqr, nominalLimit * nominalLimit);
+
+    for (uint8_t i = 0; i < 3; i++) {
+        plannerPrevUnit[i] = unit[i];
+    }
+    plannerPrevNominal = segment.nominalSpeed;
+}
+
+//Backward then forward pass over the queue so every entry speed can still be reached and stopped from.
+//The last queued segment always plans to end at rest.
+void plannerRecalculate(){
+    uint16_t count = motionQueuePlannedCount();
+    if (count == 0) {
+        return;
+    }
+    //Backward pass - newest to oldest.
+    uint16_t index = (motionQueuePlanned - 1) & (motionQueueSize - 1);
+    float exitSpeedSqr = 0;
+    for (uint16_t n = 0; n < count; n++) {
+        MotionSegment &segment = motionQueue[index];
+        segment.entrySpeedSqr = min(segment.maxEntrySpeedSqr, exitSpeedSqr + 2 * segment.acceleration * segment.lengthMM);
+        exitSpeedSqr = segment.entrySpeedSqr;
+        index = (index - 1) & (motionQueueSize - 1);
+    }
+    //Forward pass - oldest to newest. Limits each entry to what the previous segment can accelerate to.
+    index = motionQueueTail;
+    for (uint16_t n = 0; n + 1 < count; n++) {
+        MotionSegment &segment = motionQueue[index];
+        MotionSegment &next = motionQueue[(index + 1) & (motionQueueSize - 1)];
+        next.entrySpeedSqr = min(next.entrySpeedSqr, segment.entrySpeedSqr + 2 * segment.acceleration * segment.lengthMM);
+        index = (index + 1) & (motionQueueSize - 1);
+    }
+}
+
+//True once the active segment has slowed to the planned entry speed of the next one, so the next can be appended
+//without the steppers ever reaching zero. The lead axis decelerates towards its target at a known rate, so that
+//happens when the steps left equal the distance it needs to slow from the junction speed to rest.
+bool plannerReadyForNext(){
+    if (motionQueuePlannedCount() == 0 || activeSegment.lengthMM == 0) {
+        return false;
+    }
+    const MotionSegment &next = motionQueue[motionQueueTail];
+    if (next.entrySpeedSqr <= 0) {
+        return false;
+    }
+    FastAccelStepper *lead = activeSegment.leadAxis == 0 ? leftStepper : (activeSegment.leadAxis == 1 ? rightStepper : zStepper);
+    int32_t leadSteps = activeSegment.leadAxis == 0 ? activeSegment.leftSteps : (activeSegment.leadAxis == 1 ? activeSegment.rightSteps : activeSegment.zSteps);
+    float stepsPerMMAlongMove = abs(leadSteps) / activeSegment.lengthMM;
+    //The plan is for 100% feed - a lower override slows the junction with everything else.
+    float junctionSpeed = min(sqrtf(next.entrySpeedSqr),
+                              min(activeSegment.nominalSpeed, next.nominalSpeed) * feedOverrideApplied / 100);
+    float junctionHz = junctionSpeed * stepsPerMMAlongMove;
+    float leadAccel = activeSegment.acceleration * stepsPerMMAlongMove;
+    int32_t remaining = abs(lead->targetPos() - lead->getCurrentPosition());
+    return remaining <= (junctionHz * junctionHz) / (2 * leadAccel);
+}
+
+bool steppersRunning(){
+    return zStepper->isRunning() || leftStepper->isRunning() || rightStepper->isRunning();
+}
+
+//True while any stepper is still moving, homing is in progress, segments are waiting or the motion task has
+//requests it has not run yet.
+bool motionBusy(){
+    return motionState != MOTION_IDLE || motionQueueCount() > 0 ||
+           __atomic_load_n(&motionCommandHead, __ATOMIC_ACQUIRE) != __atomic_load_n(&motionCommandTail, __ATOMIC_ACQUIRE);
+}
+
+const char* motionStateName(){
+    switch (motionState) {
+        case MOTION_RUNNING: return "running";
+        case MOTION_HOMING: return "homing";
+        case MOTION_JOGGING: return "jogging";
+        case MOTION_HOLD: return "hold";
+        case MOTION_PROBING: return "probing";
+        default: return "idle";
+    }
+}
+
+//Single place where executor transitions are reported.
+void motionEvent(MotionEvent event){
+    switch (event) {
+        case EVENT_SEGMENT_DONE:
+            segmentsCompleted++;
+            break;
+        case EVENT_HOMING_DONE:
+            zHomed = true;
+            sendConsoleMessage("success", "Z-axis homing completed");
+            break;
+        case EVENT_HOMING_FAILED:
+            zHomed = false;
+            sendConsoleMessage("error", "Z-axis homing failed");
+            break;
+        case EVENT_PROBE_DONE:
+            break;
+        case EVENT_PROBE_FAILED:
+            sendConsoleMessage("warning", "Z probe made no contact");
+            break;
+        case EVENT_STOPPED:
+            break;
+    }
+}
+
+//Halt everything now and drop whatever is queued. Motion task only - other tasks call motionRequestStop().
+void motionStop(){
+    zStepper->forceStop();
+    leftStepper->forceStop();
+    rightStepper->forceStop();
+    motionQueuePlanned = __atomic_load_n(&motionQueueHead, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&motionQueueTail, motionQueuePlanned, __ATOMIC_RELEASE);
+    if (motionState == MOTION_HOMING) {
+        detachInterrupt(zEndStop);
+        homeStop = false;
+        homingPhase = HOMING_IDLE;
+        zHomed = false;
+    }
+    if (motionState == MOTION_PROBING) {
+        detachInterrupt(zProbe);
+        probePhase = PROBE_IDLE;
+        __atomic_store_n(&probeState, PROBE_FAILED, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&jogCommand, 0, __ATOMIC_RELEASE);
+    jogActive = 0;
+    holdResume = false;
+    activeSegment = MotionSegment();
+    activeHandedOver = false;
+    laserOff();
+    motionState = MOTION_IDLE;
+    motionEvent(EVENT_STOPPED);
+}
+
+//Called from every pass of the motion task. Never blocks - each call looks at where the machine is and moves it on one step.
+void motionService(){
+    laserSwitchService();
+    switch (motionState) {
+        case MOTION_HOMING:
+            homingService();
+            return;
+        case MOTION_PROBING:
+            probeService();
+            return;
+        case MOTION_JOGGING:
+            jogService();
+            return;
+        case MOTION_HOLD:
+            holdService();
+            return;
+        case MOTION_RUNNING:
+            //Hand the next segment over early when the planner allows a non-zero junction speed.
+            if (steppersRunning() && !plannerReadyForNext()) {
+                return;
+            }
+            motionState = MOTION_IDLE;
+            motionEvent(EVENT_SEGMENT_DONE);
+            previousSegment = activeSegment;
+            activeSegment = MotionSegment();
+            activeHandedOver = false;
+            //Fall through and start the next segment on this same pass.
+        case MOTION_IDLE:
+            if (motionQueuePop(activeSegment)) {
+                FastAccelStepper *axes[3] = {leftStepper, rightStepper, zStepper};
+                activeHandedOver = steppersRunning();
+                for (uint8_t i = 0; i < 3; i++) {
+                    activeStart[i] = axes[i]->isRunning() ? axes[i]->targetPos() : axes[i]->getCurrentPosition();
+                }
+                if (stepperController(activeSegment)) {
+                    motionState = MOTION_RUNNING;
+                } else {
+                    Serial.println("Segment rejected by stepper driver");
+                    motionEvent(EVENT_SEGMENT_DONE);
+                }
+            } else {
+                //Nothing left to cut - dark until the next segment starts.
+                laserOff();
+                if (__atomic_load_n(&jogCommand, __ATOMIC_ACQUIRE) != 0) {
+                    motionState = MOTION_JOGGING;
+                    jogActive = 0;
+                    jogService();
+                }
+            }
+            return;
+    }
+}
+
+//Feed hold. A running segment decelerates to a stop part way along - every axis slows in proportion, so it stops on
+//the programmed path - and nothing more is taken off the queue until cycle start. Jogs and homing are not held.
+//Motion task only.
+void motionHold(){
+    if (motionState != MOTION_RUNNING && motionState != MOTION_IDLE) {
+        return;
+    }
+    FastAccelStepper *axes[3] = {leftStepper, rightStepper, zStepper};
+    for (uint8_t i = 0; i < 3; i++) {
+        holdTargets[i] = axes[i]->isRunning() ? axes[i]->targetPos() : axes[i]->getCurrentPosition();
+        axes[i]->stopMove();
+    }
+    laserOff();
+    holdResume = false;
+    holdMidSegment = motionState == MOTION_RUNNING;
+    motionState = MOTION_HOLD;
+}
+
+//Wait out the hold. After cycle start, run what is left of the held segment from rest with its original rates, then
+//hand back to motionService() for the rest of the queue. A hold that stopped before the handover boundary first runs
+//the rest of the previous segment, still in the hold state, and comes back here for the active one once it stops.
+//A hold taken while idle only latches - cycle start goes straight back to the queue.
+void holdService(){
+    if (steppersRunning() || !holdResume) {
+        return;
+    }
+    holdResume = false;
+    if (!holdMidSegment) {
+        motionState = MOTION_IDLE;
+        return;
+    }
+    FastAccelStepper *axes[3] = {leftStepper, rightStepper, zStepper};
+    int32_t position[3];
+    for (uint8_t i = 0; i < 3; i++) {
+        position[i] = axes[i]->getCurrentPosition();
+    }
+    if (activeHandedOver) {
+        activeHandedOver = false;
+        MotionSegment rest = previousSegment;
+        if (holdRemainder(rest, activeStart, position) && stepperController(rest)) {
+            holdResume = true;
+            return;
+        }
+    }
+    motionState = MOTION_IDLE;
+    if (!holdRemainder(activeSegment, holdTargets, position)) {
+        //It finished while slowing down.
+        motionEvent(EVENT_SEGMENT_DONE);
+        return;
+    }
+    if (stepperController(activeSegment)) {
+        motionState = MOTION_RUNNING;
+    } else {
+        motionEvent(EVENT_SEGMENT_DONE);
+    }
+}
+
+//Cut segment down to what is left of it between position and targets. Axes already at or past their target in the
+//segment's own direction are left where they are. Returns false when nothing is left.
+bool holdRemainder(MotionSegment &segment, const int32_t *targets, const int32_t *position){
+    int32_t *steps[3] = {&segment.leftSteps, &segment.rightSteps, &segment.zSteps};
+    float fraction = 0;
+    bool left = false;
+    for (uint8_t i = 0; i < 3; i++) {
+        int32_t remaining = targets[i] - position[i];
+        if (*steps[i] == 0 ? remaining != 0 : remaining * *steps[i] < 0) {
+            remaining = 0;
+        }
+        if (*steps[i] != 0) {
+            fraction = max(fraction, (float)abs(remaining) / abs(*steps[i]));
+        }
+        *steps[i] = remaining;
+        left |= remaining != 0;
+    }
+    segment.lengthMM *= fraction;
+    return left;
+}
+
+//Start, change or keep alive a continuous jog. direction is a jog pad code (see planTrackSegment()) and speed the outer
+//track's speed in mm/min; speed 0 ramps the tracks to a stop. Network task only. Returns false when queued moves,
+//homing or a pending command have the tracks.
+bool jogRequest(int direction, float speed){
+    uint32_t command = 0;
+    if (speed > 0) {
+        command = (uint32_t)(direction + 1) | (uint32_t)min(lround(speed), 0xFFFFFFL) << 8;
+        if (motionState != MOTION_JOGGING && motionBusy()) {
+            return false;
+        }
+    }
+    //Time first, so the motion task never sees a new command with an old keepalive.
+    __atomic_store_n(&jogLastRequest, millis(), __ATOMIC_RELEASE);
+    __atomic_store_n(&jogCommand, command, __ATOMIC_RELEASE);
+    if (motionTaskHandle) xTaskNotifyGive(motionTaskHandle);
+    return true;
+}
+
+//Keep the tracks at the requested jog velocity and bring them to rest when the jog ends. Motion task only. A missed
+//keepalive is treated as a stop, so the tracks ramp down at their normal acceleration instead of halting dead.
+void jogService(){
+    uint32_t command = __atomic_load_n(&jogCommand, __ATOMIC_ACQUIRE);
+    if (command != 0 && millis() - __atomic_load_n(&jogLastRequest, __ATOMIC_ACQUIRE) > jogTimeoutMs) {
+        //Only clear the command that timed out - one that arrived since carries its own keepalive.
+        if (__atomic_compare_exchange_n(&jogCommand, &command, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            sendConsoleMessage("warning", "Jog keepalive missed - stopping");
+            command = 0;
+        }
+    }
+
+    if (command != jogActive) {
+        jogActive = command;
+        float leftHz = 0;
+        float rightHz = 0;
+        MotionSegment segment;
+        //A long move in the jog direction gives the rate of each track with the ratio of a curve intact.
+        if (command != 0 && planTrackSegment((int)(command & 0xFF) - 1, command >> 8, 100, segment)) {
+            leftHz = segment.leftSteps < 0 ? -(float)segment.leftHz : segment.leftHz;
+            rightHz = segment.rightSteps < 0 ? -(float)segment.rightHz : segment.rightHz;
+        }
+        jogSetVelocity(leftHz, rightHz);
+    }
+
+    if (jogActive == 0 && !leftStepper->isRunning() && !rightStepper->isRunning()) {
+        motionState = MOTION_IDLE;
+    }
+}
+
+//Ramp both tracks to signed step rates. Each track gets a share of the common acceleration in proportion to the change
+//it has to make, so both arrive together and a curve keeps its radius while it speeds up, slows down or reverses.
+//A rate of 0 ramps that track to a stop.
+void jogSetVelocity(float leftHz, float rightHz){
+    FastAccelStepper *tracks[2] = {leftStepper, rightStepper};
+    float target[2] = {leftHz, rightHz};
+    float change[2];
+    float largest = 0;
+    for (uint8_t i = 0; i < 2; i++) {
+        change[i] = fabsf(target[i] - tracks[i]->getCurrentSpeedInMilliHz() / 1000.0);
+        largest = max(largest, change[i]);
+    }
+    float accel = min(settings.accelSteps[0], settings.accelSteps[1]);
+    for (uint8_t i = 0; i < 2; i++) {
+        tracks[i]->setAcceleration(max(1L, lround(accel * (largest > 0 ? change[i] / largest : 1))));
+        if (target[i] == 0) {
+            tracks[i]->stopMove();
+            continue;
+        }
+        tracks[i]->setSpeedInMilliHz(lround(fabsf(target[i]) * 1000));
+        if (target[i] > 0) {
+            tracks[i]->runForward();
+        } else {
+            tracks[i]->runBackward();
+        }
+        tracks[i]->applySpeedAcceleration();
+    }
+}
+
+//Starts all three axes on a segment and returns straight away - motionService() watches for completion.
+//Moves are coordinated: the move lasts as long as its slowest axis needs, and every axis gets a rate and acceleration
+//in proportion to its steps, so all three ramp, cruise and stop together and the path comes out as commanded.
+//An axis with nothing to do keeps its previous settings.
+bool stepperController(const MotionSegment &segment){
+    FastAccelStepper *axes[3] = {leftStepper, rightStepper, zStepper};
+    int32_t steps[3] = {segment.leftSteps, segment.rightSteps, segment.zSteps};
+    float duration = segmentDuration(segment);
+    if (duration == 0 || segment.lengthMM == 0) {
+        return false;
+    }
+    FastAccelStepper *lead = axes[segment.leadAxis];
+    int32_t leadStart = lead->isRunning() ? lead->targetPos() : lead->getCurrentPosition();
+    bool ok = true;
+    for (uint8_t i = 0; i < 3; i++) {
+        if (steps[i] == 0) {
+            continue;
+        }
+        axes[i]->setSpeedInMilliHz(max(1L, lround(abs(steps[i]) * 1000.0 / duration)));
+        //segment.acceleration is along the move in mm/sec^2 - this axis covers abs(steps) over lengthMM of it.
+        axes[i]->setAcceleration(max(1L, lround(segment.acceleration * abs(steps[i]) / segment.lengthMM)));
+        ok &= axes[i]->move(steps[i]) == MOVE_OK;
+    }
+    laserPublish(segment, leadStart);
+    return ok;
+}
+
+//Seconds the segment takes at its programmed rates and the current feed override - the slowest axis sets it, and an
+//override above 100% never pushes an axis past its $11x maximum rate. 0 when there is nothing to run.
+float segmentDuration(const MotionSegment &segment){
+    int32_t steps[3] = {segment.leftSteps, segment.rightSteps, segment.zSteps};
+    uint32_t rates[3] = {segment.leftHz, segment.rightHz, segment.zHz};
+    float duration = 0;
+    float fastest = 0;
+    for (uint8_t i = 0; i < 3; i++) {
+        if (steps[i] != 0 && rates[i] > 0) {
+            duration = max(duration, (float)abs(steps[i]) / rates[i]);
+            fastest = max(fastest, abs(steps[i]) / (settings.maxRate[i] * settings.hzPerMMPerMin[i]));
+        }
+    }
+    if (feedOverrideApplied > 100) {
+        return max(fastest, duration * 100 / feedOverrideApplied);
+    }
+    return duration * 100 / feedOverrideApplied;
+}
+
+//Feed override changed mid-segment - give every moving axis its new speed. Accelerations stay as they are, so each
+//axis ramps to its new speed in the same time and the path is unchanged.
+void stepperApplyFeed(const MotionSegment &segment){
+    FastAccelStepper *axes[3] = {leftStepper, rightStepper, zStepper};
+    int32_t steps[3] = {segment.leftSteps, segment.rightSteps, segment.zSteps};
+    float duration = segmentDuration(segment);
+    if (duration == 0) {
+        return;
+    }
+    for (uint8_t i = 0; i < 3; i++) {
+        if (steps[i] == 0 || !axes[i]->isRunning()) {
+            continue;
+        }
+        axes[i]->setSpeedInMilliHz(max(1L, lround(abs(steps[i]) * 1000.0 / duration)));
+        axes[i]->applySpeedAcceleration();
+    }
+}
+
+//Tell the laser timer what the steppers have just been handed. leadStart is where the segment's lead axis starts -
+//ahead of it while the previous segment is still finishing. Motion task only.
+void laserPublish(const MotionSegment &segment, int32_t leadStart){
+    FastAccelStepper *axes[3] = {leftStepper, rightStepper, zStepper};
+    uint32_t rates[3] = {segment.leftHz, segment.rightHz, segment.zHz};
+    uint32_t state = 0;
+    if (segment.laserPower > 0 && rates[segment.leadAxis] > 0) {
+        state = segment.laserPower | (segment.laserDynamic ? 0x100 : 0) | (uint32_t)segment.leadAxis << 9 |
+                min(rates[segment.leadAxis], (uint32_t)0xFFFFF) << 12;
+    }
+    int32_t position = axes[segment.leadAxis]->getCurrentPosition();
+    if (leadStart == position) {
+        laserSwitchDir = 0;
+        __atomic_store_n(&laserActive, state, __ATOMIC_RELEASE);
+        return;
+    }
+    laserPending = state;
+    laserSwitchAt = leadStart;
+    laserSwitchAxis = segment.leadAxis;
+    laserSwitchDir = leadStart > position ? 1 : -1;
+}
+
+//Hand the pending power over once the lead axis has crossed into the new segment. Motion task, every pass.
+void laserSwitchService(){
+    if (laserSwitchDir == 0) {
+        return;
+    }
+    FastAccelStepper *axes[3] = {leftStepper, rightStepper, zStepper};
+    if ((laserSwitchAt - axes[laserSwitchAxis]->getCurrentPosition()) * laserSwitchDir <= 0) {
+        laserSwitchDir = 0;
+        __atomic_store_n(&laserActive, laserPending, __ATOMIC_RELEASE);
+    }
+}
+
+//Nothing is cutting - dark now, and nothing pending. Motion task only.
+void laserOff(){
+    laserSwitchDir = 0;
+    __atomic_store_n(&laserActive, 0, __ATOMIC_RELEASE);
+}
+
+//Periodic laser timer callback - see laserUpdateUs. Runs in the esp_timer task rather than the raw ISR, because
+//ledcWrite() and FastAccelStepper's speed query are not safe from interrupt context. Only writes on a change.
+void laserService(void *arg){
+    if (!settings.laserMode) {
+        //$32 switched off mid-cut - leave nothing burning behind.
+        if (laserDutyWritten > 0) {
+            ledcWrite(spindlePWM, 0);
+            digitalWrite(laser, LOW);
+        }
+        laserDutyWritten = -1;
+        return;
+    }
+    uint32_t state = __atomic_load_n(&laserActive, __ATOMIC_ACQUIRE);
+    uint32_t duty = 0;
+    if (state != 0) {
+        FastAccelStepper *axes[3] = {leftStepper, rightStepper, zStepper};
+        FastAccelStepper *lead = axes[(state >> 9) & 3];
+        duty = state & 0xFF;
+        if (state & 0x100) {
+            float speed = fabsf(lead->getCurrentSpeedInMilliHz() / 1000.0);
+            duty = lround(duty * min(1.0f, speed / (state >> 12)));
+        } else if (!lead->isRunning()) {
+            duty = 0;
+        }
+        duty = min(255, (int)(duty * spindleOverride / 100));
+    }
+    if ((int16_t)duty != laserDutyWritten) {
+        laserDutyWritten = duty;
+        ledcWrite(spindlePWM, duty);
+        digitalWrite(laser, duty > 0 ? HIGH : LOW);
+    }
+}
+
+//Fill the Q24 sine table odometrySin() interpolates in. Called once from setup().
+void odometryBuildSine(){
+    for (int i = 0; i <= (1 << odometrySineBits); i++) {
+        odometrySine[i] = lround(sin(2 * PI * i / (1 << odometrySineBits)) * (1 << 24));
+    }
+}
+
+//Sine of a binary angle in Q24, linear between table entries.
+int32_t odometrySin(uint32_t angle){
+    uint32_t index = angle >> (32 - odometrySineBits);
+    int64_t fraction = (angle >> (16 - odometrySineBits)) & 0xFFFF;
+    int32_t below = odometrySine[index];
+    return below + (int32_t)(((odometrySine[index + 1] - below) * fraction) >> 16);
+}
+
+//Start counting the heading from where it is now. Motion task only.
+void odometryRebase(){
+    odometryHeadingOrigin = odometryHeading;
+    odometryTurnSteps[0] = odometryTurnSteps[1] = 0;
+}
+
+//Per step factors for $100, $101 and $140. Steps already taken stay at the old ones. Motion task only.
+void odometryScale(){
+    odometryUpdate();
+    odometryRebase();
+    for (uint8_t i = 0; i < 2; i++) {
+        bool valid = settings.stepsPerMM[i] > 0 && settings.trackWidth > 0;
+        odometryMMPerStep[i] = valid ? llround(4294967296.0 / settings.stepsPerMM[i]) : 0;
+        odometryTurnPerStep[i] = valid ? llround(281474976710656.0 / (2 * PI * settings.trackWidth * settings.stepsPerMM[i])) : 0;
+    }
+}
+
+//Fold the track steps since the last update into the pose. Motion task only.
+void odometryUpdate(){
+    int32_t steps[2] = {leftStepper->getCurrentPosition(), rightStepper->getCurrentPosition()};
+    int32_t delta[2] = {steps[0] - odometryLastSteps[0], steps[1] - odometryLastSteps[1]};
+    odometryLastSteps[0] = steps[0];
+    odometryLastSteps[1] = steps[1];
+    if (delta[0] == 0 && delta[1] == 0) {
+        return;
+    }
+
+    //Forward is negative steps on both tracks, and the tank turns counter-clockwise as the left track gets ahead.
+    odometryTurnSteps[0] += delta[0];
+    odometryTurnSteps[1] += delta[1];
+    uint32_t previous = odometryHeading;
+    odometryHeading = odometryHeadingOrigin + (uint32_t)((odometryTurnSteps[1] * odometryTurnPerStep[1] -
+                                                          odometryTurnSteps[0] * odometryTurnPerStep[0]) >> 16);
+    int64_t distance = -(delta[0] * odometryMMPerStep[0] + delta[1] * odometryMMPerStep[1]) / 2;
+    uint32_t middle = previous + (int32_t)(odometryHeading - previous) / 2;
+    odometryX += (distance * odometrySin(middle + 0x40000000)) >> 24;
+    odometryY += (distance * odometrySin(middle)) >> 24;
+
+    if (llabs(odometryTurnSteps[0]) > odometryRebaseSteps || llabs(odometryTurnSteps[1]) > odometryRebaseSteps) {
+        odometryRebase();
+    }
+}
+
+//Motion task, every pass: once per odometryIntervalUs take on any pose set from the network task, update the pose
+//and publish it.
+void odometryService(){
+    uint32_t now = micros();
+    if (now - odometryLastUs < odometryIntervalUs) {
+        return;
+    }
+    odometryLastUs = now;
+    odometryUpdate();
+
+    portENTER_CRITICAL(&odometryMux);
+    if (odometrySetPending) {
+        odometryX = ((int64_t)odometrySetPose[0] << 32) / 1000;
+        odometryY = ((int64_t)odometrySetPose[1] << 32) / 1000;
+        odometryHeading = odometrySetPose[2];
+        odometryRebase();
+        odometrySetPending = false;
+    }
+    odometryPublished[0] = (odometryX * 1000 + (1LL << 31)) >> 32;
+    odometryPublished[1] = (odometryY * 1000 + (1LL << 31)) >> 32;
+    odometryPublished[2] = odometryHeading;
+    portEXIT_CRITICAL(&odometryMux);
+}
+
+//Latest pose from the motion task - x and y in µm, heading as a binary angle. Any task.
+void odometryRead(int32_t *pose){
+    portENTER_CRITICAL(&odometryMux);
+    memcpy(pose, odometryPublished, sizeof(odometryPublished));
+    portEXIT_CRITICAL(&odometryMux);
+}
+
+//Hand the motion task a new pose, same units. It takes effect within odometryIntervalUs. Any task.
+void odometrySet(const int32_t *pose){
+    portENTER_CRITICAL(&odometryMux);
+    memcpy(odometrySetPose, pose, sizeof(odometrySetPose));
+    odometrySetPending = true;
+    portEXIT_CRITICAL(&odometryMux);
+}
+
+//Starts the Z homing cycle: a fast seek at $25 towards the switch for up to 1.5 x $132, back off $27, then a slow
+//approach at $24 for no more than $27 past the first contact. The edge the second approach latches, plus $27, becomes
+//zero. The cycle itself is run by homingService() on the motion task.
+bool zHoming(){
+  float stepsPerMM = settings.stepsPerMM[2];
+  //Any of these at zero or below means GRBL settings that can not home.
+  if (stepsPerMM <= 0 || settings.homingSeek <= 0 || settings.homingFeed <= 0 || settings.homingPullOff <= 0 ||
+      settings.acceleration[2] <= 0 || settings.maxTravel[2] <= 0 || settings.homingDebounceMs < 0) {
+    return false;
+  }
+  homingPullOffSteps = lround(settings.homingPullOff * stepsPerMM);
+  homingLocateHz = lround(settings.homingFeed * stepsPerMM / 60);
+  uint32_t seekHz = lround(min(settings.homingSeek, settings.maxRate[2]) * stepsPerMM / 60);
+  if (homingPullOffSteps < 1 || homingLocateHz < 1 || seekHz < 1) {
+    return false;
+  }
+  homingDebounceMs = settings.homingDebounceMs;
+  homingLocating = false;
+  zHomed = false;
+  motionState = MOTION_HOMING;
+  //The back-off runs on these, whichever way the cycle starts.
+  zStepper->setSpeedInHz(seekHz);
+  zStepper->setAcceleration(settings.accelSteps[2]);
+  //Already sitting on the switch - that is the first contact.
+  if (digitalRead(zEndStop) == LOW) {
+    homeLatched = zStepper->getCurrentPosition();
+    homingTimer = millis();
+    homingPhase = HOMING_DEBOUNCE;
+    return true;
+  }
+  homeStop = false;
+  attachInterrupt(zEndStop, homingStop, FALLING);
+  zStepper->move(-lround(1.5 * settings.maxTravel[2] * stepsPerMM));
+  homingPhase = HOMING_SEEK;
+  return true;
+}
+
+//One pass of the homing cycle. The axis stops dead on each contact - the latched position is what counts, so the
+//result does not depend on how fast it was going. The ISR detaches itself on the first edge, so contact bounce can not
+//retrigger it, and nothing moves again until the switch has had $26 to settle.
+void homingService(){
+  switch (homingPhase) {
+    case HOMING_SEEK:
+    case HOMING_LOCATE:
+      if (homeStop) {
+        zStepper->forceStop();
+        homingTimer = millis();
+        homingPhase = HOMING_DEBOUNCE;
+      } else if (!zStepper->isRunning()) {
+        //Ran out of travel without finding the switch.
+        homingFail();
+      }
+      return;
+    case HOMING_DEBOUNCE:
+      //The back-off would be thrown away with a forced stop that has not drained yet - $26 may be 0.
+      if (millis() - homingTimer < (uint32_t)homingDebounceMs || zStepper->isRunning()) {
+        return;
+      }
+      zStepper->moveTo(homeLatched + homingPullOffSteps);
+      homingPhase = homingLocating ? HOMING_PULLOFF : HOMING_BACKOFF;
+      return;
+    case HOMING_BACKOFF:
+      if (zStepper->isRunning()) {
+        return;
+      }
+      //Still closed $27 away from where it closed - a stuck switch or a pull-off too short to clear it.
+      if (digitalRead(zEndStop) == LOW) {
+        homingFail();
+        return;
+      }
+      homeStop = false;
+      homingLocating = true;
+      attachInterrupt(zEndStop, homingStop, FALLING);
+      zStepper->setSpeedInHz(homingLocateHz);
+      zStepper->moveTo(homeLatched - homingPullOffSteps);
+      homingPhase = HOMING_LOCATE;
+      return;
+    case HOMING_PULLOFF:
+      if (zStepper->isRunning()) {
+        return;
+      }
+      zStepper->setCurrentPosition(0);
+      //TO-DO: Attach danger interrupt if required
+      //Allow outside functions to know safety is complete.
+      homeStop = false;
+      homingPhase = HOMING_IDLE;
+      motionState = MOTION_IDLE;
+      motionEvent(EVENT_HOMING_DONE);
+      return;
+    default:
+      homingFail();
+      return;
+  }
+}
+
+void homingFail(){
+  detachInterrupt(zEndStop);
+  homeStop = false;
+  homingPhase = HOMING_IDLE;
+  motionState = MOTION_IDLE;
+  motionEvent(EVENT_HOMING_FAILED);
+}
+
+//Stage a probing cycle of up to distance mm along Z (signed like Z moves) with the seek at feed mm/min, and hand it to
+//the motion task. Network task only.
+bool probeCycleStart(float distance, float feed){
+    float stepsPerMM = settings.stepsPerMM[2];
+    if (motionBusy() || stepsPerMM <= 0 || feed <= 0 || lround(distance * stepsPerMM) == 0) {
+        return false;
+    }
+    probeSetup.distanceSteps = lround(distance * stepsPerMM);
+    probeSetup.seekHz = max(1L, lround(min(feed, settings.maxRate[2]) * stepsPerMM / 60));
+    probeSetup.locateHz = max(1L, lround(min(settings.homingFeed, feed) * stepsPerMM / 60));
+    probeSetup.pullOffSteps = lround(max(settings.homingPullOff, (float)probeMinPullOffMM) * stepsPerMM);
+    __atomic_store_n(&probeState, PROBE_RUNNING, __ATOMIC_RELEASE);
+    if (!motionRequest(MOTION_CMD_PROBE)) {
+        __atomic_store_n(&probeState, PROBE_FAILED, __ATOMIC_RELEASE);
+        return false;
+    }
+    return true;
+}
+
+//Start the cycle staged in probeSetup. A probe that already reads closed fails straight away. Motion task only.
+void probeBegin(){
+    if (motionState != MOTION_IDLE || motionQueueCount() > 0 || digitalRead(zProbe) == LOW) {
+        probeFinish(false);
+        return;
+    }
+    probeDirection = probeSetup.distanceSteps > 0 ? 1 : -1;
+    probeTouched = false;
+    attachInterrupt(zProbe, probeTouch, FALLING);
+    zStepper->setSpeedInHz(probeSetup.seekHz);
+    zStepper->setAcceleration(settings.accelSteps[2]);
+    zStepper->move(probeSetup.distanceSteps);
+    probePhase = PROBE_SEEK;
+    motionState = MOTION_PROBING;
+}
+
+//One pass of the probing cycle. The axis stops dead on each contact - the latched position is what counts.
+void probeService(){
+  switch (probePhase) {
+    case PROBE_SEEK:
+      if (probeTouched) {
+        zStepper->forceStop();
+        probePhase = PROBE_STOP;
+      } else if (!zStepper->isRunning()) {
+        detachInterrupt(zProbe);
+        probeFinish(false);
+      }
+      return;
+    case PROBE_STOP:
+      //A move issued before the forced stop has drained the queue would be thrown away with it.
+      if (zStepper->isRunning()) {
+        return;
+      }
+      zStepper->move(-probeDirection * probeSetup.pullOffSteps);
+      probePhase = PROBE_BACKOFF;
+      return;
+    case PROBE_BACKOFF:
+      if (zStepper->isRunning()) {
+        return;
+      }
+      //Still closed after the pull-off - the probe is stuck or the surface moved with it.
+      if (digitalRead(zProbe) == LOW) {
+        probeFinish(false);
+        return;
+      }
+      //Come back no further than the pull-off past the first contact.
+      probeTouched = false;
+      attachInterrupt(zProbe, probeTouch, FALLING);
+      zStepper->setSpeedInHz(probeSetup.locateHz);
+      zStepper->move(probeDirection * 2 * probeSetup.pullOffSteps);
+      probePhase = PROBE_RETOUCH;
+      return;
+    case PROBE_RETOUCH:
+      if (probeTouched) {
+        zStepper->forceStop();
+        probeFinish(true);
+      } else if (!zStepper->isRunning()) {
+        detachInterrupt(zProbe);
+        probeFinish(false);
+      }
+      return;
+    default:
+      probeFinish(false);
+      return;
+  }
+}
+
+//End the cycle and publish the result. Motion task only.
+void probeFinish(bool touched){
+    if (touched) {
+        probePosition = probeLatched;
+    }
+    probePhase = PROBE_IDLE;
+    if (motionState == MOTION_PROBING) {
+        motionState = MOTION_IDLE;
+    }
+    __atomic_store_n(&probeState, touched ? PROBE_DONE : PROBE_FAILED, __ATOMIC_RELEASE);
+    motionEvent(touched ? EVENT_PROBE_DONE : EVENT_PROBE_FAILED);
+}
+
+//Accept the G-code client, gather one line at a time and run it. Nothing more is read while a line waits on the queue,
+//so TCP flow control holds the sender back. Every newline gets exactly one "ok" or "error:n" reply.
+void gcodeService(){
+    if (gcodeServer.hasClient()) {
+        //Newest connection wins - a sender that reconnects should not be locked out by its own stale socket.
+        if (gcodeClient) {
+            gcodeClient.stop();
+        }
+        gcodeClient = gcodeServer.accept();
+        gcodeLineLength = 0;
+        gcodeLineReady = gcodeLineOverflow = gcodeInComment = gcodeSkipRest = false;
+        gcodeProbing = false;
+        gcodeClient.print("CNC-Tank " FIRMWARE_VERSION " ready\r\n");
+    }
+
+    //An arc still being cut into chords holds back the next line.
+    if (gcodeArc.active && !gcodeArcService()) {
+        return;
+    }
+    //So does grid probing - it moves the machine through the same G-code position.
+    if (levelingPhase != LEVEL_IDLE) {
+        return;
+    }
+
+    if (!gcodeClient || !gcodeClient.connected()) {
+        return;
+    }
+
+    //Real-time bytes are picked off ahead of a line that is waiting on the queue - a sender waiting for "ok" has
+    //nothing else in flight, so a feed hold or cycle start never sits behind the move it is meant to affect.
+    while (gcodeLineReady && gcodeClient.available() && gcodeRealtime(gcodeClient.peek())) {
+        gcodeClient.read();
+    }
+
+    while (!gcodeLineReady && gcodeClient.available()) {
+        char c = gcodeClient.read();
+        if (gcodeRealtime(c)) {
+            continue;
+        }
+        if (c == '\n') {
+            gcodeLine[gcodeLineLength] = 0;
+            gcodeLineReady = true;
+            gcodeInComment = gcodeSkipRest = false;
+        } else if (gcodeSkipRest) {
+            //Rest of a ';' comment
+        } else if (gcodeInComment) {
+            if (c == ')') {
+                gcodeInComment = false;
+            }
+        } else if (c == '(') {
+            gcodeInComment = true;
+        } else if (c == ';') {
+            gcodeSkipRest = true;
+        } else if (c <= ' ' || c == '%') {
+            //Spaces, tabs, the '\r' of a CRLF and '%' program markers
+        } else if (gcodeLineLength < gcodeLineSize - 1) {
+            gcodeLine[gcodeLineLength++] = toupper(c);
+        } else {
+            gcodeLineOverflow = true;
+        }
+    }
+
+    if (!gcodeLineReady) {
+        return;
+    }
+
+    uint8_t status = gcodeLineOverflow ? gcodeErrorLineOverflow : gcodeExecuteLine(gcodeLine);
+    if (status == gcodeWait) {
+        return;
+    }
+    if (status == gcodeOk) {
+        gcodeClient.print("ok\r\n");
+    } else {
+        gcodeClient.printf("error:%d\r\n", status);
+    }
+    gcodeLineLength = 0;
+    gcodeLineReady = gcodeLineOverflow = false;
+}
+
+//GRBL's single byte real-time commands. They never become part of a line. Returns false for any other byte.
+bool gcodeRealtime(uint8_t c){
+    uint8_t feed = __atomic_load_n(&feedOverride, __ATOMIC_ACQUIRE);
+    switch (c) {
+        case '!': feedHold(); return true;
+        case '~': cycleStart(); return true;
+        case 0x90: setFeedOverride(100); return true;
+        case 0x91: setFeedOverride(feed + 10); return true;
+        case 0x92: setFeedOverride(feed - 10); return true;
+        case 0x93: setFeedOverride(feed + 1); return true;
+        case 0x94: setFeedOverride(feed - 1); return true;
+        case 0x99: setSpindleOverride(100); return true;
+        case 0x9A: setSpindleOverride(spindleOverride + 10); return true;
+        case 0x9B: setSpindleOverride(spindleOverride - 10); return true;
+        case 0x9C: setSpindleOverride(spindleOverride + 1); return true;
+        case 0x9D: setSpindleOverride(spindleOverride - 1); return true;
+        default: return false;
+    }
+}
+
+//Parse and run one stripped, upper case line. Modal state is only touched once the whole line is accepted,
+//so a line that returns gcodeWait is simply run again on a later pass.
+uint8_t gcodeExecuteLine(char *line){
+    int8_t motionMode = -1;
+    int8_t absolute = -1;
+    int8_t inches = -1;
+    int8_t spindle = -1;
+    bool hasAxis[3] = {false, false, false};
+    float axisWord[3] = {0, 0, 0};
+    float feed = -1;
+    float speed = -1;
+    bool hasOffset[2] = {false, false};
+    float offsetWord[2] = {0, 0};
+    bool hasRadius = false;
+    float radiusWord = 0;
+    int8_t probe = -1; //G38.2 = 2, G38.3 = 3
+
+    char *cursor = line;
+    while (*cursor) {
+        char letter = *cursor++;
+        if (letter < 'A' || letter > 'Z') {
+            return gcodeErrorExpectedLetter;
+        }
+        float value;
+        if (!gcodeReadNumber(&cursor, value)) {
+            return gcodeErrorBadNumber;
+        }
+        int code = (int)value;
+
+        switch (letter) {
+            case 'G':
+                if (code == 38 && (lround(value * 10) == 382 || lround(value * 10) == 383)) {
+                    probe = lround(value * 10) - 380;
+                    break;
+                }
+                if (value != code) {
+                    return gcodeErrorUnsupported;
+                }
+                switch (code) {
+                    case 0: case 1: case 2: case 3: motionMode = code; break;
+                    case 90: absolute = 1; break;
+                    case 91: absolute = 0; break;
+                    case 20: inches = 1; break;
+                    case 21: inches = 0; break;
+                    default: return gcodeErrorUnsupported;
+                }
+                break;
+            case 'M':
+                switch (code) {
+                    case 3: spindle = 1; break;
+                    case 4: spindle = 2; break;          //No reverse on this spindle - M4 is the laser's dynamic power mode
+                    case 5: spindle = 0; break;
+                    case 2: case 30: spindle = 0; break; //Program end also stops the spindle
+                    case 0: case 1: break;               //Program pause - nothing to pause for on a tank, yet
+                    default: return gcodeErrorUnsupported;
+                }
+                break;
+            case 'X': hasAxis[0] = true; axisWord[0] = value; break;
+            case 'Y': hasAxis[1] = true; axisWord[1] = value; break;
+            case 'Z': hasAxis[2] = true; axisWord[2] = value; break;
+            case 'I': hasOffset[0] = true; offsetWord[0] = value; break;
+            case 'J': hasOffset[1] = true; offsetWord[1] = value; break;
+            case 'R': hasRadius = true; radiusWord = value; break;
+            case 'F': feed = value; break;
+            case 'S': speed = value; break;
+            case 'N': case 'T': break; //Line and tool numbers are accepted and ignored
+            default: return gcodeErrorUnsupported;
+        }
+    }
+
+    float unitScale = (inches == 1 || (inches == -1 && gcodeInches)) ? 25.4 : 1.0;
+    bool isAbsolute = absolute == -1 ? gcodeAbsolute : absolute == 1;
+    uint8_t mode = motionMode == -1 ? gcodeMotionMode : motionMode;
+    float rate = feed >= 0 ? feed * unitScale : gcodeFeed;
+    bool moving = hasAxis[0] || hasAxis[1] || hasAxis[2];
+    bool spindleChange = spindle != -1 || (speed >= 0 && gcodeSpindleOn);
+
+    float target[3];
+    for (uint8_t i = 0; i < 3; i++) {
+        target[i] = gcodePosition[i];
+        if (hasAxis[i]) {
+            target[i] = axisWord[i] * unitScale + (isAbsolute ? 0 : gcodePosition[i]);
+        }
+    }
+
+    if (probe != -1) {
+        uint8_t status = gcodeProbe(probe == 2, hasAxis, target, rate);
+        if (status == gcodeOk) {
+            if (absolute != -1) gcodeAbsolute = absolute == 1;
+            if (inches != -1) gcodeInches = inches == 1;
+            if (feed >= 0) gcodeFeed = rate;
+        }
+        return status;
+    }
+
+    float arcOffset[2] = {0, 0};
+    if (moving) {
+        if (mode >= 1 && rate <= 0) {
+            return gcodeErrorUndefinedFeed;
+        }
+        if (mode >= 2) {
+            if (!hasAxis[0] && !hasAxis[1]) {
+                return gcodeErrorNoAxisWordsInPlane;
+            }
+            uint8_t status = gcodeArcOffset(mode == 2, target, hasOffset, offsetWord, hasRadius, radiusWord, unitScale, arcOffset);
+            if (status != gcodeOk) {
+                return status;
+            }
+        }
+        //A linear move or the first chord of an arc queues at most a turn and a drive, and the drive is cut once for
+        //every grid line it crosses with the height map on.
+        if (motionQueueFree() < 2 + heightMapSplits(gcodePosition, target)) {
+            return gcodeWait;
+        }
+        float sweep = mode >= 2 ? gcodeArcTravel(target, arcOffset, mode == 2) : 0;
+        if (!gcodeWithinTravel(target, arcOffset, sweep)) {
+            return gcodeErrorSoftLimit;
+        }
+    }
+    //Spindle changes wait for the queue to drain so they happen where the program put them. In laser mode the power
+    //rides along with each queued segment instead, so there is nothing to wait for.
+    if (spindleChange && !settings.laserMode && motionBusy()) {
+        return gcodeWait;
+    }
+
+    if (motionMode != -1) gcodeMotionMode = motionMode;
+    if (absolute != -1) gcodeAbsolute = absolute == 1;
+    if (inches != -1) gcodeInches = inches == 1;
+    if (feed >= 0) gcodeFeed = rate;
+    if (speed >= 0) gcodeSpindleSpeed = speed;
+    if (spindle != -1) gcodeSpindleOn = spindle != 0;
+    if (spindle != -1) gcodeSpindleDynamic = spindle == 2;
+
+    if (spindleChange && !settings.laserMode) {
+        gcodeApplySpindle();
+    }
+    if (moving && mode >= 2) {
+        gcodeArcBegin(target, arcOffset, mode == 2, gcodeFeed);
+    } else if (moving) {
+        gcodeQueueLinear(target, mode == 0 ? 0 : gcodeFeed);
+    }
+    return gcodeOk;
+}
+
+//G38.2/G38.3 towards target Z at feed mm/min. Runs over several passes: waits for the queue to drain, starts the
+//cycle, then holds the line until it has finished. Reports "[PRB:x,y,z:touched]" like GRBL and leaves the machine where
+//the probe stopped. Only Z can be probed - the probe is on the Z axis.
+uint8_t gcodeProbe(bool failIsError, const bool *hasAxis, const float *target, float feed){
+    if (!gcodeProbing) {
+        if (hasAxis[0] || hasAxis[1]) {
+            return gcodeErrorUnsupported;
+        }
+        if (!hasAxis[2] || target[2] == gcodePosition[2]) {
+            return gcodeErrorInvalidTarget;
+        }
+        if (feed <= 0) {
+            return gcodeErrorUndefinedFeed;
+        }
+        if (motionBusy()) {
+            return gcodeWait;
+        }
+        if (!gcodeWithinTravel(target, NULL, 0)) {
+            return gcodeErrorSoftLimit;
+        }
+        gcodeProbeStart = zStepper->getCurrentPosition();
+        gcodeProbing = probeCycleStart(target[2] - gcodePosition[2], feed);
+        return gcodeProbing ? gcodeWait : gcodeErrorProbeFail;
+    }
+
+    uint8_t state = __atomic_load_n(&probeState, __ATOMIC_ACQUIRE);
+    if (state == PROBE_RUNNING || motionBusy()) {
+        return gcodeWait;
+    }
+    gcodeProbing = false;
+    float stepsPerMM = settings.stepsPerMM[2];
+    float contact = gcodePosition[2] + (probePosition - gcodeProbeStart) / stepsPerMM;
+    gcodePosition[2] += (zStepper->getCurrentPosition() - gcodeProbeStart) / stepsPerMM;
+    float unitScale = gcodeInches ? 25.4 : 1.0;
+    gcodeClient.printf("[PRB:%.3f,%.3f,%.3f:%d]\r\n", gcodePosition[0] / unitScale, gcodePosition[1] / unitScale,
+                       (state == PROBE_DONE ? contact : gcodePosition[2]) / unitScale, state == PROBE_DONE ? 1 : 0);
+    return state == PROBE_DONE || !failIsError ? gcodeOk : gcodeErrorProbeFail;
+}
+
+//Work out the arc center as an offset from the current position, from either I/J or R. Follows GRBL's checks and error codes.
+uint8_t gcodeArcOffset(bool clockwise, const float *target, const bool *hasOffset, const float *offsetWord, bool hasRadius, float radiusWord, float unitScale, float *offset){
+    float x = target[0] - gcodePosition[0];
+    float y = target[1] - gcodePosition[1];
+
+    if (hasRadius) {
+        float radius = radiusWord * unitScale;
+        if (x == 0 && y == 0) {
+            return gcodeErrorInvalidTarget;
+        }
+        //Distance from the chord midpoint to the center, scaled by the chord length.
+        float h = 4.0 * radius * radius - x * x - y * y;
+        if (h < 0) {
+            return gcodeErrorArcRadius;
+        }
+        h = -sqrtf(h) / sqrtf(x * x + y * y);
+        if (!clockwise) h = -h;
+        //A negative R asks for the long way round.
+        if (radius < 0) h = -h;
+        offset[0] = 0.5 * (x - y * h);
+        offset[1] = 0.5 * (y + x * h);
+        return gcodeOk;
+    }
+
+    if (!hasOffset[0] && !hasOffset[1]) {
+        return gcodeErrorNoOffsetsInPlane;
+    }
+    offset[0] = offsetWord[0] * unitScale;
+    offset[1] = offsetWord[1] * unitScale;
+    //The target has to sit on the same circle as the start point.
+    float radius = sqrtf(offset[0] * offset[0] + offset[1] * offset[1]);
+    float targetRadius = sqrtf((x - offset[0]) * (x - offset[0]) + (y - offset[1]) * (y - offset[1]));
+    float error = fabsf(targetRadius - radius);
+    if (error > 0.005 && (error > 0.5 || error > 0.001 * radius)) {
+        return gcodeErrorInvalidTarget;
+    }
+    return gcodeOk;
+}
+
+//Set up an arc from the current position around position + offset and queue as many chords as fit right now.
+void gcodeArcBegin(const float *target, const float *offset, bool clockwise, float feed){
+    gcodeArc.center[0] = gcodePosition[0] + offset[0];
+    gcodeArc.center[1] = gcodePosition[1] + offset[1];
+    gcodeArc.offset[0] = offset[0];
+    gcodeArc.offset[1] = offset[1];
+    gcodeArc.radius[0] = -offset[0];
+    gcodeArc.radius[1] = -offset[1];
+    for (uint8_t i = 0; i < 3; i++) {
+        gcodeArc.target[i] = target[i];
+    }
+    gcodeArc.feed = feed;
+
+    float angularTravel = gcodeArcTravel(target, offset, clockwise);
+
+    //Longest chord whose midpoint stays within $12 of the arc.
+    float radius = sqrtf(offset[0] * offset[0] + offset[1] * offset[1]);
+    float segments = 0;
+    if (settings.arcTolerance > 0 && settings.arcTolerance < radius) {
+        segments = floorf(fabsf(0.5 * angularTravel * radius) / sqrtf(settings.arcTolerance * (2 * radius - settings.arcTolerance)));
+    }
+    gcodeArc.segments = segments > 1 ? (segments < 65535 ? (uint16_t)segments : 65535) : 1;
+    gcodeArc.index = 1;
+    gcodeArc.sinceCorrection = 0;
+    gcodeArc.thetaPerSegment = angularTravel / gcodeArc.segments;
+    gcodeArc.zPerSegment = (target[2] - gcodePosition[2]) / gcodeArc.segments;
+    //Third order small angle approximations of cos and sin for one chord.
+    float theta = gcodeArc.thetaPerSegment;
+    gcodeArc.cosT = 2.0 - theta * theta;
+    gcodeArc.sinT = theta * 0.16666667 * (gcodeArc.cosT + 4.0);
+    gcodeArc.cosT *= 0.5;
+    gcodeArc.active = true;
+
+    //Face along the arc first - the radius turned a quarter turn in the direction of travel.
+    float tangent = atan2f(gcodeArc.radius[1], gcodeArc.radius[0]) + (clockwise ? -PI / 2 : PI / 2);
+    gcodeQueueTurn(tangent * RAD_TO_DEG, feed);
+
+    gcodeArcService();
+}
+
+//Angle in radians the arc from the current position around position + offset turns through to reach target,
+//counter-clockwise positive.
+float gcodeArcTravel(const float *target, const float *offset, bool clockwise){
+    float toTarget[2] = {target[0] - gcodePosition[0] - offset[0], target[1] - gcodePosition[1] - offset[1]};
+    float angularTravel = atan2f(-offset[0] * toTarget[1] + offset[1] * toTarget[0],
+                                 -offset[0] * toTarget[0] - offset[1] * toTarget[1]);
+    //A target equal to the start point is a full circle.
+    if (clockwise) {
+        if (angularTravel >= -arcAngularTravelEpsilon) angularTravel -= 2 * PI;
+    } else {
+        if (angularTravel <= arcAngularTravelEpsilon) angularTravel += 2 * PI;
+    }
+    return angularTravel;
+}
+
+//Soft limit check for a move from the current position to target, around position + offset through sweep radians
+//when it is an arc (sweep 0 for a straight line). The program has the tank at gcodePosition facing tankHeading and the
+//machine has it where the queued moves end, so G-code points are turned and shifted by the difference between the two.
+bool gcodeWithinTravel(const float *target, const float *offset, float sweep){
+    if (!settings.softLimits) {
+        return true;
+    }
+    envelopeSync();
+    float rotation = envelopePose[2] - tankHeading * DEG_TO_RAD;
+    float c = cosf(rotation);
+    float s = sinf(rotation);
+    float dx = target[0] - gcodePosition[0];
+    float dy = target[1] - gcodePosition[1];
+    float box[4] = {INFINITY, INFINITY, -INFINITY, -INFINITY};
+    envelopeBoxAdd(box, envelopePose[0] + dx * c - dy * s, envelopePose[1] + dx * s + dy * c);
+    if (sweep != 0) {
+        float center[2] = {envelopePose[0] + offset[0] * c - offset[1] * s, envelopePose[1] + offset[0] * s + offset[1] * c};
+        envelopeArcBox(center, envelopePose, sweep, box);
+    }
+    float offsetZ = heightMapActive() ? heightMapOffset(target[0], target[1]) : 0;
+    float dz = target[2] + offsetZ - gcodePosition[2] - gcodeZOffset;
+    return envelopeInside(box, envelopeZ + lround(dz * settings.stepsPerMM[2]));
+}
+
+//Queue arc chords while there is room. Returns true once the whole arc is in the motion queue.
+bool gcodeArcService(){
+    //Room for the worst case chord: a turn, and a drive cut at every grid line.
+    uint16_t room = 2 + (heightMapActive() ? 2 * heightMapMaxPoints : 0);
+    while (gcodeArc.active && motionQueueFree() >= room) {
+        float point[3];
+        if (gcodeArc.index < gcodeArc.segments) {
+            if (gcodeArc.sinceCorrection < arcCorrection) {
+                float radius1 = gcodeArc.radius[0] * gcodeArc.sinT + gcodeArc.radius[1] * gcodeArc.cosT;
+                gcodeArc.radius[0] = gcodeArc.radius[0] * gcodeArc.cosT - gcodeArc.radius[1] * gcodeArc.sinT;
+                gcodeArc.radius[1] = radius1;
+                gcodeArc.sinceCorrection++;
+            } else {
+                //Rotation error builds up - recompute this chord end exactly.
+                float angle = gcodeArc.index * gcodeArc.thetaPerSegment;
+                float cosI = cosf(angle);
+                float sinI = sinf(angle);
+                gcodeArc.radius[0] = -gcodeArc.offset[0] * cosI + gcodeArc.offset[1] * sinI;
+                gcodeArc.radius[1] = -gcodeArc.offset[0] * sinI - gcodeArc.offset[1] * cosI;
+                gcodeArc.sinceCorrection = 0;
+            }
+            point[0] = gcodeArc.center[0] + gcodeArc.radius[0];
+            point[1] = gcodeArc.center[1] + gcodeArc.radius[1];
+            point[2] = gcodePosition[2] + gcodeArc.zPerSegment;
+            gcodeArc.index++;
+        } else {
+            //Last chord lands exactly on the programmed end point.
+            point[0] = gcodeArc.target[0];
+            point[1] = gcodeArc.target[1];
+            point[2] = gcodeArc.target[2];
+            gcodeArc.active = false;
+        }
+        gcodeQueueTangentArc(point, gcodeArc.feed);
+    }
+    return !gcodeArc.active;
+}
+
+//Plain decimal reader for word values. strtod would take "G0X1" as hex and accept exponents, inf and nan.
+bool gcodeReadNumber(char **cursor, float &value){
+    char *c = *cursor;
+    bool negative = false;
+    if (*c == '-' || *c == '+') {
+        negative = *c == '-';
+        c++;
+    }
+    uint32_t whole = 0;
+    float fraction = 0;
+    float scale = 1;
+    bool digits = false;
+    while (*c >= '0' && *c <= '9') {
+        whole = whole * 10 + (*c++ - '0');
+        digits = true;
+    }
+    if (*c == '.') {
+        c++;
+        while (*c >= '0' && *c <= '9') {
+            scale *= 0.1;
+            fraction += (*c++ - '0') * scale;
+            digits = true;
+        }
+    }
+    if (!digits) {
+        return false;
+    }
+    value = whole + fraction;
+    if (negative) {
+        value = -value;
+    }
+    *cursor = c;
+    return true;
+}
+
+//Drive the spindle relay and PWM from the modal M3/M5 and S state.
+void gcodeApplySpindle(){
+    digitalWrite(spindleEnb, gcodeSpindleOn ? HIGH : LOW);
+    spindleWrite(gcodeSpindleOn ? spindlePowerDuty(gcodeSpindleSpeed) : 0);
+}
+
+//PWM duty for an S word, the way GRBL scales it: 0 is off, $31 and below the lowest duty that is still on, $30 and
+//above full power, linear in between.
+uint8_t spindlePowerDuty(float rpm){
+    if (rpm <= 0) {
+        return 0;
+    }
+    if (rpm >= settings.spindleMaxRpm) {
+        return 255;
+    }
+    if (rpm <= settings.spindleMinRpm || settings.spindleMaxRpm <= settings.spindleMinRpm) {
+        return 1;
+    }
+    return 1 + lround((rpm - settings.spindleMinRpm) * 254 / (settings.spindleMaxRpm - settings.spindleMinRpm));
+}
 
-    String body = server.arg("plain");
-    StaticJsonDocument<200> doc;
-    DeserializationError error = deserializeJson(doc, body);
+//Queue a G-code segment with the power it cuts at in laser mode. cutting is false for rapids and for spins in place,
+//which turn the tank about the tool without moving it across the work.
+bool gcodeQueueSegment(MotionSegment &segment, bool cutting){
+    segment.laserPower = cutting && gcodeSpindleOn ? spindlePowerDuty(gcodeSpindleSpeed) : 0;
+    segment.laserDynamic = gcodeSpindleDynamic;
+    return motionQueuePush(segment);
+}
 
-    if (error) {
-        server.send(400, "application/json", "{\"error\": \"Invalid JSON\"}");
-        return;
-    }
+//Queue a straight move the way the tank can drive it: spin in place to face the XY target, then drive forward with any Z
+//change spread over the same time so the tool follows a straight line. A feed of 0 means rapid (G0).
+void gcodeQueueLinear(const float *target, float feed){
+    float dx = target[0] - gcodePosition[0];
+    float dy = target[1] - gcodePosition[1];
+    float distance = sqrtf(dx * dx + dy * dy);
 
-    if (!doc.containsKey("enable")) {
-        server.send(400, "application/json", "{\"error\": \"Missing required parameter: enable\"}");
+    if (lround(distance * settings.stepsPerMM[0]) > 0) {
+        //A feed move that bends only slightly away from the current heading is driven as the tangent arc through its
+        //end point instead of stopping to turn, as long as the arc stays within $12 of the programmed line.
+        float alpha = gcodeHeadingError(target);
+        if (feed > 0 && fabsf(alpha) < PI / 2 && distance * fabsf(tanf(alpha / 2)) / 2 <= settings.arcTolerance) {
+            gcodeQueueTangentArc(target, feed);
+            return;
+        }
+        float heading = atan2f(dy, dx) * RAD_TO_DEG;
+        gcodeQueueTurn(heading, feed);
+        gcodeQueueDrive(target, distance, 0, feed);
+    } else {
+        //Under a step across - the tracks can not go sideways, so XY stays where the tank is and only Z moves.
+        float zOnly[3] = {gcodePosition[0], gcodePosition[1], target[2]};
+        gcodeQueueDrive(zOnly, 0, 0, feed);
+        gcodePosition[2] = target[2];
         return;
     }
 
-    bool enable = doc["enable"];
-    digitalWrite(spindleEnb, enable ? HIGH : LOW);
-
-    StaticJsonDocument<200> response;
-    response["status"] = "success";
-    response["spindle"] = enable ? "enabled" : "disabled";
+    for (uint8_t i = 0; i < 3; i++) {
+        gcodePosition[i] = target[i];
+    }
+}
 
-    String responseStr;
-    serializeJson(response, responseStr);
-    server.send(200, "application/json", responseStr);
+//Angle in radians from the tank's heading to the XY target, -PI to PI with counter-clockwise positive.
+float gcodeHeadingError(const float *target){
+    float alpha = atan2f(target[1] - gcodePosition[1], target[0] - gcodePosition[0]) - tankHeading * DEG_TO_RAD;
+    while (alpha > PI) alpha -= 2 * PI;
+    while (alpha < -PI) alpha += 2 * PI;
+    return alpha;
 }
 
-//TO-DO Receive spindle state as "M" codes. M03 for enable, M05 for disable followed by integer value of 0-255 for PWM.
-void handleSpindleSpeed() {
-    if (server.hasArg("plain") == false) {
-        server.send(400, "application/json", "{\"error\": \"No data received\"}");
-        return;
+//Spin in place to face heading (degrees), taking the shorter way round.
+void gcodeQueueTurn(float heading, float feed){
+    float turn = heading - tankHeading;
+    //Normalize to -180 to 180 degrees for the shortest turn. Positive turns counter-clockwise.
+    if (turn > 180) turn -= 360;
+    if (turn < -180) turn += 360;
+    MotionSegment segment;
+    if (kinematicsPlan(0, turn * DEG_TO_RAD, 0, feed, segment, gcodeCarry)) {
+        gcodeQueueSegment(segment, false);
     }
+    tankHeading = heading < 0 ? heading + 360 : (heading >= 360 ? heading - 360 : heading);
+}
 
-    String body = server.arg("plain");
-    StaticJsonDocument<200> doc;
-    DeserializationError error = deserializeJson(doc, body);
-
-    if (error) {
-        server.send(400, "application/json", "{\"error\": \"Invalid JSON\"}");
+//Drive to target along the circular arc that leaves the current heading tangentially. When the tank already faces
+//along an arc, each chord end point lies on that same circle, so the tracks follow the programmed arc itself rather
+//than its chords and no turn stops are needed between them. Falls back to turn-and-drive when the target is behind.
+void gcodeQueueTangentArc(const float *target, float feed){
+    float dx = target[0] - gcodePosition[0];
+    float dy = target[1] - gcodePosition[1];
+    float chord = sqrtf(dx * dx + dy * dy);
+    float alpha = gcodeHeadingError(target);
+    if (fabsf(alpha) >= PI / 2) {
+        gcodeQueueLinear(target, feed);
         return;
     }
 
-    if (!doc.containsKey("speed")) {
-        server.send(400, "application/json", "{\"error\": \"Missing required parameter: speed\"}");
-        return;
+    //A chord at angle alpha to the tangent spans an arc of 2 * alpha.
+    float length = fabsf(alpha) > 1e-6 ? chord * alpha / sinf(alpha) : chord;
+    gcodeQueueDrive(target, length, 2 * alpha, feed);
+    float heading = tankHeading + 2 * alpha * RAD_TO_DEG;
+    tankHeading = heading < 0 ? heading + 360 : (heading >= 360 ? heading - 360 : heading);
+    for (uint8_t i = 0; i < 3; i++) {
+        gcodePosition[i] = target[i];
     }
+}
 
-    int speed = doc["speed"];
-    if (speed < 0 || speed > 100) {
-        server.send(400, "application/json", "{\"error\": \"Invalid spindle speed value\"}");
-        return;
+//Queue the drive from the current position to target - length mm along the centre line while the heading changes by
+//turn radians - as one segment, or with the height map on, one piece for every grid cell the straight line to the target
+//passes through. Each piece ends at the programmed Z plus the map's offset at its end, and since the tracks turn at a
+//steady rate, a piece covering a fraction of the line covers the same fraction of length and turn.
+void gcodeQueueDrive(const float *target, float length, float turn, float feed){
+    float delta[3];
+    for (uint8_t i = 0; i < 3; i++) {
+        delta[i] = target[i] - gcodePosition[i];
+    }
+    bool compensating = heightMapActive();
+    //Next grid line ahead on each axis, and where the move meets it as a fraction of the move.
+    int16_t line[2] = {0, 0};
+    float crossing[2] = {1, 1};
+    if (compensating) {
+        for (uint8_t k = 0; k < 2; k++) {
+            float position = (gcodePosition[k] - heightMapLine(k, 0)) / (k ? heightMap.dy : heightMap.dx);
+            line[k] = delta[k] > 0 ? max(0, (int)floorf(position) + 1) : min((k ? heightMap.ny : heightMap.nx) - 1, (int)ceilf(position) - 1);
+            crossing[k] = heightMapCrossing(k, line[k], delta);
+        }
     }
 
-    ledcWrite(spindlePWM, map(speed, 0, 100, 0, 255));
-
-    StaticJsonDocument<200> response;
-    response["status"] = "success";
-    response["spindle_speed"] = speed;
-
-    String responseStr;
-    serializeJson(response, responseStr);
-    server.send(200, "application/json", responseStr);
+    float done = 0;
+    float queuedZ = gcodePosition[2] + gcodeZOffset;
+    for (;;) {
+        float t = min(crossing[0], crossing[1]);
+        float offset = compensating ? heightMapOffset(gcodePosition[0] + delta[0] * t, gcodePosition[1] + delta[1] * t) : 0;
+        float z = gcodePosition[2] + delta[2] * t + offset;
+        MotionSegment segment;
+        //A piece too short to take a step stays in gcodeCarry and goes out with the next one.
+        if (kinematicsPlan(length * (t - done), turn * (t - done), z - queuedZ, feed, segment, gcodeCarry)) {
+            gcodeQueueSegment(segment, feed > 0);
+        }
+        done = t;
+        queuedZ = z;
+        gcodeZOffset = offset;
+        if (t >= 1) {
+            return;
+        }
+        for (uint8_t k = 0; k < 2; k++) {
+            if (crossing[k] == t) {
+                line[k] += delta[k] > 0 ? 1 : -1;
+                crossing[k] = heightMapCrossing(k, line[k], delta);
+            }
+        }
+    }
 }
 
-// OTA update handlers
-void handleUpdate() {
-    server.sendHeader("Connection", "close");
-    server.send(200, "text/html", serverIndex);
+//Compensation applies once a map has been probed and switched on, and never to the probing itself.
+bool heightMapActive(){
+    return heightMapEnabled && heightMapValid && levelingPhase == LEVEL_IDLE;
 }
 
-void handleUpdateDone() {
-    server.sendHeader("Connection", "close");
-    server.send(200, "text/plain", (Update.hasError()) ? "FAIL" : "OK");
-    ESP.restart();
+//X (axis 0) or Y (axis 1) of grid line index.
+float heightMapLine(uint8_t axis, int16_t index){
+    return axis ? heightMap.y0 + index * heightMap.dy : heightMap.x0 + index * heightMap.dx;
 }
 
-void handleUpdateUpload() {
-    HTTPUpload& upload = server.upload();
-    if (upload.status == UPLOAD_FILE_START) {
-        Serial.printf("Update: %s\n", upload.filename.c_str());
-        if (!Update.begin(UPDATE_SIZE_UNKNOWN)) {
-            Update.printError(Serial);
-        }
-    } else if (upload.status == UPLOAD_FILE_WRITE) {
-        if (Update.write(upload.buf, upload.currentSize) != upload.currentSize) {
-            Update.printError(Serial);
-        }
-    } else if (upload.status == UPLOAD_FILE_END) {
-        if (Update.end(true)) {
-            Serial.printf("Update Success: %u\nRebooting...\n", upload.totalSize);
-        } else {
-            Update.printError(Serial);
-        }
-    } else if (upload.status == UPLOAD_FILE_ABORTED) {
-        Update.end();
-        Serial.println("Update aborted");
+//Where a move of delta from the current G-code position meets grid line index, as a fraction of the move. 1 when it
+//does not meet it part way.
+float heightMapCrossing(uint8_t axis, int16_t index, const float *delta){
+    if (delta[axis] == 0 || index < 0 || index >= (axis ? heightMap.ny : heightMap.nx)) {
+        return 1;
     }
+    float t = (heightMapLine(axis, index) - gcodePosition[axis]) / delta[axis];
+    return t > 0 && t < 1 ? t : 1;
 }
 
-// OTA tunnel update handlers
-void handleTunnelUpdate() {
-    HTTPUpload& upload = server.upload();
-    if (upload.status == UPLOAD_FILE_START) {
-        Serial.printf("Tunnel Update: %s\n", upload.filename.c_str());
-        
-        // Validate file name ends with .bin
-        if (!upload.filename.endsWith(".bin")) {
-            Serial.println("Invalid file type");
-            return;
-        }
-        
-        if (!Update.begin(UPDATE_SIZE_UNKNOWN)) {
-            Update.printError(Serial);
-            return;
-        }
-        
-        Serial.println("Update started");
-    } 
-    else if (upload.status == UPLOAD_FILE_WRITE) {
-        if (Update.write(upload.buf, upload.currentSize) != upload.currentSize) {
-            Update.printError(Serial);
-            return;
-        }
-        Serial.printf("Progress: %u bytes\n", upload.totalSize);
-    } 
-    else if (upload.status == UPLOAD_FILE_END) {
-        if (Update.end(true)) {
-            Serial.printf("Update Success: %u bytes\nRebooting...\n", upload.totalSize);
-        } else {
-            Update.printError(Serial);
-        }
+//Grid lines strictly between two points - the extra pieces gcodeQueueDrive() cuts a move from one to the other into.
+uint16_t heightMapSplits(const float *from, const float *to){
+    if (!heightMapActive()) {
+        return 0;
     }
-    else if (upload.status == UPLOAD_FILE_ABORTED) {
-        Update.end();
-        Serial.println("Update aborted");
+    uint16_t splits = 0;
+    for (uint8_t k = 0; k < 2; k++) {
+        float spacing = k ? heightMap.dy : heightMap.dx;
+        float low = (min(from[k], to[k]) - heightMapLine(k, 0)) / spacing;
+        float high = (max(from[k], to[k]) - heightMapLine(k, 0)) / spacing;
+        int first = max(0, (int)floorf(low) + 1);
+        int last = min((k ? heightMap.ny : heightMap.nx) - 1, (int)ceilf(high) - 1);
+        if (last >= first) {
+            splits += last - first + 1;
+        }
     }
+    return splits;
 }
 
-void handleTunnelUpdateStatus() {
-    server.send(200, "text/plain", "Ready for update");
+//Offset at a point from its cell's coefficients. Outside the grid the edge of the map carries on.
+float heightMapOffset(float x, float y){
+    float u = constrain((x - heightMap.x0) / heightMap.dx, 0.0f, (float)(heightMap.nx - 1));
+    float v = constrain((y - heightMap.y0) / heightMap.dy, 0.0f, (float)(heightMap.ny - 1));
+    uint8_t i = min((int)u, heightMap.nx - 2);
+    uint8_t j = min((int)v, heightMap.ny - 2);
+    const HeightCell &cell = heightCells[j * (heightMap.nx - 1) + i];
+    u = (u - i) * heightMap.dx;
+    v = (v - j) * heightMap.dy;
+    return cell.a + cell.b * u + cell.c * v + cell.d * u * v;
 }
 
-void handleUpdatePost() {
-    server.sendHeader("Connection", "close");
-    server.send(200, "text/plain", (Update.hasError()) ? "FAIL" : "OK");
-    delay(1000);
-    ESP.restart();
+//Work out every cell's coefficients from the four points at its corners.
+void heightMapBuild(){
+    uint8_t nx = heightMap.nx;
+    for (uint8_t j = 0; j + 1 < heightMap.ny; j++) {
+        for (uint8_t i = 0; i + 1 < nx; i++) {
+            float z00 = heightMap.z[j * nx + i];
+            float z10 = heightMap.z[j * nx + i + 1];
+            float z01 = heightMap.z[(j + 1) * nx + i];
+            float z11 = heightMap.z[(j + 1) * nx + i + 1];
+            HeightCell &cell = heightCells[j * (nx - 1) + i];
+            cell.a = z00;
+            cell.b = (z10 - z00) / heightMap.dx;
+            cell.c = (z01 - z00) / heightMap.dy;
+            cell.d = (z11 - z10 - z01 + z00) / (heightMap.dx * heightMap.dy);
+        }
+    }
 }
 
-void handleApiUpdateGet() {
-    StaticJsonDocument<200> response;
-    response["version"] = FIRMWARE_VERSION;
-    response["used_space"] = ESP.getSketchSize();
-    response["free_space"] = ESP.getFreeSketchSpace();
-    
-    String responseStr;
-    serializeJson(response, responseStr);
-    server.send(200, "application/json", responseStr);
+bool heightMapCheck(const HeightMap &map){
+    return map.nx >= 2 && map.nx <= heightMapMaxPoints && map.ny >= 2 && map.ny <= heightMapMaxPoints &&
+           map.dx > 0 && map.dy > 0 && fabsf(map.x0) < 1E6 && fabsf(map.y0) < 1E6;
 }
 
-void handleApiUpdatePost() {
-    server.sendHeader("Connection", "close");
-    
-    StaticJsonDocument<200> response;
-    response["success"] = !Update.hasError();
-    response["message"] = Update.hasError() ? "Update failed" : "Update successful";
-    
-    String responseStr;
-    serializeJson(response, responseStr);
-    
-    server.send(200, "application/json", responseStr);
-    
-    if (!Update.hasError()) {
-        delay(1000);  // Give time for response to be sent
-        ESP.restart();
+//The map and the compensation switch live in their own NVS namespace, so a reboot carries on with the last probing.
+void heightMapLoad(){
+    myPrgVar.begin("leveling", false);
+    heightMapEnabled = myPrgVar.getBool("enabled", false);
+    heightMapValid = myPrgVar.getBytesLength("map") == sizeof(HeightMap) &&
+                     myPrgVar.getBytes("map", &heightMap, sizeof(HeightMap)) == sizeof(HeightMap) && heightMapCheck(heightMap);
+    myPrgVar.end();
+    if (heightMapValid) {
+        heightMapBuild();
     }
 }
 
-//Function checks for the first GRBL setting key:value pair. If it doesn't exist, it creates all the key value pairs for GRBL settings. If it does exist, it does nothing.
-//Create a namespace for GRBL. Or check for its existance.
-void handleGrblSetup(){
-  myPrgVar.begin("GBRL", false);
-  bool keyPresent = myPrgVar.isKey("$0");
-  if(keyPresent){
-      Serial.println("Keys are already present!");
-      return;
-  }
-  // Settings 2, 3, 4, 5, 6, 26, 32 are all non - use scenarios for the time being.
-  else {
-    myPrgVar.putInt("$0", 10); // Step pulse time, microseconds
-    myPrgVar.putInt("$1", 25); // Step idle delay, milliseconds
-    myPrgVar.putShort("$2", 0); // Step pulse invert, mask
-    myPrgVar.putShort("$3", 0); // Step direction invert, mask
-    myPrgVar.putBool("$4", 0); // Invert step enable pin, boolean
-    myPrgVar.putBool("$5", 0); // Invert limit pins, boolean
-    myPrgVar.putBool("$6", 0); // Invert probe pin, boolean
-    myPrgVar.putShort("$10", 1); // Status report options, mask
-    myPrgVar.putFloat("$11", 0.010); // Junction deviation, millimeters
-    myPrgVar.putFloat("$12", 0.002); // Arc tolerance, millimeters
-    myPrgVar.putBool("$13", false); // Report in inches, boolean
-    myPrgVar.putBool("$20", false); // Soft limits, boolean
-    myPrgVar.putBool("$21", false); // Hard limits, boolean
-    myPrgVar.putBool("$22", false); // Homing cycle, boolean
-    myPrgVar.putShort("$23", 0); // Homing direction invert, mask
-    myPrgVar.putFloat("$24", 25.000); // Homing feed, mm/min
-    myPrgVar.putFloat("$25", 500.000); // Homing seek, mm/min
-    myPrgVar.putInt("$26", 250); // Homing debounce, milliseconds
-    myPrgVar.putFloat("$27", 1.000); // Homing pull-off, millimeters
-    myPrgVar.putInt("$30", 10000); // Maximum spindle speed, RPM
-    myPrgVar.putInt("$31", 1000); // Minimum spindle speed, RPM
-    myPrgVar.putBool("$32", false); // Laser mode, boolean
-    myPrgVar.putFloat("$100", 250.000); // X-axis steps per millimeter
-    myPrgVar.putFloat("$101", 250.000); // Y-axis steps per millimeter
-    myPrgVar.putFloat("$102", 250.000); // Z-axis steps per millimeter
-    myPrgVar.putFloat("$110", 500.000); // X-axis maximum rate, mm/min
-    myPrgVar.putFloat("$111", 500.000); // Y-axis maximum rate, mm/min
-    myPrgVar.putFloat("$112", 500.000); // Z-axis maximum rate, mm/min
-    myPrgVar.putFloat("$120", 10.000); // X-axis acceleration, mm/sec^2
-    myPrgVar.putFloat("$121", 10.000); // Y-axis acceleration, mm/sec^2
-    myPrgVar.putFloat("$122", 10.000); // Z-axis acceleration, mm/sec^2
-    myPrgVar.putFloat("$130", 200.000); // X-axis maximum travel, millimeters
-    myPrgVar.putFloat("$131", 200.000); // Y-axis maximum travel, millimeters
-    myPrgVar.putFloat("$132", 200.000); // Z-axis maximum travel, millimeters
-  }
-   myPrgVar.end();
-}
-
-//On connection to the server, the server will send the current GRBL settings to the client.
-void handleGrblStatus() {
-    myPrgVar.begin("GBRL", true);
-    
-    StaticJsonDocument<1024> response;
-    
-    response["$0"] = myPrgVar.getInt("$0");
-    response["$1"] = myPrgVar.getInt("$1");
-    response["$2"] = myPrgVar.getShort("$2");
-    response["$3"] = myPrgVar.getShort("$3");
-    response["$4"] = myPrgVar.getBool("$4");
-    response["$5"] = myPrgVar.getBool("$5");
-    response["$6"] = myPrgVar.getBool("$6");
-    response["$10"] = myPrgVar.getShort("$10");
-    response["$11"] = myPrgVar.getFloat("$11");
-    response["$12"] = myPrgVar.getFloat("$12");
-    response["$13"] = myPrgVar.getBool("$13");
-    response["$20"] = myPrgVar.getBool("$20");
-    response["$21"] = myPrgVar.getBool("$21");
-    response["$22"] = myPrgVar.getBool("$22");
-    response["$23"] = myPrgVar.getShort("$23");
-    response["$24"] = myPrgVar.getFloat("$24");
-    response["$25"] = myPrgVar.getFloat("$25");
-    response["$26"] = myPrgVar.getInt("$26");
-    response["$27"] = myPrgVar.getFloat("$27");
-    response["$30"] = myPrgVar.getInt("$30");
-    response["$31"] = myPrgVar.getInt("$31");
-    response["$32"] = myPrgVar.getBool("$32");
-    response["$100"] = myPrgVar.getFloat("$100");
-    response["$101"] = myPrgVar.getFloat("$101");
-    response["$102"] = myPrgVar.getFloat("$102");
-    response["$110"] = myPrgVar.getFloat("$110");
-    response["$111"] = myPrgVar.getFloat("$111");
-    response["$112"] = myPrgVar.getFloat("$112");
-    response["$120"] = myPrgVar.getFloat("$120");
-    response["$121"] = myPrgVar.getFloat("$121");
-    response["$122"] = myPrgVar.getFloat("$122");
-    response["$130"] = myPrgVar.getFloat("$130");
-    response["$131"] = myPrgVar.getFloat("$131");
-    response["$132"] = myPrgVar.getFloat("$132");
-    
+bool heightMapSave(){
+    myPrgVar.begin("leveling", false);
+    bool success = myPrgVar.putBytes("map", &heightMap, sizeof(HeightMap)) == sizeof(HeightMap);
+    success = myPrgVar.putBool("enabled", heightMapEnabled) > 0 && success;
     myPrgVar.end();
-    
-    String responseStr;
-    serializeJson(response, responseStr);
-    server.send(200, "application/json", responseStr);
+    return success;
 }
 
-//When the client sends a GRBL update, the server will update the GRBL settings with the new values.
-void handleGrblUpdate() {
-    if (server.hasArg("plain") == false) {
-        server.send(400, "application/json", "{\"error\": \"No data received\"}");
-        return;
+//Stage grid probing over grid - its x0, y0, spacing and point counts - probing up to distance mm from the current Z at
+//feed mm/min. Network task only.
+bool levelingBegin(const HeightMap &grid, float distance, float feed){
+    if (levelingPhase != LEVEL_IDLE || gcodeArc.active || gcodeProbing || motionBusy()) {
+        return false;
+    }
+    levelingMap = grid;
+    for (uint8_t i = 0; i < 3; i++) {
+        levelingStart[i] = gcodePosition[i];
     }
+    levelingDistance = distance;
+    levelingFeed = feed;
+    levelingPoint = 0;
+    levelingState = LEVELING_RUNNING;
+    levelingPhase = LEVEL_TRAVEL;
+    return true;
+}
 
-    String body = server.arg("plain");
-    StaticJsonDocument<200> doc;
-    DeserializationError error = deserializeJson(doc, body);
+//Position of the index-th point in probing order, at the starting Z. Every other row runs backwards so the tank never
+//crosses the whole grid between two points. Returns where the point goes in the map.
+uint16_t levelingPointAt(uint16_t index, float *point){
+    uint8_t row = index / levelingMap.nx;
+    uint8_t column = index % levelingMap.nx;
+    if (row & 1) {
+        column = levelingMap.nx - 1 - column;
+    }
+    point[0] = levelingMap.x0 + column * levelingMap.dx;
+    point[1] = levelingMap.y0 + row * levelingMap.dy;
+    point[2] = levelingStart[2];
+    return row * levelingMap.nx + column;
+}
 
-    if (error) {
-        server.send(400, "application/json", "{\"error\": \"Invalid JSON\"}");
+//One step of grid probing, each once the machine has finished the one before.
+void levelingService(){
+    if (levelingPhase == LEVEL_IDLE || motionBusy()) {
         return;
     }
-
-    if (!doc.containsKey("key") || !doc.containsKey("value") || !doc.containsKey("type")) {
-        server.send(400, "application/json", "{\"error\": \"Missing required parameters\"}");
+    float point[3];
+    switch (levelingPhase) {
+      case LEVEL_TRAVEL:
+        levelingPointAt(levelingPoint, point);
+        gcodeQueueLinear(point, 0);
+        levelingPhase = LEVEL_PROBE;
+        return;
+      case LEVEL_PROBE:
+        levelingProbeStart = zStepper->getCurrentPosition();
+        if (!probeCycleStart(levelingDistance, levelingFeed)) {
+          levelingFinish(false);
+          return;
+        }
+        levelingPhase = LEVEL_CONTACT;
+        return;
+      case LEVEL_CONTACT: {
+        uint8_t state = __atomic_load_n(&probeState, __ATOMIC_ACQUIRE);
+        if (state == PROBE_RUNNING) {
+          return;
+        }
+        float stepsPerMM = settings.stepsPerMM[2];
+        float contact = gcodePosition[2] + (probePosition - levelingProbeStart) / stepsPerMM;
+        gcodePosition[2] += (zStepper->getCurrentPosition() - levelingProbeStart) / stepsPerMM;
+        //Back up to the starting Z whether or not it touched.
+        uint16_t at = levelingPointAt(levelingPoint, point);
+        gcodeQueueLinear(point, 0);
+        if (state != PROBE_DONE) {
+          levelingFinish(false);
+          return;
+        }
+        levelingMap.z[at] = contact;
+        levelingPoint++;
+        levelingPhase = levelingPoint < levelingMap.nx * levelingMap.ny ? LEVEL_TRAVEL : LEVEL_RETURN;
+        return;
+      }
+      case LEVEL_RETURN:
+        gcodeQueueLinear(levelingStart, 0);
+        levelingPhase = LEVEL_FINISH;
+        return;
+      default:
+        levelingFinish(true);
         return;
     }
+}
 
-    const char* key = doc["key"];
-    const char* type = doc["type"];
-
-    myPrgVar.begin("GBRL", false);
-    
-    bool success = false;
-    if (strcmp(type, "int") == 0) {
-        success = myPrgVar.putInt(key, doc["value"].as<int>());
-    } else if (strcmp(type, "short") == 0) {
-        success = myPrgVar.putShort(key, doc["value"].as<short>());
-    } else if (strcmp(type, "bool") == 0) {
-        success = myPrgVar.putBool(key, doc["value"].as<bool>());
-    } else if (strcmp(type, "float") == 0) {
-        success = myPrgVar.putFloat(key, doc["value"].as<float>());
+//A complete grid replaces the height map, relative to its first point, and turns compensation on. A failed one leaves
+//the old map as it was.
+void levelingFinish(bool success){
+    levelingPhase = LEVEL_IDLE;
+    levelingState = success ? LEVELING_DONE : LEVELING_FAILED;
+    if (!success) {
+        sendConsoleMessage("warning", "Grid probing failed - height map unchanged");
+        return;
     }
-    
-    myPrgVar.end();
-
-    //In case any of the settings are updated, the accelerations need to be updated as well.
-    setAccelerations();
-    
-    if (success) {
-        StaticJsonDocument<200> response;
-        response["status"] = "success";
-        response[key] = doc["value"];
-        
-        String responseStr;
-        serializeJson(response, responseStr);
-        server.send(200, "application/json", responseStr);
-    } else {
-        server.send(500, "application/json", "{\"error\": \"Failed to update setting\"}");
+    float reference = levelingMap.z[0];
+    for (uint16_t i = 0; i < levelingMap.nx * levelingMap.ny; i++) {
+        levelingMap.z[i] -= reference;
+    }
+    heightMap = levelingMap;
+    heightMapValid = true;
+    heightMapEnabled = true;
+    heightMapBuild();
+    if (!heightMapSave()) {
+        sendConsoleMessage("warning", "Height map could not be saved");
     }
+    sendConsoleMessage("info", "Height map probed - Z compensation on");
 }
 
-void setAccelerations(){
-    //Capture the required parameters from the namespace, "GRBL"
-    myPrgVar.begin("GBRL", true);
-    //Four parameters - Xacceleration, Yacceleration, Zacceleration
-    float xAccel = myPrgVar.getFloat("$120");
-    float yAccel = myPrgVar.getFloat("$121");
-    float zAccel = myPrgVar.getFloat("$122");
-    myPrgVar.end();
-    //Set the accelerations for the steppers.
-    zStepper->setAcceleration(zAccel);
-    rightStepper->setAcceleration(yAccel);
-    leftStepper->setAcceleration(xAccel);
+//E-stop - drop grid probing where it is.
+void levelingStop(){
+    if (levelingPhase != LEVEL_IDLE) {
+        levelingPhase = LEVEL_IDLE;
+        levelingState = LEVELING_FAILED;
+    }
 }
 
-//TODO Function Needs to receive commands from the console and execute them. Expected to turn the robot in the direction specified by the command.
-//rates are based off the X GRBL data
-void handleControl() {
-    myPrgVar.begin("GBRL", true);
-    //Required parameters = X-Axis steps/mm, X max rate, Y-Axis steps/mm, Y max rate
-    float xSpeed = myPrgVar.getFloat("$110");
-    float xStepsPerMM = myPrgVar.getFloat("$100");
-    // float ySpeed = myPrgVar.getFloat("$111");
-    // float yStepsPerMM = myPrgVar.getFloat("$101");
-    myPrgVar.end();
-    
-    if (server.hasArg("plain") == false) {
-        server.send(400, "application/json", "{\"error\": \"No data received\"}");
-        return;
+//Accept the telemetry client, pick up interval changes and push a frame when one is due.
+void telemetryService(){
+    if (telemetryServer.hasClient()) {
+        if (telemetryClient) {
+            telemetryClient.stop();
+        }
+        telemetryClient = telemetryServer.accept();
+        telemetryClient.setNoDelay(true);
+        telemetryIntervalMs = telemetryDefaultIntervalMs;
+        telemetrySequence = 0;
     }
-    
-    String body = server.arg("plain");
-    StaticJsonDocument<200> doc;
-    DeserializationError error = deserializeJson(doc, body);
-    
-    if (error) {
-        server.send(400, "application/json", "{\"error\": \"Invalid JSON\"}");
+
+    if (!telemetryClient || !telemetryClient.connected()) {
         return;
     }
-    
-    //Serial.println(doc);
-    Serial.println(body);
 
-    int direction = doc["direction"];
-    int speed = doc["speed"];
-    int step = doc["step"];
+    while (telemetryClient.available() >= 2) {
+        uint16_t interval = telemetryClient.read();
+        interval |= telemetryClient.read() << 8;
+        telemetryIntervalMs = constrain(interval, telemetryMinIntervalMs, telemetryMaxIntervalMs);
+    }
 
-    if (speed == 0 ||
-        step == 0) {
-        server.send(400, "application/json", "{\"error\": \"Missing required parameters ESP32\"}");
+    uint32_t now = millis();
+    if (now - telemetryLastMs < telemetryIntervalMs) {
         return;
     }
-    
-    //Enforce maximum speed. (Based off left track for now.)
-    if(speed > xSpeed){
-      speed = xSpeed;
-    }
-
-    // Calculate steps based on direction
-    int leftSteps = 0;
-    int rightSteps = 0;
+    telemetryLastMs = now;
 
-    //Calculate the number of steps required for the left and right tracks.
-    step = round(step * xStepsPerMM);
-
-    //Calculate the delay between steps
-    speed = round((xStepsPerMM * speed) / 60);
-    
-    //Will need to add logic for the direction invert pin mask. For now, assume that the direction is correct.
-    switch (direction) {
-        case 0: // forward - both tracks forward at equal speed - if it doesn't go straight towards the motors - reverse the phases at the stepper driver.
-            leftSteps = rightSteps = -step;
-            break;
-        case 1: // backward - both tracks backward at equal speed
-            leftSteps = rightSteps = step;
-            break;
-        case 2: // forwardLeft - left track at half speed, right track at full speed
-            leftSteps = step/2;
-            rightSteps = step;
-            break;
-        case 3: // forwardRight - left track at full speed, right track at half speed
-            leftSteps = step;
-            rightSteps = step/2;
-            break;
-        case 4: // turnLeft - left track backward, right track forward (spin in place)
-            leftSteps = -step;
-            rightSteps = step;
-            break;
-        case 5: // turnRight - left track forward, right track backward (spin in place)
-            leftSteps = step;
-            rightSteps = -step;
-            break;
-        case 6: // backwardLeft - left track at half backward speed
-            leftSteps = -step;
-            rightSteps = -step/2;
-            break;
-        case 7: // backwardRight - right track at half backward speed
-            leftSteps = -step/2;
-            rightSteps = -step;
-            break;
-        default:
-            leftSteps = rightSteps = 0;
-            break;
+    uint8_t frame[telemetryFrameSize];
+    uint8_t length = buildTelemetryFrame(frame, now);
+    //A slow reader loses frames instead of stalling the loop - the next one carries fresh values anyway.
+    if (telemetryClient.availableForWrite() >= length) {
+        telemetryClient.write(frame, length);
     }
+}
 
-    // Execute movement
-    if (stepperController(leftSteps, rightSteps, 0, speed, speed, 0)) {
-        StaticJsonDocument<200> response;
-        response["status"] = "success";
-        response["direction"] = direction;
-        response["speed"] = speed;
-        response["step"] = step;
-        
-        String responseStr;
-        serializeJson(response, responseStr);
-        server.send(200, "application/json", responseStr);
-    } else {
-        server.send(500, "application/json", "{\"error\": \"Movement failed\"}");
+//Binary control service - assembles frames from the control client as bytes arrive and acks each one.
+void controlService(){
+    if (controlServer.hasClient()) {
+        if (controlClient) {
+            controlClient.stop();
+        }
+        controlClient = controlServer.accept();
+        controlClient.setNoDelay(true);
+        controlLength = 0;
+        controlSynced = false;
     }
-}
 
-void handleSpindleZDepth() {
-    myPrgVar.begin("GBRL", true);
-    //Four parameters - Zsteps/mm, Zmax rate, zAccleration, z max travel, soft limits
-    float zSpeed = myPrgVar.getFloat("$112");
-    float zStepsPerMM = myPrgVar.getFloat("$102");
-    float zAccel = myPrgVar.getFloat("$122");
-    float zMaxTravel = myPrgVar.getFloat("$132");
-    bool softLimits = myPrgVar.getBool("$20");
-    myPrgVar.end();
-    if (server.hasArg("plain") == false) {
-        server.send(400, "application/json", "{\"error\": \"No data received\"}");
+    if (!controlClient || !controlClient.connected()) {
         return;
     }
 
-    String body = server.arg("plain");
-    StaticJsonDocument<200> doc;
-    DeserializationError error = deserializeJson(doc, body);
+    while (controlClient.available()) {
+        //Hunt for the magic byte, then read the header, then the payload and CRC.
+        if (controlLength == 0) {
+            if (controlClient.read() == controlMagic) {
+                controlFrame[controlLength++] = controlMagic;
+            }
+            continue;
+        }
+        if (controlLength >= controlHeaderSize && controlFrame[4] > controlMaxPayload) {
+            controlLength = 0; //Not a frame we could have been sent - resync
+            continue;
+        }
+        uint8_t frameLength = controlLength < controlHeaderSize ? controlHeaderSize : controlHeaderSize + controlFrame[4] + 4;
+        int got = controlClient.read(&controlFrame[controlLength], frameLength - controlLength);
+        if (got <= 0) {
+            break;
+        }
+        controlLength += got;
+        if (controlLength >= controlHeaderSize && controlLength == controlHeaderSize + controlFrame[4] + 4) {
+            controlHandleFrame();
+            controlLength = 0;
+        }
+    }
+}
 
-    if (error) {
-        server.send(400, "application/json", "{\"error\": \"Invalid JSON\"}");
+//Check a complete frame's CRC and sequence number, run it and ack it.
+void controlHandleFrame(){
+    uint8_t opcode = controlFrame[1];
+    uint16_t sequence;
+    memcpy(&sequence, &controlFrame[2], 2);
+    uint8_t length = controlFrame[4];
+    uint32_t crc;
+    memcpy(&crc, &controlFrame[controlHeaderSize + length], 4);
+    if (esp_rom_crc32_le(0, controlFrame, controlHeaderSize + length) != crc) {
+        controlAck(opcode, sequence, CONTROL_BAD_CRC);
         return;
     }
-    
-    int speed = doc["speed"];
-    int step = doc["step"];
-    
-    if (speed == 0 || step == 0) {
-        server.send(400, "application/json", "{\"error\": \"Missing keys\"}");
+
+    int16_t ahead = sequence - controlLastSequence;
+    if (controlSynced && ahead == 0) {
+        controlAck(opcode, sequence, controlLastStatus);
         return;
     }
-    
-    //Enforce soft limits if enabled.
-    if(softLimits){
-      if((step * zStepsPerMM) > (zMaxTravel * zStepsPerMM)){
-        server.send(400, "application/json", "{\"error\": \"Z depth exceeds maximum travel\"}");
+    if (controlSynced && ahead < 0) {
+        controlAck(opcode, sequence, CONTROL_STALE);
         return;
-      }
     }
+    bool gap = controlSynced && ahead > 1;
+    controlSynced = true;
+    controlLastSequence = sequence;
 
-    //Enforce maximum speed.
-    if(speed > zSpeed){
-      speed = zSpeed;
+    uint8_t status = controlRun(opcode, &controlFrame[controlHeaderSize], length);
+    if (status == CONTROL_OK && gap) {
+        status = CONTROL_GAP;
     }
+    controlLastStatus = status;
+    controlAck(opcode, sequence, status);
+}
 
-    //Determine period for the step delay
-    speed = round((zStepsPerMM * speed) / 60);
-
-    //Determine the actual number of steps required:
-    step = round(step * zStepsPerMM);
-
-    //Run the stepper control function.
-    stepperController(0, 0, step, 0, 0, speed);
+//Carry out one command. Moves go through the same planners and queue as the REST handlers.
+uint8_t controlRun(uint8_t opcode, const uint8_t *payload, uint8_t length){
+    MotionSegment segment;
+    float values[3];
+    switch (opcode) {
+    case CONTROL_PING:
+        return CONTROL_OK;
+    case CONTROL_JOG:
+        if (length != 9) return CONTROL_BAD_PAYLOAD;
+        memcpy(values, &payload[1], 8);
+        if (values[1] == 0 || !planTrackSegment(payload[0], values[0], values[1], segment)) {
+            return CONTROL_REJECTED;
+        }
+        break;
+    case CONTROL_MOVE:
+        if (length != 12) return CONTROL_BAD_PAYLOAD;
+        memcpy(values, payload, 12);
+        if (values[2] <= 0 || !kinematicsPlan(values[0], values[1] * DEG_TO_RAD, 0, values[2], segment, NULL)) {
+            return CONTROL_REJECTED;
+        }
+        break;
+    case CONTROL_Z:
+        if (length != 8) return CONTROL_BAD_PAYLOAD;
+        memcpy(values, payload, 8);
+        if (!planZSegment(values[0], values[1], segment)) {
+            return CONTROL_REJECTED;
+        }
+        break;
+    case CONTROL_STOP:
+        gcodeArc.active = false;
+        levelingStop();
+        motionRequestStop();
+        sendConsoleMessage("warning", "Emergency stop - motion halted and queue cleared");
+        return CONTROL_OK;
+    case CONTROL_SPINDLE:
+        if (length != 2 || (payload[1] > 100 && payload[1] != 255)) return CONTROL_BAD_PAYLOAD;
+        //Same as /api/spindle/speed - no spindle in laser mode, the relay included.
+        if (settings.laserMode) return CONTROL_REJECTED;
+        digitalWrite(spindleEnb, payload[0] ? HIGH : LOW);
+        if (payload[1] != 255) {
+            spindleWrite(map(payload[1], 0, 100, 0, 255));
+        }
+        return CONTROL_OK;
+    case CONTROL_LASER:
+        if (length != 1) return CONTROL_BAD_PAYLOAD;
+        if (settings.laserMode) return CONTROL_REJECTED;
+        digitalWrite(laser, payload[0] ? HIGH : LOW);
+        return CONTROL_OK;
+    case CONTROL_JOG_VELOCITY:
+        if (length != 5) return CONTROL_BAD_PAYLOAD;
+        memcpy(values, &payload[1], 4);
+        if (values[0] < 0 || (values[0] > 0 && payload[0] > 7) || !jogRequest(payload[0], values[0])) {
+            return CONTROL_REJECTED;
+        }
+        return CONTROL_OK;
+    case CONTROL_HOLD:
+        return feedHold() ? CONTROL_OK : CONTROL_QUEUE_FULL;
+    case CONTROL_RESUME:
+        return cycleStart() ? CONTROL_OK : CONTROL_QUEUE_FULL;
+    case CONTROL_OVERRIDE:
+        if (length != 2) return CONTROL_BAD_PAYLOAD;
+        if (payload[0]) setFeedOverride(payload[0]);
+        if (payload[1]) setSpindleOverride(payload[1]);
+        return CONTROL_OK;
+    default:
+        return CONTROL_BAD_OPCODE;
+    }
+    if (envelopeCheck(&segment, 1) != -1) {
+        return CONTROL_REJECTED;
+    }
+    return motionQueuePush(segment) ? CONTROL_OK : CONTROL_QUEUE_FULL;
+}
 
-    StaticJsonDocument<200> response;
-    response["status"] = "success";
-    
-    String responseStr;
-    serializeJson(response, responseStr);
-    server.send(200, "application/json", responseStr);
+void controlAck(uint8_t opcode, uint16_t sequence, uint8_t status){
+    uint8_t ack[controlHeaderSize + 2 + 4];
+    ack[0] = controlMagic;
+    ack[1] = opcode | controlAckFlag;
+    memcpy(&ack[2], &sequence, 2);
+    ack[4] = 2;
+    ack[5] = status;
+    ack[6] = min(motionQueueFree(), (uint16_t)255);
+    uint32_t crc = esp_rom_crc32_le(0, ack, controlHeaderSize + 2);
+    memcpy(&ack[controlHeaderSize + 2], &crc, 4);
+    controlClient.write(ack, sizeof(ack));
 }
 
-void handleHoming() {
-    StaticJsonDocument<200> response;
+//Fill frame with the current machine state and return its length. See the layout next to telemetryMagic.
+uint8_t buildTelemetryFrame(uint8_t *frame, uint32_t now){
+    uint8_t flags = 0;
+    if (settings.statusReportMask & 0x01) flags |= telemetryFlagPositions | telemetryFlagPose;
+    if (settings.statusReportMask & 0x02) flags |= telemetryFlagBuffer;
 
-    // Send initial status
-    sendConsoleMessage("info", "Starting Z-axis homing sequence...");
+    uint8_t pins = 0;
+    if (digitalRead(zEndStop)) pins |= telemetryPinEndStop;
+    if (digitalRead(zProbe)) pins |= telemetryPinProbe;
+    if (digitalRead(spindleEnb)) pins |= telemetryPinSpindle;
+    if (zHomed) pins |= telemetryPinHomed;
 
-    // Run zHoming and check for failures
-    if (!zHoming()) {
-        response["error"] = "Z-axis homing failed. Check hardware and settings.";
-        String responseStr;
-        serializeJson(response, responseStr);
-        server.send(500, "application/json", responseStr);
-        return;
-    }
+    frame[0] = telemetryMagic;
+    frame[1] = telemetryVersion;
+    frame[3] = flags;
+    memcpy(&frame[4], &telemetrySequence, 2);
+    memcpy(&frame[6], &now, 4);
+    frame[10] = motionState;
+    frame[11] = pins;
+    frame[12] = ledcRead(spindlePWM);
+    uint8_t length = 13;
 
-    // Success response
-    response["status"] = "success";
-    response["message"] = "Z-axis homing completed successfully";
-    
-    String responseStr;
-    serializeJson(response, responseStr);
-    server.send(200, "application/json", responseStr);
-    
-    // Notify client of success
-    sendConsoleMessage("success", "Z-axis homing completed");
-}
-
-//Function needs to accept the axis of movement indicated by > 0, and the speed in Us for that axis...
-//Might require a period master argument as well to determine blocking based off of period instead of distance. 
-bool stepperController(int leftSteps, int rightSteps, int zSteps, int leftPeriod, int rightPeriod, int zPeriod){
-    //Configure speeds for the steppers.
-    zStepper->setSpeedInHz(zPeriod);
-    leftStepper->setSpeedInHz(leftPeriod);
-    rightStepper->setSpeedInHz(rightPeriod);
-    //Acclerations should be constant...
-    //Check for the maximum number of steps to be the blocking variable. Left and Right should move together. In case left has the most steps:
-    if(abs(leftSteps) > abs(rightSteps) && abs(leftSteps) > abs(zSteps)){
-      zStepper->move(zSteps);
-      rightStepper->move(rightSteps);
-      leftStepper->move(leftSteps, true);
-    //In case right has most number of steps
-    }else if(abs(rightSteps) > abs(leftSteps) && abs(rightSteps) > abs(zSteps)){
-      zStepper->move(zSteps);
-      leftStepper->move(leftSteps);
-      rightStepper->move(rightSteps, true);
-    //In case of Z requiring the most steps:
-    }else if(abs(zSteps) > abs(leftSteps) && abs(zSteps) > abs(rightSteps)){
-      rightStepper->move(rightSteps);
-      leftStepper->move(leftSteps);
-      zStepper->move(zSteps, true);
-    //Off chance that all three steppers have equal steps to perform. Default to Z being blocking.
-    }else{
-      rightStepper->move(rightSteps);
-      leftStepper->move(leftSteps);
-      zStepper->move(zSteps, true);
+    if (flags & telemetryFlagPositions) {
+        int32_t positions[3] = {leftStepper->getCurrentPosition(), rightStepper->getCurrentPosition(), zStepper->getCurrentPosition()};
+        memcpy(&frame[length], positions, sizeof(positions));
+        length += sizeof(positions);
+    }
+    if (flags & telemetryFlagBuffer) {
+        uint16_t queued = motionQueueCount();
+        uint16_t free = motionQueueFree();
+        memcpy(&frame[length], &queued, 2);
+        memcpy(&frame[length + 2], &free, 2);
+        memcpy(&frame[length + 4], &segmentsCompleted, 4);
+        length += 8;
+    }
+    if (flags & telemetryFlagPose) {
+        int32_t pose[3];
+        odometryRead(pose);
+        memcpy(&frame[length], pose, sizeof(pose));
+        length += sizeof(pose);
     }
 
-    return true; //Indicates that all blocking functions have completed.
-
-}
-
-
-bool zHoming(){
-  //Capture the required parameters from the namespace, "GRBL"
-  myPrgVar.begin("GBRL", true);
-  //Four parameters - Zsteps/mm, Homing speed in US, zAccleration, Homing Pull Off
-  float zHomingSpeed = myPrgVar.getFloat("$24");
-  float zStepsPerMM = myPrgVar.getFloat("$102");
-  float zStepOff = myPrgVar.getFloat("$27");
-  float zAccel = myPrgVar.getFloat("$122");
-  int zDebounce = myPrgVar.getInt("$26");
-  myPrgVar.end();
-  //Check for any zero values implying that something is incorrect with GRBL
-  if(zHomingSpeed == 0.0, zStepsPerMM == 0.0, zStepOff == 0.0, zAccel == 0.0){
-    return false;
-  }else{
-    //Calculate steps needed per second: steps/mm * mm/min = steps required per minute / 60 seconds/min = steps per second (Hz)
-    zHomingSpeed = (zStepsPerMM * zHomingSpeed) / 60;
-    //Calculate steps needed to meet the pull-off distance: steps required = zStepOff * zStepsPerMM
-    zStepOff = zStepsPerMM * zStepOff;
-  }
-  //Set speed variables.
-  zStepper->setSpeedInHz(round(zHomingSpeed));
-  zStepper->setAcceleration(zAccel);
-  //Replace with desired ISR and ONLOW mode.
-  attachInterrupt(zEndStop, homingStop, ONLOW);
-  //Run backwards until limit is triggered
-  zStepper->runBackward();
-  while(!homeStop);
-  //Finish stepping.
-  zStepper->forceStop();
-  digitalWrite(zStepperEnb, LOW);
-  Serial.println("ISR Fired");
-  //Step off the endstop until trigger goes high
-  delay(zDebounce);
-  do{
-    zStepper->forwardStep(true);
-  }while(digitalRead(zEndStop) == 0);
-  //Finish stepping
-  digitalWrite(zStepperEnb, LOW);
-  zStepper->forceStop();
-  //Make homing pull off blocking so function does not advance.
-  zStepper->move(zStepOff, true);
-  zStepper->setCurrentPosition(0);
-  //TO-DO: Attach danger interrupt if required
-  //Allow outside functions to know safety is complete.
-  homeStop = false;
-  return true;
+    frame[2] = length;
+    telemetrySequence++;
+    return length;
 }
 
 // Main Setup
@@ -850,6 +4154,17 @@ void setup() {
 
     //Configure Analogwrite Fucntionality
     ledcAttach(spindlePWM, analogFreq, analogRes);
+
+    //Laser power timer - idles until $32 is on.
+    const esp_timer_create_args_t laserTimerArgs = {
+        .callback = &laserService,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "laser",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&laserTimerArgs, &laserTimer);
+    esp_timer_start_periodic(laserTimer, laserUpdateUs);
     
     // For tethered debugging
     Serial.begin(115200);
@@ -900,8 +4215,6 @@ void setup() {
       }
     }
 
-    setAccelerations();
-
     //Retrieve network credentials for network.
     myPrgVar.begin("credentials", true);
     ssid = myPrgVar.getString("ssid", "");
@@ -915,6 +4228,8 @@ void setup() {
 
     //Test for the existance of and/or create the GRBL variable map. Seperate function.
     handleGrblSetup();
+    heightMapLoad();
+    applySettings();
 
     //Run wifi. 
     WiFi.mode(WIFI_AP_STA);
@@ -935,31 +4250,90 @@ void setup() {
     server.on("/api/status", HTTP_GET, handleStatus);
     server.on("/api/config/grbl", HTTP_GET, handleGrblStatus);
     server.on("/api/config/grbl", HTTP_POST, handleGrblUpdate);
+    server.on("/api/config/grbl/bulk", HTTP_POST, handleGrblBulkUpdate);
     server.on("/api/test-data", HTTP_GET, handleTestData);
     server.on("/api/control", HTTP_POST, handleControl);
+    server.on("/api/control/batch", HTTP_POST, handleControlBatch);
+    server.on("/api/control/jog", HTTP_POST, handleJog);
+    server.on("/api/control/hold", HTTP_POST, handleFeedHold);
+    server.on("/api/control/resume", HTTP_POST, handleCycleStart);
+    server.on("/api/control/override", HTTP_POST, handleOverride);
+    server.on("/api/status/busy", HTTP_GET, handleBusy);
+    server.on("/api/status/pose", HTTP_GET, handlePose);
+    server.on("/api/status/pose", HTTP_POST, handlePoseUpdate);
     server.on("/api/laser", HTTP_POST, handleLaser);
     server.on("/api/spindle", HTTP_POST, handleSpindle);
     server.on("/api/spindle/speed", HTTP_POST, handleSpindleSpeed);
     server.on("/api/spindle/depth", HTTP_POST, handleSpindleZDepth);
     server.on("/api/control/zhome", HTTP_POST, handleHoming);
+    server.on("/api/control/probe", HTTP_POST, handleProbe);
+    server.on("/api/status/probe", HTTP_GET, handleProbeStatus);
+    server.on("/api/control/leveling", HTTP_POST, handleLevelingProbe);
+    server.on("/api/status/leveling", HTTP_GET, handleLeveling);
+    server.on("/api/status/leveling", HTTP_POST, handleLevelingUpdate);
+    server.on("/api/control/estop", HTTP_POST, handleEstop);
     
-    // OTA Update endpoints
-    server.on("/update", HTTP_GET, handleUpdate);
-    server.on("/update", HTTP_POST, handleUpdatePost, handleUpdateUpload);
-
-    // OTA Tunnel endpoints - via React frontend
+    // OTA Update endpoints - chunked and resumable, via the server
     server.on("/api/update", HTTP_GET, handleApiUpdateGet);
-    server.on("/api/update", HTTP_POST, handleApiUpdatePost, handleTunnelUpdate);
+    server.on("/api/update/begin", HTTP_POST, handleOtaBegin);
+    server.on("/api/update/chunk", HTTP_POST, handleOtaChunk, handleOtaChunkUpload);
+    server.on("/api/update/commit", HTTP_POST, handleOtaCommit);
+    server.on("/api/update/abort", HTTP_POST, handleOtaAbort);
+    server.on("/api/update/status", HTTP_GET, handleOtaStatus);
     
     server.begin();
     MDNS.addService("http", "tcp", 80);
+
+    gcodeServer.begin();
+    gcodeServer.setNoDelay(true);
+    MDNS.addService("telnet", "tcp", gcodePort);
+
+    telemetryServer.begin();
+
+    controlServer.begin();
+    controlServer.setNoDelay(true);
+
+    //Console messages go out from core 0 alongside the WiFi stack, away from the loop.
+    xTaskCreatePinnedToCore(consoleTask, "console", 6144, NULL, 1, &consoleTaskHandle, 0);
+    //Flash writes for chunked OTA share the console's low priority.
+    xTaskCreatePinnedToCore(otaTask, "ota", 4096, NULL, 1, &otaTaskHandle, 0);
+
+    odometryBuildSine();
+    //Steppers on core 1, everything that talks to the network on core 0.
+    xTaskCreatePinnedToCore(motionTask, "motion", motionTaskStack, NULL, motionTaskPriority, &motionTaskHandle, 1);
+    xTaskCreatePinnedToCore(networkTask, "network", networkTaskStack, NULL, networkTaskPriority, &networkTaskHandle, 0);
     
     Serial.println("Server started on host: " + WiFi.localIP().toString());
     Serial.printf("OTA Updates available at http://%s.local/update\n", host);
 
 }
 
-// Main Loop
+//Motion task - commands, planning and the executor. Wakes straight away for new work or an e-stop, otherwise once
+//a tick to watch the steppers.
+void motionTask(void *parameter) {
+    for (;;) {
+        motionCommandService();
+        plannerService();
+        motionService();
+        odometryService();
+        ulTaskNotifyTake(pdTRUE, 1);
+    }
+}
+
+//Network task - binary control, HTTP requests, the G-code stream, grid probing and telemetry. A slow client or a big JSON body only
+//ever delays this task.
+void networkTask(void *parameter) {
+    for (;;) {
+        controlService();
+        server.handleClient();
+        gcodeService();
+        levelingService();
+        telemetryService();
+        vTaskDelay(1);
+    }
+}
+
+// Main Loop - all the work happens in motionTask and networkTask.
 void loop() {
-    server.handleClient();
+    vTaskDelete(NULL);
 }
\ No newline at end of file
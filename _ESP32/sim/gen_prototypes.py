@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+"""Mimic the Arduino builder: emit the sketch with prototypes for every top-level function inserted ahead of the
+first function definition, so functions can be called before they are defined."""
+import re
+import sys
+
+KEYWORDS = {"if", "while", "for", "switch", "return", "else", "do", "case", "sizeof"}
+DEF = re.compile(r"^([A-Za-z_][\w\s\*&:<>,]*?[\s\*&])(\w+)\s*\(([^;{}]*)\)\s*(const)?\s*\{")
+
+
+def main(src, dst):
+    text = open(src).read()
+    lines = text.split("\n")
+    depth = 0
+    protos = []
+    first = None
+    in_raw = False
+    in_block_comment = False
+    for i, line in enumerate(lines):
+        stripped = line.strip()
+        if in_raw:
+            if ')"' in line:
+                in_raw = False
+            continue
+        if in_block_comment:
+            if "*/" in line:
+                in_block_comment = False
+            continue
+        if stripped.startswith("/*") and "*/" not in stripped:
+            in_block_comment = True
+            continue
+        if depth == 0 and not line.startswith((" ", "\t", "#", "//")):
+            # Join continuation lines for multi-line signatures.
+            sig = line
+            j = i
+            while "{" not in sig and ";" not in sig and j + 1 < len(lines) and j - i < 4:
+                j += 1
+                sig += " " + lines[j].strip()
+            m = DEF.match(sig)
+            if m and m.group(2) not in KEYWORDS and not m.group(1).strip().startswith(("struct", "class", "enum", "typedef", "namespace", "return", "else")):
+                protos.append("%s%s(%s)%s;" % (m.group(1), m.group(2), m.group(3), " const" if m.group(4) else ""))
+                if first is None:
+                    first = i
+        code = re.sub(r"//.*", "", line)
+        code = re.sub(r'"(\\.|[^"\\])*"', '""', code)
+        code = re.sub(r"'(\\.|[^'\\])'", "''", code)
+        if 'R"(' in code and ')"' not in code:
+            in_raw = True
+        depth += code.count("{") - code.count("}")
+    if first is None:
+        first = 0
+    out = lines[:first] + ["//Generated prototypes"] + protos + ['#line %d "%s"' % (first + 1, src)] + lines[first:]
+    open(dst, "w").write("\n".join(out))
+
+
+if __name__ == "__main__":
+    main(sys.argv[1], sys.argv[2])
@@ -0,0 +1,179 @@
+/*
+    Motion benchmark. Streams each G-code file over the port 23 socket with the same 1024 byte window the server
+    uses, then reports machine time for the job, time the tracks spent stopped, segment throughput, peak queue depth
+    and the time from sending each line to its "ok". Every figure comes from the virtual clock, so runs are
+    repeatable and can be compared against a saved baseline.
+    Usage: bench [--out results.csv] [--baseline baseline.csv] file.nc [file.nc ...]
+*/
+#include "scenario.h"
+#include "WiFi.h"
+
+#include <deque>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+uint16_t motionQueueCount();
+extern uint32_t segmentsCompleted;
+
+#define streamWindow 1024 //Matches STREAM_WINDOW in server/src/utils/GcodeStream.js
+
+struct BenchResult {
+    std::string name;
+    double jobS;
+    double stoppedS;
+    double segmentsPerS;
+    double peakQueue;
+    double ackP50Ms;
+    double ackP95Ms;
+    double ackMaxMs;
+};
+
+static const char* resultColumns = "file,job_s,stopped_s,segments_per_s,peak_queue,ack_p50_ms,ack_p95_ms,ack_max_ms";
+
+//Sampled on every tick of the virtual clock while a job runs.
+static bool sampling = false;
+static uint64_t lastSampleUs = 0;
+static uint64_t stoppedUs = 0;
+static uint16_t peakQueue = 0;
+
+static void sample(uint64_t now) {
+    if (sampling) {
+        bool moving = false;
+        for (uint8_t pin : {simLeftPin, simRightPin, simZPin})
+            moving |= simStepperOnPin(pin)->getCurrentSpeedInMilliHz() != 0;
+        if (!moving) stoppedUs += now - lastSampleUs;
+        peakQueue = std::max(peakQueue, motionQueueCount());
+    }
+    lastSampleUs = now;
+}
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+static BenchResult runFile(const char* path, std::shared_ptr<SimSocket> gcode) {
+    std::ifstream in(path);
+    CHECK(in.good(), "cannot open %s", path);
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(in, line);) lines.push_back(line);
+
+    std::deque<std::pair<size_t, uint64_t>> inFlight; //Line length and send time, oldest first
+    size_t inFlightBytes = 0, next = 0, acknowledged = 0;
+    std::vector<double> ackMs;
+    std::string reply;
+    int errors = 0;
+
+    uint32_t segmentsBefore = segmentsCompleted;
+    stoppedUs = 0;
+    peakQueue = 0;
+    sampling = true;
+    uint64_t start = simNowMicros();
+
+    while (acknowledged < lines.size()) {
+        while (next < lines.size() && (inFlight.empty() || inFlightBytes + lines[next].size() + 1 <= streamWindow)) {
+            for (char c : lines[next]) gcode->toDevice.push_back(c);
+            gcode->toDevice.push_back('\n');
+            inFlight.push_back({lines[next].size() + 1, simNowMicros()});
+            inFlightBytes += lines[next].size() + 1;
+            next++;
+        }
+        simAdvance(100);
+        while (!gcode->fromDevice.empty()) {
+            char c = gcode->fromDevice.front();
+            gcode->fromDevice.pop_front();
+            if (c != '\n') {
+                if (c != '\r') reply += c;
+                continue;
+            }
+            if (reply.empty() || inFlight.empty()) continue;
+            if (reply != "ok") errors++;
+            ackMs.push_back((simNowMicros() - inFlight.front().second) / 1000.0);
+            inFlightBytes -= inFlight.front().first;
+            inFlight.pop_front();
+            acknowledged++;
+            reply.clear();
+        }
+    }
+    CHECK(runUntilIdle(3600000), "%s: machine never went idle", path);
+    sampling = false;
+    CHECK(errors == 0, "%s: %d lines rejected", path, errors);
+
+    std::string name = path;
+    name = name.substr(name.find_last_of('/') + 1);
+    double jobS = (simNowMicros() - start) / 1e6;
+    return {name, jobS, stoppedUs / 1e6, (segmentsCompleted - segmentsBefore) / jobS, (double)peakQueue,
+            percentile(ackMs, 0.5), percentile(ackMs, 0.95), percentile(ackMs, 1.0)};
+}
+
+static std::string formatResult(const BenchResult& r) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s,%.6f,%.6f,%.6f,%.0f,%.3f,%.3f,%.3f", r.name.c_str(), r.jobS, r.stoppedS,
+             r.segmentsPerS, r.peakQueue, r.ackP50Ms, r.ackP95Ms, r.ackMaxMs);
+    return buf;
+}
+
+static std::map<std::string, std::vector<double>> readBaseline(const char* path) {
+    std::map<std::string, std::vector<double>> rows;
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line); //Header
+    while (std::getline(in, line)) {
+        std::stringstream fields(line);
+        std::string name, field;
+        std::getline(fields, name, ',');
+        while (std::getline(fields, field, ',')) rows[name].push_back(atof(field.c_str()));
+    }
+    return rows;
+}
+
+int main(int argc, char** argv) {
+    const char* outPath = nullptr;
+    const char* baselinePath = nullptr;
+    std::vector<const char*> files;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--out") && i + 1 < argc) outPath = argv[++i];
+        else if (!strcmp(argv[i], "--baseline") && i + 1 < argc) baselinePath = argv[++i];
+        else files.push_back(argv[i]);
+    }
+
+    simAddTickHook(sample);
+    bootMachine();
+    auto gcode = simConnect(23);
+    while (gcode->fromDevice.empty()) simAdvance(100);
+    gcode->fromDevice.clear(); //Greeting
+
+    std::vector<BenchResult> results;
+    for (const char* path : files) results.push_back(runFile(path, gcode));
+
+    printf("%-20s %10s %10s %8s %6s %9s %9s %9s\n", "file", "job s", "stopped s", "seg/s", "queue", "ack p50", "ack p95",
+           "ack max");
+    auto baseline = baselinePath ? readBaseline(baselinePath) : std::map<std::string, std::vector<double>>();
+    for (auto& r : results) {
+        printf("%-20s %10.3f %10.3f %8.2f %6.0f %9.2f %9.2f %9.2f\n", r.name.c_str(), r.jobS, r.stoppedS,
+               r.segmentsPerS, r.peakQueue, r.ackP50Ms, r.ackP95Ms, r.ackMaxMs);
+        auto it = baseline.find(r.name);
+        if (it == baseline.end() || it->second.size() < 7) continue;
+        const double now[7] = {r.jobS, r.stoppedS, r.segmentsPerS, r.peakQueue, r.ackP50Ms, r.ackP95Ms, r.ackMaxMs};
+        printf("%-20s", "  vs baseline");
+        for (int i = 0; i < 7; i++) {
+            double was = it->second[i];
+            if (was == 0) printf(" %9s", now[i] == 0 ? "=" : "new");
+            else printf(" %+8.1f%%", 100.0 * (now[i] - was) / was);
+        }
+        printf("\n");
+    }
+
+    if (outPath) {
+        FILE* f = fopen(outPath, "w");
+        CHECK(f != nullptr, "cannot write %s", outPath);
+        if (f) {
+            fprintf(f, "%s\n", resultColumns);
+            for (auto& r : results) fprintf(f, "%s\n", formatResult(r).c_str());
+            fclose(f);
+        }
+    }
+    return finishScenario("bench");
+}
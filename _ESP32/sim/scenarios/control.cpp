@@ -0,0 +1,139 @@
+/*
+    Drives the REST motion handlers the way the server does and checks where the steppers end up:
+    /api/control (jog directions, kinematic moves and axis coordination), /api/spindle/depth (Z), /api/control/zhome (homing against a modelled switch)
+    and /api/control/estop, plus a run of short G-code moves that must not drift from the programmed length.
+*/
+#include "scenario.h"
+
+int main() {
+    //Z endstop (pin 35) closes 8 mm below the start position, probe (pin 34) never triggers.
+    simSetInputModel(zSwitches(-2000, INT32_MAX));
+    bootMachine();
+
+    SimResponse r = request(HTTP_GET, "/api/config/grbl");
+    StaticJsonDocument<2048> grbl;
+    deserializeJson(grbl, r.body);
+    double trackStepsPerMM = grbl["$100"] | 0.0;
+    double zStepsPerMM = grbl["$102"] | 0.0;
+    CHECK(trackStepsPerMM > 0 && zStepsPerMM > 0, "settings missing from %s", r.body.c_str());
+
+    //Forward 2 mm - both tracks turn the same way by the same amount.
+    r = request(HTTP_POST, "/api/control", "{\"direction\":0,\"speed\":500,\"step\":2}");
+    CHECK(r.code == 200, "control rejected");
+    CHECK(runUntilIdle(10000), "forward move never finished");
+    int32_t expected = -lround(2 * trackStepsPerMM);
+    CHECK(stepperPosition(simLeftPin) == expected && stepperPosition(simRightPin) == expected,
+          "tracks at %d/%d, expected %d", stepperPosition(simLeftPin), stepperPosition(simRightPin), expected);
+
+    //Spin in place - tracks turn opposite ways.
+    int32_t left = stepperPosition(simLeftPin), right = stepperPosition(simRightPin);
+    r = request(HTTP_POST, "/api/control", "{\"direction\":4,\"speed\":500,\"step\":1}");
+    CHECK(r.code == 200, "turn rejected");
+    CHECK(runUntilIdle(10000), "turn never finished");
+    int32_t turn = lround(trackStepsPerMM);
+    CHECK(stepperPosition(simLeftPin) - left == -turn && stepperPosition(simRightPin) - right == turn,
+          "turn moved %d/%d", stepperPosition(simLeftPin) - left, stepperPosition(simRightPin) - right);
+
+    r = request(HTTP_POST, "/api/control", "{\"direction\":9,\"speed\":500,\"step\":1}");
+    CHECK(r.code == 400, "unknown direction accepted");
+    r = request(HTTP_POST, "/api/control", "{\"direction\":0,\"speed\":-500,\"step\":1}");
+    CHECK(r.code == 400, "negative speed accepted");
+    r = request(HTTP_POST, "/api/control", "{\"direction\":0,\"speed\":500,\"step\":0.0001}");
+    CHECK(r.code == 400 && !machineBusy(), "move under one step accepted");
+
+    //Kinematic forms - a quarter turn about the centre, then 10 mm from body velocities.
+    double trackWidth = grbl["$140"] | 0.0;
+    left = stepperPosition(simLeftPin), right = stepperPosition(simRightPin);
+    r = request(HTTP_POST, "/api/control", "{\"distance\":0,\"turn\":90,\"speed\":500}");
+    CHECK(r.code == 200, "turn by angle rejected");
+    CHECK(runUntilIdle(60000), "turn by angle never finished");
+    turn = lround(PI / 2 * trackWidth / 2 * trackStepsPerMM);
+    CHECK(stepperPosition(simLeftPin) - left == -turn && stepperPosition(simRightPin) - right == turn,
+          "quarter turn moved %d/%d, expected -/+%d", stepperPosition(simLeftPin) - left,
+          stepperPosition(simRightPin) - right, turn);
+    left = stepperPosition(simLeftPin), right = stepperPosition(simRightPin);
+    r = request(HTTP_POST, "/api/control", "{\"v\":300,\"omega\":0,\"duration\":2}");
+    CHECK(r.code == 200, "velocity move rejected");
+    CHECK(runUntilIdle(10000), "velocity move never finished");
+    expected = -lround(10 * trackStepsPerMM);
+    CHECK(stepperPosition(simLeftPin) - left == expected && stepperPosition(simRightPin) - right == expected,
+          "velocity move went %d/%d", stepperPosition(simLeftPin) - left, stepperPosition(simRightPin) - right);
+
+    //A curve runs the tracks at different rates - coordinated, each track is the same fraction of the way through
+    //its steps at any moment, so the halfway points and the ends line up.
+    FastAccelStepper* leftTrack = simStepperOnPin(simLeftPin);
+    FastAccelStepper* rightTrack = simStepperOnPin(simRightPin);
+    leftTrack->simClearTrace();
+    rightTrack->simClearTrace();
+    r = request(HTTP_POST, "/api/control", "{\"distance\":40,\"turn\":10,\"speed\":300}");
+    CHECK(r.code == 200, "curve rejected");
+    CHECK(runUntilIdle(20000), "curve never finished");
+    const std::vector<SimStepEvent>& leftSteps = leftTrack->simTrace();
+    const std::vector<SimStepEvent>& rightSteps = rightTrack->simTrace();
+    CHECK(leftSteps.size() > 100 && rightSteps.size() > 100 && leftSteps.size() != rightSteps.size(),
+          "curve moved %zu/%zu steps", leftSteps.size(), rightSteps.size());
+    double duration = leftSteps.back().timeUs - leftSteps.front().timeUs;
+    double halfSkew = (double)leftSteps[leftSteps.size() / 2].timeUs - rightSteps[rightSteps.size() / 2].timeUs;
+    double endSkew = (double)leftSteps.back().timeUs - rightSteps.back().timeUs;
+    CHECK(fabs(halfSkew) < duration * 0.02 && fabs(endSkew) < duration * 0.02,
+          "tracks out of step: halfway %.0f us, end %.0f us over %.0f us", halfSkew, endSkew, duration);
+
+    //Z depth is a relative move.
+    r = request(HTTP_POST, "/api/spindle/depth", "{\"speed\":200,\"step\":1.5}");
+    CHECK(r.code == 200, "depth rejected");
+    CHECK(runUntilIdle(10000), "depth move never finished");
+    CHECK(stepperPosition(simZPin) == lround(1.5 * zStepsPerMM), "z at %d", stepperPosition(simZPin));
+    //A negative speed or a move short of one step is refused, not queued.
+    r = request(HTTP_POST, "/api/spindle/depth", "{\"speed\":-200,\"step\":1}");
+    CHECK(r.code == 400, "negative Z speed accepted");
+    r = request(HTTP_POST, "/api/spindle/depth", "{\"speed\":200,\"step\":0.0001}");
+    CHECK(r.code == 400, "Z move under one step accepted");
+    r = request(HTTP_POST, "/api/control/batch", "{\"segments\":[{\"axis\":\"z\",\"speed\":-200,\"step\":1}]}");
+    CHECK(r.code == 400 && !machineBusy(), "negative Z speed accepted in a batch");
+
+    //Homing seeks down to the switch, backs off and zeroes.
+    r = request(HTTP_POST, "/api/control/zhome");
+    CHECK(r.code == 200, "homing refused");
+    CHECK(runUntilIdle(120000), "homing never finished");
+    r = request(HTTP_GET, "/api/status/busy");
+    CHECK(r.body.find("\"homed\":true") != std::string::npos, "not homed: %s", r.body.c_str());
+    CHECK(stepperPosition(simZPin) == 0, "z not zeroed: %d", stepperPosition(simZPin));
+
+    //E-stop part way through a long move stops the tracks and empties the queue.
+    request(HTTP_POST, "/api/control", "{\"direction\":0,\"speed\":500,\"step\":50}");
+    request(HTTP_POST, "/api/control", "{\"direction\":0,\"speed\":500,\"step\":50}");
+    simAdvance(1000000);
+    r = request(HTTP_POST, "/api/control/estop");
+    CHECK(r.code == 200, "estop failed");
+    simAdvance(5000);
+    left = stepperPosition(simLeftPin);
+    CHECK(!machineBusy(), "still busy after estop");
+    simAdvance(1000000);
+    CHECK(stepperPosition(simLeftPin) == left, "left track kept moving after estop");
+    r = request(HTTP_GET, "/api/status/busy");
+    CHECK(replyNumber(r, "queued") == 0, "queue not cleared: %s", r.body.c_str());
+
+    //G-code: 200 relative moves of 2.6 steps on the tracks and on Z come to exactly 520 steps - the part of a step each
+    //one is rounded by goes into the next instead of adding up.
+    std::shared_ptr<SimSocket> stream = simConnect(23);
+    simAdvance(10000);
+    stream->fromDevice.clear();
+    left = stepperPosition(simLeftPin);
+    right = stepperPosition(simRightPin);
+    int32_t z = stepperPosition(simZPin);
+    char line[64];
+    snprintf(line, sizeof(line), "G21 G91 G1 Y%.6f Z%.6f F1000\n", 2.6 / trackStepsPerMM, 2.6 / zStepsPerMM);
+    for (int i = 0; i < 200; i++) {
+        sendStream(stream, line);
+        std::string reply = readReply(stream, 1000);
+        CHECK(reply == "ok\r\n", "line %d answered %s", i, reply.c_str());
+        if (reply != "ok\r\n") break;
+    }
+    CHECK(runUntilIdle(30000), "short G-code moves never finished");
+    CHECK(stepperPosition(simLeftPin) - left == -520 && stepperPosition(simRightPin) - right == -520 &&
+              stepperPosition(simZPin) - z == 520,
+          "short moves went %d/%d/%d steps, expected -520/-520/520", stepperPosition(simLeftPin) - left,
+          stepperPosition(simRightPin) - right, stepperPosition(simZPin) - z);
+
+    return finishScenario("control");
+}
@@ -0,0 +1,102 @@
+/*
+    Z homing against an endstop a fixed number of steps below the start. Checks the fast seek at $25, the slow second
+    approach at $24, that zero lands $27 above the latched contact, a cycle that starts on the switch backing off at the
+    seek rate rather than whatever the last Z move ran at, and the failures - a switch that never opens and a switch that
+    is never found.
+*/
+#include "scenario.h"
+
+#define switchSteps -3000 //Endstop (pin 35) closes once Z is at or below this
+
+static std::vector<double> contactSpeeds; //Z speed in Hz at each closing edge of the endstop
+static int32_t lastSteps = 0;
+static int32_t zeroedFrom = 0; //Z position just before the firmware set it to zero
+static uint8_t lastSwitchLevel = HIGH;
+static double fastestRise = 0; //Fastest upward Z speed in Hz
+static int switchMode = 0; //0 at switchSteps, 1 stuck closed, 2 never closes
+
+static int switchModel(uint8_t pin) {
+    FastAccelStepper* z = simStepperOnPin(simZPin);
+    if (pin == 34) return HIGH;
+    if (pin != 35) return -1;
+    if (switchMode == 1) return LOW;
+    if (switchMode == 2) return HIGH;
+    return z && z->getCurrentPosition() <= switchSteps ? LOW : HIGH;
+}
+
+static bool homed() {
+    return simWebServer().simRequest(HTTP_GET, "/api/status/busy").body.find("\"homed\":true") != std::string::npos;
+}
+
+int main() {
+    simSetInputModel(switchModel);
+    bootMachine();
+    simAdvance(10000);
+    simAddTickHook([](uint64_t) {
+        uint8_t level = switchModel(35);
+        if (lastSwitchLevel == HIGH && level == LOW) {
+            contactSpeeds.push_back(fabs(simStepperOnPin(simZPin)->getCurrentSpeedInMilliHz() / 1000.0));
+        }
+        int32_t steps = stepperPosition(simZPin);
+        if (abs(steps - lastSteps) > 1) zeroedFrom = lastSteps;
+        lastSteps = steps;
+        lastSwitchLevel = level;
+        fastestRise = std::max(fastestRise, simStepperOnPin(simZPin)->getCurrentSpeedInMilliHz() / 1000.0);
+    });
+
+    SimResponse r = request(HTTP_GET, "/api/config/grbl");
+    StaticJsonDocument<2048> grbl;
+    deserializeJson(grbl, r.body);
+    double stepsPerMM = grbl["$102"] | 0.0;
+    double locateHz = (grbl["$24"] | 0.0) * stepsPerMM / 60;
+    int32_t pullOffSteps = lround((grbl["$27"] | 0.0) * stepsPerMM);
+    CHECK(stepsPerMM > 0 && locateHz > 0 && pullOffSteps > 0, "settings missing from %s", r.body.c_str());
+
+    //Seek fast, back off, come back slowly - zero is $27 above the second contact.
+    r = request(HTTP_POST, "/api/control/zhome");
+    CHECK(r.code == 200, "homing refused: %s", r.body.c_str());
+    simAdvance(10000);
+    CHECK(request(HTTP_GET, "/api/status/busy").body.find("homing") != std::string::npos, "state not reported");
+    CHECK(request(HTTP_POST, "/api/control/zhome").code == 409, "second homing accepted while homing");
+    CHECK(runUntilIdle(30000), "homing never finished");
+    CHECK(homed(), "not homed after the cycle");
+    CHECK(contactSpeeds.size() == 2, "%zu contacts, expected a seek and a locate", contactSpeeds.size());
+    if (contactSpeeds.size() == 2) {
+        CHECK(contactSpeeds[0] > 2 * locateHz, "seek touched at %.1f Hz", contactSpeeds[0]);
+        CHECK(fabs(contactSpeeds[1] - locateHz) < 1, "locate at %.1f Hz, $24 is %.1f Hz", contactSpeeds[1], locateHz);
+    }
+    //Zero is $27 above the latched contact, wherever the seek happened to stop.
+    CHECK(zeroedFrom == switchSteps + pullOffSteps, "zeroed at %d, expected %d", zeroedFrom, switchSteps + pullOffSteps);
+    CHECK(stepperPosition(simZPin) == 0, "ended at %d, expected 0", stepperPosition(simZPin));
+
+    //Start on the switch after a slow Z move - the back-off runs at the seek rate, not the last move's.
+    char body[96];
+    snprintf(body, sizeof(body), "{\"speed\":1000,\"step\":%.4f}", (switchSteps + 100) / stepsPerMM);
+    r = request(HTTP_POST, "/api/spindle/depth", body);
+    CHECK(r.code == 200 && runUntilIdle(30000), "Z move above the switch failed: %s", r.body.c_str());
+    snprintf(body, sizeof(body), "{\"speed\":%.2f,\"step\":%.4f}", (grbl["$24"] | 0.0) / 4, -200 / stepsPerMM);
+    r = request(HTTP_POST, "/api/spindle/depth", body);
+    CHECK(r.code == 200 && runUntilIdle(60000), "slow Z move onto the switch failed: %s", r.body.c_str());
+    CHECK(switchModel(35) == LOW, "not on the switch at %d", stepperPosition(simZPin));
+    contactSpeeds.clear();
+    fastestRise = 0;
+    request(HTTP_POST, "/api/control/zhome");
+    CHECK(runUntilIdle(30000) && homed(), "homing from the switch failed");
+    CHECK(fastestRise > 2 * locateHz, "backed off the switch at %.1f Hz", fastestRise);
+    CHECK(contactSpeeds.size() == 1 && zeroedFrom == switchSteps + pullOffSteps, "%zu contacts, zeroed at %d",
+          contactSpeeds.size(), zeroedFrom);
+
+    //A switch that stays closed after the back-off fails the cycle instead of zeroing on it.
+    switchMode = 1;
+    request(HTTP_POST, "/api/control/zhome");
+    CHECK(runUntilIdle(30000), "stuck switch homing never ended");
+    CHECK(!homed(), "homed on a stuck switch");
+
+    //A switch that never closes fails after 1.5 x $132 of travel.
+    switchMode = 2;
+    request(HTTP_POST, "/api/control/zhome");
+    CHECK(runUntilIdle(120000), "homing without a switch never ended");
+    CHECK(!homed(), "homed without a switch");
+
+    return finishScenario("homing");
+}
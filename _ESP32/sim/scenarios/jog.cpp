@@ -0,0 +1,108 @@
+/*
+    Holds a continuous jog through /api/control/jog the way the server does - one request every keepalive interval -
+    and checks that the tracks run smoothly at the commanded velocity, keep a curve's ratio through a change of
+    direction, ramp down on a stop request and on their own once the keepalives stop, and that queued moves keep the
+    jog out.
+*/
+#include "scenario.h"
+
+#define keepaliveMs 100
+
+static double trackStepsPerMM = 0;
+static double trackAccelSteps = 0;
+
+static double speedHz(uint8_t pin) { return simStepperOnPin(pin)->getCurrentSpeedInMilliHz() / 1000.0; }
+
+static SimResponse jog(int direction, int speed) {
+    char body[64];
+    snprintf(body, sizeof(body), "{\"direction\":%d,\"speed\":%d}", direction, speed);
+    return simWebServer().simRequest(HTTP_POST, "/api/control/jog", body);
+}
+
+//Keep a jog going for ms of machine time. Returns false if a keepalive is refused or the tracks ever stop.
+static bool holdJog(int direction, int speed, uint32_t ms) {
+    bool ok = true;
+    for (uint32_t t = 0; t < ms; t += keepaliveMs) {
+        ok = jog(direction, speed).code == 200 && ok;
+        simAdvance(keepaliveMs * 1000);
+        ok = ok && simStepperOnPin(simLeftPin)->isRunning() && simStepperOnPin(simRightPin)->isRunning();
+    }
+    return ok;
+}
+
+//Machine time until both tracks have stopped, or limitMs if they never do.
+static uint32_t msUntilStopped(uint32_t limitMs) {
+    for (uint32_t ms = 0; ms < limitMs; ms++) {
+        if (!simStepperOnPin(simLeftPin)->isRunning() && !simStepperOnPin(simRightPin)->isRunning()) return ms;
+        simAdvance(1000);
+    }
+    return limitMs;
+}
+
+int main() {
+    bootMachine();
+    simAdvance(10000);
+
+    SimResponse r = request(HTTP_GET, "/api/config/grbl");
+    StaticJsonDocument<2048> grbl;
+    deserializeJson(grbl, r.body);
+    trackStepsPerMM = grbl["$100"] | 0.0;
+    trackAccelSteps = (grbl["$120"] | 0.0) * trackStepsPerMM;
+    CHECK(trackStepsPerMM > 0 && trackAccelSteps > 0, "settings missing from %s", r.body.c_str());
+
+    r = request(HTTP_POST, "/api/control/jog", "{\"direction\":9,\"speed\":300}");
+    CHECK(r.code == 400, "unknown direction accepted");
+
+    //Forward at 300 mm/min for two seconds - both tracks run backwards at the full rate with no stalls between
+    //keepalives.
+    r = request(HTTP_POST, "/api/control/jog", "{\"direction\":0,\"speed\":300}");
+    CHECK(r.code == 200 && replyNumber(r, "timeout") > keepaliveMs, "jog refused: %s", r.body.c_str());
+    CHECK(holdJog(0, 300, 2000), "tracks stalled or keepalive refused during the jog");
+    double cruise = 300 / 60.0 * trackStepsPerMM;
+    CHECK(fabs(speedHz(simLeftPin) + cruise) < 1 && fabs(speedHz(simRightPin) + cruise) < 1,
+          "cruising at %.1f/%.1f Hz, expected -%.1f", speedHz(simLeftPin), speedHz(simRightPin), cruise);
+    CHECK(request(HTTP_GET, "/api/status/busy").body.find("jogging") != std::string::npos, "state not reported");
+
+    //Forward left: the outer track keeps the speed and the inner one drops to half of it, as for a stepped jog.
+    CHECK(holdJog(2, 300, 1000), "tracks stalled changing direction");
+    double ratio = speedHz(simRightPin) / speedHz(simLeftPin);
+    CHECK(fabs(ratio - 0.5) < 0.01, "curve ratio %.3f (%.1f/%.1f Hz)", ratio, speedHz(simLeftPin),
+          speedHz(simRightPin));
+
+    //Explicit stop ramps down at the track acceleration rather than halting.
+    double decelMs = 1000 * std::max(fabs(speedHz(simLeftPin)), fabs(speedHz(simRightPin))) / trackAccelSteps;
+    r = request(HTTP_POST, "/api/control/jog", "{\"stop\":true}");
+    CHECK(r.code == 200, "stop refused");
+    uint32_t stopped = msUntilStopped(5000);
+    CHECK(stopped > decelMs * 0.8 && stopped < decelMs * 1.2 + 20, "stop took %u ms, ramp is %.0f ms", stopped,
+          decelMs);
+    CHECK(runUntilIdle(100), "still busy after the stop");
+
+    //Deadman: the keepalives stop and the tracks ramp down by themselves once the timeout passes.
+    CHECK(holdJog(1, 300, 1000), "backward jog stalled");
+    int32_t left = stepperPosition(simLeftPin);
+    uint32_t timeoutMs = (uint32_t)replyNumber(jog(1, 300), "timeout");
+    stopped = msUntilStopped(5000);
+    decelMs = 1000 * cruise / trackAccelSteps;
+    CHECK(stopped > timeoutMs + decelMs * 0.8 && stopped < timeoutMs + decelMs * 1.2 + 20,
+          "deadman stop after %u ms, expected %u + %.0f ms", stopped, timeoutMs, decelMs);
+    CHECK(stepperPosition(simLeftPin) > left, "backward jog went the wrong way");
+    CHECK(runUntilIdle(100), "still busy after the deadman stop");
+
+    //Queued moves own the tracks - a jog waits until they are done.
+    r = request(HTTP_POST, "/api/control", "{\"direction\":0,\"speed\":500,\"step\":20}");
+    CHECK(r.code == 200, "move refused");
+    simAdvance(100000);
+    r = jog(0, 300);
+    CHECK(r.code == 409, "jog accepted during a queued move");
+    CHECK(runUntilIdle(20000), "move never finished");
+    CHECK(jog(0, 300).code == 200, "jog refused after the move");
+
+    //E-stop ends a jog at once and it does not come back with the next pass of the motion task.
+    simAdvance(200000);
+    request(HTTP_POST, "/api/control/estop");
+    simAdvance(10000);
+    CHECK(!simStepperOnPin(simLeftPin)->isRunning() && !machineBusy(), "jog survived an e-stop");
+
+    return finishScenario("jog");
+}
@@ -0,0 +1,140 @@
+/*
+    Laser mode ($32): streams a short cut and samples the PWM duty against the lead track's speed every millisecond.
+    M4 power follows the speed through the ramps, M3 power holds while the axis moves, rapids stay dark right up to the
+    end of the cut before them even though they are queued ahead of it, and M3/M4/S lines never wait on the queue.
+    Manual laser and spindle speed requests are refused so the timer stays the only writer of the outputs. With $32 off
+    M3 drives the spindle relay as before.
+*/
+#include "scenario.h"
+#include "WiFi.h"
+
+struct Sample {
+    double mm;
+    double speedHz;
+    uint32_t duty;
+    uint8_t laserPin;
+};
+
+static std::vector<Sample> samples;
+static bool sampling = false;
+static int32_t startPosition = 0;
+static double trackStepsPerMM = 0;
+
+static int countOk(std::shared_ptr<SimSocket> socket, std::string& received) {
+    while (!socket->fromDevice.empty()) {
+        received += (char)socket->fromDevice.front();
+        socket->fromDevice.pop_front();
+    }
+    int count = 0;
+    for (size_t at = received.find("ok"); at != std::string::npos; at = received.find("ok", at + 2)) count++;
+    return count;
+}
+
+int main() {
+    bootMachine();
+    simAdvance(10000);
+
+    SimResponse r = request(HTTP_GET, "/api/config/grbl");
+    StaticJsonDocument<2048> grbl;
+    deserializeJson(grbl, r.body);
+    trackStepsPerMM = grbl["$100"] | 0.0;
+    CHECK(trackStepsPerMM > 0, "settings missing from %s", r.body.c_str());
+
+    r = request(HTTP_POST, "/api/config/grbl/bulk", "{\"settings\":{\"$32\":1,\"$30\":1000,\"$31\":0}}");
+    CHECK(r.code == 200, "laser mode refused: %s", r.body.c_str());
+
+    simAddTickHook([](uint64_t nowUs) {
+        if (!sampling || nowUs % 1000 != 0) return;
+        FastAccelStepper* left = simStepperOnPin(simLeftPin);
+        samples.push_back({(startPosition - left->getCurrentPosition()) / trackStepsPerMM,
+                           fabs(left->getCurrentSpeedInMilliHz() / 1000.0), simLedcDuty(2), simOutputLevel(4)});
+    });
+
+    //Forward along Y: 20 mm cut with M4 at full power, a rapid to 30 mm, then a 10 mm cut with M3 at half power.
+    std::shared_ptr<SimSocket> stream = simConnect(23);
+    simAdvance(10000);
+    stream->fromDevice.clear();
+    startPosition = stepperPosition(simLeftPin);
+    sampling = true;
+    sendStream(stream, "G21 G90\nM4 S1000\nG1 Y20 F300\nG0 Y30\nM3 S500\nG1 Y40\nM5\n");
+    std::string received;
+    simAdvance(200000);
+    CHECK(countOk(stream, received) == 7, "spindle lines waited on the queue: %s", received.c_str());
+    CHECK(runUntilIdle(30000), "cut never finished");
+    simAdvance(10000);
+    sampling = false;
+
+    double cutHz = 300 / 60.0 * trackStepsPerMM;
+    int ramp = 0, cruise = 0, rapid = 0, handover = 0, constant = 0;
+    for (const Sample& s : samples) {
+        if (s.mm > 0.05 && s.mm < 1.2) {
+            long expected = lround(255 * std::min(1.0, s.speedHz / cutHz));
+            CHECK(labs((long)s.duty - expected) <= 3, "M4 ramp at %.3f mm: duty %u, expected %ld at %.0f Hz", s.mm,
+                  s.duty, expected, s.speedHz);
+            ramp++;
+        } else if (s.mm > 2 && s.mm < 19.8) {
+            CHECK(s.duty == 255 && s.laserPin == HIGH, "M4 cruise at %.3f mm: duty %u", s.mm, s.duty);
+            cruise++;
+        } else if (s.mm > 20.2 && s.mm < 29.8) {
+            CHECK(s.duty == 0 && s.laserPin == LOW, "lit during the rapid at %.3f mm: duty %u", s.mm, s.duty);
+            rapid++;
+            //The M3 cut is on the steppers for the last stretch of the rapid - it must not light early.
+            if (s.mm > 28.9) handover++;
+        } else if (s.mm > 30.2 && s.mm < 39.5 && s.speedHz > 0) {
+            CHECK(s.duty == 128 && s.laserPin == HIGH, "M3 cut at %.3f mm: duty %u", s.mm, s.duty);
+            constant++;
+        }
+    }
+    CHECK(ramp > 50 && cruise > 1000 && rapid > 500 && handover > 5 && constant > 1000,
+          "too few samples: ramp %d cruise %d rapid %d handover %d M3 %d", ramp, cruise, rapid, handover, constant);
+    CHECK(fabs(samples.back().mm - 40) < 0.01, "cut ended at %.3f mm", samples.back().mm);
+    CHECK(simLedcDuty(2) == 0 && simOutputLevel(4) == LOW, "laser left on after M5: duty %u", simLedcDuty(2));
+
+    //M3 with nothing moving stays dark in laser mode.
+    received.clear();
+    sendStream(stream, "M3 S1000\n");
+    simAdvance(20000);
+    CHECK(countOk(stream, received) == 1, "M3 not acknowledged: %s", received.c_str());
+    CHECK(simLedcDuty(2) == 0 && simOutputLevel(4) == LOW, "laser lit standing still: duty %u", simLedcDuty(2));
+    sendStream(stream, "M5\n");
+    simAdvance(20000);
+    stream->fromDevice.clear();
+
+    //The timer is the only writer of the laser outputs: a manual enable or spindle speed is refused mid-cut, an override
+    //change is picked up by the timer, and nothing is left burning once the cut ends.
+    received.clear();
+    sendStream(stream, "M3 S1000\nG1 Y50 F300\nM5\n");
+    simAdvance(500000);
+    CHECK(simLedcDuty(2) == 255 && simOutputLevel(4) == HIGH, "not cutting: duty %u", simLedcDuty(2));
+    r = request(HTTP_POST, "/api/laser", "{\"enable\":true}");
+    CHECK(r.code == 409, "manual laser enable accepted in laser mode: %d", r.code);
+    r = request(HTTP_POST, "/api/spindle/speed", "{\"speed\":100}");
+    CHECK(r.code == 409, "spindle speed accepted in laser mode: %d", r.code);
+    request(HTTP_POST, "/api/control/override", "{\"spindle\":50}");
+    simAdvance(5000);
+    CHECK(simLedcDuty(2) == 127, "override not applied by the timer: duty %u", simLedcDuty(2));
+    CHECK(runUntilIdle(30000), "cut never finished");
+    simAdvance(5000);
+    CHECK(simLedcDuty(2) == 0 && simOutputLevel(4) == LOW, "laser left on after the cut: duty %u pin %u",
+          simLedcDuty(2), simOutputLevel(4));
+    CHECK(request(HTTP_POST, "/api/laser", "{\"enable\":true}").code == 409, "manual enable accepted while idle");
+    request(HTTP_POST, "/api/control/override", "{\"spindle\":100}");
+    simAdvance(5000);
+    CHECK(simLedcDuty(2) == 0 && simOutputLevel(4) == LOW, "override change lit the idle laser: duty %u",
+          simLedcDuty(2));
+    CHECK(countOk(stream, received) == 3, "cut lines not acknowledged: %s", received.c_str());
+    stream->fromDevice.clear();
+
+    //$32 off: M3 is a spindle again.
+    r = request(HTTP_POST, "/api/config/grbl/bulk", "{\"settings\":{\"$32\":0}}");
+    CHECK(r.code == 200, "laser mode not cleared: %s", r.body.c_str());
+    received.clear();
+    sendStream(stream, "M3 S500\n");
+    simAdvance(50000);
+    CHECK(countOk(stream, received) == 1, "M3 not acknowledged: %s", received.c_str());
+    CHECK(simOutputLevel(16) == HIGH && simLedcDuty(2) == 128, "spindle not on: relay %u duty %u", simOutputLevel(16),
+          simLedcDuty(2));
+    CHECK(simOutputLevel(4) == LOW, "laser output driven with $32 off");
+
+    return finishScenario("laser");
+}
@@ -0,0 +1,95 @@
+/*
+    Soft limits ($20, $130-$132): moves are checked against the machine position the queue ends at before anything is
+    queued. Checks that a batch with one bad segment is refused whole, that an arc whose ends are inside but whose path
+    is not gets refused, G-code lines and arcs failing with error:15, that Z depth is checked against the absolute Z
+    once homed, that nothing is checked with $20 off, and that settings can not be changed under a running move.
+*/
+#include "scenario.h"
+#include "WiFi.h"
+
+static bool poseNear(double x, double y) {
+    SimResponse r = simWebServer().simRequest(HTTP_GET, "/api/status/pose");
+    return fabs(replyNumber(r, "x") - x) < 0.1 && fabs(replyNumber(r, "y") - y) < 0.1;
+}
+
+int main() {
+    simSetInputModel(zSwitches(-3000, INT32_MAX));
+    bootMachine();
+    simAdvance(10000);
+
+    SimResponse r = request(HTTP_POST, "/api/config/grbl/bulk",
+                            "{\"settings\":{\"$20\":1,\"$130\":100,\"$131\":30,\"$132\":10}}");
+    CHECK(r.code == 200, "settings refused: %s", r.body.c_str());
+
+    //Boot pose is (0, 0) facing Y+. Forward 10 stays inside.
+    r = request(HTTP_POST, "/api/control/batch", "{\"segments\":[{\"distance\":10,\"speed\":1000}]}");
+    CHECK(r.code == 200, "batch inside refused: %s", r.body.c_str());
+    CHECK(runUntilIdle(30000), "batch never finished");
+
+    //The third segment backs out past Y0 - the whole batch is refused and nothing moves.
+    r = request(HTTP_POST, "/api/control/batch",
+                "{\"segments\":[{\"distance\":5,\"speed\":1000},{\"distance\":5,\"speed\":1000},"
+                "{\"distance\":-30,\"speed\":1000}]}");
+    CHECK(r.code == 400 && replyNumber(r, "index") == 2, "batch out of travel: %d %s", r.code, r.body.c_str());
+    simAdvance(100000);
+    CHECK(!machineBusy() && poseNear(0, 10), "refused batch moved the tank");
+
+    //A half turn to the right of radius 22 ends at (44, 10) but passes Y32 on the way.
+    r = request(HTTP_POST, "/api/control", "{\"distance\":69.115,\"turn\":-180,\"speed\":1000}");
+    CHECK(r.code == 400, "arc over $131 accepted: %s", r.body.c_str());
+    //Radius 18 tops out at Y28.
+    r = request(HTTP_POST, "/api/control", "{\"distance\":56.549,\"turn\":-180,\"speed\":1000}");
+    CHECK(r.code == 200, "arc inside refused: %s", r.body.c_str());
+    CHECK(runUntilIdle(60000) && poseNear(36, 10), "arc did not end at (36, 10)");
+
+    //G-code: put the program and the machine in the same frame, then run lines either side of the limits.
+    r = request(HTTP_POST, "/api/status/pose", "{\"x\":0,\"y\":0,\"heading\":90}");
+    CHECK(r.code == 200, "pose refused: %s", r.body.c_str());
+    std::shared_ptr<SimSocket> stream = simConnect(23);
+    simAdvance(10000);
+    stream->fromDevice.clear();
+    sendStream(stream, "G21G90G0X10Y5\n");
+    CHECK(readReply(stream, 30000) == "ok\r\n", "rapid inside refused");
+    sendStream(stream, "G1X120F1000\n");
+    CHECK(readReply(stream, 30000) == "error:15\r\n", "line past $130 accepted");
+    //Counter-clockwise from (10, 5) around (20, 5) dips to Y-5, clockwise rises to Y15.
+    sendStream(stream, "G3X30Y5I10J0F1000\n");
+    CHECK(readReply(stream, 30000) == "error:15\r\n", "arc below Y0 accepted");
+    CHECK(runUntilIdle(30000) && poseNear(10, 5), "refused lines moved the tank");
+    sendStream(stream, "G2X30Y5I10J0F1000\n");
+    CHECK(readReply(stream, 30000) == "ok\r\n", "arc inside refused");
+    CHECK(runUntilIdle(300000) && poseNear(30, 5), "arc did not end at (30, 5)");
+
+    //Z is unchecked until it is homed, then held to 0-$132 from the homed zero - not to the size of each step.
+    r = request(HTTP_POST, "/api/spindle/depth", "{\"speed\":300,\"step\":-1}");
+    CHECK(r.code == 200, "Z before homing refused: %s", r.body.c_str());
+    CHECK(runUntilIdle(30000), "Z move never finished");
+    request(HTTP_POST, "/api/control/zhome");
+    CHECK(runUntilIdle(60000), "homing never finished");
+    r = request(HTTP_POST, "/api/spindle/depth", "{\"speed\":300,\"step\":-1}");
+    CHECK(r.code == 400, "Z below zero accepted: %s", r.body.c_str());
+    r = request(HTTP_POST, "/api/spindle/depth", "{\"speed\":300,\"step\":6}");
+    CHECK(r.code == 200, "Z inside refused: %s", r.body.c_str());
+    r = request(HTTP_POST, "/api/spindle/depth", "{\"speed\":300,\"step\":6}");
+    CHECK(r.code == 400, "Z to 12 mm accepted behind the first: %s", r.body.c_str());
+    CHECK(runUntilIdle(30000), "Z move never finished");
+    r = request(HTTP_POST, "/api/spindle/depth", "{\"speed\":300,\"step\":6}");
+    CHECK(r.code == 400, "Z to 12 mm accepted: %s", r.body.c_str());
+    r = request(HTTP_POST, "/api/control/probe", "{\"distance\":-7}");
+    CHECK(r.code == 400, "probe below zero accepted: %s", r.body.c_str());
+
+    //$20 off - nothing is checked.
+    request(HTTP_POST, "/api/config/grbl/bulk", "{\"settings\":{\"$20\":0}}");
+    r = request(HTTP_POST, "/api/control", "{\"distance\":-50,\"speed\":1000}");
+    CHECK(r.code == 200, "move refused with $20 off: %s", r.body.c_str());
+    //Settings stay put under a running move.
+    simAdvance(100000);
+    r = request(HTTP_POST, "/api/config/grbl/bulk", "{\"settings\":{\"$20\":1}}");
+    CHECK(r.code == 409, "settings written while moving: %d %s", r.code, r.body.c_str());
+    r = request(HTTP_POST, "/api/config/grbl", "{\"key\":\"$20\",\"value\":1}");
+    CHECK(r.code == 409, "setting written while moving: %d %s", r.code, r.body.c_str());
+    request(HTTP_POST, "/api/control/estop");
+    simAdvance(10000);
+
+    return finishScenario("limits");
+}
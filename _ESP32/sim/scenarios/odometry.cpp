@@ -0,0 +1,126 @@
+/*
+    Dead reckoning: drives the tank through straight moves, spins in place and a curve with the REST handlers and
+    checks the pose at /api/status/pose and in the telemetry frames against the geometry of the commanded moves - no
+    drift after a closed square, the arc end point of a curve, and a pose set part way through.
+*/
+#include "scenario.h"
+#include "WiFi.h"
+
+static std::shared_ptr<SimSocket> telemetry;
+
+struct Pose {
+    double x, y, heading;
+};
+
+static Pose pose() {
+    SimResponse r = simWebServer().simRequest(HTTP_GET, "/api/status/pose");
+    StaticJsonDocument<256> doc;
+    deserializeJson(doc, r.body);
+    return {doc["x"] | NAN, doc["y"] | NAN, doc["heading"] | NAN};
+}
+
+//Difference between two headings in degrees, -180 to 180.
+static double headingError(double heading, double expected) {
+    return remainder(heading - expected, 360.0);
+}
+
+static bool near(const Pose& p, double x, double y, double heading, double mm, double degrees) {
+    return fabs(p.x - x) <= mm && fabs(p.y - y) <= mm && fabs(headingError(p.heading, heading)) <= degrees;
+}
+
+enum { FORWARD = 0, FORWARD_LEFT = 2, TURN_LEFT = 4 };
+
+static void move(int direction, double speed, double step) {
+    char body[96];
+    snprintf(body, sizeof(body), "{\"direction\":%d,\"speed\":%g,\"step\":%g}", direction, speed, step);
+    SimResponse r = request(HTTP_POST, "/api/control", body);
+    CHECK(r.code == 200, "direction %d refused: %s", direction, r.body.c_str());
+    CHECK(runUntilIdle(60000), "direction %d never finished", direction);
+    simAdvance(5000);
+}
+
+//The pose block of the newest telemetry frame.
+static bool telemetryPose(Pose& out) {
+    std::vector<uint8_t> bytes(telemetry->fromDevice.begin(), telemetry->fromDevice.end());
+    telemetry->fromDevice.clear();
+    bool found = false;
+    for (size_t at = 0; at + 13 <= bytes.size();) {
+        uint8_t length = bytes[at + 2];
+        if (bytes[at] != 0xA5 || length < 13 || at + length > bytes.size()) {
+            at++;
+            continue;
+        }
+        uint8_t flags = bytes[at + 3];
+        size_t offset = at + 13 + (flags & 0x01 ? 12 : 0) + (flags & 0x02 ? 8 : 0);
+        if ((flags & 0x04) && offset + 12 <= at + length) {
+            int32_t x, y;
+            uint32_t heading;
+            memcpy(&x, &bytes[offset], 4);
+            memcpy(&y, &bytes[offset + 4], 4);
+            memcpy(&heading, &bytes[offset + 8], 4);
+            out = {x / 1000.0, y / 1000.0, heading * (360.0 / 4294967296.0)};
+            found = true;
+        }
+        at += length;
+    }
+    return found;
+}
+
+int main() {
+    bootMachine();
+    simAdvance(10000);
+
+    SimResponse r = request(HTTP_GET, "/api/config/grbl");
+    StaticJsonDocument<2048> grbl;
+    deserializeJson(grbl, r.body);
+    double trackWidth = grbl["$140"] | 0.0;
+    CHECK(trackWidth > 0, "settings missing from %s", r.body.c_str());
+
+    Pose p = pose();
+    CHECK(near(p, 0, 0, 90, 0, 0), "boot pose %.3f, %.3f, %.3f", p.x, p.y, p.heading);
+
+    //A 60 mm square, turning counter-clockwise at each corner - back where it started, facing the same way.
+    double quarterTurn = M_PI / 4 * trackWidth; //Track travel for a 90 degree spin
+    move(FORWARD, 500, 60);
+    p = pose();
+    CHECK(near(p, 0, 60, 90, 0.005, 0.001), "after the first side %.3f, %.3f, %.3f", p.x, p.y, p.heading);
+    move(TURN_LEFT, 500, quarterTurn);
+    p = pose();
+    CHECK(near(p, 0, 60, 180, 0.005, 0.005), "after the first corner %.3f, %.3f, %.3f", p.x, p.y, p.heading);
+    move(FORWARD, 500, 60);
+    move(TURN_LEFT, 500, quarterTurn);
+    move(FORWARD, 500, 60);
+    move(TURN_LEFT, 500, quarterTurn);
+    move(FORWARD, 500, 60);
+    move(TURN_LEFT, 500, quarterTurn);
+    p = pose();
+    CHECK(near(p, 0, 0, 90, 0.02, 0.01), "square closed at %.3f, %.3f, %.3f", p.x, p.y, p.heading);
+
+    //Set a pose, then a curve: forward left runs the tank along an arc of 0.75 step with the heading changing by
+    //step / (2 * $140) radians.
+    r = request(HTTP_POST, "/api/status/pose", "{\"x\":100,\"y\":-50,\"heading\":0}");
+    CHECK(r.code == 200, "pose refused: %s", r.body.c_str());
+    simAdvance(5000);
+    p = pose();
+    CHECK(near(p, 100, -50, 0, 0.001, 0.0001), "pose set to %.3f, %.3f, %.3f", p.x, p.y, p.heading);
+    double step = 80;
+    move(FORWARD_LEFT, 300, step);
+    double distance = 0.75 * step, turn = step / (2 * trackWidth);
+    double x = 100 + distance / turn * sin(turn), y = -50 + distance / turn * (1 - cos(turn));
+    p = pose();
+    CHECK(near(p, x, y, turn * 180 / M_PI, 0.05, 0.01), "curve ended at %.3f, %.3f, %.3f - expected %.3f, %.3f, %.3f",
+          p.x, p.y, p.heading, x, y, turn * 180 / M_PI);
+
+    r = request(HTTP_POST, "/api/status/pose", "{}");
+    CHECK(r.code == 400, "empty pose accepted");
+
+    //The telemetry frames carry the same pose.
+    telemetry = simConnect(81);
+    simAdvance(300000);
+    Pose t;
+    CHECK(telemetryPose(t), "no pose block in the telemetry frames");
+    CHECK(near(t, p.x, p.y, p.heading, 0.001, 0.0001), "telemetry pose %.3f, %.3f, %.3f vs %.3f, %.3f, %.3f", t.x, t.y,
+          t.heading, p.x, p.y, p.heading);
+
+    return finishScenario("odometry");
+}
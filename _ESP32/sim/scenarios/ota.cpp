@@ -0,0 +1,137 @@
+/*
+    Sends a firmware image through the chunked OTA endpoints (/api/update/begin, chunk, commit) the way the server
+    does, with a corrupted chunk, a lost reply and a reconnect thrown in, and checks that flash only changes while the
+    machine is idle and that the image is applied only after its SHA-256 checks out.
+*/
+#include "scenario.h"
+#include "Update.h"
+#include "esp_rom_crc.h"
+#include "mbedtls/sha256.h"
+
+#define chunkSize 4096
+
+static std::string hex(const uint8_t* data, size_t length) {
+    std::string out;
+    char pair[3];
+    for (size_t i = 0; i < length; i++) {
+        snprintf(pair, sizeof(pair), "%02x", data[i]);
+        out += pair;
+    }
+    return out;
+}
+
+static std::string sha256Hex(const std::vector<uint8_t>& data) {
+    mbedtls_sha256_context ctx;
+    uint8_t digest[32];
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+    mbedtls_sha256_update(&ctx, data.data(), data.size());
+    mbedtls_sha256_finish(&ctx, digest);
+    return hex(digest, 32);
+}
+
+static SimResponse begin(size_t size, const std::string& sha) {
+    char body[160];
+    snprintf(body, sizeof(body), "{\"size\":%zu,\"sha256\":\"%s\"}", size, sha.c_str());
+    return request(HTTP_POST, "/api/update/begin", body);
+}
+
+static SimResponse chunk(const std::vector<uint8_t>& image, size_t offset, bool corrupt = false) {
+    std::vector<uint8_t> data(image.begin() + offset, image.begin() + std::min(image.size(), offset + chunkSize));
+    char crc[16];
+    snprintf(crc, sizeof(crc), "%08x", esp_rom_crc32_le(0, data.data(), data.size()));
+    if (corrupt) data[data.size() / 2] ^= 0x40;
+    SimResponse r = simWebServer().simUpload("/api/update/chunk", "firmware.bin", data,
+                                             {{"offset", std::to_string(offset)}, {"crc", crc}});
+    printf("%9.3f POST /api/update/chunk?offset=%-7zu %3d  %.100s\n", simNowMicros() / 1e6, offset, r.code,
+           r.body.c_str());
+    return r;
+}
+
+//Send chunks from the device's offset until the image is in or a chunk is refused. 503 means the previous chunk is
+//still on its way to flash - give the OTA task time and try again.
+static bool sendFrom(const std::vector<uint8_t>& image, size_t offset, size_t stopAt) {
+    while (offset < stopAt) {
+        SimResponse r = chunk(image, offset);
+        if (r.code == 503) {
+            simAdvance(20000);
+            continue;
+        }
+        if (r.code != 200) return false;
+        offset = (size_t)replyNumber(r, "offset");
+    }
+    return true;
+}
+
+int main() {
+    bootMachine();
+
+    //The stand-ins have to agree with the real thing before anything else means much.
+    const uint8_t abc[] = {'a', 'b', 'c'};
+    CHECK(esp_rom_crc32_le(0, abc, 3) == 0x352441c2, "crc32(abc) = %08x", esp_rom_crc32_le(0, abc, 3));
+    CHECK(sha256Hex(std::vector<uint8_t>(abc, abc + 3)) ==
+              "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+          "sha256(abc) wrong");
+
+    std::vector<uint8_t> image(50000);
+    for (size_t i = 0; i < image.size(); i++) image[i] = (uint8_t)(i * 2654435761u >> 13);
+    std::string sha = sha256Hex(image);
+
+    SimResponse r = request(HTTP_POST, "/api/update/chunk", "");
+    CHECK(r.code == 409, "chunk accepted with no session");
+    r = begin(image.size(), "1234");
+    CHECK(r.code == 400, "short sha256 accepted");
+    r = begin(image.size(), sha);
+    CHECK(r.code == 200 && replyNumber(r, "offset") == 0, "begin failed");
+
+    //A corrupted chunk and one from the wrong place are refused and leave the offset alone.
+    r = chunk(image, 0, true);
+    CHECK(r.code == 400 && replyNumber(r, "offset") == 0, "corrupt chunk accepted");
+    r = chunk(image, chunkSize);
+    CHECK(r.code == 409 && replyNumber(r, "offset") == 0, "out of order chunk accepted");
+
+    CHECK(sendFrom(image, 0, 3 * chunkSize), "first part refused");
+    //The reply to the last chunk was lost - resending it is acknowledged without writing it twice.
+    simAdvance(50000);
+    r = chunk(image, 2 * chunkSize);
+    CHECK(r.code == 200 && replyNumber(r, "offset") == 3 * chunkSize, "resent chunk not acknowledged");
+
+    //Reconnect: begin with the same image resumes rather than restarting.
+    r = begin(image.size(), sha);
+    CHECK(r.code == 200 && replyNumber(r, "offset") == 3 * chunkSize, "begin did not resume");
+
+    //While the tracks move, chunks are buffered but nothing is written to flash.
+    simAdvance(50000);
+    size_t flashed = Update.simImage().size();
+    request(HTTP_POST, "/api/control", "{\"direction\":0,\"speed\":500,\"step\":5}");
+    r = chunk(image, 3 * chunkSize);
+    CHECK(r.code == 200, "chunk refused while moving");
+    simAdvance(200000);
+    CHECK(machineBusy(), "move too short to test against");
+    CHECK(Update.simImage().size() == flashed, "flash written during a move");
+    r = request(HTTP_POST, "/api/update/commit");
+    CHECK(r.code == 409, "commit accepted while incomplete");
+    CHECK(runUntilIdle(30000), "move never finished");
+
+    CHECK(sendFrom(image, 4 * chunkSize, image.size()), "second part refused");
+    CHECK(!simRestartRequested(), "restarted before commit");
+    for (int i = 0; i < 20 && replyNumber(request(HTTP_GET, "/api/update/status"), "written") < image.size(); i++) {
+        simAdvance(20000);
+    }
+    r = request(HTTP_POST, "/api/update/commit");
+    CHECK(r.code == 200, "commit failed");
+    CHECK(Update.simImage() == image && Update.isFinished(), "flash does not hold the image");
+    CHECK(simRestartRequested(), "no restart after commit");
+
+    //An image that doesn't match its hash is thrown away at commit.
+    std::vector<uint8_t> small(image.begin(), image.begin() + 6000);
+    r = begin(small.size(), sha);
+    CHECK(r.code == 200 && replyNumber(r, "offset") == 0, "second begin failed");
+    CHECK(sendFrom(small, 0, small.size()), "small image refused");
+    simAdvance(100000);
+    r = request(HTTP_POST, "/api/update/commit");
+    CHECK(r.code == 400 && r.body.find("SHA-256") != std::string::npos, "bad hash committed");
+    CHECK(Update.hasError() && !Update.isRunning(), "bad image not aborted");
+
+    return finishScenario("ota");
+}
@@ -0,0 +1,150 @@
+/*
+    Real-time commands against a running job: feed override through /api/control/override (applied mid-segment and
+    capped at the axis maximum), feed hold and cycle start with a queue behind the held segment, the single byte GRBL
+    commands on the G-code stream while a line waits on a full queue, and the spindle override on the PWM duty.
+*/
+#include "scenario.h"
+#include "WiFi.h"
+
+static double speedHz(uint8_t pin) { return simStepperOnPin(pin)->getCurrentSpeedInMilliHz() / 1000.0; }
+
+static std::string state() {
+    SimResponse r = simWebServer().simRequest(HTTP_GET, "/api/status/busy");
+    StaticJsonDocument<512> doc;
+    deserializeJson(doc, r.body);
+    return doc["state"] | "";
+}
+
+int main() {
+    bootMachine();
+    simAdvance(10000);
+
+    SimResponse r = request(HTTP_GET, "/api/config/grbl");
+    StaticJsonDocument<2048> grbl;
+    deserializeJson(grbl, r.body);
+    double stepsPerMM = grbl["$100"] | 0.0;
+    double maxRate = grbl["$110"] | 0.0;
+    double accelSteps = (grbl["$120"] | 0.0) * stepsPerMM;
+    CHECK(stepsPerMM > 0 && maxRate > 0 && accelSteps > 0, "settings missing from %s", r.body.c_str());
+
+    //Feed override on a long straight move: 50% halves the speed within the ramp time, 200% is held to $110.
+    int32_t start = stepperPosition(simLeftPin);
+    r = request(HTTP_POST, "/api/control", "{\"direction\":0,\"speed\":300,\"step\":60}");
+    CHECK(r.code == 200, "move refused");
+    simAdvance(2000000);
+    double cruise = 300 / 60.0 * stepsPerMM;
+    CHECK(fabs(speedHz(simLeftPin) + cruise) < 2, "cruising at %.1f Hz, expected -%.1f", speedHz(simLeftPin), cruise);
+
+    r = request(HTTP_POST, "/api/control/override", "{\"feed\":50}");
+    CHECK(r.code == 200 && replyNumber(r, "feed") == 50, "override refused: %s", r.body.c_str());
+    simAdvance(2000);
+    CHECK(fabs(speedHz(simLeftPin)) < cruise - 1, "override not applied within a pass");
+    simAdvance(1000 * (uint32_t)(1000 * cruise / 2 / accelSteps) + 20000);
+    CHECK(fabs(speedHz(simLeftPin) + cruise / 2) < 2 && fabs(speedHz(simLeftPin) - speedHz(simRightPin)) < 1,
+          "at 50%% running %.1f/%.1f Hz, expected -%.1f", speedHz(simLeftPin), speedHz(simRightPin), cruise / 2);
+
+    request(HTTP_POST, "/api/control/override", "{\"feed\":500}");
+    CHECK(replyNumber(request(HTTP_GET, "/api/status/busy"), "feed_override") == 200, "override not clamped to 200%%");
+    simAdvance(1500000);
+    double fastest = maxRate / 60.0 * stepsPerMM;
+    CHECK(fabs(speedHz(simLeftPin) + fastest) < 2, "at 200%% running %.1f Hz, expected the $110 limit -%.1f",
+          speedHz(simLeftPin), fastest);
+    request(HTTP_POST, "/api/control/override", "{\"feed\":100}");
+
+    //Feed hold: the tracks ramp down together and stay put with the queue intact, cycle start finishes the job exactly.
+    r = request(HTTP_POST, "/api/control", "{\"direction\":0,\"speed\":300,\"step\":5}");
+    CHECK(r.code == 200, "second move refused");
+    simAdvance(500000);
+    r = request(HTTP_POST, "/api/control/hold");
+    CHECK(r.code == 200, "hold refused");
+    simAdvance(1000 * (uint32_t)(1000 * cruise / accelSteps) + 50000);
+    CHECK(!simStepperOnPin(simLeftPin)->isRunning() && !simStepperOnPin(simRightPin)->isRunning(), "still moving in hold");
+    CHECK(state() == "hold" && machineBusy(), "state %s during hold", state().c_str());
+    int32_t held = stepperPosition(simLeftPin);
+    CHECK(held == stepperPosition(simRightPin), "tracks stopped apart: %d/%d", held, stepperPosition(simRightPin));
+    simAdvance(1000000);
+    CHECK(stepperPosition(simLeftPin) == held, "moved while held");
+    r = request(HTTP_POST, "/api/control/resume");
+    CHECK(r.code == 200, "resume refused");
+    CHECK(runUntilIdle(30000), "job never finished after resume");
+    int32_t expected = start - lround(65 * stepsPerMM);
+    CHECK(stepperPosition(simLeftPin) == expected && stepperPosition(simRightPin) == expected,
+          "ended at %d/%d, expected %d", stepperPosition(simLeftPin), stepperPosition(simRightPin), expected);
+
+    //Feed hold right after a junction: a curve, then a straight move handed to the steppers before the curve ends. The
+    //right track picks up speed for the straight move and stops short of the curve's end, so cycle start has to finish
+    //the curve first - the right track reaches its curve end as the left one does - then end exactly, both counted.
+    int32_t left0 = stepperPosition(simLeftPin), right0 = stepperPosition(simRightPin);
+    int32_t curveEnd[2] = {left0 - (int32_t)lround(10 * stepsPerMM), right0 - (int32_t)lround(5 * stepsPerMM)};
+    uint32_t completed = replyNumber(request(HTTP_GET, "/api/status/busy"), "completed");
+    r = request(HTTP_POST, "/api/control/batch",
+                "{\"segments\":[{\"direction\":2,\"speed\":300,\"step\":10},{\"direction\":0,\"speed\":300,\"step\":10}]}");
+    CHECK(r.code == 200, "junction batch refused: %s", r.body.c_str());
+    FastAccelStepper* left = simStepperOnPin(simLeftPin);
+    for (int i = 0; i < 100000 && left->targetPos() != curveEnd[0]; i++) simAdvance(50);
+    for (int i = 0; i < 100000 && left->targetPos() == curveEnd[0]; i++) simAdvance(50);
+    request(HTTP_POST, "/api/control/hold");
+    simAdvance(1000 * (uint32_t)(1000 * cruise / accelSteps) + 50000);
+    CHECK(state() == "hold" && machineBusy(), "junction hold not held - state %s", state().c_str());
+    CHECK(stepperPosition(simRightPin) > curveEnd[1], "right track held at %d, past the curve end %d",
+          stepperPosition(simRightPin), curveEnd[1]);
+    int32_t rightAtCurveEnd = 0;
+    simAddTickHook([&curveEnd, &rightAtCurveEnd](uint64_t) {
+        if (rightAtCurveEnd == 0 && stepperPosition(simLeftPin) < curveEnd[0]) {
+            rightAtCurveEnd = stepperPosition(simRightPin);
+        }
+    });
+    request(HTTP_POST, "/api/control/resume");
+    CHECK(runUntilIdle(30000), "junction job never finished after resume");
+    CHECK(abs(rightAtCurveEnd - curveEnd[1]) <= 2, "right track at %d as the left one left the curve, expected %d",
+          rightAtCurveEnd, curveEnd[1]);
+    CHECK(stepperPosition(simLeftPin) - left0 == -lround(20 * stepsPerMM) &&
+              stepperPosition(simRightPin) - right0 == -lround(15 * stepsPerMM),
+          "junction job went %d/%d", stepperPosition(simLeftPin) - left0, stepperPosition(simRightPin) - right0);
+    CHECK(replyNumber(request(HTTP_GET, "/api/status/busy"), "completed") == completed + 2,
+          "completed not %u after the junction hold", completed + 2);
+
+    //A hold while idle just latches: cycle start after it moves nothing and completes nothing.
+    left0 = stepperPosition(simLeftPin);
+    right0 = stepperPosition(simRightPin);
+    request(HTTP_POST, "/api/control/hold");
+    simAdvance(20000);
+    CHECK(state() == "hold", "idle hold not latched - state %s", state().c_str());
+    request(HTTP_POST, "/api/control/resume");
+    CHECK(runUntilIdle(10000), "idle hold never released");
+    CHECK(stepperPosition(simLeftPin) == left0 && stepperPosition(simRightPin) == right0,
+          "idle hold moved the tracks by %d/%d", stepperPosition(simLeftPin) - left0,
+          stepperPosition(simRightPin) - right0);
+    CHECK(replyNumber(request(HTTP_GET, "/api/status/busy"), "completed") == completed + 2,
+          "idle hold counted a segment");
+
+    //G-code stream: '!' and '~' get through while the sender waits on "ok", and 0x91 raises the feed by 10%.
+    std::shared_ptr<SimSocket> stream = simConnect(23);
+    simAdvance(10000);
+    stream->fromDevice.clear();
+    start = stepperPosition(simLeftPin);
+    sendStream(stream, "G91\nG1 Y40 F300\n");
+    simAdvance(1000000);
+    sendStream(stream, "!");
+    simAdvance(1000 * (uint32_t)(1000 * cruise / accelSteps) + 50000);
+    CHECK(state() == "hold", "'!' did not hold - state %s", state().c_str());
+    stream->toDevice.push_back(0x91);
+    sendStream(stream, "~");
+    simAdvance(20000);
+    CHECK(state() == "running", "'~' did not resume - state %s", state().c_str());
+    CHECK(replyNumber(request(HTTP_GET, "/api/status/busy"), "feed_override") == 110, "0x91 not applied");
+    CHECK(runUntilIdle(30000), "stream move never finished");
+    CHECK(stepperPosition(simLeftPin) - start == -lround(40 * stepsPerMM), "stream move went %d",
+          stepperPosition(simLeftPin) - start);
+    request(HTTP_POST, "/api/control/override", "{\"feed\":100}");
+
+    //Spindle override scales the commanded duty and comes back exactly.
+    request(HTTP_POST, "/api/spindle/speed", "{\"speed\":50}");
+    CHECK(simLedcDuty(2) == 127, "spindle duty %u", simLedcDuty(2));
+    request(HTTP_POST, "/api/control/override", "{\"spindle\":50}");
+    CHECK(simLedcDuty(2) == 63, "spindle at 50%% override duty %u", simLedcDuty(2));
+    request(HTTP_POST, "/api/control/override", "{\"spindle\":100}");
+    CHECK(simLedcDuty(2) == 127, "spindle duty after override reset %u", simLedcDuty(2));
+
+    return finishScenario("override");
+}
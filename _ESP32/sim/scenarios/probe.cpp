@@ -0,0 +1,106 @@
+/*
+    Z probing against a surface a fixed number of steps from the start: the REST cycle and G38.2/G38.3 on the G-code
+    stream. Checks that the contact is latched to the step, that the second touch comes in at $24 after backing off,
+    the [PRB:...] reports, and the failures - no contact, a probe already closed, and an e-stop part way.
+*/
+#include "scenario.h"
+#include "WiFi.h"
+
+#define surfaceSteps 2000 //Probe (pin 34) closes once Z is this far along in the positive direction
+
+static std::vector<double> contactSpeeds; //Z speed in Hz at each closing edge of the probe
+static uint8_t lastProbeLevel = HIGH;
+
+static std::string probeStatus(double& z) {
+    SimResponse r = simWebServer().simRequest(HTTP_GET, "/api/status/probe");
+    StaticJsonDocument<256> doc;
+    deserializeJson(doc, r.body);
+    z = doc["z"] | NAN;
+    return doc["state"] | "";
+}
+
+int main() {
+    simSetInputModel(zSwitches(INT32_MIN, surfaceSteps));
+    bootMachine();
+    simAdvance(10000);
+    simAddTickHook([](uint64_t) {
+        uint8_t level = digitalRead(34);
+        if (lastProbeLevel == HIGH && level == LOW) {
+            contactSpeeds.push_back(fabs(simStepperOnPin(simZPin)->getCurrentSpeedInMilliHz() / 1000.0));
+        }
+        lastProbeLevel = level;
+    });
+
+    SimResponse r = request(HTTP_GET, "/api/config/grbl");
+    StaticJsonDocument<2048> grbl;
+    deserializeJson(grbl, r.body);
+    double stepsPerMM = grbl["$102"] | 0.0;
+    double locateHz = (grbl["$24"] | 0.0) * stepsPerMM / 60;
+    CHECK(stepsPerMM > 0 && locateHz > 0, "settings missing from %s", r.body.c_str());
+
+    //REST: seek fast, back off, touch again slowly - the reported contact is the surface to the step.
+    r = request(HTTP_POST, "/api/control/probe", "{\"distance\":20,\"feed\":300}");
+    CHECK(r.code == 200, "probe refused: %s", r.body.c_str());
+    simAdvance(10000);
+    CHECK(request(HTTP_GET, "/api/status/busy").body.find("probing") != std::string::npos, "state not reported");
+    r = request(HTTP_POST, "/api/control/probe", "{\"distance\":20}");
+    CHECK(r.code == 409, "second probe accepted while probing");
+    CHECK(runUntilIdle(20000), "probe never finished");
+    double z;
+    std::string state = probeStatus(z);
+    CHECK(state == "done" && lround(z * stepsPerMM) == surfaceSteps, "probe %s at %.4f mm, surface at %.4f mm",
+          state.c_str(), z, surfaceSteps / stepsPerMM);
+    CHECK(contactSpeeds.size() == 2, "%zu contacts, expected a seek and a retouch", contactSpeeds.size());
+    if (contactSpeeds.size() == 2) {
+        CHECK(contactSpeeds[0] > 2 * locateHz, "seek touched at %.1f Hz", contactSpeeds[0]);
+        CHECK(fabs(contactSpeeds[1] - locateHz) < 1, "retouch at %.1f Hz, $24 is %.1f Hz", contactSpeeds[1], locateHz);
+    }
+    CHECK(abs(stepperPosition(simZPin) - surfaceSteps) <= 1, "stopped at %d, contact at %d", stepperPosition(simZPin),
+          surfaceSteps);
+
+    //The probe is still closed - a new cycle fails at once.
+    r = request(HTTP_POST, "/api/control/probe", "{\"distance\":5}");
+    CHECK(r.code == 200, "probe refused: %s", r.body.c_str());
+    CHECK(runUntilIdle(1000), "probe from a closed switch did not end");
+    CHECK(probeStatus(z) == "failed", "probe from a closed switch reported %s", probeStatus(z).c_str());
+    CHECK(abs(stepperPosition(simZPin) - surfaceSteps) <= 1, "moved with the probe closed");
+
+    //G-code: back off 5 mm and probe again - the contact comes back at work Z 0.
+    std::shared_ptr<SimSocket> stream = simConnect(23);
+    simAdvance(10000);
+    stream->fromDevice.clear();
+    sendStream(stream, "G21G91G0Z-5\n");
+    CHECK(readReply(stream, 10000) == "ok\r\n", "retract refused");
+    sendStream(stream, "G38.2Z10F300\n");
+    std::string reply = readReply(stream, 30000);
+    float x, y, contact;
+    int touched = -1;
+    CHECK(sscanf(reply.c_str(), "[PRB:%f,%f,%f:%d]", &x, &y, &contact, &touched) == 4 && touched == 1 &&
+              fabs(contact) < 1.5 / stepsPerMM && reply.find("ok\r\n") != std::string::npos,
+          "G38.2 replied %s", reply.c_str());
+    CHECK(probeStatus(z) == "done" && lround(z * stepsPerMM) == surfaceSteps, "G38.2 contact %.4f mm", z);
+
+    //Away from the surface: G38.3 reports the miss and carries on, G38.2 fails the line.
+    sendStream(stream, "G0Z-5\n");
+    readReply(stream, 10000);
+    sendStream(stream, "G38.3Z-2\n");
+    reply = readReply(stream, 30000);
+    CHECK(reply.find(":0]") != std::string::npos && reply.find("ok\r\n") != std::string::npos, "G38.3 miss replied %s",
+          reply.c_str());
+    sendStream(stream, "G38.2Z-2\n");
+    reply = readReply(stream, 30000);
+    CHECK(reply.find(":0]") != std::string::npos && reply.find("error:80") != std::string::npos,
+          "G38.2 miss replied %s", reply.c_str());
+    sendStream(stream, "G38.2X5Z1\n");
+    CHECK(readReply(stream, 1000) == "error:20\r\n", "G38.2 with X accepted");
+
+    //E-stop ends a cycle part way.
+    r = request(HTTP_POST, "/api/control/probe", "{\"distance\":-20,\"feed\":100}");
+    CHECK(r.code == 200, "probe refused: %s", r.body.c_str());
+    simAdvance(300000);
+    request(HTTP_POST, "/api/control/estop");
+    simAdvance(10000);
+    CHECK(probeStatus(z) == "failed" && !machineBusy(), "probe survived an e-stop");
+
+    return finishScenario("probe");
+}
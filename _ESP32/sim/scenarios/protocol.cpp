@@ -0,0 +1,179 @@
+/*
+    Talks to the binary control port (82) the way the server's ControlStream does and checks the acks: round-trip time,
+    CRC and sequence checks (repeat, out of order, gap) and that jog, move, Z, spindle, laser and stop frames act like
+    their REST counterparts, spindle frames being refused in laser mode as the REST ones are.
+*/
+#include "scenario.h"
+#include "WiFi.h"
+#include "esp_rom_crc.h"
+
+enum { PING = 0x00, JOG = 0x01, MOVE = 0x02, Z = 0x03, STOP = 0x04, SPINDLE = 0x05, LASER = 0x06, JOG_VELOCITY = 0x07 };
+enum { OK, GAP, STALE, BAD_CRC, BAD_OPCODE, BAD_PAYLOAD, QUEUE_FULL, REJECTED };
+
+static std::shared_ptr<SimSocket> control;
+
+struct Ack {
+    bool received = false;
+    uint8_t opcode = 0;
+    uint16_t sequence = 0;
+    uint8_t status = 0xFF;
+    uint8_t free = 0;
+    uint64_t latencyUs = 0;
+};
+
+static std::vector<uint8_t> frame(uint8_t opcode, uint16_t sequence, const std::vector<uint8_t>& payload) {
+    std::vector<uint8_t> out = {0x5A, opcode, (uint8_t)sequence, (uint8_t)(sequence >> 8), (uint8_t)payload.size()};
+    out.insert(out.end(), payload.begin(), payload.end());
+    uint32_t crc = esp_rom_crc32_le(0, out.data(), out.size());
+    for (int i = 0; i < 4; i++) out.push_back((uint8_t)(crc >> (8 * i)));
+    return out;
+}
+
+static std::vector<uint8_t> floats(std::initializer_list<float> values, int leading = -1) {
+    std::vector<uint8_t> out;
+    if (leading >= 0) out.push_back((uint8_t)leading);
+    for (float v : values) {
+        uint8_t bytes[4];
+        memcpy(bytes, &v, 4);
+        out.insert(out.end(), bytes, bytes + 4);
+    }
+    return out;
+}
+
+//Send raw bytes and wait up to 50 ms of machine time for one ack.
+static Ack sendRaw(const std::vector<uint8_t>& bytes) {
+    uint64_t start = simNowMicros();
+    for (uint8_t b : bytes) control->toDevice.push_back(b);
+    Ack ack;
+    while (simNowMicros() - start < 50000 && control->fromDevice.size() < 11) simAdvance(100);
+    if (control->fromDevice.size() < 11) return ack;
+    uint8_t data[11];
+    for (int i = 0; i < 11; i++) {
+        data[i] = control->fromDevice.front();
+        control->fromDevice.pop_front();
+    }
+    uint32_t crc;
+    memcpy(&crc, &data[7], 4);
+    ack.received = data[0] == 0x5A && data[4] == 2 && esp_rom_crc32_le(0, data, 7) == crc;
+    ack.opcode = data[1];
+    ack.sequence = data[2] | data[3] << 8;
+    ack.status = data[5];
+    ack.free = data[6];
+    ack.latencyUs = simNowMicros() - start;
+    return ack;
+}
+
+static Ack send(uint8_t opcode, uint16_t sequence, const std::vector<uint8_t>& payload = {}) {
+    Ack ack = sendRaw(frame(opcode, sequence, payload));
+    printf("%9.3f frame op %02x seq %-5u -> ack op %02x seq %-5u status %u free %u  %.3f ms\n", simNowMicros() / 1e6,
+           opcode, sequence, ack.opcode, ack.sequence, ack.status, ack.free, ack.latencyUs / 1000.0);
+    return ack;
+}
+
+int main() {
+    bootMachine();
+    control = simConnect(82);
+
+    SimResponse r = request(HTTP_GET, "/api/config/grbl");
+    StaticJsonDocument<2048> grbl;
+    deserializeJson(grbl, r.body);
+    double trackStepsPerMM = grbl["$100"] | 0.0;
+    double zStepsPerMM = grbl["$102"] | 0.0;
+
+    Ack ack = send(PING, 1);
+    CHECK(ack.received && ack.opcode == (PING | 0x80) && ack.sequence == 1 && ack.status == OK, "ping not acked");
+    CHECK(ack.latencyUs <= 3000, "ping took %.3f ms", ack.latencyUs / 1000.0);
+
+    //Forward 2 mm, the same move the REST scenario makes.
+    int32_t left = stepperPosition(simLeftPin), right = stepperPosition(simRightPin);
+    ack = send(JOG, 2, floats({500, 2}, 0));
+    CHECK(ack.status == OK && ack.free < 63, "jog refused: status %u free %u", ack.status, ack.free);
+    //The ack was lost and the jog is sent again - it must not run twice.
+    ack = send(JOG, 2, floats({500, 2}, 0));
+    CHECK(ack.status == OK, "repeat not acked with the original status");
+    CHECK(runUntilIdle(10000), "jog never finished");
+    int32_t expected = -lround(2 * trackStepsPerMM);
+    CHECK(stepperPosition(simLeftPin) - left == expected && stepperPosition(simRightPin) - right == expected,
+          "jog moved %d/%d, expected %d", stepperPosition(simLeftPin) - left, stepperPosition(simRightPin) - right,
+          expected);
+
+    //Damaged and out of order frames are refused; a jump forward runs but is flagged.
+    std::vector<uint8_t> bad = frame(JOG, 3, floats({500, 2}, 0));
+    bad[7] ^= 0x10;
+    ack = sendRaw(bad);
+    CHECK(ack.received && ack.status == BAD_CRC, "damaged frame status %u", ack.status);
+    ack = send(PING, 1);
+    CHECK(ack.status == STALE, "old sequence status %u", ack.status);
+    ack = send(PING, 5);
+    CHECK(ack.status == GAP, "skipped sequence status %u", ack.status);
+    ack = send(0x7F, 6);
+    CHECK(ack.status == BAD_OPCODE, "unknown opcode status %u", ack.status);
+    ack = send(JOG, 7, floats({500}, 0));
+    CHECK(ack.status == BAD_PAYLOAD, "short payload status %u", ack.status);
+    ack = send(JOG, 8, floats({500, 2}, 9));
+    CHECK(ack.status == REJECTED, "bad direction status %u", ack.status);
+
+    //Garbage ahead of a frame is skipped while hunting for the magic byte.
+    std::vector<uint8_t> noisy = {0x00, 0x13, 0x37};
+    std::vector<uint8_t> ping = frame(PING, 9, {});
+    noisy.insert(noisy.end(), ping.begin(), ping.end());
+    ack = sendRaw(noisy);
+    CHECK(ack.status == OK && ack.sequence == 9, "frame after noise status %u seq %u", ack.status, ack.sequence);
+
+    //Move and Z take the kinematic and depth forms.
+    left = stepperPosition(simLeftPin);
+    ack = send(MOVE, 10, floats({10, 0, 300}));
+    CHECK(ack.status == OK, "move refused: %u", ack.status);
+    int32_t z = stepperPosition(simZPin);
+    ack = send(Z, 11, floats({200, 1.5}));
+    CHECK(ack.status == OK, "z refused: %u", ack.status);
+    CHECK(runUntilIdle(20000), "move never finished");
+    CHECK(stepperPosition(simLeftPin) - left == -lround(10 * trackStepsPerMM), "move went %d",
+          stepperPosition(simLeftPin) - left);
+    CHECK(stepperPosition(simZPin) - z == lround(1.5 * zStepsPerMM), "z went %d", stepperPosition(simZPin) - z);
+
+    ack = send(SPINDLE, 12, {1, 50});
+    CHECK(ack.status == OK && simOutputLevel(16) == HIGH && simLedcDuty(2) == 127, "spindle on: status %u duty %u",
+          ack.status, simLedcDuty(2));
+    ack = send(SPINDLE, 13, {0, 255});
+    CHECK(ack.status == OK && simOutputLevel(16) == LOW && simLedcDuty(2) == 127, "spindle off changed the speed");
+    ack = send(LASER, 14, {1});
+    CHECK(ack.status == OK && simOutputLevel(4) == HIGH, "laser not on");
+    ack = send(LASER, 15, {0});
+    CHECK(ack.status == OK && simOutputLevel(4) == LOW, "laser not off");
+
+    //Laser mode ($32) refuses the spindle opcode whole - the relay as well as the speed.
+    r = request(HTTP_POST, "/api/config/grbl/bulk", "{\"settings\":{\"$32\":1}}");
+    CHECK(r.code == 200, "laser mode refused: %s", r.body.c_str());
+    ack = send(SPINDLE, 16, {1, 255});
+    CHECK(ack.status == REJECTED && simOutputLevel(16) == LOW, "spindle relay switched in laser mode: status %u",
+          ack.status);
+    ack = send(SPINDLE, 17, {1, 50});
+    CHECK(ack.status == REJECTED && simOutputLevel(16) == LOW, "spindle speed set in laser mode: status %u", ack.status);
+    request(HTTP_POST, "/api/config/grbl/bulk", "{\"settings\":{\"$32\":0}}");
+
+    //Continuous jog - every frame is a keepalive and speed 0 ramps the tracks down.
+    uint16_t sequence = 18;
+    for (int i = 0; i < 10; i++) {
+        ack = send(JOG_VELOCITY, sequence++, floats({300}, 1));
+        CHECK(ack.status == OK, "continuous jog refused: %u", ack.status);
+        simAdvance(100000);
+    }
+    CHECK(simStepperOnPin(simLeftPin)->getCurrentSpeedInMilliHz() == lround(300 / 60.0 * trackStepsPerMM) * 1000,
+          "continuous jog at %d mHz", simStepperOnPin(simLeftPin)->getCurrentSpeedInMilliHz());
+    ack = send(JOG_VELOCITY, sequence++, floats({300}, 8));
+    CHECK(ack.status == REJECTED, "bad continuous jog direction status %u", ack.status);
+    ack = send(JOG_VELOCITY, sequence++, floats({0}, 0));
+    CHECK(ack.status == OK, "continuous jog stop refused: %u", ack.status);
+    CHECK(runUntilIdle(1000), "continuous jog did not ramp down");
+
+    //Stop halts a long jog part way.
+    ack = send(JOG, sequence++, floats({500, 50}, 0));
+    CHECK(ack.status == OK, "long jog refused");
+    simAdvance(500000);
+    ack = send(STOP, sequence++);
+    CHECK(ack.status == OK, "stop refused");
+    CHECK(runUntilIdle(1000), "stop did not halt the machine");
+
+    return finishScenario("protocol");
+}
@@ -0,0 +1,107 @@
+/*
+    Shared helpers for the scenarios: boot the firmware, send requests, wait on the machine and count failed checks.
+    Each scenario is its own program and exits non-zero when any check fails.
+*/
+#pragma once
+
+#include "Arduino.h"
+#include "ArduinoJson.h"
+#include "FastAccelStepper.h"
+#include "WebServer.h"
+#include "WiFi.h"
+#include "sim.h"
+
+void setup();
+
+static int scenarioFailures = 0;
+
+#define CHECK(cond, ...)                                              \
+    do {                                                              \
+        if (!(cond)) {                                                \
+            scenarioFailures++;                                       \
+            fprintf(stderr, "FAIL %s:%d: %s - ", __FILE__, __LINE__, #cond); \
+            fprintf(stderr, __VA_ARGS__);                             \
+            fprintf(stderr, "\n");                                    \
+        }                                                             \
+    } while (0)
+
+//Step pins from machine.cpp - left track, right track, z.
+#define simLeftPin 32
+#define simRightPin 27
+#define simZPin 18
+
+//Boot with stored WiFi credentials so setup() gets past the connect loop.
+static inline void bootMachine() {
+    simNvsPutString("credentials", "ssid", "bench");
+    simNvsPutString("credentials", "password", "bench");
+    setup();
+}
+
+//Run a request and print one line for it: start time, route, status, handler time and the start of the reply.
+static inline SimResponse request(HTTPMethod method, const char* uri, const char* body = "",
+                           const std::map<std::string, std::string>& args = {}) {
+    uint64_t start = simNowMicros();
+    SimResponse r = simWebServer().simRequest(method, uri, body, args);
+    printf("%9.3f %-4s %-26s %3d %8.3f ms  %.100s\n", start / 1e6, method == HTTP_GET ? "GET" : "POST", uri, r.code,
+           r.handlerUs / 1000.0, r.body.c_str());
+    return r;
+}
+
+//Read one number out of a JSON reply.
+static inline double replyNumber(const SimResponse& r, const char* key) {
+    StaticJsonDocument<1024> doc;
+    if (deserializeJson(doc, r.body)) return NAN;
+    return doc[key] | NAN;
+}
+
+static inline bool machineBusy() {
+    return simWebServer().simRequest(HTTP_GET, "/api/status/busy").body.find("\"busy\":false") == std::string::npos;
+}
+
+//Advance until the firmware reports idle. Returns false if it is still busy after limitMs of machine time.
+static inline bool runUntilIdle(uint32_t limitMs) {
+    uint64_t end = simNowMicros() + (uint64_t)limitMs * 1000;
+    while (simNowMicros() < end) {
+        simAdvance(1000);
+        if (!machineBusy()) return true;
+    }
+    return false;
+}
+
+//Input model for simSetInputModel(): the Z endstop (pin 35) closes at or below endstopSteps and the probe (pin 34) at
+//or above probeSteps. INT32_MIN / INT32_MAX for a switch that never closes.
+static inline std::function<int(uint8_t)> zSwitches(int32_t endstopSteps, int32_t probeSteps) {
+    return [endstopSteps, probeSteps](uint8_t pin) {
+        FastAccelStepper* z = simStepperOnPin(simZPin);
+        if (pin == 35) return z && z->getCurrentPosition() <= endstopSteps ? LOW : HIGH;
+        if (pin == 34) return z && z->getCurrentPosition() >= probeSteps ? LOW : HIGH;
+        return -1;
+    };
+}
+
+//Queue text on a G-code stream socket as if the sender had written it.
+static inline void sendStream(std::shared_ptr<SimSocket> socket, const char* text) {
+    for (const char* c = text; *c; c++) socket->toDevice.push_back((uint8_t)*c);
+}
+
+//Everything the firmware has said on the stream until the reply to the line in flight, or limitMs of machine time.
+static inline std::string readReply(std::shared_ptr<SimSocket> socket, uint32_t limitMs) {
+    std::string reply;
+    for (uint32_t ms = 0; ms < limitMs; ms++) {
+        while (!socket->fromDevice.empty()) {
+            reply += (char)socket->fromDevice.front();
+            socket->fromDevice.pop_front();
+        }
+        if (reply.find("ok\r\n") != std::string::npos || reply.find("error:") != std::string::npos) break;
+        simAdvance(1000);
+    }
+    return reply;
+}
+
+static inline int32_t stepperPosition(uint8_t pin) { return simStepperOnPin(pin)->getCurrentPosition(); }
+
+static inline int finishScenario(const char* name) {
+    simWriteTraceFromEnv();
+    printf("%s: %s\n", name, scenarioFailures ? "FAILED" : "passed");
+    return scenarioFailures ? 1 : 0;
+}
@@ -0,0 +1,54 @@
+/*
+    Streams G-code files to the firmware over the port 23 socket, one line per "ok", and reports how long the
+    machine takes to run them. Any "error:" reply or a machine that never goes idle fails the run.
+    Usage: stream file.nc [file.nc ...]
+*/
+#include "scenario.h"
+#include "WiFi.h"
+
+#include <fstream>
+
+static std::shared_ptr<SimSocket> gcode;
+
+//Advance until the firmware has answered the line in flight.
+static std::string readReply() {
+    std::string reply;
+    while (reply.find('\n') == std::string::npos) {
+        simAdvance(100);
+        while (!gcode->fromDevice.empty()) {
+            reply += (char)gcode->fromDevice.front();
+            gcode->fromDevice.pop_front();
+        }
+    }
+    return reply.substr(0, reply.find_first_of("\r\n"));
+}
+
+int main(int argc, char** argv) {
+    bootMachine();
+    gcode = simConnect(23);
+    readReply(); //greeting
+
+    for (int i = 1; i < argc; i++) {
+        std::ifstream in(argv[i]);
+        CHECK(in.good(), "cannot open %s", argv[i]);
+        std::string line;
+        int lines = 0, errors = 0;
+        uint64_t start = simNowMicros();
+        while (std::getline(in, line)) {
+            for (char c : line) gcode->toDevice.push_back(c);
+            gcode->toDevice.push_back('\n');
+            lines++;
+            std::string reply = readReply();
+            if (reply != "ok") {
+                errors++;
+                fprintf(stderr, "%s:%d '%s' -> %s\n", argv[i], lines, line.c_str(), reply.c_str());
+            }
+        }
+        bool idle = runUntilIdle(3600000);
+        CHECK(errors == 0, "%s: %d lines rejected", argv[i], errors);
+        CHECK(idle, "%s: machine never went idle", argv[i]);
+        printf("%s: %d lines, %.2f s, left %d right %d z %d\n", argv[i], lines, (simNowMicros() - start) / 1e6,
+               stepperPosition(simLeftPin), stepperPosition(simRightPin), stepperPosition(simZPin));
+    }
+    return finishScenario("stream");
+}
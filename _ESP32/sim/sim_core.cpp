@@ -0,0 +1,658 @@
+/*
+    Implementation of the host stand-ins: virtual clock, GPIO/interrupt model, stepper integration and traces,
+    in-memory network endpoints, NVS and a small JSON reader/writer.
+*/
+#include "Arduino.h"
+#include "ArduinoJson.h"
+#include "ESPmDNS.h"
+#include "FastAccelStepper.h"
+#include "HTTPClient.h"
+#include "Preferences.h"
+#include "Update.h"
+#include "WebServer.h"
+#include "WiFi.h"
+#include "sim.h"
+
+#include <map>
+
+//----------------------------------------------------------------------------------------------------------------------
+// Clock, GPIO and interrupts
+
+static uint64_t nowUs = 0;
+static uint8_t pinLevels[64];
+static std::function<int(uint8_t)> inputModel;
+static std::vector<std::function<void(uint64_t)>> tickHooks;
+
+struct AttachedIsr {
+    void (*isr)(void);
+    int mode;
+    int lastLevel;
+};
+static std::map<uint8_t, AttachedIsr> isrs;
+static std::map<uint8_t, uint32_t> ledcDuty;
+
+HardwareSerial Serial;
+EspClass ESP;
+WiFiClass WiFi;
+MDNSResponder MDNS;
+UpdateClass Update;
+
+static bool serialEcho = getenv("SIM_SERIAL") != nullptr;
+static std::string serialLine;
+static std::vector<std::string> serialLog;
+static bool restartRequested = false;
+
+size_t HardwareSerial::write(uint8_t c) {
+    if (c == '\n') {
+        if (serialEcho) fprintf(stderr, "[serial %8.3f] %s\n", nowUs / 1e6, serialLine.c_str());
+        serialLog.push_back(serialLine);
+        serialLine.clear();
+    } else if (c != '\r') {
+        serialLine += (char)c;
+    }
+    return 1;
+}
+
+void EspClass::restart() { restartRequested = true; }
+
+uint64_t simNowMicros() { return nowUs; }
+unsigned long millis() { return (unsigned long)(nowUs / 1000); }
+unsigned long micros() { return (unsigned long)nowUs; }
+void delay(uint32_t ms) { simAdvance(ms * 1000); }
+void delayMicroseconds(uint32_t us) { simAdvance(us); }
+void yield() { simAdvance(1); }
+
+static int readLevel(uint8_t pin) {
+    if (inputModel) {
+        int v = inputModel(pin);
+        if (v >= 0) return v;
+    }
+    return pinLevels[pin & 63];
+}
+
+static void evaluateInterrupts() {
+    //Copy first - an ISR is allowed to detach itself.
+    auto snapshot = isrs;
+    for (auto& kv : snapshot) {
+        int level = readLevel(kv.first);
+        auto it = isrs.find(kv.first);
+        if (it == isrs.end()) continue;
+        bool fire = false;
+        switch (kv.second.mode) {
+            case ONLOW: fire = level == LOW; break;
+            case ONHIGH: fire = level == HIGH; break;
+            case FALLING: fire = kv.second.lastLevel == HIGH && level == LOW; break;
+            case RISING: fire = kv.second.lastLevel == LOW && level == HIGH; break;
+            case CHANGE: fire = kv.second.lastLevel != level; break;
+        }
+        it->second.lastLevel = level;
+        if (fire) kv.second.isr();
+    }
+}
+
+void simAdvance(uint32_t us) {
+    const uint32_t slice = 50;
+    while (us > 0) {
+        uint32_t dt = us < slice ? us : slice;
+        nowUs += dt;
+        for (auto* s : simSteppers()) s->simTick(dt);
+        evaluateInterrupts();
+        for (auto& hook : tickHooks) hook(nowUs);
+        simRunTasks();
+        us -= dt;
+    }
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (mode == INPUT_PULLUP) pinLevels[pin & 63] = HIGH;
+}
+void digitalWrite(uint8_t pin, uint8_t val) { pinLevels[pin & 63] = val ? HIGH : LOW; }
+int digitalRead(uint8_t pin) { return readLevel(pin); }
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode) { isrs[pin] = {isr, mode, readLevel(pin)}; }
+void detachInterrupt(uint8_t pin) { isrs.erase(pin); }
+
+bool ledcAttach(uint8_t pin, uint32_t freq, uint8_t resolution) {
+    (void)freq;
+    (void)resolution;
+    ledcDuty[pin] = 0;
+    return true;
+}
+bool ledcWrite(uint8_t pin, uint32_t duty) {
+    ledcDuty[pin] = duty;
+    return true;
+}
+uint32_t ledcRead(uint8_t pin) { return ledcDuty[pin]; }
+
+float temperatureRead() { return 41.5f; }
+
+long map(long x, long in_min, long in_max, long out_min, long out_max) {
+    if (in_max == in_min) return out_min;
+    return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+void simSetInputModel(std::function<int(uint8_t)> model) { inputModel = model; }
+void simAddTickHook(std::function<void(uint64_t)> hook) { tickHooks.push_back(hook); }
+uint8_t simOutputLevel(uint8_t pin) { return pinLevels[pin & 63]; }
+uint32_t simLedcDuty(uint8_t pin) { return ledcDuty[pin]; }
+const std::vector<std::string>& simSerialLog() { return serialLog; }
+bool simRestartRequested() { return restartRequested; }
+
+//----------------------------------------------------------------------------------------------------------------------
+// Steppers
+
+std::vector<FastAccelStepper*>& simSteppers() {
+    static std::vector<FastAccelStepper*> steppers;
+    return steppers;
+}
+
+FastAccelStepper* simStepperOnPin(uint8_t stepPin) {
+    for (auto* s : simSteppers())
+        if (s->getStepPin() == stepPin) return s;
+    return nullptr;
+}
+
+bool simWriteTrace(const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) return false;
+    fprintf(f, "time_us,step_pin,dir,position\n");
+    for (auto* s : simSteppers())
+        for (auto& e : s->simTrace())
+            fprintf(f, "%llu,%u,%d,%d\n", (unsigned long long)e.timeUs, s->getStepPin(), e.dir, e.position);
+    fclose(f);
+    return true;
+}
+
+void simWriteTraceFromEnv() {
+    const char* path = getenv("SIM_TRACE");
+    if (path && !simWriteTrace(path)) fprintf(stderr, "could not write trace to %s\n", path);
+}
+
+FastAccelStepper* FastAccelStepperEngine::stepperConnectToPin(uint8_t stepPin) {
+    if (simSteppers().size() >= 6) return nullptr;
+    auto* s = new FastAccelStepper(stepPin);
+    simSteppers().push_back(s);
+    return s;
+}
+
+MoveResultCode FastAccelStepper::move(int32_t steps, bool blocking) {
+    return moveTo((mode_ == MOVING ? target_ : position_) + steps, blocking);
+}
+
+MoveResultCode FastAccelStepper::moveTo(int32_t position, bool blocking) {
+    if (dirPin_ == 255) return MOVE_ERR_NO_DIRECTION_PIN;
+    if (speedHz_ <= 0) return MOVE_ERR_SPEED_IS_UNDEFINED;
+    if (accel_ <= 0) return MOVE_ERR_ACCELERATION_IS_UNDEFINED;
+    target_ = position;
+    if (mode_ != MOVING || target_ != position_) mode_ = MOVING;
+    if (target_ == position_ && velocity_ == 0) mode_ = IDLE;
+    while (blocking && isRunning()) simAdvance(100);
+    return MOVE_OK;
+}
+
+MoveResultCode FastAccelStepper::runForward() {
+    if (speedHz_ <= 0) return MOVE_ERR_SPEED_IS_UNDEFINED;
+    if (accel_ <= 0) return MOVE_ERR_ACCELERATION_IS_UNDEFINED;
+    mode_ = RUN_FORWARD;
+    return MOVE_OK;
+}
+
+MoveResultCode FastAccelStepper::runBackward() {
+    if (speedHz_ <= 0) return MOVE_ERR_SPEED_IS_UNDEFINED;
+    if (accel_ <= 0) return MOVE_ERR_ACCELERATION_IS_UNDEFINED;
+    mode_ = RUN_BACKWARD;
+    return MOVE_OK;
+}
+
+MoveResultCode FastAccelStepper::moveByAcceleration(int32_t accel, bool allowReverse) {
+    (void)allowReverse;
+    byAccel_ = accel;
+    mode_ = BY_ACCEL;
+    return MOVE_OK;
+}
+
+void FastAccelStepper::forwardStep(bool blocking) {
+    takeStep(1);
+    if (blocking) simAdvance(speedHz_ > 0 ? (uint32_t)(1e6 / speedHz_) : 1000);
+}
+
+void FastAccelStepper::backwardStep(bool blocking) {
+    takeStep(-1);
+    if (blocking) simAdvance(speedHz_ > 0 ? (uint32_t)(1e6 / speedHz_) : 1000);
+}
+
+void FastAccelStepper::takeStep(int dir) {
+    position_ += dir;
+    stepCount_++;
+    trace_.push_back({simNowMicros(), (int8_t)dir, position_});
+}
+
+void FastAccelStepper::simTick(double dtUs) {
+    if (mode_ == IDLE) return;
+    double dt = dtUs / 1e6;
+    double dv = accel_ * dt;
+    double v = velocity_;
+    double vmax = speedHz_;
+
+    switch (mode_) {
+        case MOVING: {
+            double remaining = (double)target_ - position_ - (v >= 0 ? frac_ : -frac_);
+            double dir = remaining > 0 ? 1 : (remaining < 0 ? -1 : 0);
+            if (dir == 0 || (v != 0 && (v > 0) != (dir > 0))) {
+                //Wrong way or on target - brake.
+                v = v > 0 ? std::max(0.0, v - dv) : std::min(0.0, v + dv);
+            } else {
+                //Follow the lower of the cruise speed and the speed that still stops on target.
+                double floorV = sqrt(2 * accel_);
+                double desired = std::max(floorV, std::min(vmax, sqrt(2 * accel_ * fabs(remaining))));
+                double mag = fabs(v) < desired ? std::min(desired, fabs(v) + dv) : std::max(desired, fabs(v) - dv);
+                v = dir * mag;
+            }
+            break;
+        }
+        case RUN_FORWARD:
+            v = v < vmax ? std::min(vmax, v + dv) : std::max(vmax, v - dv);
+            break;
+        case RUN_BACKWARD:
+            v = v > -vmax ? std::max(-vmax, v - dv) : std::min(-vmax, v + dv);
+            break;
+        case BY_ACCEL:
+            v = std::max(-vmax, std::min(vmax, v + byAccel_ * dt));
+            break;
+        case STOPPING:
+            v = v > 0 ? std::max(0.0, v - dv) : std::min(0.0, v + dv);
+            break;
+        default:
+            break;
+    }
+
+    velocity_ = v;
+    frac_ += fabs(v) * dt;
+    int dir = v > 0 ? 1 : -1;
+    while (frac_ >= 1.0) {
+        frac_ -= 1.0;
+        if (mode_ == MOVING && position_ == target_) {
+            frac_ = 0;
+            break;
+        }
+        takeStep(dir);
+    }
+
+    if (mode_ == MOVING && position_ == target_ && fabs(velocity_) <= dv * 2) {
+        velocity_ = 0;
+        frac_ = 0;
+        mode_ = IDLE;
+    } else if (mode_ == STOPPING && velocity_ == 0) {
+        frac_ = 0;
+        mode_ = IDLE;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Network endpoints
+
+static std::map<uint16_t, std::deque<std::shared_ptr<SimSocket>>> pendingSockets;
+static std::map<uint16_t, std::deque<std::vector<uint8_t>>> pendingDatagrams;
+static std::vector<SimDatagram> udpReplies;
+
+std::shared_ptr<SimSocket> simConnect(uint16_t port) {
+    auto s = std::make_shared<SimSocket>();
+    s->port = port;
+    pendingSockets[port].push_back(s);
+    return s;
+}
+
+bool WiFiServer::hasClient() { return listening_ && !pendingSockets[port_].empty(); }
+
+WiFiClient WiFiServer::accept() {
+    if (!hasClient()) return WiFiClient();
+    auto s = pendingSockets[port_].front();
+    pendingSockets[port_].pop_front();
+    return WiFiClient(s);
+}
+
+void simUdpSend(uint16_t port, const std::vector<uint8_t>& data) { pendingDatagrams[port].push_back(data); }
+std::vector<SimDatagram>& simUdpReplies() { return udpReplies; }
+
+int WiFiUDP::parsePacket() {
+    auto& q = pendingDatagrams[port_];
+    if (!port_ || q.empty()) return 0;
+    rx_ = q.front();
+    rxPos_ = 0;
+    q.pop_front();
+    return (int)rx_.size();
+}
+
+int WiFiUDP::endPacket() {
+    udpReplies.push_back({port_, tx_});
+    tx_.clear();
+    return 1;
+}
+
+std::vector<SimHttpPost>& simHttpPosts() {
+    static std::vector<SimHttpPost> posts;
+    return posts;
+}
+
+int HTTPClient::POST(const String& body) {
+    simHttpPosts().push_back({simNowMicros(), url_.str(), body.str()});
+    return 200;
+}
+
+const WebServer::Route* WebServer::findRoute(HTTPMethod method, const std::string& uri) const {
+    for (auto& r : routes_)
+        if (r.uri == uri && (r.method == method || r.method == HTTP_ANY)) return &r;
+    return nullptr;
+}
+
+static WebServer* activeWebServer = nullptr;
+
+void WebServer::begin() {
+    started_ = true;
+    activeWebServer = this;
+}
+
+WebServer& simWebServer() { return *activeWebServer; }
+
+void WebServer::setArgs(const std::map<std::string, std::string>& args, const std::string& body) {
+    args_ = args;
+    argList_.clear();
+    for (const auto& arg : args) argList_.push_back({String(arg.first), String(arg.second)});
+    if (!body.empty()) {
+        args_["plain"] = body;
+        argList_.push_back({String("plain"), String(body)});
+    }
+    _currentArgs = argList_.data();
+    _currentArgCount = (int)argList_.size();
+}
+
+SimResponse WebServer::simRequest(HTTPMethod method, const std::string& uri, const std::string& body,
+                                  const std::map<std::string, std::string>& args) {
+    response_ = SimResponse();
+    setArgs(args, body);
+    uri_ = uri;
+    method_ = method;
+    const Route* r = findRoute(method, uri);
+    uint64_t start = simNowMicros();
+    if (r) r->fn();
+    else if (notFound_) notFound_();
+    else send(404, "text/plain", "Not found");
+    response_.handlerUs = simNowMicros() - start;
+    return response_;
+}
+
+SimResponse WebServer::simUpload(const std::string& uri, const std::string& filename, const std::vector<uint8_t>& data,
+                                 const std::map<std::string, std::string>& args) {
+    response_ = SimResponse();
+    setArgs(args, std::string());
+    uri_ = uri;
+    method_ = HTTP_POST;
+    const Route* r = findRoute(HTTP_POST, uri);
+    if (!r) {
+        response_.code = 404;
+        return response_;
+    }
+    uint64_t start = simNowMicros();
+    upload_.filename = filename;
+    upload_.totalSize = 0;
+    upload_.currentSize = 0;
+    upload_.status = UPLOAD_FILE_START;
+    if (r->upload) r->upload();
+    for (size_t off = 0; off < data.size(); off += HTTP_UPLOAD_BUFLEN) {
+        size_t n = std::min((size_t)HTTP_UPLOAD_BUFLEN, data.size() - off);
+        memcpy(upload_.buf, data.data() + off, n);
+        upload_.currentSize = n;
+        upload_.totalSize += n;
+        upload_.status = UPLOAD_FILE_WRITE;
+        if (r->upload) r->upload();
+    }
+    upload_.currentSize = 0;
+    upload_.status = UPLOAD_FILE_END;
+    if (r->upload) r->upload();
+    r->fn();
+    response_.handlerUs = simNowMicros() - start;
+    return response_;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Preferences
+
+static std::map<std::string, std::map<std::string, std::vector<uint8_t>>> nvs;
+
+SimNvsStats& simNvsStats() {
+    static SimNvsStats stats;
+    return stats;
+}
+
+bool Preferences::begin(const char* name, bool readOnly, const char* partition) {
+    (void)partition;
+    simNvsStats().opens++;
+    ns_ = &nvs[name];
+    readOnly_ = readOnly;
+    return true;
+}
+
+bool Preferences::clear() {
+    if (!ns_ || readOnly_) return false;
+    ns_->clear();
+    return true;
+}
+
+bool Preferences::remove(const char* key) {
+    if (!ns_ || readOnly_) return false;
+    return ns_->erase(key) > 0;
+}
+
+bool Preferences::isKey(const char* key) { return ns_ && ns_->count(key); }
+
+size_t Preferences::putRaw(const char* key, const void* v, size_t len) {
+    if (!ns_ || readOnly_) return 0;
+    simNvsStats().writes++;
+    auto p = (const uint8_t*)v;
+    (*ns_)[key] = std::vector<uint8_t>(p, p + len);
+    return len;
+}
+
+String Preferences::getString(const char* key, const String& def) {
+    if (!ns_) return def;
+    simNvsStats().reads++;
+    auto it = ns_->find(key);
+    if (it == ns_->end() || it->second.empty()) return def;
+    return String((const char*)it->second.data());
+}
+
+size_t Preferences::getBytesLength(const char* key) {
+    if (!ns_) return 0;
+    auto it = ns_->find(key);
+    return it == ns_->end() ? 0 : it->second.size();
+}
+
+size_t Preferences::getBytes(const char* key, void* buf, size_t maxLen) {
+    if (!ns_) return 0;
+    simNvsStats().reads++;
+    auto it = ns_->find(key);
+    if (it == ns_->end() || it->second.size() > maxLen) return 0;
+    memcpy(buf, it->second.data(), it->second.size());
+    return it->second.size();
+}
+
+void simNvsPutString(const char* ns, const char* key, const char* value) {
+    nvs[ns][key] = std::vector<uint8_t>(value, value + strlen(value) + 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// JSON
+
+namespace simjson {
+
+static void skipWs(const char*& p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+}
+
+static bool parseString(const char*& p, const char* end, std::string& out) {
+    if (p >= end || *p != '"') return false;
+    p++;
+    while (p < end && *p != '"') {
+        if (*p == '\\' && p + 1 < end) {
+            p++;
+            switch (*p) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                default: out += *p; break;
+            }
+        } else {
+            out += *p;
+        }
+        p++;
+    }
+    if (p >= end) return false;
+    p++;
+    return true;
+}
+
+bool parse(const char*& p, const char* end, Node& out, int depth) {
+    if (depth > 10) return false;
+    skipWs(p, end);
+    if (p >= end) return false;
+    if (*p == '{') {
+        out.type = Node::OBJ;
+        p++;
+        skipWs(p, end);
+        if (p < end && *p == '}') { p++; return true; }
+        while (true) {
+            skipWs(p, end);
+            std::string key;
+            if (!parseString(p, end, key)) return false;
+            skipWs(p, end);
+            if (p >= end || *p != ':') return false;
+            p++;
+            auto child = std::make_shared<Node>();
+            if (!parse(p, end, *child, depth + 1)) return false;
+            out.obj.push_back({key, child});
+            skipWs(p, end);
+            if (p < end && *p == ',') { p++; continue; }
+            if (p < end && *p == '}') { p++; return true; }
+            return false;
+        }
+    }
+    if (*p == '[') {
+        out.type = Node::ARR;
+        p++;
+        skipWs(p, end);
+        if (p < end && *p == ']') { p++; return true; }
+        while (true) {
+            auto child = std::make_shared<Node>();
+            if (!parse(p, end, *child, depth + 1)) return false;
+            out.arr.push_back(child);
+            skipWs(p, end);
+            if (p < end && *p == ',') { p++; continue; }
+            if (p < end && *p == ']') { p++; return true; }
+            return false;
+        }
+    }
+    if (*p == '"') {
+        out.type = Node::STR;
+        return parseString(p, end, out.s);
+    }
+    if (end - p >= 4 && !strncmp(p, "true", 4)) { out.type = Node::BOOL; out.b = true; p += 4; return true; }
+    if (end - p >= 5 && !strncmp(p, "false", 5)) { out.type = Node::BOOL; out.b = false; p += 5; return true; }
+    if (end - p >= 4 && !strncmp(p, "null", 4)) { out.type = Node::NUL; p += 4; return true; }
+    const char* start = p;
+    bool isFloat = false;
+    if (p < end && (*p == '-' || *p == '+')) p++;
+    while (p < end && ((*p >= '0' && *p <= '9') || *p == '.' || *p == 'e' || *p == 'E' || *p == '-' || *p == '+')) {
+        if (*p == '.' || *p == 'e' || *p == 'E') isFloat = true;
+        p++;
+    }
+    if (p == start) return false;
+    std::string num(start, p);
+    if (isFloat) { out.type = Node::FLOAT; out.f = strtod(num.c_str(), nullptr); }
+    else { out.type = Node::INT; out.i = strtoll(num.c_str(), nullptr, 10); }
+    return true;
+}
+
+static void writeString(const std::string& s, std::string& out) {
+    out += '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') { out += '\\'; out += c; }
+        else if (c == '\n') out += "\\n";
+        else out += c;
+    }
+    out += '"';
+}
+
+void write(const Node* n, std::string& out) {
+    if (!n) { out += "null"; return; }
+    char buf[40];
+    switch (n->type) {
+        case Node::NUL: out += "null"; break;
+        case Node::BOOL: out += n->b ? "true" : "false"; break;
+        case Node::INT: out += std::to_string(n->i); break;
+        case Node::FLOAT:
+            snprintf(buf, sizeof(buf), "%.9g", n->f);
+            out += buf;
+            break;
+        case Node::STR: writeString(n->s, out); break;
+        case Node::OBJ:
+            out += '{';
+            for (size_t i = 0; i < n->obj.size(); i++) {
+                if (i) out += ',';
+                writeString(n->obj[i].first, out);
+                out += ':';
+                write(n->obj[i].second.get(), out);
+            }
+            out += '}';
+            break;
+        case Node::ARR:
+            out += '[';
+            for (size_t i = 0; i < n->arr.size(); i++) {
+                if (i) out += ',';
+                write(n->arr[i].get(), out);
+            }
+            out += ']';
+            break;
+    }
+}
+
+} // namespace simjson
+
+DeserializationError deserializeJson(JsonDocument& doc, const char* input, size_t len) {
+    doc.clear();
+    if (!input || len == 0) return DeserializationError::EmptyInput;
+    const char* p = input;
+    auto root = doc.root().node();
+    if (!simjson::parse(p, input + len, *root, 0)) {
+        doc.clear();
+        return DeserializationError::InvalidInput;
+    }
+    return DeserializationError::Ok;
+}
+
+size_t serializeJson(const JsonVariant& v, String& out) {
+    std::string s;
+    simjson::write(v.node().get(), s);
+    out = String(s);
+    return s.size();
+}
+
+size_t serializeJson(const JsonVariant& v, char* buf, size_t size) {
+    std::string s;
+    simjson::write(v.node().get(), s);
+    if (size == 0) return 0;
+    size_t n = std::min(s.size(), size - 1);
+    memcpy(buf, s.data(), n);
+    buf[n] = 0;
+    return n;
+}
+
+size_t serializeJson(const JsonVariant& v, Print& out) {
+    std::string s;
+    simjson::write(v.node().get(), s);
+    return out.write((const uint8_t*)s.data(), s.size());
+}
+
+size_t measureJson(const JsonVariant& v) {
+    std::string s;
+    simjson::write(v.node().get(), s);
+    return s.size();
+}
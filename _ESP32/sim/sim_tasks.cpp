@@ -0,0 +1,138 @@
+/*
+    Cooperative FreeRTOS task model for the host simulation. See freertos_sim.h.
+*/
+#include "Arduino.h"
+#include "freertos_sim.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct SimTask {
+    TaskFunction_t fn;
+    void* parameter;
+    std::string name;
+    BaseType_t core;
+    uint64_t wakeUs;
+    uint32_t notifications;
+    bool waitingNotify;
+    bool deleted;
+};
+
+//Leaked on purpose: destroying a condition variable that parked task threads still wait on blocks process exit.
+static std::mutex& batonMutex = *new std::mutex;
+static std::condition_variable& batonCv = *new std::condition_variable;
+static SimTask* baton = nullptr; //nullptr means the Arduino loop thread holds it
+static thread_local SimTask* currentTask = nullptr;
+static std::vector<SimTask*> tasks;
+
+static void handBatonTo(SimTask* next) {
+    std::unique_lock<std::mutex> lock(batonMutex);
+    baton = next;
+    batonCv.notify_all();
+    batonCv.wait(lock, [] { return baton == currentTask; });
+}
+
+//Give the baton back to the loop thread and sleep until the scheduler picks this task again.
+static void taskBlock() {
+    handBatonTo(nullptr);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stackDepth, void* parameter,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+    (void)stackDepth;
+    (void)priority;
+    SimTask* task = new SimTask{fn, parameter, name ? name : "", core, simNowMicros(), 0, false, false};
+    tasks.push_back(task);
+    if (handle) *handle = task;
+    std::thread([task] {
+        currentTask = task;
+        {
+            std::unique_lock<std::mutex> lock(batonMutex);
+            batonCv.wait(lock, [task] { return baton == task; });
+        }
+        task->fn(task->parameter);
+        //A FreeRTOS task must never return - treat it like vTaskDelete(NULL).
+        task->deleted = true;
+        std::unique_lock<std::mutex> lock(batonMutex);
+        baton = nullptr;
+        batonCv.notify_all();
+    }).detach();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stackDepth, void* parameter, UBaseType_t priority,
+                       TaskHandle_t* handle) {
+    return xTaskCreatePinnedToCore(fn, name, stackDepth, parameter, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    if (!currentTask) {
+        simAdvance((uint64_t)ticks * 1000);
+        return;
+    }
+    currentTask->wakeUs = simNowMicros() + (uint64_t)(ticks ? ticks : 1) * 1000;
+    taskBlock();
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    SimTask* t = task ? task : currentTask;
+    if (!t) return;
+    t->deleted = true;
+    if (t == currentTask) {
+        std::unique_lock<std::mutex> lock(batonMutex);
+        baton = nullptr;
+        batonCv.notify_all();
+        batonCv.wait(lock, [] { return false; });
+    }
+}
+
+TickType_t xTaskGetTickCount() { return (TickType_t)(simNowMicros() / 1000); }
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait) {
+    if (!currentTask) return 0;
+    SimTask* t = currentTask;
+    if (t->notifications == 0 && ticksToWait > 0) {
+        t->waitingNotify = true;
+        t->wakeUs = ticksToWait == portMAX_DELAY ? UINT64_MAX : simNowMicros() + (uint64_t)ticksToWait * 1000;
+        taskBlock();
+        t->waitingNotify = false;
+    }
+    uint32_t value = t->notifications;
+    if (clearOnExit) t->notifications = 0;
+    else if (value) t->notifications--;
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    if (!task) return pdFALSE;
+    task->notifications++;
+    //Wake a waiting task on the next scheduling point, as a real notification would.
+    if (task->waitingNotify) task->wakeUs = simNowMicros();
+    return pdPASS;
+}
+
+BaseType_t xPortGetCoreID() { return currentTask ? (currentTask->core == tskNO_AFFINITY ? 0 : currentTask->core) : 1; }
+
+void taskYIELD() {
+    if (currentTask) {
+        currentTask->wakeUs = simNowMicros();
+        taskBlock();
+    }
+}
+
+void simRunTasks() {
+    //Tasks only run when the loop thread passes through simAdvance().
+    if (currentTask) return;
+    bool ran = true;
+    while (ran) {
+        ran = false;
+        for (SimTask* task : tasks) {
+            if (task->deleted || task->wakeUs > simNowMicros()) continue;
+            task->wakeUs = UINT64_MAX;
+            handBatonTo(task);
+            ran = true;
+        }
+    }
+}
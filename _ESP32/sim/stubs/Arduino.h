@@ -0,0 +1,206 @@
+/*
+    Host stand-in for the ESP32 Arduino core. Only the pieces machine.cpp touches are provided.
+    Time is virtual: millis()/micros() read the simulation clock, delay() advances it.
+*/
+#pragma once
+
+#include <type_traits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+#include <cmath>
+#include <string>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define ARDUINO_ISR_ATTR
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define ONLOW 0x04
+#define ONHIGH 0x05
+
+#define PI 3.1415926535897932384626433832795
+#define DEG_TO_RAD 0.017453292519943295769236907684886
+#define RAD_TO_DEG 57.295779513082320876798154814105
+
+//Simulation clock and pin model - implemented in sim_core.cpp
+uint64_t simNowMicros();
+void simAdvance(uint32_t us);
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode);
+void detachInterrupt(uint8_t pin);
+#define digitalPinToInterrupt(p) (p)
+
+bool ledcAttach(uint8_t pin, uint32_t freq, uint8_t resolution);
+bool ledcWrite(uint8_t pin, uint32_t duty);
+uint32_t ledcRead(uint8_t pin);
+
+float temperatureRead();
+
+#ifndef __APPLE__
+//newlib on the ESP32 has strlcpy; older glibc does not.
+inline size_t strlcpy(char* dst, const char* src, size_t size) {
+    size_t len = strlen(src);
+    if (size) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = 0;
+    }
+    return len;
+}
+#endif
+
+long map(long x, long in_min, long in_max, long out_min, long out_max);
+template <class T, class L, class H>
+auto constrain(T amt, L low, H high) -> typename std::decay<decltype(amt < low ? low : (amt > high ? high : amt))>::type {
+    return amt < low ? low : (amt > high ? high : amt);
+}
+
+class String {
+public:
+    String() {}
+    String(const char* s) : s_(s ? s : "") {}
+    String(const std::string& s) : s_(s) {}
+    String(char c) : s_(1, c) {}
+    String(int v) : s_(std::to_string(v)) {}
+    String(unsigned int v) : s_(std::to_string(v)) {}
+    String(long v) : s_(std::to_string(v)) {}
+    String(unsigned long v) : s_(std::to_string(v)) {}
+    String(long long v) : s_(std::to_string(v)) {}
+    String(unsigned long long v) : s_(std::to_string(v)) {}
+    String(float v, unsigned int decimals = 2) { fromDouble(v, decimals); }
+    String(double v, unsigned int decimals = 2) { fromDouble(v, decimals); }
+
+    const char* c_str() const { return s_.c_str(); }
+    unsigned int length() const { return s_.size(); }
+    bool isEmpty() const { return s_.empty(); }
+    bool reserve(unsigned int n) { s_.reserve(n); return true; }
+    char operator[](unsigned int i) const { return i < s_.size() ? s_[i] : 0; }
+    char charAt(unsigned int i) const { return (*this)[i]; }
+
+    bool endsWith(const String& suffix) const {
+        return s_.size() >= suffix.s_.size() && s_.compare(s_.size() - suffix.s_.size(), suffix.s_.size(), suffix.s_) == 0;
+    }
+    bool startsWith(const String& prefix) const { return s_.rfind(prefix.s_, 0) == 0; }
+    int indexOf(char c, unsigned int from = 0) const { auto p = s_.find(c, from); return p == std::string::npos ? -1 : (int)p; }
+    int indexOf(const String& str, unsigned int from = 0) const { auto p = s_.find(str.s_, from); return p == std::string::npos ? -1 : (int)p; }
+    String substring(unsigned int from) const { return from < s_.size() ? String(s_.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const { return from < s_.size() ? String(s_.substr(from, to - from)) : String(); }
+    long toInt() const { return strtol(s_.c_str(), nullptr, 10); }
+    float toFloat() const { return strtof(s_.c_str(), nullptr); }
+    void trim() {
+        size_t a = s_.find_first_not_of(" \t\r\n");
+        size_t b = s_.find_last_not_of(" \t\r\n");
+        s_ = a == std::string::npos ? std::string() : s_.substr(a, b - a + 1);
+    }
+
+    String& operator+=(const String& o) { s_ += o.s_; return *this; }
+    String& operator+=(const char* o) { s_ += o; return *this; }
+    String& operator+=(char c) { s_ += c; return *this; }
+    bool concat(const char* o, unsigned int n) { s_.append(o, n); return true; }
+    bool operator==(const String& o) const { return s_ == o.s_; }
+    bool operator==(const char* o) const { return s_ == o; }
+    bool operator!=(const String& o) const { return s_ != o.s_; }
+    bool operator!=(const char* o) const { return s_ != o; }
+    bool equals(const String& o) const { return s_ == o.s_; }
+
+    friend String operator+(const String& a, const String& b) { return String(a.s_ + b.s_); }
+    friend String operator+(const String& a, const char* b) { return String(a.s_ + b); }
+    friend String operator+(const char* a, const String& b) { return String(a + b.s_); }
+
+    const std::string& str() const { return s_; }
+
+private:
+    void fromDouble(double v, unsigned int decimals) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+        s_ = buf;
+    }
+    std::string s_;
+};
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buf, size_t n) {
+        for (size_t i = 0; i < n; i++) write(buf[i]);
+        return n;
+    }
+    size_t print(const String& s) { return write((const uint8_t*)s.c_str(), s.length()); }
+    size_t print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int v) { return print(String(v)); }
+    size_t print(unsigned int v) { return print(String(v)); }
+    size_t print(long v) { return print(String(v)); }
+    size_t print(unsigned long v) { return print(String(v)); }
+    size_t print(double v, int d = 2) { return print(String(v, d)); }
+    size_t println() { return print("\n"); }
+    template <class T>
+    size_t println(const T& v) { size_t n = print(v); return n + print("\n"); }
+    size_t println(double v, int d) { size_t n = print(v, d); return n + print("\n"); }
+    size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+        char buf[512];
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+        va_end(ap);
+        return write((const uint8_t*)buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+    }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() { return -1; }
+};
+
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long) {}
+    size_t write(uint8_t c) override;
+    using Print::write;
+    int available() override { return 0; }
+    int read() override { return -1; }
+};
+
+extern HardwareSerial Serial;
+
+class EspClass {
+public:
+    uint64_t getEfuseMac() { return 0x0000A1B2C3D4E5F6ULL; }
+    uint32_t getSketchSize() { return 1200000; }
+    uint32_t getFreeSketchSpace() { return 1900000; }
+    uint32_t getFreeHeap() { return 180000; }
+    void restart();
+};
+
+extern EspClass ESP;
+
+#include "freertos_sim.h"
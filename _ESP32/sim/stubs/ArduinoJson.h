@@ -0,0 +1,397 @@
+/*
+    Host stand-in for the subset of ArduinoJson 6 used by the firmware. It is a small tree of reference counted
+    nodes - capacity template arguments are accepted and ignored.
+*/
+#pragma once
+
+#include "Arduino.h"
+#include <memory>
+#include <vector>
+#include <utility>
+#include <type_traits>
+
+#define JSON_ARRAY_SIZE(n) ((n) * 8)
+#define JSON_OBJECT_SIZE(n) ((n) * 16)
+
+namespace simjson {
+
+struct Node {
+    enum Type { NUL, BOOL, INT, FLOAT, STR, OBJ, ARR } type = NUL;
+    bool b = false;
+    long long i = 0;
+    double f = 0;
+    std::string s;
+    std::vector<std::pair<std::string, std::shared_ptr<Node>>> obj;
+    std::vector<std::shared_ptr<Node>> arr;
+
+    std::shared_ptr<Node> member(const std::string& key) const {
+        if (type != OBJ) return nullptr;
+        for (auto& kv : obj) if (kv.first == key) return kv.second;
+        return nullptr;
+    }
+    std::shared_ptr<Node> clone() const {
+        auto n = std::make_shared<Node>(*this);
+        for (auto& kv : n->obj) kv.second = kv.second->clone();
+        for (auto& e : n->arr) e = e->clone();
+        return n;
+    }
+};
+
+void write(const Node* n, std::string& out);
+bool parse(const char*& p, const char* end, Node& out, int depth);
+
+} // namespace simjson
+
+class JsonArray;
+class JsonObject;
+class JsonVariant;
+
+class JsonString {
+public:
+    JsonString(const std::string* s = nullptr) : s_(s) {}
+    const char* c_str() const { return s_ ? s_->c_str() : nullptr; }
+    size_t size() const { return s_ ? s_->size() : 0; }
+    bool operator==(const char* o) const { return s_ && *s_ == o; }
+
+private:
+    const std::string* s_;
+};
+
+class JsonVariant {
+public:
+    JsonVariant() {}
+    explicit JsonVariant(std::shared_ptr<simjson::Node> n) : node_(n) {}
+
+    JsonVariant operator[](const char* key) const {
+        JsonVariant v;
+        v.node_ = node_ ? node_->member(key) : nullptr;
+        v.parent_ = std::make_shared<JsonVariant>(*this);
+        v.key_ = key;
+        return v;
+    }
+    JsonVariant operator[](const String& key) const { return (*this)[key.c_str()]; }
+    JsonVariant operator[](int index) const {
+        JsonVariant v;
+        if (node_ && node_->type == simjson::Node::ARR && index >= 0 && (size_t)index < node_->arr.size())
+            v.node_ = node_->arr[index];
+        return v;
+    }
+    JsonVariant operator[](size_t index) const { return (*this)[(int)index]; }
+
+    bool isNull() const { return !node_ || node_->type == simjson::Node::NUL; }
+    bool containsKey(const char* key) const { return node_ && node_->member(key) != nullptr; }
+    bool containsKey(const String& key) const { return containsKey(key.c_str()); }
+    size_t size() const {
+        if (!node_) return 0;
+        if (node_->type == simjson::Node::ARR) return node_->arr.size();
+        if (node_->type == simjson::Node::OBJ) return node_->obj.size();
+        return 0;
+    }
+
+    template <class T>
+    T as() const;
+    template <class T>
+    bool is() const;
+    template <class T>
+    operator T() const { return as<T>(); }
+    template <class T>
+    T operator|(T def) const { return is<T>() ? as<T>() : def; }
+    const char* operator|(const char* def) const { return is<const char*>() ? as<const char*>() : def; }
+
+    JsonVariant& operator=(const JsonVariant& o) {
+        if (this == &o) return *this;
+        if (!parent_ && !o.parent_ && !node_) {
+            node_ = o.node_;
+            return *this;
+        }
+        auto n = ensure();
+        if (o.node_) *n = *o.node_->clone();
+        else *n = simjson::Node();
+        return *this;
+    }
+    JsonVariant(const JsonVariant&) = default;
+
+    JsonVariant& operator=(bool v) { auto n = reset(); n->type = simjson::Node::BOOL; n->b = v; return *this; }
+    JsonVariant& operator=(int v) { return setInt(v); }
+    JsonVariant& operator=(unsigned int v) { return setInt(v); }
+    JsonVariant& operator=(long v) { return setInt(v); }
+    JsonVariant& operator=(unsigned long v) { return setInt(v); }
+    JsonVariant& operator=(long long v) { return setInt(v); }
+    JsonVariant& operator=(unsigned long long v) { return setInt((long long)v); }
+    JsonVariant& operator=(short v) { return setInt(v); }
+    JsonVariant& operator=(unsigned short v) { return setInt(v); }
+    JsonVariant& operator=(signed char v) { return setInt(v); }
+    JsonVariant& operator=(unsigned char v) { return setInt(v); }
+    JsonVariant& operator=(float v) { return setFloat(v); }
+    JsonVariant& operator=(double v) { return setFloat(v); }
+    JsonVariant& operator=(const char* v) {
+        auto n = reset();
+        if (v) { n->type = simjson::Node::STR; n->s = v; }
+        return *this;
+    }
+    JsonVariant& operator=(char* v) { return *this = (const char*)v; }
+    JsonVariant& operator=(const String& v) { return *this = v.c_str(); }
+    JsonVariant& operator=(std::nullptr_t) { reset(); return *this; }
+
+    bool set(const JsonVariant& o) { *this = o; return true; }
+    template <class T>
+    bool set(T v) { *this = v; return true; }
+
+    JsonArray to_array();
+    JsonObject to_object();
+    JsonArray createNestedArray(const char* key);
+    JsonObject createNestedObject(const char* key);
+    JsonVariant add();
+    template <class T>
+    bool add(T v) { JsonVariant e = add(); e = v; return true; }
+
+    std::shared_ptr<simjson::Node> node() const { return node_; }
+    std::shared_ptr<simjson::Node> ensure() {
+        if (node_) return node_;
+        node_ = std::make_shared<simjson::Node>();
+        if (parent_) {
+            auto p = parent_->ensure();
+            if (p->type != simjson::Node::OBJ) { *p = simjson::Node(); p->type = simjson::Node::OBJ; }
+            p->obj.push_back({key_, node_});
+        }
+        return node_;
+    }
+
+private:
+    std::shared_ptr<simjson::Node> reset() {
+        auto n = ensure();
+        *n = simjson::Node();
+        return n;
+    }
+    JsonVariant& setInt(long long v) { auto n = reset(); n->type = simjson::Node::INT; n->i = v; return *this; }
+    JsonVariant& setFloat(double v) { auto n = reset(); n->type = simjson::Node::FLOAT; n->f = v; return *this; }
+
+    std::shared_ptr<simjson::Node> node_;
+    std::shared_ptr<JsonVariant> parent_;
+    std::string key_;
+};
+
+typedef JsonVariant JsonVariantConst;
+
+class JsonArray {
+public:
+    JsonArray() {}
+    explicit JsonArray(std::shared_ptr<simjson::Node> n) : node_(n) {}
+
+    class iterator {
+    public:
+        iterator(std::shared_ptr<simjson::Node> n, size_t i) : node_(n), i_(i) {}
+        JsonVariant operator*() const { return JsonVariant(node_->arr[i_]); }
+        iterator& operator++() { ++i_; return *this; }
+        bool operator!=(const iterator& o) const { return i_ != o.i_; }
+
+    private:
+        std::shared_ptr<simjson::Node> node_;
+        size_t i_;
+    };
+
+    iterator begin() const { return iterator(node_, 0); }
+    iterator end() const { return iterator(node_, node_ ? node_->arr.size() : 0); }
+    size_t size() const { return node_ ? node_->arr.size() : 0; }
+    bool isNull() const { return !node_; }
+    JsonVariant operator[](size_t i) const { return JsonVariant(node_)[(int)i]; }
+    JsonVariant add() {
+        auto e = std::make_shared<simjson::Node>();
+        node_->arr.push_back(e);
+        return JsonVariant(e);
+    }
+    template <class T>
+    bool add(T v) { JsonVariant e = add(); e = v; return true; }
+    JsonObject createNestedObject();
+
+private:
+    std::shared_ptr<simjson::Node> node_;
+};
+
+class JsonPair {
+public:
+    JsonPair(const std::string* k, std::shared_ptr<simjson::Node> v) : key_(k), value_(v) {}
+    JsonString key() const { return key_; }
+    JsonVariant value() const { return value_; }
+
+private:
+    JsonString key_;
+    JsonVariant value_;
+};
+
+class JsonObject {
+public:
+    JsonObject() {}
+    explicit JsonObject(std::shared_ptr<simjson::Node> n) : node_(n) {}
+
+    class iterator {
+    public:
+        iterator(std::shared_ptr<simjson::Node> n, size_t i) : node_(n), i_(i) {}
+        JsonPair operator*() const { return JsonPair(&node_->obj[i_].first, node_->obj[i_].second); }
+        iterator& operator++() { ++i_; return *this; }
+        bool operator!=(const iterator& o) const { return i_ != o.i_; }
+
+    private:
+        std::shared_ptr<simjson::Node> node_;
+        size_t i_;
+    };
+
+    iterator begin() const { return iterator(node_, 0); }
+    iterator end() const { return iterator(node_, node_ ? node_->obj.size() : 0); }
+    size_t size() const { return node_ ? node_->obj.size() : 0; }
+    bool isNull() const { return !node_; }
+    bool containsKey(const char* key) const { return node_ && node_->member(key) != nullptr; }
+    JsonVariant operator[](const char* key) const { return JsonVariant(node_)[key]; }
+
+private:
+    std::shared_ptr<simjson::Node> node_;
+};
+
+template <class T>
+T JsonVariant::as() const {
+    using namespace simjson;
+    if constexpr (std::is_same<T, bool>::value) {
+        if (!node_) return false;
+        if (node_->type == Node::BOOL) return node_->b;
+        if (node_->type == Node::INT) return node_->i != 0;
+        if (node_->type == Node::FLOAT) return node_->f != 0;
+        return false;
+    } else if constexpr (std::is_integral<T>::value) {
+        if (!node_) return 0;
+        if (node_->type == Node::INT) return (T)node_->i;
+        if (node_->type == Node::FLOAT) return (T)node_->f;
+        if (node_->type == Node::BOOL) return (T)node_->b;
+        if (node_->type == Node::STR) return (T)strtoll(node_->s.c_str(), nullptr, 10);
+        return 0;
+    } else if constexpr (std::is_floating_point<T>::value) {
+        if (!node_) return 0;
+        if (node_->type == Node::INT) return (T)node_->i;
+        if (node_->type == Node::FLOAT) return (T)node_->f;
+        if (node_->type == Node::BOOL) return (T)node_->b;
+        if (node_->type == Node::STR) return (T)strtod(node_->s.c_str(), nullptr);
+        return 0;
+    } else if constexpr (std::is_same<T, const char*>::value) {
+        return node_ && node_->type == Node::STR ? node_->s.c_str() : nullptr;
+    } else if constexpr (std::is_same<T, String>::value) {
+        if (!node_ || node_->type == Node::NUL) return String("null");
+        if (node_->type == Node::STR) return String(node_->s);
+        std::string out;
+        write(node_.get(), out);
+        return String(out);
+    } else if constexpr (std::is_same<T, JsonArray>::value) {
+        return node_ && node_->type == Node::ARR ? JsonArray(node_) : JsonArray();
+    } else if constexpr (std::is_same<T, JsonObject>::value) {
+        return node_ && node_->type == Node::OBJ ? JsonObject(node_) : JsonObject();
+    } else if constexpr (std::is_same<T, JsonVariant>::value) {
+        return *this;
+    } else {
+        static_assert(sizeof(T) == 0, "unsupported JsonVariant::as<T>");
+    }
+}
+
+template <class T>
+bool JsonVariant::is() const {
+    using namespace simjson;
+    if (!node_) return false;
+    if constexpr (std::is_same<T, bool>::value) return node_->type == Node::BOOL;
+    else if constexpr (std::is_integral<T>::value) return node_->type == Node::INT;
+    else if constexpr (std::is_floating_point<T>::value) return node_->type == Node::INT || node_->type == Node::FLOAT;
+    else if constexpr (std::is_same<T, const char*>::value || std::is_same<T, String>::value) return node_->type == Node::STR;
+    else if constexpr (std::is_same<T, JsonArray>::value) return node_->type == Node::ARR;
+    else if constexpr (std::is_same<T, JsonObject>::value) return node_->type == Node::OBJ;
+    else return false;
+}
+
+inline JsonArray JsonVariant::to_array() {
+    auto n = reset();
+    n->type = simjson::Node::ARR;
+    return JsonArray(n);
+}
+inline JsonObject JsonVariant::to_object() {
+    auto n = reset();
+    n->type = simjson::Node::OBJ;
+    return JsonObject(n);
+}
+inline JsonArray JsonVariant::createNestedArray(const char* key) { return (*this)[key].to_array(); }
+inline JsonObject JsonVariant::createNestedObject(const char* key) { return (*this)[key].to_object(); }
+inline JsonVariant JsonVariant::add() {
+    auto n = ensure();
+    if (n->type != simjson::Node::ARR) { *n = simjson::Node(); n->type = simjson::Node::ARR; }
+    auto e = std::make_shared<simjson::Node>();
+    n->arr.push_back(e);
+    return JsonVariant(e);
+}
+inline JsonObject JsonArray::createNestedObject() { return add().to_object(); }
+
+class JsonDocument {
+public:
+    JsonDocument() : root_(std::make_shared<simjson::Node>()) {}
+    JsonVariant operator[](const char* key) { return JsonVariant(root_)[key]; }
+    JsonVariant operator[](const String& key) { return JsonVariant(root_)[key.c_str()]; }
+    JsonVariant operator[](int index) { return JsonVariant(root_)[index]; }
+    bool containsKey(const char* key) const { return root_->member(key) != nullptr; }
+    bool containsKey(const String& key) const { return containsKey(key.c_str()); }
+    template <class T>
+    T to() {
+        *root_ = simjson::Node();
+        if constexpr (std::is_same<T, JsonArray>::value) { root_->type = simjson::Node::ARR; return JsonArray(root_); }
+        else { root_->type = simjson::Node::OBJ; return JsonObject(root_); }
+    }
+    template <class T>
+    T as() const { return JsonVariant(root_).as<T>(); }
+    JsonArray createNestedArray(const char* key) { return JsonVariant(root_).createNestedArray(key); }
+    JsonObject createNestedObject(const char* key) { return JsonVariant(root_).createNestedObject(key); }
+    template <class T>
+    bool add(T v) { return JsonVariant(root_).add(v); }
+    void clear() { *root_ = simjson::Node(); }
+    size_t size() const { return JsonVariant(root_).size(); }
+    bool isNull() const { return root_->type == simjson::Node::NUL; }
+    bool overflowed() const { return false; }
+    size_t memoryUsage() const { return 0; }
+    JsonVariant root() const { return JsonVariant(root_); }
+
+private:
+    std::shared_ptr<simjson::Node> root_;
+};
+
+template <size_t N>
+class StaticJsonDocument : public JsonDocument {};
+
+class DynamicJsonDocument : public JsonDocument {
+public:
+    explicit DynamicJsonDocument(size_t capacity) { (void)capacity; }
+};
+
+class DeserializationError {
+public:
+    enum Code { Ok, EmptyInput, IncompleteInput, InvalidInput, NoMemory, TooDeep };
+    DeserializationError(Code c = Ok) : code_(c) {}
+    explicit operator bool() const { return code_ != Ok; }
+    bool operator==(Code c) const { return code_ == c; }
+    bool operator!=(Code c) const { return code_ != c; }
+    Code code() const { return code_; }
+    const char* c_str() const {
+        static const char* names[] = {"Ok", "EmptyInput", "IncompleteInput", "InvalidInput", "NoMemory", "TooDeep"};
+        return names[code_];
+    }
+
+private:
+    Code code_;
+};
+
+DeserializationError deserializeJson(JsonDocument& doc, const char* input, size_t len);
+inline DeserializationError deserializeJson(JsonDocument& doc, const char* input) {
+    return deserializeJson(doc, input, input ? strlen(input) : 0);
+}
+inline DeserializationError deserializeJson(JsonDocument& doc, const String& input) {
+    return deserializeJson(doc, input.c_str(), input.length());
+}
+
+size_t serializeJson(const JsonVariant& v, String& out);
+size_t serializeJson(const JsonVariant& v, char* buf, size_t size);
+size_t serializeJson(const JsonVariant& v, Print& out);
+inline size_t serializeJson(const JsonDocument& doc, String& out) { return serializeJson(doc.root(), out); }
+inline size_t serializeJson(const JsonDocument& doc, char* buf, size_t size) { return serializeJson(doc.root(), buf, size); }
+inline size_t serializeJson(const JsonDocument& doc, Print& out) { return serializeJson(doc.root(), out); }
+size_t measureJson(const JsonVariant& v);
+inline size_t measureJson(const JsonDocument& doc) { return measureJson(doc.root()); }
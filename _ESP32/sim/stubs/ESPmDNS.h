@@ -0,0 +1,19 @@
+/*
+    Host stand-in for ESPmDNS.
+*/
+#pragma once
+
+#include "Arduino.h"
+
+class MDNSResponder {
+public:
+    bool begin(const char* host) { (void)host; return true; }
+    bool addService(const char* service, const char* proto, uint16_t port) {
+        (void)service;
+        (void)proto;
+        (void)port;
+        return true;
+    }
+};
+
+extern MDNSResponder MDNS;
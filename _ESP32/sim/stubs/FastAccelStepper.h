@@ -0,0 +1,129 @@
+/*
+    Host stand-in for FastAccelStepper. Each stepper integrates a trapezoidal ramp against the virtual clock
+    and records every step it takes so that a run can be inspected or replayed afterwards.
+*/
+#pragma once
+
+#include "Arduino.h"
+#include <vector>
+
+enum MoveResultCode : int8_t {
+    MOVE_OK = 0,
+    MOVE_ERR_NO_DIRECTION_PIN = -1,
+    MOVE_ERR_SPEED_IS_UNDEFINED = -2,
+    MOVE_ERR_ACCELERATION_IS_UNDEFINED = -3
+};
+
+//One recorded step - time of the pulse, the direction line at that moment and the position after the step.
+struct SimStepEvent {
+    uint64_t timeUs;
+    int8_t dir;
+    int32_t position;
+};
+
+class FastAccelStepper {
+public:
+    explicit FastAccelStepper(uint8_t stepPin) : stepPin_(stepPin) {}
+
+    void setDirectionPin(uint8_t pin, bool dirHighCountsUp = true, uint16_t dirChangeDelayUs = 0) {
+        dirPin_ = pin;
+        (void)dirHighCountsUp;
+        (void)dirChangeDelayUs;
+    }
+    void setEnablePin(uint8_t pin, bool lowActiveEnablesStepper = true) {
+        enablePin_ = pin;
+        (void)lowActiveEnablesStepper;
+    }
+    void setAutoEnable(bool autoEnable) { autoEnable_ = autoEnable; }
+    int8_t setDelayToDisable(uint16_t ms) { (void)ms; return 0; }
+    void enableOutputs() { enabled_ = true; }
+    void disableOutputs() { enabled_ = false; }
+
+    int8_t setSpeedInUs(uint32_t minStepUs) {
+        if (minStepUs == 0) return -1;
+        speedHz_ = 1e6 / minStepUs;
+        return 0;
+    }
+    int8_t setSpeedInHz(uint32_t speedHz) {
+        if (speedHz == 0) return -1;
+        speedHz_ = speedHz;
+        return 0;
+    }
+    int8_t setSpeedInMilliHz(uint32_t speedMilliHz) {
+        if (speedMilliHz == 0) return -1;
+        speedHz_ = speedMilliHz / 1000.0;
+        return 0;
+    }
+    int8_t setAcceleration(int32_t stepsPerSS) {
+        if (stepsPerSS <= 0) return -1;
+        accel_ = stepsPerSS;
+        return 0;
+    }
+    void setLinearAcceleration(uint32_t steps) { (void)steps; }
+    int8_t setJumpStart(uint32_t steps) { (void)steps; return 0; }
+    void applySpeedAcceleration() { applied_ = true; }
+
+    MoveResultCode move(int32_t steps, bool blocking = false);
+    MoveResultCode moveTo(int32_t position, bool blocking = false);
+    MoveResultCode runForward();
+    MoveResultCode runBackward();
+    MoveResultCode moveByAcceleration(int32_t accel, bool allowReverse = true);
+    void forwardStep(bool blocking = false);
+    void backwardStep(bool blocking = false);
+    void stopMove() { if (mode_ != IDLE) mode_ = STOPPING; }
+    void forceStop() { mode_ = IDLE; velocity_ = 0; frac_ = 0; }
+    void forceStopAndNewPosition(int32_t pos) { forceStop(); position_ = pos; }
+
+    bool isRunning() const { return mode_ != IDLE; }
+    bool isStopping() const { return mode_ == STOPPING; }
+    int32_t getCurrentPosition() const { return position_; }
+    void setCurrentPosition(int32_t pos) { target_ += pos - position_; position_ = pos; }
+    int32_t targetPos() const { return target_; }
+    int32_t getPositionAfterCommandsCompleted() const { return mode_ == MOVING ? target_ : position_; }
+    int32_t getCurrentSpeedInMilliHz(bool realtime = true) const { (void)realtime; return (int32_t)(velocity_ * 1000); }
+    int32_t getCurrentSpeedInUs(bool realtime = true) const {
+        (void)realtime;
+        return velocity_ == 0 ? 0 : (int32_t)(1e6 / velocity_);
+    }
+    uint32_t getSpeedInMilliHz() const { return (uint32_t)(speedHz_ * 1000); }
+    uint32_t getMaxSpeedInHz() const { return 200000; }
+    uint32_t getAcceleration() const { return (uint32_t)accel_; }
+    uint8_t getStepPin() const { return stepPin_; }
+
+    //Simulation hooks.
+    void simTick(double dtUs);
+    const std::vector<SimStepEvent>& simTrace() const { return trace_; }
+    void simClearTrace() { trace_.clear(); }
+    uint64_t simStepCount() const { return stepCount_; }
+
+private:
+    enum Mode { IDLE, MOVING, RUN_FORWARD, RUN_BACKWARD, BY_ACCEL, STOPPING };
+    void takeStep(int dir);
+
+    uint8_t stepPin_;
+    uint8_t dirPin_ = 255;
+    uint8_t enablePin_ = 255;
+    bool autoEnable_ = false;
+    bool enabled_ = false;
+    bool applied_ = false;
+    double speedHz_ = 0;
+    double accel_ = 0;
+    double velocity_ = 0; //signed steps/s
+    double frac_ = 0;
+    int32_t position_ = 0;
+    int32_t target_ = 0;
+    int32_t byAccel_ = 0;
+    Mode mode_ = IDLE;
+    uint64_t stepCount_ = 0;
+    std::vector<SimStepEvent> trace_;
+};
+
+class FastAccelStepperEngine {
+public:
+    void init(uint8_t cpuCore = 255) { (void)cpuCore; }
+    FastAccelStepper* stepperConnectToPin(uint8_t stepPin);
+};
+
+//Registry used by the simulation clock to advance every connected stepper.
+std::vector<FastAccelStepper*>& simSteppers();
+FastAccelStepper* simStepperOnPin(uint8_t stepPin);
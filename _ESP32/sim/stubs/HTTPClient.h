@@ -0,0 +1,38 @@
+/*
+    Host stand-in for HTTPClient. Requests are never sent anywhere; each POST is recorded with its timestamp
+    so the console traffic a run generates can be checked.
+*/
+#pragma once
+
+#include "Arduino.h"
+#include "WiFi.h"
+#include <vector>
+
+#define HTTP_CODE_OK 200
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+
+struct SimHttpPost {
+    uint64_t timeUs;
+    std::string url;
+    std::string body;
+};
+
+std::vector<SimHttpPost>& simHttpPosts();
+
+class HTTPClient {
+public:
+    bool begin(const String& url) { url_ = url; return true; }
+    bool begin(WiFiClient& client, const String& url) { (void)client; url_ = url; return true; }
+    void addHeader(const String& name, const String& value) { (void)name; (void)value; }
+    void setReuse(bool reuse) { (void)reuse; }
+    void setTimeout(uint16_t ms) { (void)ms; }
+    void setConnectTimeout(int32_t ms) { (void)ms; }
+    int POST(const String& body);
+    int POST(const uint8_t* body, size_t len) { return POST(String(std::string((const char*)body, len))); }
+    String getString() { return String("{\"status\":\"Message received\"}"); }
+    void end() {}
+    static String errorToString(int code) { return String("error ") + String(code); }
+
+private:
+    String url_;
+};
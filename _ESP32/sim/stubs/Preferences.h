@@ -0,0 +1,66 @@
+/*
+    Host stand-in for the NVS backed Preferences library. Namespaces live in memory for the life of the process,
+    and every begin() is counted so flash traffic can be compared between builds.
+*/
+#pragma once
+
+#include "Arduino.h"
+#include <map>
+#include <vector>
+
+struct SimNvsStats {
+    uint32_t opens = 0;
+    uint32_t reads = 0;
+    uint32_t writes = 0;
+};
+
+SimNvsStats& simNvsStats();
+
+class Preferences {
+public:
+    bool begin(const char* name, bool readOnly = false, const char* partition = nullptr);
+    void end() { ns_ = nullptr; }
+    bool clear();
+    bool remove(const char* key);
+    bool isKey(const char* key);
+
+    size_t putChar(const char* key, int8_t v) { return putRaw(key, &v, sizeof(v)); }
+    size_t putUChar(const char* key, uint8_t v) { return putRaw(key, &v, sizeof(v)); }
+    size_t putShort(const char* key, int16_t v) { return putRaw(key, &v, sizeof(v)); }
+    size_t putUShort(const char* key, uint16_t v) { return putRaw(key, &v, sizeof(v)); }
+    size_t putInt(const char* key, int32_t v) { return putRaw(key, &v, sizeof(v)); }
+    size_t putUInt(const char* key, uint32_t v) { return putRaw(key, &v, sizeof(v)); }
+    size_t putLong(const char* key, int32_t v) { return putRaw(key, &v, sizeof(v)); }
+    size_t putFloat(const char* key, float v) { return putRaw(key, &v, sizeof(v)); }
+    size_t putBool(const char* key, bool v) { uint8_t b = v; return putRaw(key, &b, sizeof(b)); }
+    size_t putString(const char* key, const String& v) { return putRaw(key, v.c_str(), v.length() + 1); }
+    size_t putBytes(const char* key, const void* v, size_t len) { return putRaw(key, v, len); }
+
+    int8_t getChar(const char* key, int8_t def = 0) { return getRaw(key, def); }
+    uint8_t getUChar(const char* key, uint8_t def = 0) { return getRaw(key, def); }
+    int16_t getShort(const char* key, int16_t def = 0) { return getRaw(key, def); }
+    uint16_t getUShort(const char* key, uint16_t def = 0) { return getRaw(key, def); }
+    int32_t getInt(const char* key, int32_t def = 0) { return getRaw(key, def); }
+    uint32_t getUInt(const char* key, uint32_t def = 0) { return getRaw(key, def); }
+    int32_t getLong(const char* key, int32_t def = 0) { return getRaw(key, def); }
+    float getFloat(const char* key, float def = NAN) { return getRaw(key, def); }
+    bool getBool(const char* key, bool def = false) { return getRaw<uint8_t>(key, def) != 0; }
+    String getString(const char* key, const String& def = String());
+    size_t getBytesLength(const char* key);
+    size_t getBytes(const char* key, void* buf, size_t maxLen);
+
+private:
+    size_t putRaw(const char* key, const void* v, size_t len);
+    template <class T>
+    T getRaw(const char* key, T def) {
+        if (!ns_) return def;
+        simNvsStats().reads++;
+        auto it = ns_->find(key);
+        if (it == ns_->end() || it->second.size() != sizeof(T)) return def;
+        T v;
+        memcpy(&v, it->second.data(), sizeof(T));
+        return v;
+    }
+    std::map<std::string, std::vector<uint8_t>>* ns_ = nullptr;
+    bool readOnly_ = false;
+};
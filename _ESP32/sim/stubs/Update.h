@@ -0,0 +1,51 @@
+/*
+    Host stand-in for the OTA Update class. Written images are kept in memory.
+*/
+#pragma once
+
+#include "Arduino.h"
+#include <vector>
+
+#define UPDATE_SIZE_UNKNOWN 0xFFFFFFFF
+#define U_FLASH 0
+
+class UpdateClass {
+public:
+    bool begin(size_t size = UPDATE_SIZE_UNKNOWN, int command = U_FLASH) {
+        (void)command;
+        image_.clear();
+        size_ = size;
+        running_ = true;
+        error_ = false;
+        return true;
+    }
+    size_t write(uint8_t* data, size_t len) {
+        if (!running_) { error_ = true; return 0; }
+        image_.insert(image_.end(), data, data + len);
+        return len;
+    }
+    bool end(bool evenIfRemaining = false) {
+        if (!running_) return false;
+        running_ = false;
+        if (!evenIfRemaining && size_ != UPDATE_SIZE_UNKNOWN && image_.size() != size_) error_ = true;
+        return !error_;
+    }
+    void abort() { running_ = false; error_ = true; }
+    bool hasError() const { return error_; }
+    bool isRunning() const { return running_; }
+    bool isFinished() const { return !running_ && !error_; }
+    size_t progress() const { return image_.size(); }
+    size_t size() const { return size_; }
+    size_t remaining() const { return size_ == UPDATE_SIZE_UNKNOWN ? 0 : size_ - image_.size(); }
+    void printError(Print& out) { out.println("Update error"); }
+    const char* errorString() const { return error_ ? "Update error" : "No Error"; }
+    const std::vector<uint8_t>& simImage() const { return image_; }
+
+private:
+    std::vector<uint8_t> image_;
+    size_t size_ = 0;
+    bool running_ = false;
+    bool error_ = false;
+};
+
+extern UpdateClass Update;
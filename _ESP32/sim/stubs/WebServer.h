@@ -0,0 +1,136 @@
+/*
+    Host stand-in for the synchronous ESP32 WebServer. Routes are registered exactly as on the device and a
+    simulation script invokes them through simRequest(), which captures the response the handler sent.
+*/
+#pragma once
+
+#include "Arduino.h"
+#include "WiFi.h"
+#include <functional>
+#include <map>
+#include <vector>
+
+typedef enum {
+    HTTP_ANY = 0,
+    HTTP_GET = 1,
+    HTTP_POST = 3,
+    HTTP_PUT = 4,
+    HTTP_DELETE = 5
+} HTTPMethod;
+
+enum HTTPUploadStatus {
+    UPLOAD_FILE_START,
+    UPLOAD_FILE_WRITE,
+    UPLOAD_FILE_END,
+    UPLOAD_FILE_ABORTED
+};
+
+#define HTTP_UPLOAD_BUFLEN 1436
+
+struct HTTPUpload {
+    HTTPUploadStatus status;
+    String filename;
+    String name;
+    String type;
+    size_t totalSize;
+    size_t currentSize;
+    uint8_t buf[HTTP_UPLOAD_BUFLEN];
+};
+
+struct SimResponse {
+    int code = 0;
+    std::string contentType;
+    std::string body;
+    uint64_t handlerUs = 0;
+};
+
+class WebServer {
+public:
+    typedef std::function<void(void)> THandlerFunction;
+
+    explicit WebServer(int port = 80) : port_(port) {}
+
+    void begin();
+    void handleClient() {}
+    void on(const String& uri, HTTPMethod method, THandlerFunction fn) { on(uri, method, fn, nullptr); }
+    void on(const String& uri, HTTPMethod method, THandlerFunction fn, THandlerFunction upload) {
+        routes_.push_back({uri.str(), method, fn, upload});
+    }
+    void onNotFound(THandlerFunction fn) { notFound_ = fn; }
+    void enableDelay(bool value) { (void)value; }
+
+    String arg(const String& name) const {
+        auto it = args_.find(name.str());
+        return it == args_.end() ? String() : String(it->second);
+    }
+    bool hasArg(const String& name) const { return args_.count(name.str()) != 0; }
+    int args() const { return (int)args_.size(); }
+    String uri() const { return String(uri_); }
+    HTTPMethod method() const { return method_; }
+    String header(const String& name) const {
+        auto it = headers_.find(name.str());
+        return it == headers_.end() ? String() : String(it->second);
+    }
+    bool hasHeader(const String& name) const { return headers_.count(name.str()) != 0; }
+    void collectHeaders(const char* headerKeys[], size_t count) { (void)headerKeys; (void)count; }
+
+    void sendHeader(const String& name, const String& value, bool first = false) {
+        (void)name;
+        (void)value;
+        (void)first;
+    }
+    void setContentLength(size_t len) { (void)len; }
+    void send(int code, const char* contentType = nullptr, const String& content = String()) {
+        response_.code = code;
+        response_.contentType = contentType ? contentType : "";
+        response_.body = content.str();
+    }
+    void send(int code, const String& contentType, const String& content) { send(code, contentType.c_str(), content); }
+    void send(int code, const char* contentType, const char* content) { send(code, contentType, String(content)); }
+    void send_P(int code, const char* contentType, const char* content, size_t len) {
+        send(code, contentType, String(std::string(content, len)));
+    }
+    void sendContent(const char* content, size_t len) { response_.body.append(content, len); }
+    void sendContent(const String& content) { response_.body += content.str(); }
+
+    HTTPUpload& upload() { return upload_; }
+    WiFiClient client() { return WiFiClient(); }
+
+    //Simulation hooks.
+    SimResponse simRequest(HTTPMethod method, const std::string& uri, const std::string& body = std::string(),
+                           const std::map<std::string, std::string>& args = {});
+    SimResponse simUpload(const std::string& uri, const std::string& filename, const std::vector<uint8_t>& data,
+                          const std::map<std::string, std::string>& args = {});
+
+protected:
+    //Same layout as the core's argument list - the plain body of a JSON POST is the last entry, keyed "plain".
+    struct RequestArgument {
+        String key;
+        String value;
+    };
+    int _currentArgCount = 0;
+    RequestArgument* _currentArgs = nullptr;
+
+private:
+    void setArgs(const std::map<std::string, std::string>& args, const std::string& body);
+
+    struct Route {
+        std::string uri;
+        HTTPMethod method;
+        THandlerFunction fn;
+        THandlerFunction upload;
+    };
+    const Route* findRoute(HTTPMethod method, const std::string& uri) const;
+
+    int port_;
+    bool started_ = false;
+    std::vector<Route> routes_;
+    THandlerFunction notFound_;
+    std::map<std::string, std::string> args_;
+    std::vector<RequestArgument> argList_;
+    std::map<std::string, std::string> headers_;
+    std::string uri_;
+    HTTPMethod method_ = HTTP_GET;
+    HTTPUpload upload_;
+    SimResponse response_;
+};
@@ -0,0 +1,142 @@
+/*
+    Host stand-in for the ESP32 WiFi stack. Station mode always "connects", and TCP/UDP endpoints are in-memory
+    pipes that a simulation script can open with simConnect()/simUdpSend().
+*/
+#pragma once
+
+#include "Arduino.h"
+#include <deque>
+#include <memory>
+#include <vector>
+
+#define WIFI_STA 1
+#define WIFI_AP 2
+#define WIFI_AP_STA 3
+
+typedef enum {
+    WL_IDLE_STATUS = 0,
+    WL_CONNECTED = 3,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+class IPAddress {
+public:
+    IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : a_(a), b_(b), c_(c), d_(d) {}
+    String toString() const {
+        char buf[20];
+        snprintf(buf, sizeof(buf), "%u.%u.%u.%u", a_, b_, c_, d_);
+        return String(buf);
+    }
+    bool operator==(const IPAddress& o) const { return a_ == o.a_ && b_ == o.b_ && c_ == o.c_ && d_ == o.d_; }
+
+private:
+    uint8_t a_, b_, c_, d_;
+};
+
+class WiFiClass {
+public:
+    bool mode(int m) { (void)m; return true; }
+    wl_status_t begin(const char* ssid, const char* pass) { (void)ssid; (void)pass; return WL_CONNECTED; }
+    wl_status_t status() { return WL_CONNECTED; }
+    IPAddress localIP() { return IPAddress(192, 168, 1, 50); }
+    int32_t RSSI() { return -55; }
+    bool setSleep(bool enabled) { (void)enabled; return true; }
+};
+
+extern WiFiClass WiFi;
+
+//Both directions of one simulated TCP connection.
+struct SimSocket {
+    uint16_t port = 0;
+    bool open = true;
+    std::deque<uint8_t> toDevice;
+    std::deque<uint8_t> fromDevice;
+};
+
+class WiFiClient : public Stream {
+public:
+    WiFiClient() {}
+    explicit WiFiClient(std::shared_ptr<SimSocket> s) : sock_(s) {}
+
+    int connect(const char* host, uint16_t port) { (void)host; (void)port; return 0; }
+    uint8_t connected() { return sock_ && (sock_->open || !sock_->toDevice.empty()); }
+    operator bool() const { return (bool)sock_; }
+    int available() override { return sock_ ? (int)sock_->toDevice.size() : 0; }
+    int read() override {
+        if (!available()) return -1;
+        uint8_t c = sock_->toDevice.front();
+        sock_->toDevice.pop_front();
+        return c;
+    }
+    int read(uint8_t* buf, size_t len) {
+        size_t n = 0;
+        while (n < len && available()) buf[n++] = (uint8_t)read();
+        return (int)n;
+    }
+    int peek() override { return available() ? sock_->toDevice.front() : -1; }
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buf, size_t n) override {
+        if (!sock_ || !sock_->open) return 0;
+        sock_->fromDevice.insert(sock_->fromDevice.end(), buf, buf + n);
+        return n;
+    }
+    int availableForWrite() { return 4096; }
+    void flush() {}
+    void stop() { if (sock_) sock_->open = false; sock_.reset(); }
+    int setNoDelay(bool nodelay) { (void)nodelay; return 0; }
+    IPAddress remoteIP() const { return IPAddress(192, 168, 1, 10); }
+
+private:
+    std::shared_ptr<SimSocket> sock_;
+};
+
+class WiFiServer {
+public:
+    explicit WiFiServer(uint16_t port = 80, uint8_t maxClients = 4) : port_(port) { (void)maxClients; }
+    void begin(uint16_t port = 0) { if (port) port_ = port; listening_ = true; }
+    void setNoDelay(bool nodelay) { (void)nodelay; }
+    WiFiClient accept();
+    WiFiClient available() { return accept(); }
+    bool hasClient();
+    void end() { listening_ = false; }
+
+private:
+    uint16_t port_;
+    bool listening_ = false;
+};
+
+struct SimDatagram {
+    uint16_t port;
+    std::vector<uint8_t> data;
+};
+
+class WiFiUDP : public Stream {
+public:
+    uint8_t begin(uint16_t port) { port_ = port; return 1; }
+    void stop() { port_ = 0; }
+    int parsePacket();
+    int available() override { return (int)(rx_.size() - rxPos_); }
+    int read() override { return available() ? rx_[rxPos_++] : -1; }
+    int read(uint8_t* buf, size_t len) {
+        size_t n = 0;
+        while (n < len && available()) buf[n++] = (uint8_t)read();
+        return (int)n;
+    }
+    IPAddress remoteIP() const { return IPAddress(192, 168, 1, 10); }
+    uint16_t remotePort() const { return 50000; }
+    int beginPacket(IPAddress ip, uint16_t port) { (void)ip; (void)port; tx_.clear(); return 1; }
+    size_t write(uint8_t c) override { tx_.push_back(c); return 1; }
+    size_t write(const uint8_t* buf, size_t n) override { tx_.insert(tx_.end(), buf, buf + n); return n; }
+    int endPacket();
+
+private:
+    uint16_t port_ = 0;
+    std::vector<uint8_t> rx_;
+    size_t rxPos_ = 0;
+    std::vector<uint8_t> tx_;
+};
+
+//Simulation hooks.
+std::shared_ptr<SimSocket> simConnect(uint16_t port);
+void simUdpSend(uint16_t port, const std::vector<uint8_t>& data);
+std::vector<SimDatagram>& simUdpReplies();
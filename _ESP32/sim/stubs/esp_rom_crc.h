@@ -0,0 +1,17 @@
+/*
+    Host stand-in for the CRC routines in the ESP32 ROM. esp_rom_crc32_le(0, ...) gives the usual IEEE CRC-32, the same
+    as zlib's crc32().
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+static inline uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len) {
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    }
+    return ~crc;
+}
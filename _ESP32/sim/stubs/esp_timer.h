@@ -0,0 +1,63 @@
+/*
+    Host stand-in for the ESP-IDF high resolution timer. Periodic timers fire from the virtual clock's tick hooks, so a
+    callback runs within one simulation slice of when the hardware timer would dispatch it.
+*/
+#pragma once
+
+#include <cstdint>
+#include "sim.h"
+
+#ifndef ESP_OK
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_ERR_INVALID_STATE 0x103
+#endif
+
+typedef void (*esp_timer_cb_t)(void* arg);
+
+typedef enum { ESP_TIMER_TASK, ESP_TIMER_ISR } esp_timer_dispatch_t;
+
+typedef struct {
+    esp_timer_cb_t callback;
+    void* arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char* name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void* arg;
+    uint64_t periodUs;
+    uint64_t nextUs;
+    bool running;
+};
+typedef struct esp_timer* esp_timer_handle_t;
+
+static inline esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out) {
+    esp_timer_handle_t timer = new esp_timer{args->callback, args->arg, 0, 0, false};
+    simAddTickHook([timer](uint64_t nowUs) {
+        if (timer->running && nowUs >= timer->nextUs) {
+            timer->nextUs += timer->periodUs;
+            timer->callback(timer->arg);
+        }
+    });
+    *out = timer;
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t periodUs) {
+    if (timer->running) return ESP_ERR_INVALID_STATE;
+    timer->periodUs = periodUs;
+    timer->nextUs = micros() + periodUs;
+    timer->running = true;
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    if (!timer->running) return ESP_ERR_INVALID_STATE;
+    timer->running = false;
+    return ESP_OK;
+}
+
+static inline int64_t esp_timer_get_time() { return (int64_t)micros(); }
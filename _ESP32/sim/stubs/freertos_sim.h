@@ -0,0 +1,45 @@
+/*
+    Host stand-in for the FreeRTOS pieces of the ESP32 core. Tasks run on their own threads but only one thread (the
+    Arduino loop or a single task) holds the baton at a time, and tasks are only woken from simAdvance() when their
+    virtual wake time has passed. Scheduling is therefore deterministic and free of data races.
+*/
+#pragma once
+
+#include <cstdint>
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(m) ((void)(m))
+#define portEXIT_CRITICAL(m) ((void)(m))
+#define portENTER_CRITICAL_ISR(m) ((void)(m))
+#define portEXIT_CRITICAL_ISR(m) ((void)(m))
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void (*TaskFunction_t)(void*);
+struct SimTask;
+typedef SimTask* TaskHandle_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xFFFFFFFFu
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stackDepth, void* parameter,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core);
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stackDepth, void* parameter, UBaseType_t priority,
+                       TaskHandle_t* handle);
+void vTaskDelay(TickType_t ticks);
+void vTaskDelete(TaskHandle_t task);
+TickType_t xTaskGetTickCount();
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+BaseType_t xPortGetCoreID();
+void taskYIELD();
+
+//Simulation hook: run every task whose wake time has come. Called from simAdvance().
+void simRunTasks();
@@ -0,0 +1,26 @@
+/*
+    Simulation control surface shared by the scenarios in scenarios/.
+*/
+#pragma once
+
+#include "Arduino.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+class WebServer;
+
+//The server the firmware started in setup().
+WebServer& simWebServer();
+void simSetInputModel(std::function<int(uint8_t)> model);
+void simAddTickHook(std::function<void(uint64_t)> hook);
+uint8_t simOutputLevel(uint8_t pin);
+uint32_t simLedcDuty(uint8_t pin);
+const std::vector<std::string>& simSerialLog();
+bool simRestartRequested();
+void simNvsPutString(const char* ns, const char* key, const char* value);
+
+//Write every stepper's step/dir trace as CSV (time_us,step_pin,dir,position) - returns false if the file can't be opened.
+bool simWriteTrace(const char* path);
+//Write the trace to $SIM_TRACE when it is set. Scenarios call this once at the end of a run.
+void simWriteTraceFromEnv();
@@ -6,6 +6,11 @@ import LoadingButton from './LoadingButton';
 
 // TODO: .nc file destructure in FileCompare or ObjectsInfo
 
+// Holding a direction longer than this switches from a single step to a continuous jog
+const JOG_HOLD_MS = 250;
+// The ESP32 ramps the tracks down if it hears nothing for 300 ms, so keep well inside that
+const JOG_KEEPALIVE_MS = 100;
+
 const MovementControls = () => {
   const [movementState, setMovementState] = useState('');
   const [zState, setZState] = useState('');
@@ -26,6 +31,7 @@ const MovementControls = () => {
   const [isSpindleSpeedLoading, setIsSpindleSpeedLoading] = useState(false);
   const [isZHomingLoading, setIsZHomingLoading] = useState(false);
   const spindleSpeedTimeout = useRef(null);
+  const directionalPress = useRef(null);
   
   const speedMenuRef = useRef(null);
   const stepMenuRef = useRef(null);
@@ -345,6 +351,58 @@ const handleSpindleSpeedCommit = async () => {
     }
   };
   
+  const sendJog = async (body) => {
+    const response = await fetch('http://localhost:3001/api/control/jog', {
+      method: 'POST',
+      headers: {
+        'Content-Type': 'application/json'
+      },
+      body: JSON.stringify(body)
+    });
+    if (!response.ok) {
+      const errorData = await response.json();
+      throw new Error(errorData.error || 'Unknown error');
+    }
+  };
+
+  // A short press steps by the selected distance; holding the button jogs continuously until it is released
+  const startDirectionalPress = (direction) => {
+    const press = { direction, timer: null, keepalive: null };
+    press.timer = setTimeout(() => {
+      const jog = { direction, speed: selectedSpeed };
+      logRequest(`Continuous jog: ${direction} (Speed: ${selectedSpeed})`);
+      press.keepalive = setInterval(() => sendJog(jog).catch(() => {}), JOG_KEEPALIVE_MS);
+      sendJog(jog).catch((error) => {
+        logError(`Failed to start continuous jog: ${error.message}`);
+        clearInterval(press.keepalive);
+      });
+    }, JOG_HOLD_MS);
+    directionalPress.current = press;
+  };
+
+  const endDirectionalPress = (released) => {
+    const press = directionalPress.current;
+    if (!press) return;
+    directionalPress.current = null;
+    clearTimeout(press.timer);
+    if (press.keepalive) {
+      clearInterval(press.keepalive);
+      sendJog({ stop: true })
+        .then(() => logResponse('Continuous jog stopped'))
+        .catch((error) => logError(`Error stopping continuous jog: ${error.message}`));
+    } else if (released) {
+      handleDirectionalMove(press.direction);
+    }
+  };
+
+  useEffect(() => () => endDirectionalPress(false), []);
+
+  const directionalButtonProps = (direction) => ({
+    onPointerDown: () => startDirectionalPress(direction),
+    onPointerUp: () => endDirectionalPress(true),
+    onPointerLeave: () => endDirectionalPress(false)
+  });
+  
   // TODO: set machine state based on API response
 
   return (
@@ -524,28 +582,28 @@ const handleSpindleSpeedCommit = async () => {
       <div className="grid grid-cols-3 gap-2 w-40">
         <button 
           type="button" 
-          onClick={() => handleDirectionalMove('forwardLeft')}
+          {...directionalButtonProps('forwardLeft')}
           className="w-12 h-12 p-2 rounded-lg flex items-center justify-center hover:bg-gray-700"
         >
           <CurvedArrowSVG className="w-full h-full" />
         </button>
         <button 
           type="button"
-          onClick={() => handleDirectionalMove('forward')} 
+          {...directionalButtonProps('forward')}
           className="w-12 h-12 p-2 rounded-lg flex items-center justify-center hover:bg-gray-700"
         >
           <ArrowUpSVG className="w-full h-full" />
         </button>
         <button 
           type="button"
-          onClick={() => handleDirectionalMove('forwardRight')}
+          {...directionalButtonProps('forwardRight')}
           className="w-12 h-12 p-2 rounded-lg flex items-center justify-center hover:bg-gray-700"
         >
           <CurvedArrowSVG className="w-full h-full -scale-x-100" />
         </button>
         <button 
           type="button"
-          onClick={() => handleDirectionalMove('turnLeft')}
+          {...directionalButtonProps('turnLeft')}
           className="w-12 h-12 p-2 rounded-lg flex items-center justify-center hover:bg-gray-700"
         >
           <ArrowUpSVG className="w-full h-full -rotate-90" />
@@ -555,28 +613,28 @@ const handleSpindleSpeedCommit = async () => {
         </button>
         <button 
           type="button"
-          onClick={() => handleDirectionalMove('turnRight')}
+          {...directionalButtonProps('turnRight')}
           className="w-12 h-12 p-2 rounded-lg flex items-center justify-center hover:bg-gray-700"
         >
           <ArrowUpSVG className="w-full h-full rotate-90" />
         </button>
         <button 
           type="button"
-          onClick={() => handleDirectionalMove('backwardLeft')}
+          {...directionalButtonProps('backwardLeft')}
           className="w-12 h-12 p-2 rounded-lg flex items-center justify-center hover:bg-gray-700"
         >
           <CurvedArrowSVG className="w-full h-full -scale-y-100" />
         </button>
         <button 
           type="button"
-          onClick={() => handleDirectionalMove('backward')}
+          {...directionalButtonProps('backward')}
           className="w-12 h-12 p-2 rounded-lg flex items-center justify-center hover:bg-gray-700"
         >
           <ArrowUpSVG className="w-full h-full rotate-180" />
         </button>
         <button 
           type="button"
-          onClick={() => handleDirectionalMove('backwardRight')}
+          {...directionalButtonProps('backwardRight')}
           className="w-12 h-12 p-2 rounded-lg flex items-center justify-center hover:bg-gray-700"
         >
           <CurvedArrowSVG className="w-full h-full -scale-x-100 -scale-y-100" />
@@ -15,6 +15,8 @@ const NCInfo = () => {
     const [opacity, setOpacity] = useState(100);
     const [hoveredLine, setHoveredLine] = useState(null);
     const [isExecuting, setIsExecuting] = useState(false);
+    const [isHeld, setIsHeld] = useState(false);
+    const [feedOverride, setFeedOverride] = useState(100);
     const leftListRef = useRef(null);
     const rightListRef = useRef(null);
     const lastScrollRef = useRef(0);
@@ -305,6 +307,7 @@ const NCInfo = () => {
     const executeGCode = async () => {
         try {
             setIsExecuting(true);
+            setIsHeld(false);
             logRequest('Starting G-code execution on ESP32...');
             
             // Convert original content to commands again
@@ -347,6 +350,31 @@ const NCInfo = () => {
         }
     };
 
+    // Feed hold / cycle start - the machine stops on the path and keeps its queue
+    const toggleHold = async () => {
+        const action = isHeld ? 'resume' : 'hold';
+        try {
+            logRequest(isHeld ? 'Resuming G-code execution...' : 'Feed hold...');
+            await axios.post(`http://localhost:3001/api/control/${action}`);
+            setIsHeld(!isHeld);
+            logResponse(isHeld ? 'Execution resumed' : 'Feed hold - machine stopping');
+        } catch (error) {
+            logError(`Error sending ${action}: ${error.response?.data?.error || error.message}`);
+        }
+    };
+
+    // Feed override in 10% steps, 10-200%, applied to the move already running
+    const changeFeedOverride = async (change) => {
+        const feed = Math.min(200, Math.max(10, feedOverride + change));
+        try {
+            await axios.post('http://localhost:3001/api/control/override', { feed });
+            setFeedOverride(feed);
+            logResponse(`Feed override ${feed}%`);
+        } catch (error) {
+            logError(`Error setting feed override: ${error.response?.data?.error || error.message}`);
+        }
+    };
+
     const handleDrop = async (e) => {
         e.preventDefault();
         setIsDragging(false);
@@ -529,6 +557,21 @@ const NCInfo = () => {
                                         {isExecuting ? 'Executing...' : 'Execute on ESP32'}
                                     </button>
                                 )}
+
+                                {isExecuting && (
+                                    <div className="flex flex-row items-center justify-center space-x-2 mb-2">
+                                        <button type="button" className="execute-button px-4" onClick={toggleHold}>
+                                            {isHeld ? 'Resume' : 'Feed Hold'}
+                                        </button>
+                                        <button type="button" className="execute-button px-3" onClick={() => changeFeedOverride(-10)}>
+                                            -10%
+                                        </button>
+                                        <span className="text-white w-24 text-center">Feed {feedOverride}%</span>
+                                        <button type="button" className="execute-button px-3" onClick={() => changeFeedOverride(10)}>
+                                            +10%
+                                        </button>
+                                    </div>
+                                )}
                                 
                                 <button 
                                     type="button"
@@ -32,5 +32,6 @@ export const GRBL_DESCRIPTIONS = {
     "$122": "Z-axis acceleration in mm/sec²",
     "$130": "X-axis maximum travel in millimeters",
     "$131": "Y-axis maximum travel in millimeters",
-    "$132": "Z-axis maximum travel in millimeters"
+    "$132": "Z-axis maximum travel in millimeters",
+    "$140": "Track width in millimeters"
 };
\ No newline at end of file
@@ -89,6 +89,36 @@ export const MachineProvider = ({ children }) => {
         }
     };
 
+    // Update several GRBL settings at once - one request and one flash write on the ESP32
+    const updateGrblSettings = async (changes) => {
+        const keys = Object.keys(changes).join(', ');
+        try {
+            logRequest(`Updating GRBL settings ${keys}`);
+            const response = await axios.post('http://localhost:3001/api/config/grbl/bulk', {
+                settings: changes
+            });
+            
+            if (response.data.status === 'success') {
+                // Update local state after successful API update
+                setGrblSettings(prev => {
+                    const next = { ...prev };
+                    Object.entries(changes).forEach(([key, value]) => {
+                        next[key] = { ...prev[key], value };
+                    });
+                    return next;
+                });
+                logResponse(`Successfully updated ${keys}`);
+                return true;
+            } else {
+                logError(`Failed to update ${keys}: ${response.data.error || 'Unknown error'}`);
+                return false;
+            }
+        } catch (error) {
+            logError(`Error updating ${keys}: ${error.message}`);
+            return false;
+        }
+    };
+
     // Fetch GRBL settings when connection status changes to 'connected'
     useEffect(() => {
         if (status === 'connected' && !isGrblLoaded) {
@@ -108,7 +138,8 @@ export const MachineProvider = ({ children }) => {
         isGrblLoaded,
         isGrblError,
         fetchGrblSettings,
-        updateGrblSetting
+        updateGrblSetting,
+        updateGrblSettings
     };
 
     return (
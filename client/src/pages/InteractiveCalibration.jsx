@@ -60,7 +60,7 @@ const InteractiveCalibration = () => {
   const [selectedAxis, setSelectedAxis] = useState('z');
   
   // GRBL settings management - using centralized context
-  const { grblSettings, isGrblLoaded, updateGrblSetting, fetchGrblSettings } = useMachine();
+  const { grblSettings, isGrblLoaded, updateGrblSetting, updateGrblSettings, fetchGrblSettings } = useMachine();
   const [originalSettings, setOriginalSettings] = useState(null);
   const [isSettingsModified, setIsSettingsModified] = useState(false);
   
@@ -106,15 +106,11 @@ const InteractiveCalibration = () => {
         setOriginalSettings({...grblSettings});
       }
       
-      // Store steps/mm and update them to 1
-      for (const axis of ['$100', '$101', '$102']) {
-        await updateGrblSetting(axis, 1);
-      }
-      
-      // Store max rate values and update them to 20400
-      for (const axis of ['$110', '$111', '$112']) {
-        await updateGrblSetting(axis, 20400);
-      }
+      // Set steps/mm to 1 and max rates to 20400 in one save
+      await updateGrblSettings({
+        '$100': 1, '$101': 1, '$102': 1,
+        '$110': 20400, '$111': 20400, '$112': 20400
+      });
 
       logResponse('Calibration preparation complete');
       setIsSettingsModified(true);
@@ -164,21 +160,23 @@ const InteractiveCalibration = () => {
       if (axis === 'z') {
         updatedResults.z = { stepsPerMm, completed: true };
         
-        // Update Z steps per mm in GRBL settings
-        await updateGrblSetting('$102', stepsPerMm);
-        // Restore Z max rate
-        await updateGrblSetting('$112', originalSettings['$112'].value);
+        // Update Z steps per mm and restore Z max rate in GRBL settings
+        await updateGrblSettings({
+          '$102': stepsPerMm,
+          '$112': originalSettings['$112'].value
+        });
         
         setCalibrationStep('xyCalibrating');
       } else {
         updatedResults.xy = { stepsPerMm, completed: true };
         
-        // Update X and Y steps per mm in GRBL settings
-        await updateGrblSetting('$100', stepsPerMm);
-        await updateGrblSetting('$101', stepsPerMm);
-        // Restore X and Y max rate
-        await updateGrblSetting('$110', originalSettings['$110'].value);
-        await updateGrblSetting('$111', originalSettings['$111'].value);
+        // Update X and Y steps per mm and restore X and Y max rates in GRBL settings
+        await updateGrblSettings({
+          '$100': stepsPerMm,
+          '$101': stepsPerMm,
+          '$110': originalSettings['$110'].value,
+          '$111': originalSettings['$111'].value
+        });
         
         if (updatedResults.z.completed) {
           // Validate that max rates were properly restored before completing
@@ -35,7 +35,7 @@ const OTAU = () => {
                 throw new Error('Device not ready for update');
             }
 
-            setStatus('Updating firmware... This may take up to 30 seconds.');
+            setStatus('Updating firmware... This can take a few minutes, and waits while the machine is moving.');
             await new Promise(resolve => setTimeout(resolve, 1000)); // Ensure message is shown for at least 1 second
 
             const formData = new FormData();
@@ -54,7 +54,7 @@ const OTAU = () => {
                         }, 2000);
                     }
                 },
-                timeout: 30000
+                timeout: 600000
             });
             
             if (response.data.success) {
@@ -35,7 +35,8 @@ const GRBL_DESCRIPTIONS = {
     "$122": "Z-axis acceleration in mm/sec²",
     "$130": "X-axis maximum travel in millimeters",
     "$131": "Y-axis maximum travel in millimeters",
-    "$132": "Z-axis maximum travel in millimeters"
+    "$132": "Z-axis maximum travel in millimeters",
+    "$140": "Track width in millimeters"
 };
 
 const getGrblSettingUnit = (description) => {
@@ -98,6 +99,35 @@ export const getGrblConfig = async (req, res) => {
     }
 };
 
+// Convert a setting value to the type the ESP32 stores it as. Throws on values that do not fit.
+const convertGrblValue = (key, value) => {
+    let processedValue;
+    const settingType = getGrblSettingType(key);
+
+    switch (settingType) {
+        case 'int':
+            processedValue = parseInt(value);
+            break;
+        case 'short':
+            processedValue = parseInt(value);
+            if (processedValue < -32768 || processedValue > 32767) {
+                throw new Error('Value out of range for short');
+            }
+            break;
+        case 'bool':
+            processedValue = Boolean(value);
+            break;
+        case 'float':
+            processedValue = parseFloat(value);
+            break;
+    }
+
+    if (isNaN(processedValue) && settingType !== 'bool') {
+        throw new Error('Invalid numeric value');
+    }
+    return processedValue;
+};
+
 export const updateGrblConfig = async (req, res) => {
     const { key, value } = req.body;
 
@@ -110,27 +140,7 @@ export const updateGrblConfig = async (req, res) => {
     let processedValue;
 
     try {
-        switch (settingType) {
-            case 'int':
-                processedValue = parseInt(value);
-                break;
-            case 'short':
-                processedValue = parseInt(value);
-                if (processedValue < -32768 || processedValue > 32767) {
-                    throw new Error('Value out of range for short');
-                }
-                break;
-            case 'bool':
-                processedValue = Boolean(value);
-                break;
-            case 'float':
-                processedValue = parseFloat(value);
-                break;
-        }
-
-        if (isNaN(processedValue) && settingType !== 'bool') {
-            throw new Error('Invalid numeric value');
-        }
+        processedValue = convertGrblValue(key, value);
     } catch (error) {
         return res.status(400).json({ 
             error: `Invalid value for setting type ${settingType}: ${error.message}` 
@@ -144,6 +154,41 @@ export const updateGrblConfig = async (req, res) => {
             type: settingType
         });
         
+        res.json(response.data);
+    } catch (error) {
+        res.status(500).json({ 
+            error: error.response?.data?.error || 'Error updating GRBL configuration' 
+        });
+    }
+};
+
+// Update several GRBL settings in one request - the ESP32 writes them in a single NVS transaction
+export const updateGrblConfigBulk = async (req, res) => {
+    const { settings } = req.body;
+
+    if (!settings || typeof settings !== 'object' || Object.keys(settings).length === 0) {
+        return res.status(400).json({ error: 'Settings object is required' });
+    }
+
+    const processedSettings = {};
+    for (const [key, value] of Object.entries(settings)) {
+        if (!GRBL_DESCRIPTIONS[key]) {
+            return res.status(400).json({ error: `Unknown setting ${key}` });
+        }
+        try {
+            processedSettings[key] = convertGrblValue(key, value);
+        } catch (error) {
+            return res.status(400).json({ 
+                error: `Invalid value for setting ${key}: ${error.message}` 
+            });
+        }
+    }
+
+    try {
+        const response = await axios.post(`${ESP32_BASE_URL}/api/config/grbl/bulk`, {
+            settings: processedSettings
+        });
+
         res.json(response.data);
     } catch (error) {
         res.status(500).json({ 
@@ -1,5 +1,6 @@
 import { PlannerInstance } from '../utils/Planner.js';
 import { ConsoleContext } from '../utils/ConsoleContext.js';
+import { GcodeStreamInstance } from '../utils/GcodeStream.js';
 import axios from 'axios';
 import { ESP32_BASE_URL } from '../config/esp32.js';
 
@@ -264,32 +265,39 @@ export const getGcodeStatus = (req, res) => {
 };
 
 // Execute commands in the background
+// The raw lines are streamed to the ESP32, which parses them and feeds its motion queue directly.
 const executeInBackground = async (plan) => {
     try {
-        // Execute the plan using the Planner
-        const result = await PlannerInstance.executePlan(plan);
-        
-        if (result) {
-            // Update execution status on success
-            executionStatus = {
-                ...executionStatus,
-                status: 'complete',
-                progress: 1,
-                currentLine: executionStatus.totalLines
-            };
-            
-            ConsoleContext.addMessage('success', 'G-code execution completed successfully');
-        } else {
-            // Update execution status on failure
+        const lines = plan.commands
+            .filter(command => command.type !== 'comment' && command.original)
+            .map(command => command.original.trim());
+
+        await GcodeStreamInstance.streamLines(lines, (acknowledged, total) => {
             executionStatus = {
                 ...executionStatus,
-                status: 'error',
-                error: 'Plan execution failed'
+                progress: total > 0 ? acknowledged / total : 1,
+                currentLine: acknowledged
             };
-            
-            ConsoleContext.addMessage('error', 'G-code execution failed');
-        }
+        });
+
+        // Every line is queued on the machine - wait for the queue to run dry.
+        await waitForMachineIdle();
+
+        // Update execution status on success
+        executionStatus = {
+            ...executionStatus,
+            status: 'complete',
+            progress: 1,
+            currentLine: executionStatus.totalLines
+        };
+
+        ConsoleContext.addMessage('success', 'G-code execution completed successfully');
     } catch (error) {
+        // A stop request has already set the status
+        if (executionStatus.status === 'stopped') {
+            return;
+        }
+
         // Update execution status on error
         executionStatus = {
             ...executionStatus,
@@ -301,12 +309,20 @@ const executeInBackground = async (plan) => {
     }
 };
 
+// Poll the ESP32 until its motion queue is empty
+const waitForMachineIdle = async () => {
+    while (executionStatus.status === 'running') {
+        const response = await axios.get(`${ESP32_BASE_URL}/api/status/busy`);
+        if (!response.data.busy) {
+            return;
+        }
+        await new Promise(resolve => setTimeout(resolve, 250));
+    }
+};
+
 // Emergency stop for G-code execution
 export const stopGcode = async (req, res) => {
     try {
-        // Call the Planner's emergency stop function
-        await PlannerInstance.emergencyStop();
-        
         // Update execution status
         executionStatus = {
             ...executionStatus,
@@ -314,6 +330,9 @@ export const stopGcode = async (req, res) => {
             progress: 0,
             currentLine: 0
         };
+
+        // Drop the stream and halt the machine
+        await GcodeStreamInstance.stop();
         
         ConsoleContext.addMessage('warning', 'G-code execution stopped by user');
         res.json({ status: 'stopped', message: 'G-code execution stopped' });
@@ -1,5 +1,6 @@
 import axios from 'axios';
 import { ESP32_BASE_URL } from '../config/esp32.js';
+import { ControlStreamInstance } from '../utils/ControlStream.js';
 
 const DIRECTION_MAP = {
     'forward': 0,      // straight -> forward for clarity
@@ -33,14 +34,84 @@ export const sendCommand = async (req, res) => {
 
     try {
         const direction = directionCode;
+        // Jogs take the binary control stream when it is up - a few bytes and one ack instead of an HTTP request
+        if (ControlStreamInstance.connected) {
+            const { free } = await ControlStreamInstance.jog(direction, speed, step);
+            return res.json({ status: 'success', direction, free });
+        }
         const response = await axios.post(`${ESP32_BASE_URL}/api/control`, { direction, speed, step });
         res.json(response.data);
     } catch (error) {
-        const errorMessage = error.response?.data?.error || 'Error connecting to ESP32';
+        const errorMessage = error.response?.data?.error || error.message || 'Error connecting to ESP32';
+        res.status(500).json({ error: errorMessage });
+    }
+};
+
+// Continuous jog - { direction, speed } starts or keeps it going, { stop: true } ends it. The client repeats the request
+// while the button is held; each one is passed straight on so the ESP32's keepalive timeout covers the whole path.
+export const jogVelocity = async (req, res) => {
+    const { direction, speed, stop } = req.body;
+
+    if (!ESP32_BASE_URL) {
+        return res.status(400).json({ error: 'ESP32 not connected. Please set IP address first.' });
+    }
+
+    const jogSpeed = stop ? 0 : Number(speed);
+    const directionCode = stop ? 0 : DIRECTION_MAP[direction];
+    if (!stop && (directionCode === undefined || !(jogSpeed > 0))) {
+        return res.status(400).json({ error: 'Continuous jog needs a valid direction and speed' });
+    }
+
+    try {
+        if (ControlStreamInstance.connected) {
+            await ControlStreamInstance.jogVelocity(directionCode, jogSpeed);
+            return res.json({ status: jogSpeed > 0 ? 'jogging' : 'stopping' });
+        }
+        const body = jogSpeed > 0 ? { direction: directionCode, speed: jogSpeed } : { stop: true };
+        const response = await axios.post(`${ESP32_BASE_URL}/api/control/jog`, body);
+        res.json(response.data);
+    } catch (error) {
+        const errorMessage = error.response?.data?.error || error.message || 'Error connecting to ESP32';
+        res.status(500).json({ error: errorMessage });
+    }
+};
+
+// Feed hold, cycle start and overrides act on the running job straight away, ahead of anything queued
+const sendRealtime = async (res, streamCommand, path, body) => {
+    if (!ESP32_BASE_URL) {
+        return res.status(400).json({ error: 'ESP32 not connected. Please set IP address first.' });
+    }
+
+    try {
+        if (ControlStreamInstance.connected) {
+            await streamCommand();
+            return res.json({ status: 'success' });
+        }
+        const response = await axios.post(`${ESP32_BASE_URL}${path}`, body);
+        res.json(response.data);
+    } catch (error) {
+        const errorMessage = error.response?.data?.error || error.message || 'Error connecting to ESP32';
         res.status(500).json({ error: errorMessage });
     }
 };
 
+export const feedHold = (req, res) =>
+    sendRealtime(res, () => ControlStreamInstance.feedHold(), '/api/control/hold');
+
+export const cycleStart = (req, res) =>
+    sendRealtime(res, () => ControlStreamInstance.cycleStart(), '/api/control/resume');
+
+export const setOverride = (req, res) => {
+    const { feed, spindle } = req.body;
+    const valid = (value) => value === undefined || (Number.isInteger(value) && value >= 10 && value <= 200);
+
+    if ((feed === undefined && spindle === undefined) || !valid(feed) || !valid(spindle)) {
+        return res.status(400).json({ error: 'Overrides are whole percentages from 10 to 200' });
+    }
+
+    return sendRealtime(res, () => ControlStreamInstance.override(feed, spindle), '/api/control/override', { feed, spindle });
+};
+
 export const toggleLaser = async (req, res) => {
     const { enable } = req.body;
 
@@ -49,10 +120,14 @@ export const toggleLaser = async (req, res) => {
     }
 
     try {
+        if (ControlStreamInstance.connected) {
+            await ControlStreamInstance.laser(enable);
+            return res.json({ status: 'success', laser: enable ? 'enabled' : 'disabled' });
+        }
         const response = await axios.post(`${ESP32_BASE_URL}/api/laser`, { enable });
         res.json(response.data);
     } catch (error) {
-        const errorMessage = error.response?.data?.error || 'Error connecting to ESP32';
+        const errorMessage = error.response?.data?.error || error.message || 'Error connecting to ESP32';
         res.status(500).json({ error: errorMessage });
     }
 };
@@ -65,10 +140,14 @@ export const toggleSpindle = async (req, res) => {
     }
 
     try {
+        if (ControlStreamInstance.connected) {
+            await ControlStreamInstance.spindle(enable);
+            return res.json({ status: 'success', spindle: enable ? 'enabled' : 'disabled' });
+        }
         const response = await axios.post(`${ESP32_BASE_URL}/api/spindle`, { enable });
         res.json(response.data);
     } catch (error) {
-        const errorMessage = error.response?.data?.error || 'Error connecting to ESP32';
+        const errorMessage = error.response?.data?.error || error.message || 'Error connecting to ESP32';
         res.status(500).json({ error: errorMessage });
     }
 };
@@ -100,14 +179,34 @@ export const setSpindleZDepth = async (req, res) => {
     }
 
     try {
+        if (ControlStreamInstance.connected) {
+            const { free } = await ControlStreamInstance.moveZ(speed, step);
+            return res.json({ status: 'success', free });
+        }
         const response = await axios.post(`${ESP32_BASE_URL}/api/spindle/depth`, { step, speed });
         res.json(response.data);
     } catch (error) {
-        const errorMessage = error.response?.data?.error || 'Error connecting to ESP32';
+        const errorMessage = error.response?.data?.error || error.message || 'Error connecting to ESP32';
         res.status(500).json({ error: errorMessage });
     }
 };
 
+// Homing runs on the ESP32 without blocking its web server, so poll until the cycle finishes
+const HOMING_POLL_INTERVAL = 250;
+const HOMING_TIMEOUT = 120000;
+
+const waitForHoming = async () => {
+    const startTime = Date.now();
+    while (Date.now() - startTime < HOMING_TIMEOUT) {
+        await new Promise((resolve) => setTimeout(resolve, HOMING_POLL_INTERVAL));
+        const { data } = await axios.get(`${ESP32_BASE_URL}/api/status/busy`, { timeout: 3000 });
+        if (data.state !== 'homing') {
+            return data.homed;
+        }
+    }
+    throw new Error('Z-axis homing timed out');
+};
+
 export const homeZAxis = async (req, res) => {
     if (!ESP32_BASE_URL) {
         return res.status(400).json({ error: 'ESP32 not connected. Please set IP address first.' });
@@ -120,10 +219,90 @@ export const homeZAxis = async (req, res) => {
             return res.status(500).json({ error: response.data.error });
         }
 
-        // Forward success response from ESP32
-        res.json(response.data);
+        const homed = await waitForHoming();
+        if (!homed) {
+            return res.status(500).json({ error: 'Z-axis homing failed. Check hardware and settings.' });
+        }
+
+        res.json({ status: 'success', message: 'Z-axis homing completed successfully' });
     } catch (error) {
-        const errorMessage = error.response?.data?.error || 'Error during Z-axis homing';
+        const errorMessage = error.response?.data?.error || error.message || 'Error during Z-axis homing';
         res.status(500).json({ error: errorMessage });
     }
-};
\ No newline at end of file
+};
+
+// Probing also runs on the ESP32 without blocking its web server - poll for the result like homing
+const PROBE_POLL_INTERVAL = 100;
+const PROBE_TIMEOUT = 120000;
+
+const waitForProbe = async () => {
+    const startTime = Date.now();
+    while (Date.now() - startTime < PROBE_TIMEOUT) {
+        await new Promise((resolve) => setTimeout(resolve, PROBE_POLL_INTERVAL));
+        const { data } = await axios.get(`${ESP32_BASE_URL}/api/status/probe`, { timeout: 3000 });
+        if (data.state !== 'probing') {
+            return data;
+        }
+    }
+    throw new Error('Z probe timed out');
+};
+
+// Body: { distance, feed } - distance in mm, signed like Z moves; feed is the seek in mm/min ($25 if left out)
+export const probeZAxis = async (req, res) => {
+    if (!ESP32_BASE_URL) {
+        return res.status(400).json({ error: 'ESP32 not connected. Please set IP address first.' });
+    }
+
+    const { distance, feed } = req.body;
+    try {
+        await axios.post(`${ESP32_BASE_URL}/api/control/probe`, { distance, feed });
+
+        const result = await waitForProbe();
+        if (result.state !== 'done') {
+            return res.status(500).json({ error: 'Z probe made no contact' });
+        }
+
+        res.json({ status: 'success', z: result.z });
+    } catch (error) {
+        const errorMessage = error.response?.data?.error || error.message || 'Error during Z probing';
+        res.status(500).json({ error: errorMessage });
+    }
+};
+
+// Grid probing for the height map - nine points or more, each with a full probing cycle, so give it much longer
+const LEVELING_TIMEOUT = 30 * 60 * 1000;
+
+const waitForLeveling = async () => {
+    const startTime = Date.now();
+    while (Date.now() - startTime < LEVELING_TIMEOUT) {
+        await new Promise((resolve) => setTimeout(resolve, PROBE_POLL_INTERVAL * 10));
+        const { data } = await axios.get(`${ESP32_BASE_URL}/api/status/leveling`, { timeout: 3000 });
+        if (data.state !== 'probing') {
+            return data;
+        }
+    }
+    throw new Error('Grid probing timed out');
+};
+
+// Body: { x, y, width, height, columns, rows, distance, feed } - the grid in G-code coordinates, 2-16 points each way,
+// probed from the current Z; distance and feed as for probeZAxis. Turns Z compensation on once the map is complete.
+export const levelSurface = async (req, res) => {
+    if (!ESP32_BASE_URL) {
+        return res.status(400).json({ error: 'ESP32 not connected. Please set IP address first.' });
+    }
+
+    const { x, y, width, height, columns, rows, distance, feed } = req.body;
+    try {
+        await axios.post(`${ESP32_BASE_URL}/api/control/leveling`, { x, y, width, height, columns, rows, distance, feed });
+
+        const result = await waitForLeveling();
+        if (result.state !== 'done') {
+            return res.status(500).json({ error: 'Grid probing failed' });
+        }
+
+        res.json({ status: 'success', map: result });
+    } catch (error) {
+        const errorMessage = error.response?.data?.error || error.message || 'Error during grid probing';
+        res.status(500).json({ error: errorMessage });
+    }
+};
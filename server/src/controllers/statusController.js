@@ -3,6 +3,8 @@ import { networkInterfaces } from 'os';
 import { ESP32_BASE_URL, setESP32BaseURL } from '../config/esp32.js';
 import { ConsoleContext } from '../utils/ConsoleContext.js';
 import { PlannerInstance } from '../utils/Planner.js';
+import { TelemetryStreamInstance } from '../utils/TelemetryStream.js';
+import { ControlStreamInstance } from '../utils/ControlStream.js';
 
 const getServerIPAddress = (port) => {
     const nets = networkInterfaces();
@@ -37,6 +39,10 @@ export const checkStatus = async (req, res) => {
             timeout: 3000
         });
 
+        // Start (or move) the push telemetry and binary control streams now that the ESP32 answers
+        TelemetryStreamInstance.start();
+        ControlStreamInstance.start();
+
         // Get update information including free space
         const updateResponse = await axios.get(`${ESP32_BASE_URL}/api/update`, {
             timeout: 3000
@@ -56,26 +62,28 @@ export const checkStatus = async (req, res) => {
 };
 
 export const handleConsoleMessage = (req, res) => {
-    const { type, message } = req.body;
-    if (!type || !message) {
+    // The ESP32 batches its log as { messages: [{ type, message }, ...] }; a single { type, message } is still accepted
+    const messages = Array.isArray(req.body.messages) ? req.body.messages : [req.body];
+    if (messages.length === 0 || messages.some(({ type, message }) => !type || !message)) {
         return res.status(400).json({ error: 'Type and message are required' });
     }
 
-    ConsoleContext.addMessage(type, message);
+    messages.forEach(({ type, message }) => ConsoleContext.addMessage(type, message));
 
-    res.status(200).json({ status: 'Message received' });
+    res.status(200).json({ status: 'Message received', count: messages.length });
 };
 
 export const getCurrentPosition = (req, res) => {
     try {
-        // Get position from the Planner
+        // XY and heading from the ESP32's dead reckoning when telemetry is streaming, otherwise what the Planner commanded
         const { position, heading } = PlannerInstance.getPosition();
+        const pose = TelemetryStreamInstance.latest?.pose;
         
         res.json({
-            x: position.x.toFixed(2),
-            y: position.y.toFixed(2),
+            x: (pose?.x ?? position.x).toFixed(2),
+            y: (pose?.y ?? position.y).toFixed(2),
             z: position.z.toFixed(2),
-            theta: heading.toFixed(2)
+            theta: (pose?.heading ?? heading).toFixed(2)
         });
     } catch (error) {
         res.status(500).json({ 
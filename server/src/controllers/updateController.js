@@ -1,6 +1,6 @@
 import axios from 'axios';
 import { ESP32_BASE_URL } from '../config/esp32.js';
-import FormData from 'form-data';
+import { uploadFirmware } from '../utils/FirmwareUpload.js';
 
 export const checkUpdateStatus = async (req, res) => {
     try {
@@ -43,32 +43,15 @@ export const handleFirmwareUpdate = async (req, res) => {
         //     return res.status(400).json({ error: 'Same firmware version' });
         // }
 
-        const formData = new FormData();
-        formData.append('update', firmwareFile.data, {
-            filename: firmwareFile.name,
-            contentType: 'application/octet-stream'
-        });
-        
-        const response = await axios.post(`${ESP32_BASE_URL}/api/update`, formData, {
-            headers: {
-                ...formData.getHeaders()
-            },
-            maxContentLength: Infinity,
-            maxBodyLength: Infinity,
-            timeout: 30000
-        });
+        // Sent in CRC-checked chunks that resume after a dropped connection, and only applied once the ESP32 has
+        // verified the whole image's SHA-256
+        await uploadFirmware(firmwareFile.data);
 
-        // TODO: Add data stream to response during upload from server to ESP32
-
-        if (response.status === 200) {
-            res.status(200).json({ 
-                success: true,
-                message: 'Firmware update successful! Device will restart.',
-                details: 'The ESP32 will reboot to apply the update.'
-            });
-        } else {
-            throw new Error(`Update failed with status ${response.status}`);
-        }
+        res.status(200).json({ 
+            success: true,
+            message: 'Firmware update successful! Device will restart.',
+            details: 'The ESP32 will reboot to apply the update.'
+        });
     } catch (error) {
         res.status(500).json({ 
             success: false,
@@ -1,5 +1,5 @@
 import express from 'express';
-import { getGrblConfig, updateGrblConfig } from '../../../controllers/configController.js';
+import { getGrblConfig, updateGrblConfig, updateGrblConfigBulk } from '../../../controllers/configController.js';
 import { setESP32BaseURL } from '../../../config/esp32.js';
 
 const configRouter = express.Router();
@@ -22,4 +22,7 @@ configRouter.post('/esp32', (req, res) => {
 configRouter.get('/grbl', getGrblConfig);
 configRouter.post('/grbl', updateGrblConfig);
 
+// /api/config/grbl/bulk
+configRouter.post('/grbl/bulk', updateGrblConfigBulk);
+
 export default configRouter;
\ No newline at end of file
@@ -1,16 +1,22 @@
 import express from 'express';
-import { sendCommand, toggleLaser, toggleSpindle, setSpindleSpeed, setSpindleZDepth, homeZAxis } from '../../../controllers/movementController.js';
+import { sendCommand, jogVelocity, feedHold, cycleStart, setOverride, toggleLaser, toggleSpindle, setSpindleSpeed, setSpindleZDepth, homeZAxis, probeZAxis, levelSurface } from '../../../controllers/movementController.js';
 import { convertGcode, executeGcode, getGcodeStatus, stopGcode } from '../../../controllers/gcodeController.js';
 
 const controlRouter = express.Router();
 
 // /api/control/
 controlRouter.post('/', sendCommand);
+controlRouter.post('/jog', jogVelocity);
+controlRouter.post('/hold', feedHold);
+controlRouter.post('/resume', cycleStart);
+controlRouter.post('/override', setOverride);
 controlRouter.post('/laser', toggleLaser); 
 controlRouter.post('/spindle', toggleSpindle);
 controlRouter.post('/spindle/speed', setSpindleSpeed);
 controlRouter.post('/spindle/depth', setSpindleZDepth);
 controlRouter.post('/zhome', homeZAxis);
+controlRouter.post('/probe', probeZAxis);
+controlRouter.post('/leveling', levelSurface);
 
 // G-code conversion and execution routes
 controlRouter.post('/convert-gcode', convertGcode);
@@ -48,6 +48,11 @@ export const sendConsoleMessageToClients = (message) => {
     io.emit('consoleMessage', message);
 };
 
+// Decoded ESP32 telemetry frames - volatile, so a slow client simply misses a few
+export const sendTelemetryToClients = (frame) => {
+    io.volatile.emit('telemetry', frame);
+};
+
 // Start the server
 server.listen(PORT, () => {
     console.log(`Server is running on port ${PORT}`);
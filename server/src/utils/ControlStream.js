@@ -0,0 +1,218 @@
+// Control stream imports
+import net from 'net';
+import { ConsoleContext } from './ConsoleContext.js';
+import { ESP32_BASE_URL } from '../config/esp32.js';
+import { crc32 } from './FirmwareUpload.js';
+
+// Binary control port on the ESP32 - see the frame layout next to controlMagic in machine.cpp
+const CONTROL_PORT = 82;
+const CONTROL_MAGIC = 0x5A;
+const ACK_FLAG = 0x80;
+const ACK_LENGTH = 11;
+// A frame with no ack after this long is sent again with the same sequence number - the ESP32 won't run it twice
+const ACK_TIMEOUT_MS = 100;
+const MAX_SENDS = 3;
+const RECONNECT_DELAY_MS = 2000;
+
+export const OPCODES = { ping: 0x00, jog: 0x01, move: 0x02, z: 0x03, stop: 0x04, spindle: 0x05, laser: 0x06, jogVelocity: 0x07, hold: 0x08, resume: 0x09, override: 0x0A };
+const STATUS = ['ok', 'gap', 'stale', 'bad crc', 'bad opcode', 'bad payload', 'motion queue full', 'rejected'];
+
+class ControlStream {
+    constructor() {
+        this.socket = null;
+        this.host = null;
+        this.reconnectTimer = null;
+        this.buffer = Buffer.alloc(0);
+        this.sequence = 0;
+        this.pending = new Map();   // sequence -> { resolve, reject, timer }
+        this.queue = Promise.resolve();
+    }
+
+    get connected() {
+        return this.socket !== null && !this.socket.connecting;
+    }
+
+    /**
+     * Connect (or reconnect) to the ESP32 the server is currently pointed at
+     */
+    start() {
+        const host = new URL(ESP32_BASE_URL).hostname;
+        if (this.socket && this.host === host) return;
+
+        this.stop();
+        this.host = host;
+
+        const socket = net.createConnection({ host, port: CONTROL_PORT });
+        socket.setNoDelay(true);
+
+        socket.on('connect', () => {
+            ConsoleContext.addMessage('info', 'Control stream connected');
+        });
+        socket.on('data', (chunk) => this.handleData(chunk));
+        socket.on('error', (error) => {
+            ConsoleContext.addMessage('warning', `Control stream error: ${error.message}`);
+        });
+        socket.on('close', () => {
+            if (this.socket !== socket) return;
+            this.socket = null;
+            this.failPending(new Error('Control stream closed'));
+            this.reconnectTimer = setTimeout(() => this.start(), RECONNECT_DELAY_MS);
+        });
+
+        this.socket = socket;
+    }
+
+    stop() {
+        clearTimeout(this.reconnectTimer);
+        if (this.socket) {
+            const socket = this.socket;
+            this.socket = null;
+            socket.destroy();
+        }
+        this.buffer = Buffer.alloc(0);
+        this.failPending(new Error('Control stream stopped'));
+    }
+
+    failPending(error) {
+        for (const { reject, timer } of this.pending.values()) {
+            clearTimeout(timer);
+            reject(error);
+        }
+        this.pending.clear();
+    }
+
+    encode(opcode, sequence, payload) {
+        const frame = Buffer.alloc(5 + payload.length + 4);
+        frame[0] = CONTROL_MAGIC;
+        frame[1] = opcode;
+        frame.writeUInt16LE(sequence, 2);
+        frame[4] = payload.length;
+        payload.copy(frame, 5);
+        frame.writeUInt32LE(crc32(frame.subarray(0, 5 + payload.length)), 5 + payload.length);
+        return frame;
+    }
+
+    /**
+     * Send one command and resolve with { status, free } once the ESP32 acks it. Rejects if the ESP32 refuses it or
+     * no ack comes back after a few resends. Commands go one at a time, so a resend is always of the newest frame and
+     * the ESP32 can tell it from a frame that arrived out of order.
+     */
+    send(opcode, payload = Buffer.alloc(0)) {
+        const result = this.queue.then(() => this.transmit(opcode, payload));
+        this.queue = result.catch(() => {});
+        return result;
+    }
+
+    transmit(opcode, payload) {
+        if (!this.connected) return Promise.reject(new Error('Control stream not connected'));
+
+        this.sequence = (this.sequence + 1) & 0xFFFF;
+        const sequence = this.sequence;
+        const frame = this.encode(opcode, sequence, payload);
+
+        return new Promise((resolve, reject) => {
+            const entry = { resolve, reject, sends: 0, timer: null };
+            const write = () => {
+                if (++entry.sends > MAX_SENDS) {
+                    this.pending.delete(sequence);
+                    reject(new Error('No acknowledgement from ESP32'));
+                    return;
+                }
+                this.socket?.write(frame);
+                entry.timer = setTimeout(write, ACK_TIMEOUT_MS);
+            };
+            this.pending.set(sequence, entry);
+            write();
+        });
+    }
+
+    handleData(chunk) {
+        this.buffer = Buffer.concat([this.buffer, chunk]);
+
+        while (this.buffer.length >= ACK_LENGTH) {
+            // Resynchronise on the magic byte if we ever land mid-frame
+            if (this.buffer[0] !== CONTROL_MAGIC) {
+                const next = this.buffer.indexOf(CONTROL_MAGIC, 1);
+                this.buffer = next === -1 ? Buffer.alloc(0) : this.buffer.subarray(next);
+                continue;
+            }
+
+            const ack = this.buffer.subarray(0, ACK_LENGTH);
+            if (ack[4] !== 2 || ack.readUInt32LE(7) !== crc32(ack.subarray(0, 7)) || !(ack[1] & ACK_FLAG)) {
+                this.buffer = this.buffer.subarray(1);
+                continue;
+            }
+            this.buffer = this.buffer.subarray(ACK_LENGTH);
+            this.handleAck(ack.readUInt16LE(2), ack[5], ack[6]);
+        }
+    }
+
+    handleAck(sequence, status, free) {
+        const entry = this.pending.get(sequence);
+        if (!entry) return;   // Ack for a frame we already gave up on, or a repeat
+        clearTimeout(entry.timer);
+        this.pending.delete(sequence);
+
+        const name = STATUS[status] || `status ${status}`;
+        if (name === 'gap') {
+            ConsoleContext.addMessage('warning', 'Control stream: ESP32 reports lost commands');
+        }
+        if (name === 'ok' || name === 'gap') {
+            entry.resolve({ status: name, free });
+        } else {
+            entry.reject(new Error(`ESP32 refused command: ${name}`));
+        }
+    }
+
+    jog(direction, speed, step) {
+        const payload = Buffer.alloc(9);
+        payload[0] = direction;
+        payload.writeFloatLE(speed, 1);
+        payload.writeFloatLE(step, 5);
+        return this.send(OPCODES.jog, payload);
+    }
+
+    moveZ(speed, step) {
+        const payload = Buffer.alloc(8);
+        payload.writeFloatLE(speed, 0);
+        payload.writeFloatLE(step, 4);
+        return this.send(OPCODES.z, payload);
+    }
+
+    // speed is a percentage; leave it out to switch the spindle without changing its speed
+    spindle(enable, speed = 255) {
+        return this.send(OPCODES.spindle, Buffer.from([enable ? 1 : 0, speed]));
+    }
+
+    laser(enable) {
+        return this.send(OPCODES.laser, Buffer.from([enable ? 1 : 0]));
+    }
+
+    // Continuous jog at speed mm/min - resend at least every 100 ms or the ESP32 ramps the tracks down; 0 stops
+    jogVelocity(direction, speed) {
+        const payload = Buffer.alloc(5);
+        payload[0] = direction;
+        payload.writeFloatLE(speed, 1);
+        return this.send(OPCODES.jogVelocity, payload);
+    }
+
+    feedHold() {
+        return this.send(OPCODES.hold);
+    }
+
+    cycleStart() {
+        return this.send(OPCODES.resume);
+    }
+
+    // Percentages, 10-200 - leave one out to keep its current value
+    override(feed = 0, spindle = 0) {
+        return this.send(OPCODES.override, Buffer.from([feed, spindle]));
+    }
+
+    estop() {
+        return this.send(OPCODES.stop);
+    }
+}
+
+// Control stream export
+export const ControlStreamInstance = new ControlStream();
@@ -0,0 +1,126 @@
+// Chunked firmware upload imports
+import crypto from 'crypto';
+import axios from 'axios';
+import FormData from 'form-data';
+import { ConsoleContext } from './ConsoleContext.js';
+import { ESP32_BASE_URL } from '../config/esp32.js';
+
+// How many failures in a row - network errors, damaged chunks, lost sessions - before giving up on the upload
+const MAX_ATTEMPTS = 20;
+// Wait after a failed request, and while the ESP32 is still writing the last chunk (or the machine is moving)
+const RETRY_DELAY_MS = 250;
+// Waiting on a busy ESP32 is not a failure, but it does not go on forever - matches the client's request timeout
+const UPLOAD_DEADLINE_MS = 600000;
+const REQUEST_TIMEOUT_MS = 10000;
+
+const CRC_TABLE = Array.from({ length: 256 }, (_, n) => {
+    let c = n;
+    for (let k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320 ^ (c >>> 1) : c >>> 1;
+    return c >>> 0;
+});
+
+// IEEE CRC-32, the same as the ESP32 ROM's esp_rom_crc32_le(0, ...)
+export const crc32 = (buffer) => {
+    let crc = 0xFFFFFFFF;
+    for (const byte of buffer) crc = CRC_TABLE[(crc ^ byte) & 0xFF] ^ (crc >>> 8);
+    return (crc ^ 0xFFFFFFFF) >>> 0;
+};
+
+const sleep = (ms) => new Promise(resolve => setTimeout(resolve, ms));
+
+// Error replies from the ESP32 still carry the session state - hand them back instead of throwing
+const post = (path, data, config = {}) => axios.post(`${ESP32_BASE_URL}${path}`, data, {
+    timeout: REQUEST_TIMEOUT_MS,
+    validateStatus: () => true,
+    ...config
+});
+
+/**
+ * Send a firmware image with the ESP32's chunked OTA protocol: begin (size + SHA-256), chunks carrying their offset
+ * and CRC-32, then commit. A dropped connection resumes from the offset the ESP32 reports rather than starting over.
+ * Nothing is applied until the commit, which the ESP32 refuses unless the SHA-256 of the written image matches.
+ */
+export const uploadFirmware = async (image, onProgress = () => {}) => {
+    const sha256 = crypto.createHash('sha256').update(image).digest('hex');
+    let session = null;
+    let attempts = 0;
+
+    const deadline = Date.now() + UPLOAD_DEADLINE_MS;
+
+    const retry = async (reason) => {
+        if (++attempts > MAX_ATTEMPTS) throw new Error(`Firmware upload failed: ${reason}`);
+        await sleep(RETRY_DELAY_MS);
+    };
+
+    // The ESP32 is flashing the last chunk or the machine is moving - try again without spending an attempt
+    const wait = async (reason) => {
+        if (Date.now() > deadline) throw new Error(`Firmware upload timed out: ${reason}`);
+        await sleep(RETRY_DELAY_MS);
+    };
+
+    // Calling begin again with the same image is how a session is resumed
+    const begin = async () => {
+        const response = await post('/api/update/begin', { size: image.length, sha256 });
+        if (response.status !== 200) throw new Error(response.data?.error || `begin failed with ${response.status}`);
+        return response.data;
+    };
+
+    session = await begin();
+    ConsoleContext.addMessage('info', `Firmware upload started at ${session.offset} of ${image.length} bytes`);
+
+    let offset = session.offset;
+    while (offset < image.length) {
+        const chunk = image.subarray(offset, Math.min(image.length, offset + session.chunk));
+        const form = new FormData();
+        form.append('chunk', chunk, { filename: 'firmware.bin', contentType: 'application/octet-stream' });
+
+        let response;
+        try {
+            response = await post(`/api/update/chunk?offset=${offset}&crc=${crc32(chunk).toString(16)}`, form, {
+                headers: form.getHeaders()
+            });
+        } catch (error) {
+            await retry(error.message);
+            session = await begin().catch(() => session);
+            offset = session.offset;
+            continue;
+        }
+
+        if (response.status === 200) {
+            offset = response.data.offset;
+            attempts = 0;
+            onProgress(offset, image.length);
+        } else if (response.status === 503) {
+            // Still flashing the last chunk - resend the same one
+            await wait(response.data?.error || 'chunk refused with 503');
+        } else if (response.status === 409 || response.status === 400) {
+            // Our offset is stale or the chunk was damaged on the way - resend from where the ESP32 says it is
+            await retry(response.data?.error || `chunk refused with ${response.status}`);
+            if (typeof response.data?.offset === 'number' && response.data.state === 'receiving') {
+                offset = response.data.offset;
+            } else {
+                session = await begin();
+                offset = session.offset;
+            }
+        } else {
+            throw new Error(response.data?.error || `chunk failed with ${response.status}`);
+        }
+    }
+
+    // Wait for the last chunk to reach flash and the machine to stop, then apply
+    for (;;) {
+        let response;
+        try {
+            response = await post('/api/update/commit');
+        } catch (error) {
+            await retry(error.message);
+            continue;
+        }
+        if (response.status === 200) return response.data;
+        // A 409 with the session still receiving is a chunk on its way to flash or a moving machine
+        if (response.status !== 409 || response.data?.state !== 'receiving') {
+            throw new Error(response.data?.error || `commit failed with ${response.status}`);
+        }
+        await wait(response.data?.error);
+    }
+};
@@ -0,0 +1,139 @@
+// G-code stream imports
+import net from 'net';
+import axios from 'axios';
+import { ConsoleContext } from './ConsoleContext.js';
+import { ESP32_BASE_URL } from '../config/esp32.js';
+
+// Raw G-code port on the ESP32 - the firmware parses lines itself and replies "ok" or "error:n" to each one
+const GCODE_PORT = 23;
+// Bytes allowed in flight before waiting on replies. Keeps a stop from having to chew through a long backlog.
+const STREAM_WINDOW = 1024;
+
+class GcodeStream {
+    constructor() {
+        this.socket = null;
+        this.isStreaming = false;
+        this.pending = [];      // Lines sent and waiting on a reply, oldest first
+        this.inFlight = 0;      // Bytes of the pending lines
+        this.received = '';     // Partial reply text
+        this.onReply = null;
+    }
+
+    /**
+     * Open the persistent socket to the ESP32 and wait for its greeting
+     */
+    connect() {
+        if (this.socket) return Promise.resolve();
+
+        const host = new URL(ESP32_BASE_URL).hostname;
+        return new Promise((resolve, reject) => {
+            const socket = net.createConnection({ host, port: GCODE_PORT });
+            socket.setNoDelay(true);
+            socket.setEncoding('utf8');
+
+            socket.once('data', (greeting) => {
+                ConsoleContext.addMessage('info', `G-code stream connected: ${greeting.trim()}`);
+                socket.on('data', (chunk) => this.handleData(chunk));
+                resolve();
+            });
+            socket.on('error', (error) => {
+                ConsoleContext.addMessage('error', `G-code stream error: ${error.message}`);
+                this.socket = null;
+                reject(error);
+            });
+            socket.on('close', () => {
+                this.socket = null;
+                if (this.onReply) this.onReply(new Error('G-code stream closed'));
+            });
+            this.socket = socket;
+        });
+    }
+
+    handleData(chunk) {
+        this.received += chunk;
+        let newline;
+        while ((newline = this.received.indexOf('\n')) !== -1) {
+            const reply = this.received.slice(0, newline).trim();
+            this.received = this.received.slice(newline + 1);
+            if (!reply) continue;
+
+            // Only "ok" and "error:n" answer a line. Anything else - "[PRB:...]" from G38.2/G38.3 - is a report.
+            if (reply !== 'ok' && !reply.startsWith('error:')) {
+                ConsoleContext.addMessage('info', `ESP32: ${reply}`);
+                continue;
+            }
+
+            const line = this.pending.shift();
+            if (line !== undefined) this.inFlight -= line.length + 1;
+            if (this.onReply) this.onReply(null, reply, line);
+        }
+    }
+
+    /**
+     * Stream raw G-code lines, keeping up to STREAM_WINDOW bytes queued on the machine.
+     * onProgress(acknowledged, total) is called as each line is answered. Resolves once every line has been acknowledged.
+     */
+    async streamLines(lines, onProgress) {
+        if (this.isStreaming) {
+            throw new Error('A G-code stream is already running');
+        }
+        // Nothing to send means nothing will ever be acknowledged
+        if (lines.length === 0) return;
+        await this.connect();
+
+        this.isStreaming = true;
+        this.pending = [];
+        this.inFlight = 0;
+
+        let next = 0;
+        let acknowledged = 0;
+
+        try {
+            await new Promise((resolve, reject) => {
+                const fill = () => {
+                    while (next < lines.length && (this.pending.length === 0 || this.inFlight + lines[next].length + 1 <= STREAM_WINDOW)) {
+                        const line = lines[next++];
+                        this.pending.push(line);
+                        this.inFlight += line.length + 1;
+                        this.socket.write(`${line}\n`);
+                    }
+                };
+
+                this.onReply = (error, reply, line) => {
+                    if (error) return reject(error);
+                    if (!this.isStreaming) return reject(new Error('G-code stream stopped'));
+
+                    if (reply.startsWith('error')) {
+                        ConsoleContext.addMessage('warning', `ESP32 rejected "${line}" (${reply})`);
+                    }
+                    acknowledged++;
+                    if (onProgress) onProgress(acknowledged, lines.length);
+
+                    if (acknowledged === lines.length) return resolve();
+                    fill();
+                };
+
+                fill();
+            });
+        } finally {
+            this.isStreaming = false;
+            this.onReply = null;
+        }
+    }
+
+    /**
+     * Abandon the stream and halt the machine. Lines already on the machine are thrown away by the e-stop.
+     */
+    async stop() {
+        this.isStreaming = false;
+        if (this.socket) {
+            this.socket.destroy();
+            this.socket = null;
+        }
+        await axios.post(`${ESP32_BASE_URL}/api/control/estop`);
+        ConsoleContext.addMessage('warning', 'G-code stream stopped');
+    }
+}
+
+// G-code stream export
+export const GcodeStreamInstance = new GcodeStream();
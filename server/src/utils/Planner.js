@@ -3,6 +3,7 @@ import { ConsoleContext } from './ConsoleContext.js';
 import { getGrblConfig } from '../controllers/configController.js';
 import axios from 'axios';
 import { ESP32_BASE_URL } from '../config/esp32.js';
+import { TelemetryStreamInstance } from './TelemetryStream.js';
 
 // Default GRBL settings for when we can't fetch from ESP32
 const DEFAULT_GRBL_SETTINGS = {
@@ -17,7 +18,8 @@ const DEFAULT_GRBL_SETTINGS = {
     "$122": { value: 10, type: "float", description: "Z-axis acceleration, mm/sec^2" },
     "$130": { value: 200, type: "float", description: "X-axis maximum travel, millimeters" },
     "$131": { value: 200, type: "float", description: "Y-axis maximum travel, millimeters" },
-    "$132": { value: 200, type: "float", description: "Z-axis maximum travel, millimeters" }
+    "$132": { value: 200, type: "float", description: "Z-axis maximum travel, millimeters" },
+    "$140": { value: 250, type: "float", description: "Track width, millimeters" }
 };
 
 class Planner {
@@ -76,6 +78,8 @@ class Planner {
             this.grblSettings = DEFAULT_GRBL_SETTINGS;
             ConsoleContext.addMessage('warning', `Failed to fetch GRBL settings: ${error.message}. Using defaults.`);
         }
+        // Track width ($140) is shared with the firmware kinematics
+        this.tankConfig.trackWidth = this.grblSettings['$140']?.value ?? this.tankConfig.trackWidth;
     }
 
     // Tank-specific motion planning functions
@@ -211,6 +215,7 @@ class Planner {
             this.heading += angleToTurn;
             // Normalize heading to 0-360
             this.heading = ((this.heading % 360) + 360) % 360;
+            await this.syncFromOdometry();
             
             ConsoleContext.addMessage('info', `Rotation complete. New heading: ${this.heading.toFixed(2)}°`);
             return response.data;
@@ -247,6 +252,7 @@ class Planner {
             const radians = this.toRadians(this.heading);
             this.lastPosition.x += distance * Math.cos(radians);
             this.lastPosition.y += distance * Math.sin(radians);
+            await this.syncFromOdometry();
             
             ConsoleContext.addMessage('info', `Move complete. New position: (${this.lastPosition.x.toFixed(2)}, ${this.lastPosition.y.toFixed(2)})`);
             return response.data;
@@ -257,6 +263,21 @@ class Planner {
         }
     }
 
+    /**
+     * Take the XY position and heading from the ESP32's dead reckoning once a move has finished. Every move rounds to
+     * whole steps, so the commanded figures drift from where the tank really is over a long job; the pose in the
+     * telemetry frames comes from the steps themselves. Keeps the commanded figures if telemetry isn't streaming.
+     */
+    async syncFromOdometry() {
+        const frame = await TelemetryStreamInstance.nextFrame(250);
+        if (!frame?.pose || frame.state !== 'idle') return false;
+
+        this.lastPosition.x = frame.pose.x;
+        this.lastPosition.y = frame.pose.y;
+        this.heading = frame.pose.heading;
+        return true;
+    }
+
     /**
      * Execute a move to an absolute XY position
      */
@@ -498,6 +519,15 @@ class Planner {
         if (heading !== undefined) {
             this.heading = heading;
         }
+
+        // Keep the ESP32's dead reckoning in the same frame
+        axios.post(`${ESP32_BASE_URL}/api/status/pose`, {
+            x: this.lastPosition.x,
+            y: this.lastPosition.y,
+            heading: this.heading
+        }).catch((error) => {
+            ConsoleContext.addMessage('warning', `Failed to set the ESP32 pose: ${error.message}`);
+        });
         
         ConsoleContext.addMessage('info', `Position set to (${this.lastPosition.x.toFixed(2)}, ${this.lastPosition.y.toFixed(2)}, ${this.lastPosition.z.toFixed(2)}), heading: ${this.heading.toFixed(2)}°`);
     }
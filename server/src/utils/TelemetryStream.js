@@ -0,0 +1,176 @@
+// Telemetry stream imports
+import net from 'net';
+import { ConsoleContext } from './ConsoleContext.js';
+import { ESP32_BASE_URL } from '../config/esp32.js';
+import { sendTelemetryToClients } from '../server.js';
+
+// Binary telemetry port on the ESP32 - see the frame layout next to telemetryMagic in machine.cpp
+const TELEMETRY_PORT = 81;
+const TELEMETRY_MAGIC = 0xA5;
+const TELEMETRY_INTERVAL_MS = 50;
+const RECONNECT_DELAY_MS = 2000;
+
+const FLAG_POSITIONS = 0x01;
+const FLAG_BUFFER = 0x02;
+const FLAG_POSE = 0x04;
+const TURN = 2 ** 32;       // Binary angle units per turn
+const MOTION_STATES = ['idle', 'running', 'homing', 'jogging', 'hold', 'probing'];
+
+class TelemetryStream {
+    constructor() {
+        this.socket = null;
+        this.buffer = Buffer.alloc(0);
+        this.host = null;
+        this.reconnectTimer = null;
+        this.latest = null;     // Last decoded frame
+        this.waiters = [];      // nextFrame() callers
+        this.dropped = 0;       // Frames too short for the blocks their flags announce
+    }
+
+    /**
+     * Connect (or reconnect) to the ESP32 the server is currently pointed at
+     */
+    start() {
+        const host = new URL(ESP32_BASE_URL).hostname;
+        if (this.socket && this.host === host) return;
+
+        this.stop();
+        this.host = host;
+
+        const socket = net.createConnection({ host, port: TELEMETRY_PORT });
+        socket.setNoDelay(true);
+
+        socket.on('connect', () => {
+            // Ask for our frame rate - a little-endian uint16 in milliseconds
+            const interval = Buffer.alloc(2);
+            interval.writeUInt16LE(TELEMETRY_INTERVAL_MS);
+            socket.write(interval);
+            ConsoleContext.addMessage('info', `Telemetry stream connected (${TELEMETRY_INTERVAL_MS} ms)`);
+        });
+        socket.on('data', (chunk) => this.handleData(chunk));
+        socket.on('error', (error) => {
+            ConsoleContext.addMessage('warning', `Telemetry stream error: ${error.message}`);
+        });
+        socket.on('close', () => {
+            if (this.socket !== socket) return;
+            this.socket = null;
+            this.reconnectTimer = setTimeout(() => this.start(), RECONNECT_DELAY_MS);
+        });
+
+        this.socket = socket;
+    }
+
+    stop() {
+        clearTimeout(this.reconnectTimer);
+        if (this.socket) {
+            const socket = this.socket;
+            this.socket = null;
+            socket.destroy();
+        }
+        this.buffer = Buffer.alloc(0);
+    }
+
+    handleData(chunk) {
+        this.buffer = Buffer.concat([this.buffer, chunk]);
+
+        while (this.buffer.length >= 3) {
+            // Resynchronise on the magic byte if we ever land mid-frame
+            if (this.buffer[0] !== TELEMETRY_MAGIC) {
+                const next = this.buffer.indexOf(TELEMETRY_MAGIC, 1);
+                this.buffer = next === -1 ? Buffer.alloc(0) : this.buffer.subarray(next);
+                continue;
+            }
+
+            // No frame is shorter than its fixed header - a length under that is a false magic byte, so skip it
+            const length = this.buffer[2];
+            if (length < 13) {
+                this.buffer = this.buffer.subarray(1);
+                continue;
+            }
+            if (this.buffer.length < length) return;
+
+            const frame = this.decodeFrame(this.buffer.subarray(0, length));
+            this.buffer = this.buffer.subarray(length);
+
+            if (frame) {
+                this.latest = frame;
+                sendTelemetryToClients(frame);
+                this.waiters.splice(0).forEach((resolve) => resolve(frame));
+            }
+        }
+    }
+
+    /**
+     * Resolve with the next frame to arrive - one sent after the call - or null if none comes within timeoutMs
+     */
+    nextFrame(timeoutMs) {
+        return new Promise((resolve) => {
+            const timer = setTimeout(() => {
+                this.waiters = this.waiters.filter((waiter) => waiter !== done);
+                resolve(null);
+            }, timeoutMs);
+            const done = (frame) => {
+                clearTimeout(timer);
+                resolve(frame);
+            };
+            this.waiters.push(done);
+        });
+    }
+
+    decodeFrame(data) {
+        if (data.length < 13) return null;
+
+        // Every block the flags announce has to fit in the frame before any of it is read
+        const flags = data[3];
+        const needed = 13 + (flags & FLAG_POSITIONS ? 12 : 0) + (flags & FLAG_BUFFER ? 8 : 0) + (flags & FLAG_POSE ? 12 : 0);
+        if (data.length < needed) {
+            this.dropped++;
+            ConsoleContext.addMessage('warning', `Telemetry frame dropped: ${data.length} bytes, flags need ${needed} (${this.dropped} so far)`);
+            return null;
+        }
+        const pins = data[11];
+        const frame = {
+            version: data[1],
+            sequence: data.readUInt16LE(4),
+            millis: data.readUInt32LE(6),
+            state: MOTION_STATES[data[10]] || 'unknown',
+            endStop: (pins & 0x01) !== 0,
+            probe: (pins & 0x02) !== 0,
+            spindleEnabled: (pins & 0x04) !== 0,
+            homed: (pins & 0x08) !== 0,
+            spindlePWM: data[12]
+        };
+
+        let offset = 13;
+        if (flags & FLAG_POSITIONS) {
+            frame.steps = {
+                left: data.readInt32LE(offset),
+                right: data.readInt32LE(offset + 4),
+                z: data.readInt32LE(offset + 8)
+            };
+            offset += 12;
+        }
+        if (flags & FLAG_BUFFER) {
+            frame.queue = {
+                queued: data.readUInt16LE(offset),
+                free: data.readUInt16LE(offset + 2),
+                completed: data.readUInt32LE(offset + 4)
+            };
+            offset += 8;
+        }
+        if (flags & FLAG_POSE) {
+            // Dead-reckoned from the track steps - mm, and degrees counter-clockwise from X+
+            frame.pose = {
+                x: data.readInt32LE(offset) / 1000,
+                y: data.readInt32LE(offset + 4) / 1000,
+                heading: data.readUInt32LE(offset + 8) * 360 / TURN
+            };
+            offset += 12;
+        }
+
+        return frame;
+    }
+}
+
+// Telemetry stream export
+export const TelemetryStreamInstance = new TelemetryStream();